@@ -99,6 +99,7 @@ rm -rf %{buildroot}
 %defattr(-,root,root,-)
 %license COPYING
 %{_bindir}/%{name}
+%{_bindir}/%{name}-agent
 %{_bindir}/run_tests.sh
 
 %files tests
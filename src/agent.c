@@ -0,0 +1,531 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <libgen.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "testrunnerlite.h"
+#include "agent_protocol.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+#define AGENT_NAME "testrunner-lite-agent"
+#define AGENT_SHELL "/bin/sh"
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/** Step started by the agent */
+typedef struct _agent_step {
+	uint32_t id;      /**< request id of the step */
+	pid_t    pid;     /**< step process, also its process group */
+	int      out_fd;  /**< stdout of the step, -1 at end of stream */
+	int      err_fd;  /**< stderr of the step, -1 at end of stream */
+	int      exited;  /**< step process has been waited for */
+	int      status;  /**< wait status of the step process */
+	struct _agent_step *next;
+} agent_step;
+
+/** File being received from host */
+typedef struct _agent_put {
+	uint32_t id;      /**< request id of the put */
+	int      fd;      /**< file being written, -1 on error */
+	int      error;   /**< errno of the first error */
+	struct _agent_put *next;
+} agent_put;
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+LOCAL int host_in = -1;       /* frames from host */
+LOCAL int host_out = -1;      /* frames to host */
+LOCAL int signal_pipe[2] = { -1, -1 }; /* signals to main loop */
+LOCAL agent_step *steps = NULL;
+LOCAL agent_put *files = NULL;
+LOCAL agent_frame frame;
+LOCAL char chunk[AGENT_PAYLOAD_MAX];
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL void handle_signal (int signum);
+/* ------------------------------------------------------------------------- */
+LOCAL void send_frame (int type, uint32_t id, const void *payload,
+		       size_t length);
+/* ------------------------------------------------------------------------- */
+LOCAL void start_step (uint32_t id, const char *command);
+/* ------------------------------------------------------------------------- */
+LOCAL void kill_step (uint32_t id, int sig);
+/* ------------------------------------------------------------------------- */
+LOCAL int read_output (agent_step *s, int *fd, int type);
+/* ------------------------------------------------------------------------- */
+LOCAL void reap_steps (void);
+/* ------------------------------------------------------------------------- */
+LOCAL void send_files (uint32_t id, const char *pattern);
+/* ------------------------------------------------------------------------- */
+LOCAL void receive_file (const agent_frame *f);
+/* ------------------------------------------------------------------------- */
+LOCAL int handle_frame (void);
+/* ------------------------------------------------------------------------- */
+LOCAL void stop_steps (void);
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Pass signals to the main loop
+ * @param signum signal number
+ */
+LOCAL void handle_signal (int signum)
+{
+	int saved = errno;
+	char c = signum;
+
+	if (write (signal_pipe[1], &c, 1) < 0) {
+		/* pipe is full, main loop has signals to handle anyway */
+	}
+	errno = saved;
+}
+/* ------------------------------------------------------------------------- */
+/** Send a frame to host, exit if host is gone
+ * @param type agent_frame_type
+ * @param id request id
+ * @param payload payload
+ * @param length payload length
+ */
+LOCAL void send_frame (int type, uint32_t id, const void *payload,
+		       size_t length)
+{
+	if (agent_write_frame (host_out, type, id, payload, length) < 0) {
+		stop_steps ();
+		exit (1);
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Start a step in a process group of its own
+ * @param id request id
+ * @param command shell command of the step
+ */
+LOCAL void start_step (uint32_t id, const char *command)
+{
+	agent_step *s;
+	int out[2] = { -1, -1 };
+	int err[2] = { -1, -1 };
+	int nul;
+	int32_t status;
+
+	s = (agent_step *)calloc (1, sizeof (agent_step));
+	if (!s || pipe2 (out, O_CLOEXEC) < 0 || pipe2 (err, O_CLOEXEC) < 0)
+		goto err_out;
+
+	s->pid = fork ();
+	if (s->pid < 0)
+		goto err_out;
+	if (s->pid == 0) {
+		setpgid (0, 0);
+		nul = open ("/dev/null", O_RDONLY);
+		dup2 (nul, STDIN_FILENO);
+		dup2 (out[1], STDOUT_FILENO);
+		dup2 (err[1], STDERR_FILENO);
+		signal (SIGCHLD, SIG_DFL);
+		signal (SIGTERM, SIG_DFL);
+		signal (SIGHUP, SIG_DFL);
+		signal (SIGPIPE, SIG_DFL);
+		execl (AGENT_SHELL, AGENT_SHELL, "-c", command, (char *)NULL);
+		_exit (127);
+	}
+	/* also here, so that the group exists when kill arrives */
+	setpgid (s->pid, s->pid);
+
+	close (out[1]);
+	close (err[1]);
+	fcntl (out[0], F_SETFL, O_NONBLOCK);
+	fcntl (err[0], F_SETFL, O_NONBLOCK);
+	s->id = id;
+	s->out_fd = out[0];
+	s->err_fd = err[0];
+	s->next = steps;
+	steps = s;
+
+	return;
+ err_out:
+	fprintf (stderr, "%s: failed to start step: %s\n", AGENT_NAME,
+		 strerror (errno));
+	if (out[0] >= 0) close (out[0]);
+	if (out[1] >= 0) close (out[1]);
+	if (err[0] >= 0) close (err[0]);
+	if (err[1] >= 0) close (err[1]);
+	free (s);
+	status = 127 << 8;
+	agent_write_int (host_out, AGENT_EXIT, id, status);
+}
+/* ------------------------------------------------------------------------- */
+/** Send a signal to the process group of a step
+ * @param id request id of the step
+ * @param sig signal
+ */
+LOCAL void kill_step (uint32_t id, int sig)
+{
+	agent_step *s;
+
+	for (s = steps; s; s = s->next)
+		if (s->id == id && killpg (s->pid, sig) < 0 && errno != ESRCH)
+			fprintf (stderr, "%s: killpg %d: %s\n", AGENT_NAME,
+				 s->pid, strerror (errno));
+}
+/* ------------------------------------------------------------------------- */
+/** Send available output of a step to host
+ * @param s step
+ * @param fd output stream of the step, set to -1 at end of stream
+ * @param type AGENT_STDOUT or AGENT_STDERR
+ * @return 1 if the stream is still open, 0 at end of stream
+ */
+LOCAL int read_output (agent_step *s, int *fd, int type)
+{
+	ssize_t ret;
+
+	while (*fd >= 0) {
+		ret = read (*fd, chunk, sizeof (chunk));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && errno == EAGAIN)
+			return 1;
+		if (ret <= 0) {
+			close (*fd);
+			*fd = -1;
+			break;
+		}
+		send_frame (type, s->id, chunk, ret);
+	}
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Wait for terminated steps and report them to host. Output written by
+ *  the step process is sent before the exit status. Processes left behind
+ *  by the step are not waited for.
+ */
+LOCAL void reap_steps (void)
+{
+	agent_step *s, **prev;
+	pid_t pid;
+	int status;
+
+	while ((pid = waitpid (-1, &status, WNOHANG)) > 0) {
+		for (s = steps; s; s = s->next)
+			if (s->pid == pid) {
+				s->exited = 1;
+				s->status = status;
+			}
+	}
+
+	prev = &steps;
+	while ((s = *prev)) {
+		if (!s->exited) {
+			prev = &s->next;
+			continue;
+		}
+		read_output (s, &s->out_fd, AGENT_STDOUT);
+		read_output (s, &s->err_fd, AGENT_STDERR);
+		if (s->out_fd >= 0)
+			close (s->out_fd);
+		if (s->err_fd >= 0)
+			close (s->err_fd);
+		agent_write_int (host_out, AGENT_EXIT, s->id, s->status);
+		*prev = s->next;
+		free (s);
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Send files matching a pattern to host
+ * @param id request id
+ * @param pattern path of the files, may contain wildcards
+ */
+LOCAL void send_files (uint32_t id, const char *pattern)
+{
+	glob_t g;
+	char *name;
+	size_t i;
+	ssize_t ret;
+	int fd, error = 0;
+
+	if (glob (pattern, 0, NULL, &g) != 0) {
+		agent_write_int (host_out, AGENT_END, id, ENOENT);
+		return;
+	}
+
+	for (i = 0; i < g.gl_pathc; i++) {
+		fd = open (g.gl_pathv[i], O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			error = errno;
+			continue;
+		}
+		name = basename (g.gl_pathv[i]);
+		send_frame (AGENT_FILE, id, name, strlen (name));
+		while ((ret = read (fd, chunk, sizeof (chunk))) != 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0) {
+				error = errno;
+				break;
+			}
+			send_frame (AGENT_DATA, id, chunk, ret);
+		}
+		close (fd);
+	}
+	globfree (&g);
+
+	agent_write_int (host_out, AGENT_END, id, error);
+}
+/* ------------------------------------------------------------------------- */
+/** Handle a frame of a file sent by host
+ * @param f AGENT_PUT, AGENT_DATA or AGENT_END frame
+ */
+LOCAL void receive_file (const agent_frame *f)
+{
+	agent_put *p, **prev;
+	size_t done;
+	ssize_t ret;
+
+	if (f->type == AGENT_PUT) {
+		p = (agent_put *)calloc (1, sizeof (agent_put));
+		if (!p) {
+			agent_write_int (host_out, AGENT_END, f->id, ENOMEM);
+			return;
+		}
+		p->id = f->id;
+		p->fd = open (f->payload, O_WRONLY | O_CREAT | O_TRUNC |
+			      O_CLOEXEC, 0644);
+		if (p->fd < 0)
+			p->error = errno;
+		p->next = files;
+		files = p;
+		return;
+	}
+
+	for (prev = &files; (p = *prev); prev = &p->next)
+		if (p->id == f->id)
+			break;
+	if (!p)
+		return;
+
+	if (f->type == AGENT_DATA) {
+		for (done = 0; p->fd >= 0 && done < f->length; done += ret) {
+			ret = write (p->fd, f->payload + done,
+				     f->length - done);
+			if (ret < 0 && errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			if (ret < 0) {
+				p->error = errno;
+				close (p->fd);
+				p->fd = -1;
+			}
+		}
+		return;
+	}
+
+	/* AGENT_END */
+	if (p->fd >= 0 && close (p->fd) < 0)
+		p->error = errno;
+	agent_write_int (host_out, AGENT_END, p->id, p->error);
+	*prev = p->next;
+	free (p);
+}
+/* ------------------------------------------------------------------------- */
+/** Read and handle a frame from host
+ * @return 1 on success, 0 if host has closed the connection
+ */
+LOCAL int handle_frame (void)
+{
+	int ret;
+
+	ret = agent_read_frame (host_in, &frame);
+	if (ret <= 0)
+		return 0;
+
+	switch (frame.type) {
+	case AGENT_START:
+		start_step (frame.id, frame.payload);
+		break;
+	case AGENT_KILL:
+		kill_step (frame.id, agent_frame_int (&frame));
+		break;
+	case AGENT_GET:
+		send_files (frame.id, frame.payload);
+		break;
+	case AGENT_PUT:
+	case AGENT_DATA:
+	case AGENT_END:
+		receive_file (&frame);
+		break;
+	default:
+		fprintf (stderr, "%s: unknown frame type %d\n", AGENT_NAME,
+			 frame.type);
+		break;
+	}
+
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Terminate running steps when host is gone
+ */
+LOCAL void stop_steps (void)
+{
+	agent_step *s;
+
+	for (s = steps; s; s = s->next)
+		if (!s->exited)
+			killpg (s->pid, SIGTERM);
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Agent executing test steps for testrunner-lite on the system under
+ *  test. Frames are read from stdin and written to stdout.
+ * @param argc not used
+ * @param argv not used
+ * @return 0 when host closes the connection, 1 on error
+ */
+int main (int argc, char *argv[])
+{
+	struct pollfd *pfd = NULL;
+	agent_step *s;
+	size_t n, max = 0;
+	int nul, i;
+	char c;
+	struct sigaction sa;
+
+	/* keep protocol out of the way of the steps */
+	host_in = fcntl (STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+	host_out = fcntl (STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+	nul = open ("/dev/null", O_RDWR);
+	if (host_in < 0 || host_out < 0 || nul < 0) {
+		fprintf (stderr, "%s: %s\n", AGENT_NAME, strerror (errno));
+		return 1;
+	}
+	dup2 (nul, STDIN_FILENO);
+	dup2 (nul, STDOUT_FILENO);
+	close (nul);
+
+	if (pipe2 (signal_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+		fprintf (stderr, "%s: %s\n", AGENT_NAME, strerror (errno));
+		return 1;
+	}
+	memset (&sa, 0x0, sizeof (sa));
+	sa.sa_handler = handle_signal;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction (SIGCHLD, &sa, NULL);
+	sigaction (SIGTERM, &sa, NULL);
+	sigaction (SIGHUP, &sa, NULL);
+	signal (SIGPIPE, SIG_IGN);
+
+	agent_write_int (host_out, AGENT_HELLO, 0, AGENT_PROTOCOL_VERSION);
+
+	while (1) {
+		for (n = 2, s = steps; s; s = s->next)
+			n += 2;
+		if (n > max) {
+			max = n * 2;
+			pfd = (struct pollfd *)realloc (pfd, max * 
+							sizeof (*pfd));
+			if (!pfd)
+				break;
+		}
+		pfd[0].fd = host_in;
+		pfd[1].fd = signal_pipe[0];
+		for (n = 2, s = steps; s; s = s->next) {
+			pfd[n++].fd = s->out_fd;
+			pfd[n++].fd = s->err_fd;
+		}
+		for (i = 0; i < (int)n; i++) {
+			pfd[i].events = POLLIN;
+			pfd[i].revents = 0;
+		}
+
+		if (poll (pfd, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfd[1].revents) {
+			while (read (signal_pipe[0], &c, 1) == 1)
+				if (c == SIGTERM || c == SIGHUP)
+					goto out;
+		}
+		for (n = 2, s = steps; s; s = s->next, n += 2) {
+			if (pfd[n].revents)
+				read_output (s, &s->out_fd, AGENT_STDOUT);
+			if (pfd[n + 1].revents)
+				read_output (s, &s->err_fd, AGENT_STDERR);
+		}
+		if (pfd[1].revents)
+			reap_steps ();
+		if (pfd[0].revents && !handle_frame ())
+			break;
+	}
+ out:
+	stop_steps ();
+	free (pfd);
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/* End of file */
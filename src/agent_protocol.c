@@ -0,0 +1,229 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "testrunnerlite.h"
+#include "agent_protocol.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL int write_all (int fd, const void *buf, size_t len);
+/* ------------------------------------------------------------------------- */
+LOCAL int read_all (int fd, void *buf, size_t len);
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Write the whole buffer
+ * @param fd file descriptor
+ * @param buf data to write
+ * @param len length of data
+ * @return 0 on success, -1 on error
+ */
+LOCAL int write_all (int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write (fd, p, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Read until the buffer is full
+ * @param fd file descriptor
+ * @param buf buffer
+ * @param len bytes to read
+ * @return len on success, bytes read before end of file, -1 on error
+ */
+LOCAL int read_all (int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = read (fd, p + done, len - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			break;
+		done += ret;
+	}
+
+	return done;
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Write a frame. Writers sharing the file descriptor must serialize the
+ *  calls.
+ * @param fd file descriptor
+ * @param type agent_frame_type
+ * @param id request id
+ * @param payload payload, may be NULL if length is 0
+ * @param length payload length, at most AGENT_PAYLOAD_MAX
+ * @return 0 on success, -1 on error
+ */
+int agent_write_frame (int fd, int type, uint32_t id, const void *payload,
+		       size_t length)
+{
+	unsigned char header[AGENT_HEADER_SIZE];
+	uint32_t n;
+
+	if (length > AGENT_PAYLOAD_MAX) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	n = htonl (length);
+	memcpy (header, &n, 4);
+	n = htonl (id);
+	memcpy (header + 4, &n, 4);
+	header[8] = type;
+
+	if (write_all (fd, header, AGENT_HEADER_SIZE) < 0)
+		return -1;
+	if (length && write_all (fd, payload, length) < 0)
+		return -1;
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Write a frame with an integer payload
+ * @param fd file descriptor
+ * @param type agent_frame_type
+ * @param id request id
+ * @param value payload
+ * @return 0 on success, -1 on error
+ */
+int agent_write_int (int fd, int type, uint32_t id, int32_t value)
+{
+	uint32_t n = htonl ((uint32_t)value);
+
+	return agent_write_frame (fd, type, id, &n, 4);
+}
+/* ------------------------------------------------------------------------- */
+/** Read a frame. Blocks until the whole frame is read.
+ * @param fd file descriptor
+ * @param frame frame read
+ * @return 1 on success, 0 on end of file before the frame, -1 on error or
+ *         on a truncated or too long frame
+ */
+int agent_read_frame (int fd, agent_frame *frame)
+{
+	unsigned char header[AGENT_HEADER_SIZE];
+	uint32_t n;
+	int ret;
+
+	ret = read_all (fd, header, AGENT_HEADER_SIZE);
+	if (ret <= 0)
+		return ret;
+	if (ret < AGENT_HEADER_SIZE)
+		return -1;
+	memcpy (&n, header, 4);
+	frame->length = ntohl (n);
+	memcpy (&n, header + 4, 4);
+	frame->id = ntohl (n);
+	frame->type = header[8];
+	if (frame->length > AGENT_PAYLOAD_MAX)
+		return -1;
+
+	if (read_all (fd, frame->payload, frame->length) != 
+	    (int)frame->length)
+		return -1;
+	frame->payload[frame->length] = '\0';
+
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Integer payload of a frame
+ * @param frame frame
+ * @return payload value, -1 if payload is not an integer
+ */
+int32_t agent_frame_int (const agent_frame *frame)
+{
+	uint32_t n;
+
+	if (frame->length != 4)
+		return -1;
+	memcpy (&n, frame->payload, 4);
+
+	return (int32_t)ntohl (n);
+}
+/* ------------------------------------------------------------------------- */
+/* End of file */
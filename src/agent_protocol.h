@@ -0,0 +1,95 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef AGENT_PROTOCOL_H
+#define AGENT_PROTOCOL_H
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDES */
+#include <stddef.h>
+#include <stdint.h>
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+#define AGENT_PROTOCOL_VERSION 1
+#define AGENT_HEADER_SIZE      9       /* length, id and type */
+#define AGENT_PAYLOAD_MAX      65536
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* DATA TYPES */
+/* ------------------------------------------------------------------------- */
+/** Frame types. A frame is a header of 32 bit payload length, 32 bit
+ *  request id and 8 bit type, integers in network byte order, followed
+ *  by the payload. Integer payloads are 32 bits in network byte order. */
+typedef enum {
+	/* host to agent */
+	AGENT_START = 1,  /**< start step, payload is the command */
+	AGENT_KILL,       /**< signal process group of step, payload signal */
+	AGENT_GET,        /**< send files matching payload pattern */
+	AGENT_PUT,        /**< receive file to payload path in AGENT_DATA
+			     frames ended by AGENT_END */
+	/* agent to host */
+	AGENT_HELLO,      /**< agent is ready, payload protocol version */
+	AGENT_STDOUT,     /**< stdout of step */
+	AGENT_STDERR,     /**< stderr of step */
+	AGENT_EXIT,       /**< step has terminated, payload wait status */
+	AGENT_FILE,       /**< file of get follows, payload file name */
+	/* both directions */
+	AGENT_DATA,       /**< file contents */
+	AGENT_END         /**< end of get or put, payload 0 or errno */
+} agent_frame_type;
+
+/* ------------------------------------------------------------------------- */
+/** Frame read from a connection */
+typedef struct {
+	uint8_t  type;     /**< agent_frame_type */
+	uint32_t id;       /**< request the frame belongs to */
+	uint32_t length;   /**< payload length */
+	char     payload[AGENT_PAYLOAD_MAX + 1]; /**< payload, null
+						    terminated */
+} agent_frame;
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+int agent_write_frame (int fd, int type, uint32_t id, const void *payload,
+		       size_t length);
+/* ------------------------------------------------------------------------- */
+int agent_write_int (int fd, int type, uint32_t id, int32_t value);
+/* ------------------------------------------------------------------------- */
+int agent_read_frame (int fd, agent_frame *frame);
+/* ------------------------------------------------------------------------- */
+int32_t agent_frame_int (const agent_frame *frame);
+/* ------------------------------------------------------------------------- */
+#endif                          /* AGENT_PROTOCOL_H */
+/* End of file */
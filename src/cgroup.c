@@ -0,0 +1,457 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "testrunnerlite.h"
+#include "cgroup.h"
+#include "log.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+#define CGROUP_STEP_PREFIX      "step."
+#define CGROUP_KILL_POLL_MS     10
+#define CGROUP_KILL_TIMEOUT_MS  2000
+#define CGROUP_FILE_MAX         4096
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+LOCAL char *run_dir = NULL;     /* cgroup of this testrunner-lite run */
+LOCAL unsigned long seq = 0;    /* number of step cgroups created */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL int cg_write (const char *cgroup, const char *file, const char *value);
+/* ------------------------------------------------------------------------- */
+LOCAL ssize_t cg_pread (int fd, char *buf, size_t size);
+/* ------------------------------------------------------------------------- */
+LOCAL ssize_t cg_read (const char *cgroup, const char *file, char *buf,
+		       size_t size);
+/* ------------------------------------------------------------------------- */
+LOCAL int cg_key (const char *text, const char *key,
+		  unsigned long long *value);
+/* ------------------------------------------------------------------------- */
+LOCAL int cg_kill_procs (const char *cgroup);
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Write a value to a cgroup interface file
+ * @param cgroup cgroup directory
+ * @param file name of the interface file
+ * @param value value to write
+ * @return 0 on success, -1 on error
+ */
+LOCAL int cg_write (const char *cgroup, const char *file, const char *value)
+{
+	char path[PATH_MAX];
+	size_t len = strlen (value);
+	int fd, ret = 0;
+
+	snprintf (path, PATH_MAX, "%s/%s", cgroup, file);
+	fd = open (path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (write (fd, value, len) != (ssize_t)len)
+		ret = -1;
+	close (fd);
+
+	return ret;
+}
+/* ------------------------------------------------------------------------- */
+/** Read an interface file from the beginning to a null terminated buffer
+ * @param fd open interface file
+ * @param buf buffer
+ * @param size size of buffer
+ * @return number of bytes read, -1 on error
+ */
+LOCAL ssize_t cg_pread (int fd, char *buf, size_t size)
+{
+	ssize_t ret;
+
+	ret = pread (fd, buf, size - 1, 0);
+	if (ret < 0)
+		return -1;
+	buf[ret] = '\0';
+
+	return ret;
+}
+/* ------------------------------------------------------------------------- */
+/** Read a cgroup interface file to a null terminated buffer
+ * @param cgroup cgroup directory
+ * @param file name of the interface file
+ * @param buf buffer
+ * @param size size of buffer
+ * @return number of bytes read, -1 on error
+ */
+LOCAL ssize_t cg_read (const char *cgroup, const char *file, char *buf,
+		       size_t size)
+{
+	char path[PATH_MAX];
+	ssize_t ret;
+	int fd;
+
+	snprintf (path, PATH_MAX, "%s/%s", cgroup, file);
+	fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	ret = cg_pread (fd, buf, size);
+	close (fd);
+
+	return ret;
+}
+/* ------------------------------------------------------------------------- */
+/** Find a "key value" line from contents of a flat keyed file like
+ *  cgroup.events or cpu.stat
+ * @param text file contents
+ * @param key key to look for
+ * @param value set to value of the key
+ * @return 0 if key was found, -1 if not
+ */
+LOCAL int cg_key (const char *text, const char *key,
+		  unsigned long long *value)
+{
+	size_t len = strlen (key);
+	const char *p = text;
+
+	while (p && *p) {
+		if (!strncmp (p, key, len) && p[len] == ' ') {
+			*value = strtoull (p + len + 1, NULL, 10);
+			return 0;
+		}
+		p = strchr (p, '\n');
+		if (p)
+			p++;
+	}
+
+	return -1;
+}
+/* ------------------------------------------------------------------------- */
+/** Send SIGKILL to each process in a cgroup. Used on kernels older than
+ *  5.14 which do not have cgroup.kill.
+ * @param cgroup cgroup directory
+ * @return 0 on success, -1 if processes could not be listed
+ */
+LOCAL int cg_kill_procs (const char *cgroup)
+{
+	char path[PATH_MAX];
+	FILE *procs;
+	int pid;
+
+	snprintf (path, PATH_MAX, "%s/cgroup.procs", cgroup);
+	procs = fopen (path, "r");
+	if (!procs)
+		return -1;
+	while (fscanf (procs, "%d", &pid) == 1)
+		kill (pid, SIGKILL);
+	fclose (procs);
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Create cgroup for this run under the delegated cgroup given with
+ *  --cgroup. Step cgroups are created under it.
+ * @param opts testrunner-lite options
+ * @return 0 on success, -1 on error
+ */
+int cgroup_init (testrunner_lite_options *opts)
+{
+	char path[PATH_MAX];
+	size_t len;
+
+	snprintf (path, PATH_MAX, "%s/cgroup.procs", opts->cgroup);
+	if (access (path, W_OK) < 0) {
+		LOG_MSG (LOG_ERR, "%s is not a writable cgroup v2 directory: "
+			 "%s", opts->cgroup, strerror (errno));
+		return -1;
+	}
+
+	len = strlen (opts->cgroup) + strlen ("/testrunner-lite.") + 10 + 1;
+	run_dir = (char *)malloc (len);
+	if (!run_dir) {
+		LOG_MSG (LOG_ERR, "OOM");
+		return -1;
+	}
+	snprintf (run_dir, len, "%s/testrunner-lite.%d", opts->cgroup,
+		  getpid ());
+
+	if (mkdir (run_dir, 0755) < 0 && errno != EEXIST) {
+		LOG_MSG (LOG_ERR, "Failed to create cgroup %s: %s", run_dir,
+			 strerror (errno));
+		free (run_dir);
+		run_dir = NULL;
+		return -1;
+	}
+
+	LOG_MSG (LOG_DEBUG, "Running steps in cgroups under %s", run_dir);
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Create a cgroup for a step
+ * @return path of the cgroup, to be freed by caller, NULL if cgroups are
+ *         not in use or the cgroup could not be created
+ */
+char *cgroup_create (void)
+{
+	char *cgroup;
+	size_t len;
+
+	if (!run_dir)
+		return NULL;
+
+	len = strlen (run_dir) + strlen ("/" CGROUP_STEP_PREFIX) + 20 + 1;
+	cgroup = (char *)malloc (len);
+	if (!cgroup) {
+		LOG_MSG (LOG_ERR, "OOM");
+		return NULL;
+	}
+	snprintf (cgroup, len, "%s/" CGROUP_STEP_PREFIX "%lu", run_dir,
+		  __sync_add_and_fetch (&seq, 1));
+
+	if (mkdir (cgroup, 0755) < 0) {
+		LOG_MSG (LOG_ERR, "Failed to create cgroup %s: %s", cgroup,
+			 strerror (errno));
+		free (cgroup);
+		return NULL;
+	}
+
+	return cgroup;
+}
+/* ------------------------------------------------------------------------- */
+/** Move the calling process to a cgroup. Called by step process before
+ *  exec, so that everything the step starts is in the cgroup.
+ * @param cgroup cgroup directory
+ * @return 0 on success, -1 on error
+ */
+int cgroup_enter (const char *cgroup)
+{
+	return cg_write (cgroup, "cgroup.procs", "0");
+}
+/* ------------------------------------------------------------------------- */
+/** Check if a cgroup has live processes
+ * @param cgroup cgroup directory
+ * @return 1 if it has, 0 if not, -1 on error
+ */
+int cgroup_populated (const char *cgroup)
+{
+	char buf[CGROUP_FILE_MAX];
+	unsigned long long populated;
+
+	if (cg_read (cgroup, "cgroup.events", buf, sizeof (buf)) < 0 ||
+	    cg_key (buf, "populated", &populated) < 0)
+		return -1;
+
+	return populated ? 1 : 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Kill all processes of a cgroup, including ones which have left the
+ *  session and process group of the step, and wait until cgroup.events
+ *  reports that the cgroup is empty.
+ * @param cgroup cgroup directory
+ * @return 0 when the cgroup is empty, -1 on error or if processes survived
+ */
+int cgroup_kill (const char *cgroup)
+{
+	char path[PATH_MAX];
+	char buf[CGROUP_FILE_MAX];
+	unsigned long long populated = 1;
+	struct pollfd pfd;
+	int use_kill;
+	int i;
+
+	if (!cgroup)
+		return -1;
+
+	snprintf (path, PATH_MAX, "%s/cgroup.events", cgroup);
+	pfd.fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (pfd.fd < 0) {
+		LOG_MSG (LOG_ERR, "Failed to open %s: %s", path,
+			 strerror (errno));
+		return -1;
+	}
+	pfd.events = POLLPRI;
+
+	use_kill = (cg_write (cgroup, "cgroup.kill", "1") == 0);
+	LOG_MSG (LOG_DEBUG, "Killing processes in %s%s", cgroup,
+		 use_kill ? "" : " one by one");
+
+	for (i = 0; i < CGROUP_KILL_TIMEOUT_MS / CGROUP_KILL_POLL_MS; i++) {
+		if (cg_pread (pfd.fd, buf, sizeof (buf)) < 0 ||
+		    cg_key (buf, "populated", &populated) < 0 ||
+		    !populated)
+			break;
+		/* processes may fork while they are killed one by one */
+		if (!use_kill)
+			cg_kill_procs (cgroup);
+		poll (&pfd, 1, CGROUP_KILL_POLL_MS);
+	}
+	close (pfd.fd);
+
+	if (populated) {
+		LOG_MSG (LOG_WARNING, "Processes in cgroup %s survived kill",
+			 cgroup);
+		return -1;
+	}
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Read resource usage of a cgroup. CPU time comes from cpu.stat, which
+ *  counts every process that has been in the cgroup. Memory peak and I/O
+ *  are available only if the memory and io controllers are enabled, other
+ *  fields of usage are left untouched.
+ * @param cgroup cgroup directory
+ * @param usage usage to update
+ * @return 0 on success, -1 on error
+ */
+int cgroup_usage (const char *cgroup, struct rusage *usage)
+{
+	char buf[CGROUP_FILE_MAX];
+	unsigned long long value, rbytes = 0, wbytes = 0;
+	char *tok, *save = NULL;
+
+	if (!cgroup || cg_read (cgroup, "cpu.stat", buf, sizeof (buf)) < 0)
+		return -1;
+
+	if (cg_key (buf, "user_usec", &value) == 0) {
+		usage->ru_utime.tv_sec = value / 1000000;
+		usage->ru_utime.tv_usec = value % 1000000;
+	}
+	if (cg_key (buf, "system_usec", &value) == 0) {
+		usage->ru_stime.tv_sec = value / 1000000;
+		usage->ru_stime.tv_usec = value % 1000000;
+	}
+
+	if (cg_read (cgroup, "memory.peak", buf, sizeof (buf)) > 0)
+		usage->ru_maxrss = strtoull (buf, NULL, 10) / 1024;
+
+	/* lines of "major:minor rbytes=N wbytes=N rios=N ..." */
+	if (cg_read (cgroup, "io.stat", buf, sizeof (buf)) > 0) {
+		for (tok = strtok_r (buf, " \n", &save); tok;
+		     tok = strtok_r (NULL, " \n", &save)) {
+			if (!strncmp (tok, "rbytes=", 7))
+				rbytes += strtoull (tok + 7, NULL, 10);
+			else if (!strncmp (tok, "wbytes=", 7))
+				wbytes += strtoull (tok + 7, NULL, 10);
+		}
+		usage->ru_inblock = rbytes / 512;
+		usage->ru_oublock = wbytes / 512;
+	}
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Kill processes left in a step cgroup and remove it
+ * @param cgroup cgroup directory
+ */
+void cgroup_remove (const char *cgroup)
+{
+	if (!cgroup)
+		return;
+
+	if (cgroup_populated (cgroup) > 0)
+		cgroup_kill (cgroup);
+
+	if (rmdir (cgroup) < 0 && errno != ENOENT)
+		LOG_MSG (LOG_WARNING, "Failed to remove cgroup %s: %s", cgroup,
+			 strerror (errno));
+}
+/* ------------------------------------------------------------------------- */
+/** Remove cgroups of all steps and the cgroup of this run
+ */
+void cgroup_close (void)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+
+	if (!run_dir)
+		return;
+
+	dir = opendir (run_dir);
+	if (dir) {
+		while ((entry = readdir (dir)) != NULL) {
+			if (strncmp (entry->d_name, CGROUP_STEP_PREFIX,
+				     strlen (CGROUP_STEP_PREFIX)))
+				continue;
+			snprintf (path, PATH_MAX, "%s/%s", run_dir,
+				  entry->d_name);
+			cgroup_remove (path);
+		}
+		closedir (dir);
+	}
+
+	if (rmdir (run_dir) < 0)
+		LOG_MSG (LOG_WARNING, "Failed to remove cgroup %s: %s",
+			 run_dir, strerror (errno));
+	free (run_dir);
+	run_dir = NULL;
+}
+/* ------------------------------------------------------------------------- */
+/* End of file */
@@ -0,0 +1,71 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef CGROUP_H
+#define CGROUP_H
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDES */
+#include <sys/resource.h>
+#include "testrunnerlite.h"
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* DATA TYPES */
+/* ------------------------------------------------------------------------- */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+int cgroup_init (testrunner_lite_options *opts);
+/* ------------------------------------------------------------------------- */
+char *cgroup_create (void);
+/* ------------------------------------------------------------------------- */
+int cgroup_enter (const char *cgroup);
+/* ------------------------------------------------------------------------- */
+int cgroup_populated (const char *cgroup);
+/* ------------------------------------------------------------------------- */
+int cgroup_kill (const char *cgroup);
+/* ------------------------------------------------------------------------- */
+int cgroup_usage (const char *cgroup, struct rusage *usage);
+/* ------------------------------------------------------------------------- */
+void cgroup_remove (const char *cgroup);
+/* ------------------------------------------------------------------------- */
+void cgroup_close (void);
+/* ------------------------------------------------------------------------- */
+#endif                          /* CGROUP_H */
+/* End of file */
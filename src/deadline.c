@@ -0,0 +1,200 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "testrunnerlite.h"
+#include "deadline.h"
+#include "log.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+#define STAGE_IDLE   0
+#define STAGE_SOFT   1
+#define STAGE_HARD   2
+#define STAGE_DONE   3
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL int deadline_arm (step_deadline *d, unsigned secs);
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Arm (or disarm) the timer to expire after given number of seconds
+ * @param d deadline
+ * @param secs seconds until expiration on CLOCK_MONOTONIC, 0 disarms
+ * @return 0 in success, -1 in error
+ */
+LOCAL int deadline_arm (step_deadline *d, unsigned secs)
+{
+	struct itimerspec its;
+
+	if (d->fd < 0)
+		return -1;
+
+	memset (&its, 0, sizeof (its));
+	its.it_value.tv_sec = secs;
+
+	if (timerfd_settime (d->fd, 0, &its, NULL) < 0) {
+		LOG_MSG (LOG_ERR, "timerfd_settime: %s", strerror (errno));
+		return -1;
+	}
+
+	LOG_MSG (LOG_DEBUG, "Set timeout timer to %u seconds", secs);
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Initialize a deadline which has not been started
+ * @param d deadline
+ */
+void deadline_init (step_deadline *d)
+{
+	d->fd = -1;
+	d->stage = STAGE_IDLE;
+	d->hard_timeout = 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Start timing a step. When the soft timeout expires, the hard timeout is
+ *  armed automatically.
+ * @param d deadline
+ * @param soft_timeout seconds until soft timeout, 0 = no timeout
+ * @param hard_timeout seconds from soft to hard timeout, 0 = no timeout
+ * @return 0 in success, -1 in error
+ */
+int deadline_start (step_deadline *d, unsigned soft_timeout,
+		    unsigned hard_timeout)
+{
+	if (d->fd < 0) {
+		d->fd = timerfd_create (CLOCK_MONOTONIC,
+					TFD_NONBLOCK | TFD_CLOEXEC);
+		if (d->fd < 0) {
+			LOG_MSG (LOG_ERR, "timerfd_create: %s",
+				 strerror (errno));
+			return -1;
+		}
+	}
+
+	d->stage = STAGE_SOFT;
+	d->hard_timeout = hard_timeout;
+
+	return deadline_arm (d, soft_timeout);
+}
+/* ------------------------------------------------------------------------- */
+/** Check if a timeout has expired. Does not block, call when d->fd is
+ *  readable or periodically.
+ * @param d deadline
+ * @return DEADLINE_SOFT or DEADLINE_HARD once when the timeout expires,
+ *         DEADLINE_NONE otherwise
+ */
+deadline_event deadline_check (step_deadline *d)
+{
+	uint64_t expirations;
+
+	if (d->fd < 0 ||
+	    read (d->fd, &expirations, sizeof (expirations)) <= 0)
+		return DEADLINE_NONE;
+
+	switch (d->stage) {
+	case STAGE_SOFT:
+		d->stage = STAGE_HARD;
+		deadline_arm (d, d->hard_timeout);
+		return DEADLINE_SOFT;
+	case STAGE_HARD:
+		d->stage = STAGE_DONE;
+		return DEADLINE_HARD;
+	default:
+		return DEADLINE_NONE;
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Skip the rest of soft timeout and arm the hard timeout now, for example
+ *  when the step is terminated because of a signal.
+ * @param d deadline
+ * @return 0 in success, -1 in error
+ */
+int deadline_escalate (step_deadline *d)
+{
+	if (d->stage == STAGE_HARD || d->stage == STAGE_DONE)
+		return 0;
+
+	d->stage = STAGE_HARD;
+
+	return deadline_arm (d, d->hard_timeout);
+}
+/* ------------------------------------------------------------------------- */
+/** Stop timing a step and release the timer
+ * @param d deadline
+ */
+void deadline_stop (step_deadline *d)
+{
+	if (d->fd >= 0)
+		close (d->fd);
+	deadline_init (d);
+}
+/* ------------------------------------------------------------------------- */
+/* End of file */
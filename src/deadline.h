@@ -0,0 +1,77 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* DATA TYPES */
+/* ------------------------------------------------------------------------- */
+/** Result of checking a deadline */
+typedef enum {
+	DEADLINE_NONE = 0,      /**< nothing has expired */
+	DEADLINE_SOFT,          /**< soft timeout expired, hard one is armed */
+	DEADLINE_HARD           /**< hard timeout expired */
+} deadline_event;
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* STRUCTURES */
+/** Soft and hard timeout of one step. Each step has a timer of its own, so
+ *  any number of steps can be supervised at the same time. */
+typedef struct {
+	int      fd;            /**< timerfd, readable on expiration,
+				     -1 if not started */
+	int      stage;         /**< timeout the timer is armed for */
+	unsigned hard_timeout;  /**< seconds after soft timeout, 0 = none */
+} step_deadline;
+
+/* ------------------------------------------------------------------------- */
+/* FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+void deadline_init (step_deadline *d);
+/* ------------------------------------------------------------------------- */
+int deadline_start (step_deadline *d, unsigned soft_timeout,
+		    unsigned hard_timeout);
+/* ------------------------------------------------------------------------- */
+deadline_event deadline_check (step_deadline *d);
+/* ------------------------------------------------------------------------- */
+int deadline_escalate (step_deadline *d);
+/* ------------------------------------------------------------------------- */
+void deadline_stop (step_deadline *d);
+/* ------------------------------------------------------------------------- */
+#endif                          /* DEADLINE_H */
+/* End of file */
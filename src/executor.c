@@ -32,11 +32,15 @@
 #include <unistd.h>  		/* dup, pipe, fork, close, execvp */
 #include <string.h>		/* strtok, strncpy */
 #include <errno.h>
-#include <poll.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <sched.h>
 #include <libxml/xmlstring.h>
@@ -46,6 +50,9 @@
 #include "remote_executor_libssh2.h"
 #endif
 #include "executor.h"
+#include "shell_worker.h"
+#include "remote_agent.h"
+#include "cgroup.h"
 #include "log.h"
 #include "utils.h"
 
@@ -55,6 +62,7 @@
 
 /* ------------------------------------------------------------------------- */
 /* EXTERNAL GLOBAL VARIABLES */
+extern char **environ;
 extern int bail_out;
 extern char *global_failure;
 
@@ -76,16 +84,19 @@ volatile sig_atomic_t resume_testrun_count = 0;
 
 /* ------------------------------------------------------------------------- */
 /* LOCAL GLOBAL VARIABLES */
-LOCAL volatile sig_atomic_t timer_value = 0;
-LOCAL struct sigaction default_alarm_action = { .sa_handler = NULL };
 LOCAL testrunner_lite_options *options;
-LOCAL exec_data *current_data; 
+LOCAL exec_data *volatile running_steps[MAX_PARALLEL_JOBS];
+/* executor of the target the thread runs cases on, in sharded runs */
+LOCAL __thread const char *target_executor;
+LOCAL int splice_supported = 1;
 #ifdef ENABLE_LIBSSH2
 LOCAL libssh2_conn *lssh2_conn;
 #endif
 /* ------------------------------------------------------------------------- */
 /* LOCAL CONSTANTS AND MACROS */
-/* None */
+#define EPOLL_MAX_EVENTS 4
+#define STREAM_READ_SIZE (64 * 1024)
+#define SPLICE_SIZE (1024 * 1024)
 
 /* ------------------------------------------------------------------------- */
 /* MODULE DATA STRUCTURES */
@@ -103,35 +114,64 @@ LOCAL void free_args(char* argv[]);
 /* ------------------------------------------------------------------------- */
 LOCAL void set_child_signal_handlers();
 /* ------------------------------------------------------------------------- */
+LOCAL void child_fail(const char *msg, const char *arg);
+/* ------------------------------------------------------------------------- */
+LOCAL void child_enter_cgroup(exec_data* data);
+/* ------------------------------------------------------------------------- */
 LOCAL pid_t fork_process_redirect(int* stdout_fd, int* stderr_fd, 
 				   const char *command, exec_data* data);
 /* ------------------------------------------------------------------------- */
 LOCAL pid_t fork_process(const char *command, exec_data* data);
 /* ------------------------------------------------------------------------- */
+LOCAL int spawn_allowed(exec_data* data);
+/* ------------------------------------------------------------------------- */
+LOCAL pid_t spawn_process(int* stdout_fd, int* stderr_fd, 
+			  const char *command);
+/* ------------------------------------------------------------------------- */
 LOCAL void* stream_data_realloc(stream_data* data, int size);
 /* ------------------------------------------------------------------------- */
 LOCAL void stream_data_free(stream_data* data);
 /* ------------------------------------------------------------------------- */
 LOCAL void stream_data_append(stream_data* data, char* src);
 /* ------------------------------------------------------------------------- */
-LOCAL int read_and_append(int fd, stream_data* data);
+LOCAL int stream_data_spill(stream_data* data, const char *id, pid_t pid);
+/* ------------------------------------------------------------------------- */
+LOCAL void stream_data_write_spill(stream_data* data, 
+				   const unsigned char *buf, int length);
+/* ------------------------------------------------------------------------- */
+LOCAL void stream_data_tail_append(stream_data* data, 
+				   const unsigned char *buf, int length);
+/* ------------------------------------------------------------------------- */
+LOCAL void stream_data_reload_tail(stream_data* data);
+/* ------------------------------------------------------------------------- */
+LOCAL void stream_data_join_tail(stream_data* data);
 /* ------------------------------------------------------------------------- */
-LOCAL void timer_handler(int signum);
+LOCAL void stream_data_end_spill(stream_data* data);
 /* ------------------------------------------------------------------------- */
-LOCAL int set_timer(long secs);
+LOCAL int stream_data_splice(int fd, stream_data* data);
 /* ------------------------------------------------------------------------- */
-LOCAL void reset_timer();
+LOCAL int read_and_append(int fd, stream_data* data, const char *id,
+			  pid_t pid);
+/* ------------------------------------------------------------------------- */
+LOCAL int open_pidfd(pid_t pid);
+/* ------------------------------------------------------------------------- */
+LOCAL int watch_fd(int epoll_fd, int fd);
 /* ------------------------------------------------------------------------- */
 LOCAL int execution_terminated(exec_data* data);
 /* ------------------------------------------------------------------------- */
-LOCAL void process_output_streams(int stdout_fd, int stderr_fd, 
-				   exec_data* data);
+LOCAL int worker_step_terminated(exec_data* data);
+/* ------------------------------------------------------------------------- */
+LOCAL int agent_step_terminated(exec_data* data);
 /* ------------------------------------------------------------------------- */
 LOCAL void communicate(int stdout_fd, int stderr_fd, exec_data* data);
 /* ------------------------------------------------------------------------- */
-LOCAL void strip_ctrl_chars (stream_data* data);
+LOCAL void sanitize_stream (stream_data* data, const char *id, pid_t pid);
+/* ------------------------------------------------------------------------- */
+LOCAL void step_started (exec_data *data);
+/* ------------------------------------------------------------------------- */
+LOCAL void step_finished (exec_data *data);
 /* ------------------------------------------------------------------------- */
-LOCAL void utf8_check (stream_data* data, const char *id, pid_t pid);
+LOCAL void kill_running_steps (void);
 #ifdef ENABLE_LIBSSH2
 /* ------------------------------------------------------------------------- */
 LOCAL int executor_init_libssh2 (testrunner_lite_options *opts);
@@ -201,6 +241,45 @@ LOCAL void set_child_signal_handlers()
 	signal(SIGTERM, SIG_DFL);
 }
 /* ------------------------------------------------------------------------- */
+/** Reports an error of a forked child before exec and exits. Only 
+ *  async-signal-safe calls are used, the log mutex may be held by another
+ *  thread of the parent at the time of the fork.
+ * @param msg error message
+ * @param arg quoted after the message, or NULL
+ */
+LOCAL void child_fail(const char *msg, const char *arg)
+{
+	struct iovec iov[5];
+	int n = 0;
+
+	iov[n].iov_base = (void *)PROGNAME ": ";
+	iov[n++].iov_len = strlen(PROGNAME ": ");
+	iov[n].iov_base = (void *)msg;
+	iov[n++].iov_len = strlen(msg);
+	if (arg) {
+		iov[n].iov_base = (void *)" '";
+		iov[n++].iov_len = 2;
+		iov[n].iov_base = (void *)arg;
+		iov[n++].iov_len = strlen(arg);
+	}
+	iov[n].iov_base = (void *)(arg ? "'\n" : "\n");
+	iov[n++].iov_len = arg ? 2 : 1;
+	if (writev(STDERR_FILENO, iov, n) < 0) {
+		/* nothing to do, exiting anyway */
+	}
+	_exit(1);
+}
+/* ------------------------------------------------------------------------- */
+/** Moves a forked child to the cgroup of its step
+ * @param data execution data of the step
+ */
+LOCAL void child_enter_cgroup(exec_data* data)
+{
+	if (!data || !data->cgroup || cgroup_enter(data->cgroup) == 0)
+		return;
+	child_fail("failed to move step process to its cgroup", NULL);
+}
+/* ------------------------------------------------------------------------- */
 /** Executes a command on local or remote host
  * @param command Command to execute
  * @return Does not return in success, error code from exec in case of error
@@ -209,23 +288,18 @@ LOCAL int exec_wrapper(const char *command, exec_data* data)
 {
 	int ret = 0;
 
-	if (options->remote_executor) {
-		ret = remote_execute (options->remote_executor, command);
+	if (data->remote_executor) {
+		ret = remote_execute (data->remote_executor, command);
 	} else {
-		if (data != NULL && data->disobey_chroot) {
-			LOG_MSG(LOG_DEBUG, "Disobeying chroot for command %s",
-				command);
-		} else if (options->chroot_folder) {
-			if (chdir(options->chroot_folder) == -1) {
-				LOG_MSG(LOG_ERR, "Failed to chdir into chroot '%s'",
-					options->chroot_folder);
-				return -1;
-			}
-			if (chroot(".") == -1) {
-				LOG_MSG(LOG_ERR, "Failed to set chroot to '%s'",
-					options->chroot_folder);
-				return -1;
-			}
+		/* in the forked child, disobeying chroot is logged by
+		   execute() */
+		if (options->chroot_folder && !data->disobey_chroot) {
+			if (chdir(options->chroot_folder) == -1)
+				child_fail("failed to chdir into chroot",
+					   options->chroot_folder);
+			if (chroot(".") == -1)
+				child_fail("failed to set chroot to",
+					   options->chroot_folder);
 		}
 
 		/* on success, execvp does not return */
@@ -250,10 +324,12 @@ LOCAL pid_t fork_process_redirect(int* stdout_fd, int* stderr_fd, const char *co
 	int err_pipe[2];
 	pid_t pid;
 	
-	if (pipe(out_pipe) < 0)
+	/* close on exec, so that steps forked concurrently by other threads
+	   do not inherit the pipes */
+	if (pipe2(out_pipe, O_CLOEXEC) < 0)
 		goto error_out;
 
-	if (pipe(err_pipe) < 0)
+	if (pipe2(err_pipe, O_CLOEXEC) < 0)
 		goto error_err;
 
 	pid = fork();
@@ -272,6 +348,7 @@ LOCAL pid_t fork_process_redirect(int* stdout_fd, int* stderr_fd, const char *co
 		 * Process group ID and session ID
 		 * are set to PID (they were PPID) */
 		setsid();
+		child_enter_cgroup(data);
 		/* close the read end of the pipes */
 		close(out_pipe[0]);
 		close(err_pipe[0]);
@@ -290,7 +367,7 @@ LOCAL pid_t fork_process_redirect(int* stdout_fd, int* stderr_fd, const char *co
 		
 		exec_wrapper(command, data);
 		/* execution should never reach this point */
-		exit(1);
+		_exit(1);
 	} else {
 		LOG_MSG(LOG_ERR, "Fork failed: %s", strerror(errno));
 		goto error_fork;
@@ -324,10 +401,11 @@ LOCAL pid_t fork_process(const char *command, exec_data* data) {
 		 * Process group ID and session ID
 		 * are set to PID (they were PPID) */
 		setsid();
+		child_enter_cgroup(data);
 		
 		exec_wrapper(command, data);
 		/* execution should never reach this point */
-		exit(1);
+		_exit(1);
 	} else {
 		LOG_MSG(LOG_ERR, "Fork failed: %s", strerror(errno));
 	}
@@ -335,23 +413,118 @@ LOCAL pid_t fork_process(const char *command, exec_data* data) {
 	return pid;
 }
 /* ------------------------------------------------------------------------- */
+/** Check if the step can be started with posix_spawn() instead of fork().
+ *  Remote executor, chroot and moving the child to the cgroup of the step
+ *  need code to be run in the child before exec.
+ * @param data Input data controlling execution
+ * @return 1 if spawn can be used, 0 if not
+ */
+LOCAL int spawn_allowed(exec_data* data) {
+#ifdef POSIX_SPAWN_SETSID
+	if (data->remote_executor)
+		return 0;
+	if (options->chroot_folder && !data->disobey_chroot)
+		return 0;
+	if (data->cgroup)
+		return 0;
+	return 1;
+#else
+	return 0;
+#endif
+}
+/* ------------------------------------------------------------------------- */
+/** Create new process with new session ID using posix_spawn(), which 
+ *  does not need to copy the address space of testrunner-lite.
+ * @param stdout_fd Pointer to a file descriptor used to read stdout of
+ *        executed command, NULL if output is not redirected
+ * @param stderr_fd Pointer to a file descriptor used to read stderr of 
+ *        executed command, NULL if output is not redirected
+ * @param command Command to execute
+ * @return PID of process on success, -1 in error
+ */
+LOCAL pid_t spawn_process(int* stdout_fd, int* stderr_fd, 
+			  const char *command) {
+#ifdef POSIX_SPAWN_SETSID
+	int out_pipe[2] = { -1, -1 };
+	int err_pipe[2] = { -1, -1 };
+	char *argv[] = { SHELLCMD, SHELLCMD_ARGS, (char *)command, NULL };
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	pid_t pid = -1;
+	int ret;
+
+	if (stdout_fd) {
+		/* only the duplicated ends are left open in the child */
+		if (pipe2(out_pipe, O_CLOEXEC) < 0)
+			goto out;
+		if (pipe2(err_pipe, O_CLOEXEC) < 0)
+			goto out;
+	}
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+
+	if (stdout_fd) {
+		/* redirect stdout and stderr to the pipes */
+		posix_spawn_file_actions_adddup2(&actions, out_pipe[1], 1);
+		posix_spawn_file_actions_adddup2(&actions, err_pipe[1], 2);
+	}
+
+	/* Reset signal handlers and mask set by parent process */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+
+	/* Create new session id.
+	 * Process group ID and session ID
+	 * are set to PID (they were PPID) */
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | 
+				 POSIX_SPAWN_SETSIGDEF | 
+				 POSIX_SPAWN_SETSIGMASK);
+
+	ret = posix_spawn(&pid, SHELLCMD, &actions, &attr, argv, environ);
+	if (ret) {
+		LOG_MSG(LOG_ERR, "Spawn failed: %s", strerror(ret));
+		pid = -1;
+	} else {
+		LOG_MSG(LOG_DEBUG, "Spawned new process %d", pid);
+		if (stdout_fd) {
+			*stdout_fd = out_pipe[0];
+			*stderr_fd = err_pipe[0];
+			out_pipe[0] = err_pipe[0] = -1;
+		}
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+ out:
+	/* close the write end of the pipes, and read end in error */
+	if (out_pipe[0] >= 0) close(out_pipe[0]);
+	if (out_pipe[1] >= 0) close(out_pipe[1]);
+	if (err_pipe[0] >= 0) close(err_pipe[0]);
+	if (err_pipe[1] >= 0) close(err_pipe[1]);
+
+	return pid;
+#else
+	return -1;
+#endif
+}
+/* ------------------------------------------------------------------------- */
 /** Allocate memory for stream_data
  * @param data Pointer to stream_data structure
  * @param size Number of bytes to be allocated
  * @return Non NULL on success, NULL in error
  */
 LOCAL void* stream_data_realloc(stream_data* data, int size) {
-	unsigned char* newptr = (unsigned char*)malloc(size);
-	unsigned char* oldptr = data->buffer;
-	int length = data->size <= size ? data->size : size;
+	unsigned char* newptr = (unsigned char*)realloc(data->buffer, size);
 
 	if (newptr) {
-		if (data->buffer != NULL) {
-			memcpy(newptr, oldptr, length);
-		}
 		data->buffer = newptr;
 		data->size = size;
-		free(oldptr);
 	} else {
 		LOG_MSG(LOG_ERR, "Stream data memory allocation failed");
 	}
@@ -363,10 +536,18 @@ LOCAL void* stream_data_realloc(stream_data* data, int size) {
  * @param data Pointer to stream_data structure
  */
 LOCAL void stream_data_free(stream_data* data) {
+	free(data->tail);
+	data->tail = NULL;
+	stream_data_end_spill(data);
 	free(data->buffer);
+	free(data->spill_file);
 	data->buffer = NULL;
+	data->spill_file = NULL;
 	data->size = 0;
 	data->length = 0;
+	data->total = 0;
+	data->spliced = 0;
+	data->spill_failed = 0;
 }
 /* ------------------------------------------------------------------------- */
 /** Append data to stream_data and reallocate memory if necessary
@@ -384,122 +565,368 @@ LOCAL void stream_data_append(stream_data* data, char* src) {
 
 }
 /* ------------------------------------------------------------------------- */
-/** Read data from file descriptor and append to stream_data. Reallocates 
- * memory if necessary
- * @param fd File descriptor to read
+/** Start writing stream to a file in output folder once the memory limit 
+ * is exceeded. Everything buffered so far is written to the file and only 
+ * the beginning of the output is kept in memory, and with 
+ * options->output_tail also the end of it. If the file can not be opened
+ * the output is truncated the same way and the rest of it is dropped.
  * @param data Pointer to stream_data structure
- * @return Value returned by read
+ * @param id identifier (stdout/stderr)
+ * @param pid pid of test step
+ * @return 0 in success, -1 if the output is not written to a file
  */
-LOCAL int read_and_append(int fd, stream_data* data) {
-	const int read_size = 255;	/* number of bytes to read */
-	int ret = 0;
-
-	do {
-		/*
-		 * is there allocated memory left for read_size bytes + 
-		 * terminating null ? 
-		 */
-		if (data->size - data->length < read_size + 1) {
-			if (stream_data_realloc(data, data->size + 1024) 
-			    == NULL) {
-				/* memory allocation failed */
-				return -3;
-			}
-		}
-
-		ret = read(fd, &data->buffer[data->length], read_size);
+LOCAL int stream_data_spill(stream_data* data, const char *id, pid_t pid) {
+	const char *folder = options->output_folder ? 
+		options->output_folder : ".";
+	char *fname = NULL;
+	size_t len;
+	int cut;
+	int ret = -1;
 
-		if (ret > 0) {
-			/* read was successful, update stream_data */
-			data->buffer[data->length + ret] = '\0';
-			if (options->print_step_output)
-				printf ("%s", &data->buffer[data->length]);
+	len = strlen (id) + 10 + strlen (".log") + 2;
+	data->spill_file = (char *)malloc (len);
+	if (!data->spill_file) {
+		LOG_MSG(LOG_ERR, "OOM");
+		goto err_out;
+	}
+	snprintf (data->spill_file, len, "%s.%d.log", id, pid);
 
-			data->length += ret;
+	len = strlen (folder) + strlen (data->spill_file) + 2;
+	fname = (char *)malloc (len);
+	if (!fname) {
+		LOG_MSG(LOG_ERR, "OOM");
+		goto err_out;
+	}
+	snprintf (fname, len, "%s/%s", folder, data->spill_file);
 
+	/* readable for getting the tail back after splice */
+	data->spill_fd = open (fname, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+			       0644);
+	if (data->spill_fd < 0) {
+		LOG_MSG (LOG_ERR, "%s:%s:failed to open file %s %s\n",
+			 PROGNAME, __FUNCTION__, fname,
+			 strerror(errno));
+		goto err_out;
+	}
+	LOG_MSG (LOG_DEBUG, "%s of process %d exceeds %lu bytes, writing "
+		 "it to %s", id, pid, options->output_limit, fname);
+
+	stream_data_write_spill(data, data->buffer, data->length);
+	ret = 0;
+	goto truncate;
+ err_out:
+	/* not retried for every chunk, the buffer would grow without bound */
+	data->spill_failed = 1;
+	free (data->spill_file);
+	data->spill_file = NULL;
+ truncate:
+	/* keep the beginning, do not cut in the middle of a character */
+	cut = options->output_limit;
+	while (cut > 0 && (data->buffer[cut] & 0xC0) == 0x80)
+		cut--;
+
+	if (options->output_tail) {
+		data->tail = (unsigned char *)malloc (options->output_tail);
+		if (!data->tail) {
+			LOG_MSG(LOG_ERR, "OOM");
+		} else {
+			data->tail_pos = 0;
+			data->tail_length = 0;
+			stream_data_tail_append(data, &data->buffer[cut],
+						data->length - cut);
 		}
 	}
-	while (ret > 0);
 
+	data->buffer[cut] = '\0';
+	data->length = cut;
+	/* give back what the buffer grew to before the limit was hit */
+	stream_data_realloc(data, cut + 1);
+
+	free (fname);
 	return ret;
 }
 /* ------------------------------------------------------------------------- */
-/** Signal handler for SIGALRM (timer)
- * @param signum Identifier of received signal
+/** Write data to the file stream is spilled to
+ * @param data Pointer to stream_data structure
+ * @param buf Data to write
+ * @param length Number of bytes to write
  */
-LOCAL void timer_handler(int signum) {
-	if (signum == SIGALRM) {
-		timer_value = 1;
+LOCAL void stream_data_write_spill(stream_data* data, 
+				   const unsigned char *buf, int length) {
+	ssize_t ret;
+
+	while (length > 0) {
+		ret = write (data->spill_fd, buf, length);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			LOG_MSG(LOG_ERR, "Failed to write %s: %s", 
+				data->spill_file, strerror(errno));
+			return;
+		}
+		buf += ret;
+		length -= ret;
 	}
 }
 /* ------------------------------------------------------------------------- */
-/** Initialize timer and set signal action for SIGALRM
- * @param secs Value in seconds after which global variable timer_value
- * will be set
- * @return 0 in success, -1 in error
+/** Keep the last options->output_tail bytes of spilled stream in a ring 
+ * buffer
+ * @param data Pointer to stream_data structure
+ * @param buf Data to append
+ * @param length Number of bytes to append
  */
-LOCAL int set_timer(long secs) {
-	struct sigaction act;
-	struct itimerval timer;
+LOCAL void stream_data_tail_append(stream_data* data, 
+				   const unsigned char *buf, int length) {
+	int size = options->output_tail;
+	int n;
+
+	if (length >= size) {
+		memcpy(data->tail, buf + length - size, size);
+		data->tail_pos = 0;
+		data->tail_length = size;
+		return;
+	}
 
-	act.sa_handler = timer_handler;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = 0;
+	n = size - data->tail_pos;
+	if (n > length)
+		n = length;
+	memcpy(&data->tail[data->tail_pos], buf, n);
+	memcpy(data->tail, buf + n, length - n);
 
-	timer.it_interval.tv_sec = 0;
-	timer.it_interval.tv_usec = 0;
-	timer.it_value.tv_sec = secs;
-	timer.it_value.tv_usec = 0;
+	data->tail_pos = (data->tail_pos + length) % size;
+	data->tail_length += length;
+	if (data->tail_length > size)
+		data->tail_length = size;
+}
+/* ------------------------------------------------------------------------- */
+/** Read the end of spilled stream back from the file, when it has been 
+ * moved there with splice instead of passing through the ring buffer
+ * @param data Pointer to stream_data structure
+ */
+LOCAL void stream_data_reload_tail(stream_data* data) {
+	unsigned long long size = options->output_tail;
+	off_t offset = data->total > size ? data->total - size : 0;
+	ssize_t ret;
 
-	timer_value = 0;
+	do {
+		ret = pread (data->spill_fd, data->tail, size, offset);
+	} while (ret < 0 && errno == EINTR);
 
-	/* set signal action. original action is stored in global 
-	 * default_alarm_action */
-	if (sigaction(SIGALRM, &act, &default_alarm_action) < 0) {
-		perror("sigaction");
-		goto erraction;
+	if (ret < 0) {
+		LOG_MSG(LOG_ERR, "Failed to read %s: %s", 
+			data->spill_file, strerror(errno));
+		ret = 0;
+	}
+	data->tail_length = ret;
+	data->tail_pos = ret % size;
+}
+/* ------------------------------------------------------------------------- */
+/** Append the tail kept from spilled stream to the beginning of it in 
+ * memory, with a note on how much was left out in between
+ * @param data Pointer to stream_data structure
+ */
+LOCAL void stream_data_join_tail(stream_data* data) {
+	int size = options->output_tail;
+	int start = 0, skip, n;
+	unsigned long long omitted;
+	char note[128];
+	int note_len;
+
+	if (!data->tail)
+		data->tail_length = 0;
+	if (data->tail_length) {
+		start = (data->tail_pos - data->tail_length + size) % size;
+
+		/* do not start in the middle of a character */
+		for (skip = 0; skip < 3 && skip < data->tail_length; skip++)
+			if ((data->tail[(start + skip) % size] & 0xC0) != 0x80)
+				break;
+		start = (start + skip) % size;
+		data->tail_length -= skip;
 	}
 
-	if (setitimer(ITIMER_REAL, &timer, NULL) < 0) {
-		perror("setitimer");
-		goto errtimer;
+	omitted = data->total - data->length - data->tail_length;
+	if (data->spill_file)
+		note_len = snprintf (note, sizeof (note), 
+				     "\n[... %llu bytes omitted, see %s ...]\n",
+				     omitted, data->spill_file);
+	else
+		note_len = snprintf (note, sizeof (note), 
+				     "\n[... %llu bytes omitted ...]\n",
+				     omitted);
+	if (note_len >= sizeof (note))
+		note_len = sizeof (note) - 1;
+
+	if (!stream_data_realloc(data, data->length + note_len + 
+				 data->tail_length + 1))
+		return;
+
+	memcpy(&data->buffer[data->length], note, note_len);
+	data->length += note_len;
+
+	n = size - start;
+	if (n > data->tail_length)
+		n = data->tail_length;
+	memcpy(&data->buffer[data->length], &data->tail[start], n);
+	memcpy(&data->buffer[data->length + n], data->tail, 
+	       data->tail_length - n);
+	data->length += data->tail_length;
+	data->buffer[data->length] = '\0';
+}
+/* ------------------------------------------------------------------------- */
+/** Close the file stream is spilled to, if any, and add the end of the 
+ * stream kept in memory to the buffer
+ * @param data Pointer to stream_data structure
+ */
+LOCAL void stream_data_end_spill(stream_data* data) {
+	if (data->tail || data->spill_failed) {
+		if (data->tail && data->spliced && data->spill_fd >= 0)
+			stream_data_reload_tail(data);
+		stream_data_join_tail(data);
+		free(data->tail);
+		data->tail = NULL;
+		/* note of the dropped output is added once */
+		data->spill_failed = 0;
+	}
+	if (data->spill_fd >= 0) {
+		close (data->spill_fd);
+		data->spill_fd = -1;
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Move data from pipe to the file stream is spilled to, without copying 
+ * it through user space
+ * @param fd File descriptor to read
+ * @param data Pointer to stream_data structure
+ * @return Value returned by splice, -2 if splice can not be used
+ */
+LOCAL int stream_data_splice(int fd, stream_data* data) {
+	ssize_t ret;
+
+	ret = splice (fd, NULL, data->spill_fd, NULL, SPLICE_SIZE,
+		      SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (ret > 0) {
+		data->total += ret;
+		data->spliced = 1;
+	} else if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+		LOG_MSG(LOG_DEBUG, "Cannot splice to %s: %s", 
+			data->spill_file, strerror(errno));
+		/* file system of output folder does not support it */
+		if (errno == EINVAL || errno == ENOSYS)
+			splice_supported = 0;
+		return -2;
 	}
 
-	LOG_MSG(LOG_DEBUG, "Set timeout timer to %lu seconds", secs);
+	return ret;
+}
+/* ------------------------------------------------------------------------- */
+/** Read data from file descriptor and append to stream_data. Buffer grows 
+ * geometrically, and once options->output_limit (plus options->output_tail)
+ * is exceeded the rest of the stream is written to a file instead of 
+ * memory. Data going to the file is moved there with splice if possible.
+ * @param fd File descriptor to read
+ * @param data Pointer to stream_data structure
+ * @param id identifier (stdout/stderr) used in the name of spill file
+ * @param pid pid of test step
+ * @return Value returned by read
+ */
+LOCAL int read_and_append(int fd, stream_data* data, const char *id,
+			  pid_t pid) {
+	unsigned char chunk[STREAM_READ_SIZE];
+	int size;
+	int ret = 0;
+
+	do {
+		if (data->spill_fd >= 0 && splice_supported && 
+		    !options->print_step_output) {
+			ret = stream_data_splice(fd, data);
+			if (ret != -2)
+				continue;
+		}
 
-	return 0;
+		ret = read(fd, chunk, sizeof(chunk));
+		if (ret <= 0)
+			break;
+
+		if (options->print_step_output)
+			fwrite (chunk, 1, ret, stdout);
+
+		data->total += ret;
+
+		if (data->spill_fd >= 0 || data->spill_failed) {
+			/* memory limit exceeded earlier */
+			if (data->spill_fd >= 0)
+				stream_data_write_spill(data, chunk, ret);
+			if (data->tail)
+				stream_data_tail_append(data, chunk, ret);
+			continue;
+		}
 
- errtimer:
-	if (sigaction(SIGALRM, &default_alarm_action, NULL) < 0) {
-		perror("sigaction");
+		/* 
+		 * is there allocated memory left for read bytes + 
+		 * terminating null ? 
+		 */
+		if (data->size - data->length < ret + 1) {
+			size = data->size ? data->size : 1024;
+			while (size - data->length < ret + 1)
+				size *= 2;
+			if (stream_data_realloc(data, size) == NULL) {
+				/* memory allocation failed */
+				return -3;
+			}
+		}
+
+		/* read was successful, update stream_data */
+		memcpy(&data->buffer[data->length], chunk, ret);
+		data->length += ret;
+		data->buffer[data->length] = '\0';
+
+		if (options->output_limit && 
+		    (unsigned long)data->length > options->output_limit +
+		    options->output_tail &&
+		    stream_data_spill(data, id, pid) == 0) {
+#ifdef F_SETPIPE_SZ
+			/* output is large, move it in larger pieces */
+			fcntl(fd, F_SETPIPE_SZ, SPLICE_SIZE);
+#endif
+		}
 	}
- erraction:
+	while (ret > 0);
+
+	return ret;
+}
+/* ------------------------------------------------------------------------- */
+/** Obtain a file descriptor that becomes readable when process terminates
+ * @param pid Process ID
+ * @return pidfd on success, -1 if not supported or in error
+ */
+LOCAL int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
 	return -1;
+#endif
 }
 /* ------------------------------------------------------------------------- */
-/** Reset timer and restore signal action of SIGALRM
+/** Add file descriptor to the epoll set for input
+ * @param epoll_fd epoll file descriptor
+ * @param fd File descriptor to watch
+ * @return 0 in success, -1 in error
  */
-LOCAL void reset_timer() {
-	struct itimerval timer;
-
-	timer.it_interval.tv_sec = 0;
-	timer.it_interval.tv_usec = 0;
-	timer.it_value.tv_sec = 0;
-	timer.it_value.tv_usec = 0;
+LOCAL int watch_fd(int epoll_fd, int fd) {
+	struct epoll_event ev;
 
-	if (setitimer(ITIMER_REAL, &timer, NULL) < 0) {
-		perror("setitimer");
-	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
 
-	/* restore original action for signal SIGALRM */
-	if (default_alarm_action.sa_handler != NULL && 
-	    sigaction(SIGALRM, &default_alarm_action, NULL) < 0) {
-		perror("sigaction");
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		LOG_MSG(LOG_ERR, "epoll_ctl: %s", strerror(errno));
+		return -1;
 	}
 
-	timer_value = 0;
-
-	LOG_MSG(LOG_DEBUG, "Reset timeout timer");
+	return 0;
 }
 /* ------------------------------------------------------------------------- */
 /** Do unblocking wait for state change of process(es)
@@ -513,6 +940,7 @@ LOCAL int execution_terminated(exec_data* data) {
 	int ret = 0;
 	int status = 0;
 	char fail_str [100];
+	struct rusage usage;
 
 	pgroup = getpgid(data->pid);
 	if (pgroup > 1 && pgroup != data->pgid) {
@@ -522,7 +950,7 @@ LOCAL int execution_terminated(exec_data* data) {
 			data->pid, data->pgid);
 	}
 
-	pid = waitpid(-pgroup, &status, WNOHANG);
+	pid = wait4(-pgroup, &status, WNOHANG, &usage);
 
 	switch (pid) {
 	case -1:
@@ -552,15 +980,22 @@ LOCAL int execution_terminated(exec_data* data) {
 		/* set flag that process has been terminated */
 		data->waited = 1;
 
+		/* usage covers the descendants the process has waited for,
+		   but with remote executor only the local client */
+		if (!data->remote_executor) {
+			data->usage = usage;
+			data->has_usage = 1;
+		}
+
 		if (WIFEXITED(status)) {
 			/* child exited normally */
 			data->result = WEXITSTATUS(status);
-			if (options->remote_executor &&
+			if (data->remote_executor &&
 			    (data->result == 255 ||
 			     (data->result > 64 && data->result < 80))
 			    ) {
 				if (remote_check_conn
-				    (options->remote_executor)) {
+				    (data->remote_executor)) {
 					bail_out = TESTRUNNER_LITE_REMOTE_FAIL;
 					global_failure = 
 						"earlier connection failure";
@@ -573,7 +1008,7 @@ LOCAL int execution_terminated(exec_data* data) {
 							   "failure");
 				}
 			}
-			else if (options->remote_executor &&
+			else if (data->remote_executor &&
 				 data->result > 128 &&
 				 data->result < 160) {
 				stream_data_append(&data->failure_info,
@@ -605,93 +1040,206 @@ LOCAL int execution_terminated(exec_data* data) {
 	return ret;
 }
 /* ------------------------------------------------------------------------- */
-/** Read output streams from executed process
- * @param stdout_fd File descriptor to read stdout stream
- * @param stderr_fd File descriptor to read stderr stream
+/** Check if a step run by shell worker has terminated. The shell reports
+ *  termination by signal as exit status 128 + signal, which can not be 
+ *  told apart from the same exit status.
  * @param data Input and output data controlling execution
+ * @return 1 if the step has terminated, 0 if not
  */
-LOCAL void process_output_streams(int stdout_fd, int stderr_fd, 
-				   exec_data* data) 
-{
-	struct pollfd fds[2];
-	int i = 0;
+LOCAL int worker_step_terminated(exec_data* data) {
+	int status = 0;
+	int ret;
+	char fail_str [100];
 
-	fds[0].fd = stdout_fd;
-	fds[0].events = POLLIN;
-	fds[1].fd = stderr_fd;
-	fds[1].events = POLLIN;
+	ret = shell_worker_status(data, &status);
+	if (ret == 0)
+		return 0;
+
+	data->waited = 1;
+
+	if (ret < 0) {
+		data->result = -1;
+		stream_data_append(&data->failure_info, "shell worker failure");
+	} else if (status > 128 && status - 128 < NSIG) {
+		data->result = status - 128;
+		snprintf (fail_str, 100, " terminated by signal %d ",
+			  data->result);
+		stream_data_append(&data->failure_info, fail_str);
+		LOG_MSG(LOG_DEBUG, "Process %d was terminated by signal %d",
+			data->pid, data->result);
+	} else {
+		data->result = status;
+		LOG_MSG(LOG_DEBUG, "Process %d exited with status %d",
+			data->pid, status);
+	}
 
-	switch(poll(fds, 2, POLL_TIMEOUT_MS)) {
-	case 0:
-		/* poll timeout */
-		break;
-	case -1:
-		/* error */
-		break;
-	default:
-		for(i = 0; i < 2; i++) {
-			if (fds[i].revents & POLLIN) {
-				if (fds[i].fd == stdout_fd) {
-					LOG_MSG(LOG_DEBUG, 
-						"Reading stdout of process %d",
-						data->pid);
-					read_and_append(stdout_fd, 
-							&data->stdout_data);
-				} else if (fds[i].fd == stderr_fd) {
-					LOG_MSG(LOG_DEBUG, 
-						"Reading stderr of process %d",
-						data->pid);
-					read_and_append(stderr_fd,
-							&data->stderr_data);
-				}
-			}
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if a step run by remote agent has terminated. Losing the agent
+ *  is handled as a remote connection failure.
+ * @param data Input and output data controlling execution
+ * @return 1 if the step has terminated, 0 if not
+ */
+LOCAL int agent_step_terminated(exec_data* data) {
+	int status = 0;
+	int ret;
+	char fail_str [100];
+
+	ret = remote_agent_status(data, &status);
+	if (ret == 0)
+		return 0;
+
+	data->waited = 1;
+
+	if (ret < 0) {
+		data->result = -1;
+		/* agent is also stopped on interrupt */
+		if (!bail_out) {
+			bail_out = TESTRUNNER_LITE_REMOTE_FAIL;
+			global_failure = "earlier connection failure";
 		}
-		break;
+		if (data->control != CONTROL_REBOOT_EXPECTED)
+			LOG_MSG(LOG_ERR, "remote connection failure");
+		stream_data_append(&data->failure_info, "connection failure");
+	} else if (WIFSIGNALED(status)) {
+		data->result = WTERMSIG(status);
+		snprintf (fail_str, 100, " terminated by signal %d ",
+			  WTERMSIG(status));
+		stream_data_append(&data->failure_info, fail_str);
+		LOG_MSG(LOG_DEBUG, "Step %d was terminated by signal %d",
+			data->pid, WTERMSIG(status));
+	} else {
+		data->result = WEXITSTATUS(status);
+		LOG_MSG(LOG_DEBUG, "Step %d exited with status %d",
+			data->pid, data->result);
 	}
 
+	return 1;
 }
 /* ------------------------------------------------------------------------- */
-/** Set timeout timers, read output, and control execution of test step
+/** Set timeout timers, read output, and control execution of test step.
+ *  Sleeps in epoll until output is available, the step process terminates
+ *  or a timeout expires.
  * @param stdout_fd File descriptor to read stdout stream
  * @param stderr_fd File descriptor to read stderr stream
  * @param data Input and output data controlling execution
  */
 LOCAL void communicate(int stdout_fd, int stderr_fd, exec_data* data) {
-	int terminated = 0;
-	int killed = 0;
 	int ready = 0;
+	int epoll_fd = -1;
+	int pid_fd = -1;
+	int wait_ms = -1;
+	int check_child;
+	deadline_event expired;
+	int i, n;
+	struct epoll_event events[EPOLL_MAX_EVENTS];
 
 	LOG_MSG(LOG_DEBUG, "Communicating with process %d", data->pid);
 
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		LOG_MSG(LOG_ERR, "epoll_create1: %s", strerror(errno));
+	}
+
 	if (data->redirect_output == REDIRECT_OUTPUT) {
 		/* Use non blocking mode such that read will not block */
 		fcntl(stdout_fd, F_SETFL, O_NONBLOCK);
 		fcntl(stderr_fd, F_SETFL, O_NONBLOCK);
+		watch_fd(epoll_fd, stdout_fd);
+		watch_fd(epoll_fd, stderr_fd);
+	}
+
+	if (data->status_fd >= 0) {
+		/* step is not our child, shell worker or agent tells when it
+		   is done */
+		watch_fd(epoll_fd, data->status_fd);
+	} else if ((pid_fd = open_pidfd(data->pid)) < 0 || 
+		   watch_fd(epoll_fd, pid_fd) < 0) {
+		/* termination can only be noticed by polling */
+		LOG_MSG(LOG_DEBUG, "pidfd not available, polling process %d",
+			data->pid);
+		wait_ms = POLL_TIMEOUT_MS;
 	}
 
-	set_timer(data->soft_timeout);
+	if (deadline_start(&data->deadline, data->soft_timeout,
+			   data->hard_timeout) < 0 ||
+	    watch_fd(epoll_fd, data->deadline.fd) < 0) {
+		LOG_MSG(LOG_ERR, "Failed to create timeout timer");
+	}
 
 	while (!ready) {
-		ready = execution_terminated(data);
+		check_child = (wait_ms >= 0);
+		expired = DEADLINE_NONE;
+
+		n = epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, wait_ms);
+		if (n < 0) {
+			if (errno != EINTR) {
+				LOG_MSG(LOG_ERR, "epoll_wait: %s",
+					strerror(errno));
+				usleep(POLL_TIMEOUT_US);
+				check_child = 1;
+			}
+			n = 0;
+		}
 
-		if (data->redirect_output == REDIRECT_OUTPUT) {
-			/* read output streams. sleeps in poll */
-			process_output_streams(stdout_fd, stderr_fd, data);
-		} else {
-			usleep(POLL_TIMEOUT_US);
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == pid_fd ||
+			    events[i].data.fd == data->status_fd) {
+				check_child = 1;
+			} else if (events[i].data.fd == data->deadline.fd) {
+				expired = deadline_check(&data->deadline);
+			} else if (events[i].data.fd == stdout_fd) {
+				LOG_MSG(LOG_DEBUG, 
+					"Reading stdout of process %d",
+					data->pid);
+				/* stop watching on end of stream */
+				if (read_and_append(stdout_fd, 
+						    &data->stdout_data,
+						    "stdout", data->pid) == 0)
+					epoll_ctl(epoll_fd, EPOLL_CTL_DEL, 
+						  stdout_fd, NULL);
+			} else if (events[i].data.fd == stderr_fd) {
+				LOG_MSG(LOG_DEBUG, 
+					"Reading stderr of process %d",
+					data->pid);
+				if (read_and_append(stderr_fd,
+						    &data->stderr_data,
+						    "stderr", data->pid) == 0)
+					epoll_ctl(epoll_fd, EPOLL_CTL_DEL, 
+						  stderr_fd, NULL);
+			}
 		}
 
-		if (timer_value && !terminated) {
+		if (check_child && data->agent) {
+			ready = agent_step_terminated(data);
+		} else if (check_child && data->status_fd >= 0) {
+			ready = worker_step_terminated(data);
+		} else if (check_child) {
+			ready = execution_terminated(data);
+			/* the first call reaps the process, the second one
+			   reports that there are no more children */
+			if (!ready && data->waited)
+				ready = execution_terminated(data);
+		}
+
+		if (ready)
+			break;
+
+		if (expired == DEADLINE_SOFT) {
 			/* try to terminate */
 			LOG_MSG(LOG_DEBUG, "Timeout, terminating process %d", 
 				data->pid);
 
-			if (options->remote_executor && !bail_out) {
-				remote_kill (options->remote_executor, 
+			if (data->agent) {
+				remote_agent_kill (data->remote_executor,
+						   data->pid, SIGTERM);
+			} else if (data->remote_executor && !bail_out) {
+				remote_kill (data->remote_executor, 
 					     data->pid, SIGTERM);
 			}
 
-			if(!options->remote_executor) {
+			if(!data->remote_executor) {
 				kill_step(data->pid, SIGTERM);
 			}
 
@@ -699,38 +1247,56 @@ LOCAL void communicate(int stdout_fd, int stderr_fd, exec_data* data) {
 
 			stream_data_append(&data->failure_info,
 					   FAILURE_INFO_TIMEOUT);
-
-			terminated = 1;
-			reset_timer();
-			set_timer(data->hard_timeout);
-		} else if (timer_value && !killed) {
+		} else if (expired == DEADLINE_HARD) {
 			/* try to kill */
 			LOG_MSG(LOG_DEBUG, "Timeout, killing process %d", 
 				data->pid);
 
-			if (options->remote_executor && !bail_out) {
-				remote_kill (options->remote_executor, 
+			if (data->agent) {
+				remote_agent_kill (data->remote_executor,
+						   data->pid, SIGKILL);
+			} else if (data->remote_executor && !bail_out) {
+				remote_kill (data->remote_executor, 
 					     data->pid, SIGKILL);
 			}
 
-			kill_step(data->pid, SIGKILL);
+			if (data->cgroup)
+				cgroup_kill(data->cgroup);
+			/* pid of agent step is not a local process */
+			if (!data->agent)
+				kill_step(data->pid, SIGKILL);
 
 			data->signaled = SIGKILL;
-
-			killed = 1;
 		}
 	}
 
+	/* read what was left in the pipes when the process terminated */
+	if (data->redirect_output == REDIRECT_OUTPUT) {
+		read_and_append(stdout_fd, &data->stdout_data, "stdout",
+				data->pid);
+		read_and_append(stderr_fd, &data->stderr_data, "stderr",
+				data->pid);
+	}
+	stream_data_end_spill(&data->stdout_data);
+	stream_data_end_spill(&data->stderr_data);
+
 	/* ensure that test process' children which have not terminated by
 	   SIGTERM are terminated now. */
 	if (data->signaled && data->pgid > 0) {
 		kill_pgroup(data->pgid, SIGKILL);
 	}
+	if (data->signaled && data->cgroup) {
+		cgroup_kill(data->cgroup);
+	}
 
-	reset_timer();
+	deadline_stop(&data->deadline);
+	if (pid_fd >= 0)
+		close(pid_fd);
+	if (epoll_fd >= 0)
+		close(epoll_fd);
 
-	if (options->remote_executor && !bail_out) {
-		remote_clean(options->remote_executor, data->pid);
+	if (data->remote_executor && !data->agent && !bail_out) {
+		remote_clean(data->remote_executor, data->pid);
 	}
 	if (data->redirect_output == REDIRECT_OUTPUT) {
 		close(stdout_fd);
@@ -738,55 +1304,24 @@ LOCAL void communicate(int stdout_fd, int stderr_fd, exec_data* data) {
 	}
 }
 /* ------------------------------------------------------------------------- */
-/** Replace control characters with space 
- * @param data stream data to mangle
- */
-LOCAL void strip_ctrl_chars (stream_data* data)
-{
-	size_t clean_len = 0, tmp;
-	char *p = (char *)data->buffer, *endp;
-	
-	/* \x01-\x09\x0B\x0C\x0E-\x1F\x7F */
-	const char rej[] = {0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,
-			    0x0B,
-			    0x0C,
-			    0x0E,0x0F,0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,
-			    0x18,0x19,0x1A,0x1B,0x1C,0x1D,0x1E,0x1F, 
-			    0x7F, '\0'};
-
-	
-	do {
-		tmp = strcspn(p, rej);
-		clean_len += tmp;
-		p += tmp;
-		if (clean_len < data->length)
-			*p = ' ';
-	} while (clean_len < data->length);
-
-	/* \0 needs special handling */
-	endp = (char *)&data->buffer [data->length];
-	do {
-		p = rawmemchr(data->buffer, '\0');
-
-		if (p && p != endp)
-			*p = ' ';
-	} while (p != endp);
-	
-}
-/* ------------------------------------------------------------------------- */
-/** If the data contains non utf-8 write the data to file instead of result xml
+/** Replace control characters with space. If the data contains non utf-8
+ *  write the data to file instead of result xml
  * @param data stream data to mangle
  * @param id identifier (stdout/stderr)
  * @param pid pid of test step
  */
-LOCAL void utf8_check (stream_data* data, const char *id, pid_t pid)
+LOCAL void sanitize_stream (stream_data* data, const char *id, pid_t pid)
 {
 	char *fname = NULL;
 	FILE *ofile = NULL;
 	size_t written = 0, len;
 	
-	if (utf8_validity_check (data->buffer, options->max_utf8_bytes ?
-				 options->max_utf8_bytes : 4)) {
+	if (!data->length)
+		return;
+
+	if (sanitize_output (data->buffer, data->length, 
+			     options->max_utf8_bytes ?
+			     options->max_utf8_bytes : 4)) {
 		return;
 	}
 	len = strlen (options->output_folder) + strlen ("id") + 10 + 1 + 1;
@@ -835,6 +1370,59 @@ LOCAL void utf8_check (stream_data* data, const char *id, pid_t pid)
 	return;
 } 
 
+/* ------------------------------------------------------------------------- */
+/** Register a step as running, so that it is killed if testrunner-lite is
+ *  interrupted. Steps of parallel cases run in several threads at a time.
+ * @param data Step execution data
+ */
+LOCAL void step_started (exec_data *data)
+{
+	int i;
+
+	for (i = 0; i < MAX_PARALLEL_JOBS; i++)
+		if (__sync_bool_compare_and_swap (&running_steps[i], NULL, data))
+			return;
+	LOG_MSG(LOG_WARNING, "Too many running steps, pid %d is not "
+		"killed on interrupt", data->pid);
+}
+/* ------------------------------------------------------------------------- */
+/** Remove a step from the running steps
+ * @param data Step execution data
+ */
+LOCAL void step_finished (exec_data *data)
+{
+	int i;
+
+	for (i = 0; i < MAX_PARALLEL_JOBS; i++)
+		if (__sync_bool_compare_and_swap (&running_steps[i], data, NULL))
+			return;
+}
+/* ------------------------------------------------------------------------- */
+/** Kill all running steps. Called from signal handlers.
+ */
+LOCAL void kill_running_steps (void)
+{
+	exec_data *data;
+	int i;
+
+	for (i = 0; i < MAX_PARALLEL_JOBS; i++) {
+		data = running_steps[i];
+		if (!data)
+			continue;
+		if (data->agent) {
+			/* agents terminate their steps when stopped */
+			remote_agent_interrupt();
+		}
+		else if (data->remote_executor) {
+			remote_kill (data->remote_executor, data->pid, 
+				     SIGTERM);
+		}
+		else {
+			kill_step(data->pid, SIGKILL);
+		}
+	}
+}
+
 /* ------------------------------------------------------------------------- */
 /* ======================== FUNCTIONS ====================================== */
 /* ------------------------------------------------------------------------- */
@@ -850,36 +1438,100 @@ int execute(const char* command, exec_data* data) {
 	if (command != NULL) {
 		LOG_MSG(LOG_DEBUG, "Executing command \'%s\'", command);
 	}
+	deadline_init(&data->deadline);
+	data->remote_executor = NULL;
+	if (!data->local)
+		data->remote_executor = target_executor ? target_executor :
+			options->remote_executor;
 
 #ifdef ENABLE_LIBSSH2
-	if (options->libssh2 && options->target_address) {
-		return execute_libssh2(command, data);
+	if (options->libssh2 && options->target_address && !data->local) {
+		if (!options->remote_agent)
+			return execute_libssh2(command, data);
+		/* the agent of the session is known by the target address */
+		data->remote_executor = options->target_address;
 	}
 #endif
 
 	data->start_time = time(NULL);
-	
-	if (data->redirect_output == REDIRECT_OUTPUT) {
+	data->status_fd = -1;
+	data->pid = -1;
+	data->agent = 0;
+	if (data->disobey_chroot && !data->remote_executor)
+		LOG_MSG(LOG_DEBUG, "Disobeying chroot for command %s",
+			command);
+	data->has_usage = 0;
+	if (options->cgroup && !data->remote_executor && !data->cgroup)
+		data->cgroup = cgroup_create();
+
+	if (options->shell_worker && !data->remote_executor &&
+	    !data->parallel) {
+		if (data->redirect_output == REDIRECT_OUTPUT)
+			data->pid = shell_worker_execute(command, data, 
+							 &stdout_fd, 
+							 &stderr_fd);
+		else
+			data->pid = shell_worker_execute(command, data, 
+							 NULL, NULL);
+	}
+
+	if (options->remote_agent && data->remote_executor) {
+		if (data->redirect_output == REDIRECT_OUTPUT)
+			data->pid = remote_agent_execute(data->remote_executor,
+							 command, data,
+							 &stdout_fd,
+							 &stderr_fd);
+		else
+			data->pid = remote_agent_execute(data->remote_executor,
+							 command, data,
+							 NULL, NULL);
+		data->agent = (data->pid > 0);
+	}
+
+#ifdef ENABLE_LIBSSH2
+	if (options->libssh2 && data->remote_executor && !data->agent) {
+		data->remote_executor = NULL;
+		return execute_libssh2(command, data);
+	}
+#endif
+	if (data->pid > 0) {
+		/* step is run by shell worker or agent */
+	} else if (spawn_allowed(data)) {
+		if (data->redirect_output == REDIRECT_OUTPUT)
+			data->pid = spawn_process(&stdout_fd, &stderr_fd,
+						  command);
+		else
+			data->pid = spawn_process(NULL, NULL, command);
+	} else if (data->redirect_output == REDIRECT_OUTPUT) {
 		data->pid = fork_process_redirect(&stdout_fd, 
 		                                  &stderr_fd, 
 		                                  command, data);
 	} else {
 		data->pid = fork_process(command, data);
 	}
-	current_data = data; 
+	step_started(data);
 	
 	if (data->pid > 0) {
 		/* start communicating with test process */
 		communicate(stdout_fd, stderr_fd, data);
 	}
-	current_data = NULL;
+	step_finished(data);
+	if (data->cgroup) {
+		/* cpu.stat counts also processes that were not waited for */
+		if (!data->has_usage)
+			memset(&data->usage, 0, sizeof(data->usage));
+		if (cgroup_usage(data->cgroup, &data->usage) == 0)
+			data->has_usage = 1;
+		/* keep the cgroup only if the step left processes behind */
+		if (cgroup_populated(data->cgroup) == 0) {
+			cgroup_remove(data->cgroup);
+			free(data->cgroup);
+			data->cgroup = NULL;
+		}
+	}
 	data->end_time = time(NULL);
-	if (data->stdout_data.length) strip_ctrl_chars (&data->stdout_data);
-	if (data->stderr_data.length) strip_ctrl_chars (&data->stderr_data);
-	if (data->stdout_data.length) utf8_check (&data->stdout_data, "stdout",
-						  data->pid);
-	if (data->stderr_data.length) utf8_check (&data->stderr_data, "stderr",
-						  data->pid);
+	sanitize_stream (&data->stdout_data, "stdout", data->pid);
+	sanitize_stream (&data->stderr_data, "stderr", data->pid);
 	return 0;
 }
 #ifdef ENABLE_LIBSSH2
@@ -919,12 +1571,8 @@ LOCAL int execute_libssh2 (const char* command, exec_data* data) {
 	}
 
 	data->end_time = time(NULL);
-	if (data->stdout_data.length) strip_ctrl_chars (&data->stdout_data);
-	if (data->stderr_data.length) strip_ctrl_chars (&data->stderr_data);
-	if (data->stdout_data.length) utf8_check (&data->stdout_data, "stdout",
-						  data->pid);
-	if (data->stderr_data.length) utf8_check (&data->stderr_data, "stderr",
-						  data->pid);
+	sanitize_stream (&data->stdout_data, "stdout", data->pid);
+	sanitize_stream (&data->stderr_data, "stderr", data->pid);
 	return 0;
 }
 #endif
@@ -944,6 +1592,14 @@ void init_exec_data(exec_data* data) {
 	init_stream_data(&data->failure_info, 0);
 	data->waited = 0;
 	data->disobey_chroot = 0;
+	data->status_fd = -1;
+	data->has_usage = 0;
+	data->cgroup = NULL;
+	data->parallel = 0;
+	data->local = 0;
+	data->remote_executor = NULL;
+	data->agent = 0;
+	deadline_init(&data->deadline);
 	data->control = CONTROL_NONE;
 }
 /* ------------------------------------------------------------------------- */
@@ -954,6 +1610,11 @@ void clean_exec_data(exec_data* data) {
 	clean_stream_data(&data->stdout_data);
 	clean_stream_data(&data->stderr_data);
 	clean_stream_data(&data->failure_info);
+	if (data->cgroup) {
+		cgroup_remove(data->cgroup);
+		free(data->cgroup);
+		data->cgroup = NULL;
+	}
 }
 /* ------------------------------------------------------------------------- */
 /** Initialize stream_data structure
@@ -964,6 +1625,14 @@ void init_stream_data(stream_data* data, int allocate) {
 	data->buffer = NULL;
 	data->size = 0;
 	data->length = 0;
+	data->spill_fd = -1;
+	data->spill_file = NULL;
+	data->tail = NULL;
+	data->tail_pos = 0;
+	data->tail_length = 0;
+	data->total = 0;
+	data->spliced = 0;
+	data->spill_failed = 0;
 
 	/* try to allocate memory for stream data */
 	if (allocate && stream_data_realloc(data, allocate)) {
@@ -1030,12 +1699,28 @@ void kill_step(pid_t pid, int sig)
  */
 int executor_init(testrunner_lite_options *opts)
 {
+	int i;
+
 	LOG_MSG(LOG_INFO, "Initializing executor");
 	options = opts;
 #ifdef ENABLE_LIBSSH2
-	if (options->libssh2)
+	if (options->libssh2) {
+		/* the agent is started over the session */
+		if (options->remote_agent)
+			remote_agent_init(opts);
 		return executor_init_libssh2(opts);
+	}
 #endif
+	if (options->shell_worker)
+		shell_worker_init(opts);
+	if (options->remote_agent)
+		remote_agent_init(opts);
+	if (options->cgroup && cgroup_init(opts) < 0)
+		LOG_MSG(LOG_ERR, "Steps are not run in cgroups");
+	for (i = 1; i < options->target_count; i++)
+		if (remote_executor_init (options->targets[i].remote_executor))
+			LOG_MSG(LOG_ERR, "Failed to initialize target %s",
+				options->targets[i].address);
 	if (options->remote_executor)
 		return remote_executor_init (options->remote_executor);
 	return 0;
@@ -1063,17 +1748,67 @@ LOCAL int executor_init_libssh2(testrunner_lite_options *opts)
 }
 #endif
 /* ------------------------------------------------------------------------- */
+/** Set the remote executor used for steps executed by the calling thread.
+ *  Used when cases are sharded to several targets.
+ * @param remote_executor executor of the target, NULL for the default
+ */
+void executor_set_target (const char *remote_executor)
+{
+	target_executor = remote_executor;
+}
+#ifdef ENABLE_LIBSSH2
+/* ------------------------------------------------------------------------- */
+/** Copy files from target over the session of the libssh2 executor
+ * @param pattern path of the files on target, may contain wildcards
+ * @param folder destination folder
+ * @return 0 on success, errno on error, -1 if the session can not be used
+ */
+int executor_libssh2_get (const char *pattern, const char *folder)
+{
+	if (!options || !options->libssh2 || !lssh2_conn)
+		return -1;
+
+	return lssh2_get (lssh2_conn, pattern, folder);
+}
+/* ------------------------------------------------------------------------- */
+/** Start a command on target over the session of the libssh2 executor,
+ *  with its stdin and stdout connected to pipes
+ * @param command command to start
+ * @param to_fd set to the fd to write the stdin of the command
+ * @param from_fd set to the fd to read the stdout of the command
+ * @return pipe to close with lssh2_pipe_close(), NULL on error
+ */
+lssh2_pipe *executor_libssh2_pipe (const char *command, int *to_fd, 
+				   int *from_fd)
+{
+	if (!options || !options->libssh2 || !lssh2_conn)
+		return NULL;
+
+	return lssh2_pipe_open (lssh2_conn, command, to_fd, from_fd);
+}
+#endif
+/* ------------------------------------------------------------------------- */
 /** Clean up for executor
  */
 void executor_close()
 {
+	if (options->cgroup)
+		cgroup_close();
+	if (options->shell_worker)
+		shell_worker_close();
 #ifdef ENABLE_LIBSSH2
 	if (options->libssh2) {
+		/* the agent channel is closed before the session */
+		if (options->remote_agent)
+			remote_agent_close();
 		lssh2_executor_close(lssh2_conn);
 		return;
 	}
 #endif
-	if ((options->remote_executor || options->hwinfo_target) && !bail_out) {
+	if (options->remote_agent)
+		remote_agent_close();
+	/* also after bail out, to stop ssh master connections */
+	if (options->remote_executor || options->hwinfo_target) {
 		remote_executor_close();
 	}
 }
@@ -1223,18 +1958,13 @@ void handle_sigint (int signum)
 #ifdef ENABLE_LIBSSH2
 	if (options->libssh2) {
 		lssh2_signal(signum);
-		return;
+		/* steps of the agent are not run by the session */
+		if (!options->remote_agent)
+			return;
 	}
 #endif
 
-	if (current_data) {
-		if (options->remote_executor) {
-			remote_kill (options->remote_executor, current_data->pid, SIGTERM);
-		}
-		else {
-			kill_step(current_data->pid, SIGKILL);
-		}
-	}
+	kill_running_steps();
 
 }
 /* ------------------------------------------------------------------------- */
@@ -1251,19 +1981,13 @@ void handle_sigterm (int signum)
 #ifdef ENABLE_LIBSSH2
 	if (options->libssh2) {
 		lssh2_signal(signum);
-		return;
+		/* steps of the agent are not run by the session */
+		if (!options->remote_agent)
+			return;
 	}
 #endif
 
-	if (current_data) {
-		if (options->remote_executor) {
-			remote_kill (options->remote_executor, 
-				     current_data->pid, SIGTERM);
-		}
-		else {
-			kill_step(current_data->pid, SIGKILL);
-		}
-	}
+	kill_running_steps();
 }
 /* ------------------------------------------------------------------------- */
 /** handler for SIGUSR1
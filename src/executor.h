@@ -26,10 +26,11 @@
 
 #include <time.h>
 #include <unistd.h>
+#include <sys/resource.h>
 
 /* ------------------------------------------------------------------------- */
 /* INCLUDES */
-/* None */
+#include "deadline.h"
 
 /* ------------------------------------------------------------------------- */
 /* CONSTANTS */
@@ -58,6 +59,15 @@ struct _stream_data {
 	unsigned char* buffer;
 	int size;
 	int length;
+	int spill_fd;      /* file receiving output beyond memory limit */
+	char *spill_file;  /* name of that file in output folder */
+	unsigned char *tail; /* ring buffer with the end of spilled output */
+	int tail_pos;      /* next write position in tail */
+	int tail_length;   /* bytes in tail */
+	unsigned long long total; /* bytes read from the stream */
+	int spliced;       /* output was moved to spill file by splice */
+	int spill_failed;  /* spill file could not be opened, output beyond
+			      memory limit is dropped */
 };
 
 typedef struct _stream_data stream_data;
@@ -85,6 +95,19 @@ struct _exec_data {
 	int signaled; /* In case step is terminated by signal */
 	int waited;   /* flag for that pid has been returned by waitpid */
 	int disobey_chroot; /* never execute command in chroot */
+	step_deadline deadline; /* soft and hard timeout of the step */
+	int status_fd; /* shell worker reports step status here, -1 if the
+			  step is a child of testrunner-lite */
+	struct rusage usage; /* resources used by the step process tree */
+	int has_usage;       /* usage is valid */
+	char *cgroup;        /* cgroup containing the step processes, NULL if
+				steps are not run in cgroups */
+	int parallel;        /* step is run concurrently with other steps */
+	int local;           /* execute on host even with remote executor */
+	const char *remote_executor; /* executor prefix of the step, NULL if
+					the step is executed locally */
+	int agent;           /* step is run by agent on target, pid is the
+				id of the step in the agent */
 };
 
 typedef struct _exec_data exec_data;
@@ -116,6 +139,15 @@ int kill_pgroup(pid_t pgroup, int sig);
 /* ------------------------------------------------------------------------- */
 void kill_step(pid_t pid, int sig);
 /* ------------------------------------------------------------------------- */
+void executor_set_target (const char *remote_executor);
+/* ------------------------------------------------------------------------- */
+#ifdef ENABLE_LIBSSH2
+int executor_libssh2_get (const char *pattern, const char *folder);
+/* ------------------------------------------------------------------------- */
+struct lssh2_pipe *executor_libssh2_pipe (const char *command, int *to_fd,
+					  int *from_fd);
+/* ------------------------------------------------------------------------- */
+#endif
 void executor_close ();
 /* ------------------------------------------------------------------------- */
 void restore_bail_out_after_resume_execution();
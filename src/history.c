@@ -0,0 +1,488 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <libxml/hash.h>
+
+#include "testrunnerlite.h"
+#include "testdefinitiondatatypes.h"
+#include "executor.h"
+#include "history.h"
+#include "log.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+#define HISTORY_HEADER "# testrunner-lite history 1\n"
+/* start, plan, hwid, set, case, result, duration, timeouts, cpu_user,
+   cpu_system, max_rss, io_read, io_write */
+#define HISTORY_FIELDS 13
+#define NO_VALUE       "-"
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/** History of a case on a hardware */
+typedef struct {
+	history_stats stats;     /**< statistics returned to callers */
+	double total_duration;   /**< sum of the durations */
+	double total_cpu;        /**< sum of the cpu times */
+} history_entry;
+
+/** One recorded run of a case */
+typedef struct {
+	time_t start;
+	const char *set;
+	const char *name;
+	const char *hwid;
+	case_result_t result;
+	double duration;
+	int timeouts;            /**< steps which timed out */
+	double cpu_user;
+	double cpu_system;
+	long max_rss;
+	unsigned long long io_read;
+	unsigned long long io_write;
+} history_run;
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+LOCAL int history_fd = -1;             /* history file opened for append */
+LOCAL char *plan = NULL;               /* test plan the history is read for */
+LOCAL char *default_hwid = NULL;       /* hwid if case has none */
+LOCAL xmlHashTablePtr entries = NULL;  /* history_entry by case, set, hwid */
+LOCAL pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL const char *field_value (const char *);
+/* ------------------------------------------------------------------------- */
+LOCAL char *field_escape (const char *);
+/* ------------------------------------------------------------------------- */
+LOCAL void history_add (const history_run *);
+/* ------------------------------------------------------------------------- */
+LOCAL int history_parse_line (char *, history_run *);
+/* ------------------------------------------------------------------------- */
+LOCAL int history_load (const char *);
+/* ------------------------------------------------------------------------- */
+LOCAL double tv_seconds (const struct timeval *);
+/* ------------------------------------------------------------------------- */
+LOCAL int step_usage (const void *, const void *);
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Map empty or missing string to the no value marker
+ *  @param s string or NULL
+ *  @return s or NO_VALUE
+ */
+LOCAL const char *field_value (const char *s)
+{
+	return s && *s ? s : NO_VALUE;
+}
+/* ------------------------------------------------------------------------- */
+/** Copy a string for a history field, replacing field and record
+ *  separators with spaces
+ *  @param s string or NULL
+ *  @return allocated copy, NULL on OOM
+ */
+LOCAL char *field_escape (const char *s)
+{
+	char *copy, *p;
+
+	copy = strdup (field_value (s));
+	for (p = copy; p && *p; p++)
+		if (*p == '\t' || *p == '\n' || *p == '\r')
+			*p = ' ';
+	return copy;
+}
+/* ------------------------------------------------------------------------- */
+/** Update statistics with a run. Caller holds history_mutex.
+ *  @param run recorded run
+ */
+LOCAL void history_add (const history_run *run)
+{
+	history_entry *e;
+	history_stats *st;
+
+	e = xmlHashLookup3 (entries, BAD_CAST run->name, BAD_CAST run->set,
+			    BAD_CAST run->hwid);
+	if (!e) {
+		e = calloc (1, sizeof (history_entry));
+		if (!e)
+			return;
+		if (xmlHashAddEntry3 (entries, BAD_CAST run->name,
+				      BAD_CAST run->set, BAD_CAST run->hwid,
+				      e)) {
+			free (e);
+			return;
+		}
+	}
+
+	st = &e->stats;
+	if (st->runs > 0 && run->result != CASE_NA &&
+	    st->last_result != CASE_NA && run->result != st->last_result)
+		st->flips++;
+	st->runs++;
+	if (run->result == CASE_PASS)
+		st->passed++;
+	if (run->result == CASE_FAIL)
+		st->failed++;
+	if (run->timeouts)
+		st->timeouts++;
+	if (run->result != CASE_NA)
+		st->last_result = run->result;
+	else if (st->runs == 1)
+		st->last_result = CASE_NA;
+
+	e->total_duration += run->duration;
+	st->mean_duration = e->total_duration / st->runs;
+	if (run->duration > st->max_duration)
+		st->max_duration = run->duration;
+	st->last_duration = run->duration;
+	st->last_run = run->start;
+
+	e->total_cpu += run->cpu_user + run->cpu_system;
+	st->mean_cpu = e->total_cpu / st->runs;
+	if (run->max_rss > st->max_rss)
+		st->max_rss = run->max_rss;
+}
+/* ------------------------------------------------------------------------- */
+/** Split a line of history file to a run
+ *  @param line line without the newline, modified
+ *  @param run filled with the fields, strings point to line
+ *  @return 0 on success, 1 if the line is not a valid record
+ */
+LOCAL int history_parse_line (char *line, history_run *run)
+{
+	char *field[HISTORY_FIELDS];
+	char *p = line;
+	int i;
+
+	for (i = 0; i < HISTORY_FIELDS && p; i++)
+		field[i] = strsep (&p, "\t");
+	if (i < HISTORY_FIELDS)
+		return 1;
+
+	run->start = (time_t)strtoll (field[0], NULL, 10);
+	if (strcmp (field[1], plan))
+		return 1;
+	run->hwid = field[2];
+	run->set = field[3];
+	run->name = field[4];
+	for (i = CASE_FAIL; i <= CASE_NA; i++)
+		if (!strcmp (field[5], case_result_str (i)))
+			break;
+	if (i > CASE_NA)
+		return 1;
+	run->result = i;
+	run->duration = strtod (field[6], NULL);
+	run->timeouts = atoi (field[7]);
+	run->cpu_user = strtod (field[8], NULL);
+	run->cpu_system = strtod (field[9], NULL);
+	run->max_rss = strtol (field[10], NULL, 10);
+	run->io_read = strtoull (field[11], NULL, 10);
+	run->io_write = strtoull (field[12], NULL, 10);
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Read the runs of current plan from history file
+ *  @param filename history file
+ *  @return number of runs read
+ */
+LOCAL int history_load (const char *filename)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	history_run run;
+	int count = 0;
+
+	f = fopen (filename, "r");
+	if (!f)
+		return 0;
+
+	while ((len = getline (&line, &size, f)) > 0) {
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		if (line[0] == '#')
+			continue;
+		if (history_parse_line (line, &run))
+			continue;
+		history_add (&run);
+		count++;
+	}
+
+	free (line);
+	fclose (f);
+	return count;
+}
+/* ------------------------------------------------------------------------- */
+/** Convert timeval to seconds
+ *  @param tv time value
+ *  @return seconds
+ */
+LOCAL double tv_seconds (const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+/* ------------------------------------------------------------------------- */
+/** Add timeouts and resource usage of a step to a run
+ *  @param data step data
+ *  @param user history_run
+ *  @return 1 always
+ */
+LOCAL int step_usage (const void *data, const void *user)
+{
+	const td_step *step = (const td_step *)data;
+	history_run *run = (history_run *)user;
+
+	if (step->failure_info &&
+	    !xmlStrncmp (step->failure_info, BAD_CAST FAILURE_INFO_TIMEOUT,
+			 strlen (FAILURE_INFO_TIMEOUT)))
+		run->timeouts++;
+	if (!step->has_usage)
+		return 1;
+	run->cpu_user += tv_seconds (&step->usage.ru_utime);
+	run->cpu_system += tv_seconds (&step->usage.ru_stime);
+	if (step->usage.ru_maxrss > run->max_rss)
+		run->max_rss = step->usage.ru_maxrss;
+	/* block counts are in 512 byte units */
+	run->io_read += (unsigned long long)step->usage.ru_inblock * 512;
+	run->io_write += (unsigned long long)step->usage.ru_oublock * 512;
+
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Open the run history file given with --history and read the earlier
+ *  runs of the test plan
+ *  @param opts testrunner-lite options, history_file and input_filename
+ *         are used
+ *  @param hwinfo hardware information, product is the default hwid
+ *  @return 0 on success or if history is not used, 1 on error
+ */
+int history_init (testrunner_lite_options *opts, hw_info *hwinfo)
+{
+	char *copy;
+	struct stat st;
+	int count;
+
+	if (!opts->history_file)
+		return 0;
+
+	copy = strdup (opts->input_filename ? opts->input_filename : "");
+	plan = field_escape (copy ? basename (copy) : NULL);
+	free (copy);
+	default_hwid = field_escape (hwinfo ? (char *)hwinfo->product : NULL);
+	entries = xmlHashCreate (64);
+	if (!plan || !default_hwid || !entries) {
+		LOG_MSG (LOG_ERR, "OOM");
+		goto err_out;
+	}
+
+	count = history_load (opts->history_file);
+	LOG_MSG (LOG_DEBUG, "Read %d earlier runs of %s from %s", count,
+		 plan, opts->history_file);
+
+	history_fd = open (opts->history_file,
+			   O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (history_fd < 0) {
+		LOG_MSG (LOG_ERR, "Failed to open history file %s: %s",
+			 opts->history_file, strerror (errno));
+		goto err_out;
+	}
+	if (fstat (history_fd, &st) == 0 && st.st_size == 0 &&
+	    write (history_fd, HISTORY_HEADER, strlen (HISTORY_HEADER)) < 0)
+		LOG_MSG (LOG_WARNING, "Failed to write history file: %s",
+			 strerror (errno));
+
+	return 0;
+ err_out:
+	history_close ();
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if run history is recorded
+ *  @return 1 if history is enabled, 0 if not
+ */
+int history_enabled (void)
+{
+	return history_fd >= 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Append a run of a case to the history. Safe to call from concurrent
+ *  case workers.
+ *  @param s set of the case
+ *  @param c executed case
+ *  @param hwid hardware identifier, NULL for the default one
+ *  @param start start time of the case
+ *  @param duration wall clock duration of the case in seconds
+ */
+void history_record_case (const td_set *s, const td_case *c,
+			  const char *hwid, time_t start, double duration)
+{
+	history_run run;
+	char *set, *name, *hw, *line = NULL;
+	int len;
+
+	if (history_fd < 0)
+		return;
+
+	memset (&run, 0x0, sizeof (run));
+	run.start = start;
+	run.result = c->case_res;
+	run.duration = duration;
+	xmlListWalk (c->steps, step_usage, &run);
+
+	set = field_escape ((char *)s->gen.name);
+	name = field_escape ((char *)c->gen.name);
+	hw = hwid ? field_escape (hwid) : strdup (default_hwid);
+	if (!set || !name || !hw) {
+		LOG_MSG (LOG_ERR, "OOM");
+		goto out;
+	}
+	run.set = set;
+	run.name = name;
+	run.hwid = hw;
+
+	len = asprintf (&line, "%lld\t%s\t%s\t%s\t%s\t%s\t%.3f\t%d\t%.3f\t"
+			"%.3f\t%ld\t%llu\t%llu\n", (long long)run.start,
+			plan, run.hwid, run.set, run.name,
+			case_result_str (run.result), run.duration,
+			run.timeouts, run.cpu_user, run.cpu_system,
+			run.max_rss, run.io_read, run.io_write);
+	if (len < 0) {
+		line = NULL;
+		LOG_MSG (LOG_ERR, "OOM");
+		goto out;
+	}
+
+	pthread_mutex_lock (&history_mutex);
+	/* one write per record keeps the file consistent if we die */
+	if (write (history_fd, line, len) != len)
+		LOG_MSG (LOG_WARNING, "Failed to write history file: %s",
+			 strerror (errno));
+	history_add (&run);
+	pthread_mutex_unlock (&history_mutex);
+ out:
+	free (line);
+	free (set);
+	free (name);
+	free (hw);
+}
+/* ------------------------------------------------------------------------- */
+/** Get statistics of the recorded runs of a case
+ *  @param set name of the set
+ *  @param name name of the case
+ *  @param hwid hardware identifier, NULL for the default one
+ *  @param stats filled with the statistics
+ *  @return 1 if the case has history, 0 if not
+ */
+int history_case_stats (const char *set, const char *name, const char *hwid,
+			history_stats *stats)
+{
+	history_entry *e;
+	char *s, *n, *h;
+
+	memset (stats, 0x0, sizeof (history_stats));
+	if (!entries)
+		return 0;
+
+	s = field_escape (set);
+	n = field_escape (name);
+	h = hwid ? field_escape (hwid) : strdup (default_hwid);
+	if (s && n && h) {
+		pthread_mutex_lock (&history_mutex);
+		e = xmlHashLookup3 (entries, BAD_CAST n, BAD_CAST s,
+				    BAD_CAST h);
+		if (e)
+			*stats = e->stats;
+		pthread_mutex_unlock (&history_mutex);
+	}
+	free (s);
+	free (n);
+	free (h);
+
+	return stats->runs > 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Close the history file and free the statistics
+ */
+void history_close (void)
+{
+	if (history_fd >= 0)
+		close (history_fd);
+	history_fd = -1;
+	if (entries)
+		xmlHashFree (entries, (xmlHashDeallocator) free);
+	entries = NULL;
+	free (plan);
+	plan = NULL;
+	free (default_hwid);
+	default_hwid = NULL;
+}
+/* ================= OTHER EXPORTED FUNCTIONS ============================== */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* End of file */
@@ -0,0 +1,83 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDES */
+#include <time.h>
+#include "testrunnerlite.h"
+#include "testdefinitiondatatypes.h"
+#include "hwinfo.h"
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* DATA TYPES */
+/* ------------------------------------------------------------------------- */
+/** Statistics of the recorded runs of a case */
+typedef struct {
+	int    runs;             /**< number of recorded runs */
+	int    passed;           /**< runs where the case passed */
+	int    failed;           /**< runs where the case failed */
+	int    flips;            /**< result changed from the previous run */
+	int    timeouts;         /**< runs where a step timed out */
+	double mean_duration;    /**< mean duration in seconds */
+	double max_duration;     /**< longest duration in seconds */
+	double last_duration;    /**< duration of the latest run */
+	case_result_t last_result; /**< result of the latest run */
+	time_t last_run;         /**< start time of the latest run */
+	double mean_cpu;         /**< mean user + system cpu time in seconds */
+	long   max_rss;          /**< largest maximum resident set in kB */
+} history_stats;
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+int history_init (testrunner_lite_options *opts, hw_info *hwinfo);
+/* ------------------------------------------------------------------------- */
+int history_enabled (void);
+/* ------------------------------------------------------------------------- */
+void history_record_case (const td_set *s, const td_case *c,
+			  const char *hwid, time_t start, double duration);
+/* ------------------------------------------------------------------------- */
+int history_case_stats (const char *set, const char *name, const char *hwid,
+			history_stats *stats);
+/* ------------------------------------------------------------------------- */
+void history_close (void);
+/* ------------------------------------------------------------------------- */
+#endif                          /* HISTORY_H */
+/* End of file */
@@ -0,0 +1,563 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include <libxml/hash.h>
+
+#include "testrunnerlite.h"
+#include "testdefinitiondatatypes.h"
+#include "testresultlogger.h"
+#include "journal.h"
+#include "log.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+#define JOURNAL_HEADER "# testrunner-lite journal 2"
+/* kind, suite, set, case, result, attempts, length of the record following
+   the line */
+#define JOURNAL_FIELDS 7
+#define NO_VALUE       "-"
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/** Result of a case or a set read from the journal */
+typedef struct _journal_entry {
+	case_result_t result;          /**< case result */
+	int attempts;                  /**< attempts of the case, 0 if the
+					  case has no retries */
+	xmlChar *record;               /**< result in the result file format */
+	struct _journal_entry *next;   /**< entry of the next case or set
+					  with the same names */
+} journal_entry;
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+LOCAL int journal_fd = -1;             /* journal opened for append */
+LOCAL xmlHashTablePtr cases = NULL;    /* journal_entry by case, set, suite */
+LOCAL xmlHashTablePtr sets = NULL;     /* journal_entry by set, suite */
+LOCAL pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL char *name_escape (const xmlChar *);
+/* ------------------------------------------------------------------------- */
+LOCAL void entry_delete (void *, xmlChar *);
+/* ------------------------------------------------------------------------- */
+LOCAL void entry_add (xmlHashTablePtr, const char *, const char *,
+		      const char *, journal_entry *);
+/* ------------------------------------------------------------------------- */
+LOCAL journal_entry *entry_take (xmlHashTablePtr, const xmlChar *,
+				 const xmlChar *, const xmlChar *);
+/* ------------------------------------------------------------------------- */
+LOCAL int journal_read_entry (FILE *, char **, size_t *);
+/* ------------------------------------------------------------------------- */
+LOCAL int journal_load (const char *, const char *, off_t *);
+/* ------------------------------------------------------------------------- */
+LOCAL void journal_append (const char *, const td_suite *, const td_set *,
+			   const td_case *, const xmlChar *);
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Copy a name for a journal field, replacing field and line separators
+ *  with spaces
+ *  @param name name or NULL
+ *  @return allocated copy, NULL on OOM
+ */
+LOCAL char *name_escape (const xmlChar *name)
+{
+	char *copy, *p;
+
+	copy = strdup (name && *name ? (char *)name : NO_VALUE);
+	for (p = copy; p && *p; p++)
+		if (*p == '\t' || *p == '\n' || *p == '\r')
+			*p = ' ';
+	return copy;
+}
+/* ------------------------------------------------------------------------- */
+/** Free a journal entry and the entries following it
+ *  @param payload journal entry
+ *  @param name not used
+ */
+LOCAL void entry_delete (void *payload, xmlChar *name)
+{
+	journal_entry *e = (journal_entry *)payload, *next;
+
+	while (e) {
+		next = e->next;
+		xmlFree (e->record);
+		free (e);
+		e = next;
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Add an entry after the earlier entries with the same names
+ *  @param hash cases or sets
+ *  @param name case or set name
+ *  @param name2 set or suite name
+ *  @param name3 suite name or NO_VALUE
+ *  @param e journal entry
+ */
+LOCAL void entry_add (xmlHashTablePtr hash, const char *name,
+		      const char *name2, const char *name3, journal_entry *e)
+{
+	journal_entry *last;
+
+	last = xmlHashLookup3 (hash, BAD_CAST name, BAD_CAST name2,
+			       BAD_CAST name3);
+	if (!last) {
+		if (xmlHashAddEntry3 (hash, BAD_CAST name, BAD_CAST name2,
+				      BAD_CAST name3, e))
+			entry_delete (e, NULL);
+		return;
+	}
+	while (last->next)
+		last = last->next;
+	last->next = e;
+}
+/* ------------------------------------------------------------------------- */
+/** Remove the first entry with the given names
+ *  @param hash cases or sets
+ *  @param name case or set name
+ *  @param name2 set or suite name
+ *  @param name3 suite name or NULL
+ *  @return entry, NULL if there is none
+ */
+LOCAL journal_entry *entry_take (xmlHashTablePtr hash, const xmlChar *name,
+				 const xmlChar *name2, const xmlChar *name3)
+{
+	journal_entry *e = NULL;
+	char *n, *n2, *n3;
+
+	n = name_escape (name);
+	n2 = name_escape (name2);
+	n3 = name_escape (name3);
+	if (!n || !n2 || !n3) {
+		LOG_MSG (LOG_ERR, "OOM");
+		goto out;
+	}
+
+	pthread_mutex_lock (&journal_mutex);
+	e = xmlHashLookup3 (hash, BAD_CAST n, BAD_CAST n2, BAD_CAST n3);
+	if (e && e->next)
+		xmlHashUpdateEntry3 (hash, BAD_CAST n, BAD_CAST n2,
+				     BAD_CAST n3, e->next, NULL);
+	else if (e)
+		xmlHashRemoveEntry3 (hash, BAD_CAST n, BAD_CAST n2,
+				     BAD_CAST n3, NULL);
+	pthread_mutex_unlock (&journal_mutex);
+ out:
+	free (n);
+	free (n2);
+	free (n3);
+	return e;
+}
+/* ------------------------------------------------------------------------- */
+/** Read an entry from the journal and add it to cases or sets
+ *  @param f journal
+ *  @param line buffer for the entry line, reallocated as needed
+ *  @param size size of line
+ *  @return 0 on success, 1 at the end of the journal or at an entry which
+ *          was not completely written
+ */
+LOCAL int journal_read_entry (FILE *f, char **line, size_t *size)
+{
+	char *field[JOURNAL_FIELDS];
+	char *p, *end;
+	ssize_t len;
+	size_t length;
+	journal_entry *e;
+	int i, attempts;
+
+	len = getline (line, size, f);
+	if (len <= 0 || (*line)[len - 1] != '\n')
+		return 1;
+	(*line)[len - 1] = '\0';
+
+	p = *line;
+	for (i = 0; i < JOURNAL_FIELDS && p; i++)
+		field[i] = strsep (&p, "\t");
+	if (i < JOURNAL_FIELDS)
+		return 1;
+	attempts = strtol (field[5], &end, 10);
+	if (*end != '\0')
+		return 1;
+	length = strtoul (field[6], &end, 10);
+	if (*end != '\0')
+		return 1;
+
+	e = (journal_entry *)calloc (1, sizeof (journal_entry));
+	if (!e)
+		return 1;
+	e->record = (xmlChar *)xmlMalloc (length + 1);
+	if (!e->record ||
+	    fread (e->record, 1, length + 1, f) != length + 1 ||
+	    e->record[length] != '\n') {
+		entry_delete (e, NULL);
+		return 1;
+	}
+	e->record[length] = '\0';
+
+	if (!strcmp (field[0], "set")) {
+		entry_add (sets, field[2], field[1], NO_VALUE, e);
+		return 0;
+	}
+	for (i = CASE_FAIL; i <= CASE_NA; i++)
+		if (!strcmp (field[4], case_result_str (i)))
+			break;
+	if (strcmp (field[0], "case") || i > CASE_NA) {
+		entry_delete (e, NULL);
+		return 1;
+	}
+	e->result = i;
+	e->attempts = attempts;
+	entry_add (cases, field[3], field[2], field[1], e);
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Read the entries of the journal of an interrupted run
+ *  @param filename journal
+ *  @param header expected first line of the journal
+ *  @param valid set to the size of the complete entries in the journal,
+ *         0 if the journal is empty or does not exist
+ *  @return number of entries read, -1 if the journal is not for the
+ *          current test plan and result format
+ */
+LOCAL int journal_load (const char *filename, const char *header,
+			off_t *valid)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int count = 0;
+
+	*valid = 0;
+	f = fopen (filename, "r");
+	if (!f)
+		return 0;
+
+	len = getline (&line, &size, f);
+	if (len <= 0 || line[len - 1] != '\n')
+		goto out;
+	if (strcmp (line, header)) {
+		count = -1;
+		goto out;
+	}
+	*valid = ftello (f);
+
+	/* entries are complete up to the last one written before the
+	   run was interrupted */
+	while (!journal_read_entry (f, &line, &size)) {
+		*valid = ftello (f);
+		count++;
+	}
+ out:
+	free (line);
+	fclose (f);
+	return count;
+}
+/* ------------------------------------------------------------------------- */
+/** Append an entry to the journal and wait until it is on disk. Safe to
+ *  call from concurrent case workers.
+ *  @param kind "case" or "set"
+ *  @param suite suite of the set
+ *  @param s set data
+ *  @param c case data, NULL for a set entry
+ *  @param record result record of the case or the set
+ */
+LOCAL void journal_append (const char *kind, const td_suite *suite,
+			   const td_set *s, const td_case *c,
+			   const xmlChar *record)
+{
+	char *su, *se, *ca, *line = NULL;
+	struct iovec iov[3];
+	int len, attempts = 0;
+
+	su = name_escape (suite ? suite->gen.name : NULL);
+	se = name_escape (s->gen.name);
+	ca = name_escape (c ? c->gen.name : NULL);
+	if (!su || !se || !ca) {
+		LOG_MSG (LOG_ERR, "OOM");
+		goto out;
+	}
+
+	if (c && xmlListSize (c->attempts) > 0)
+		attempts = xmlListSize (c->attempts);
+	len = asprintf (&line, "%s\t%s\t%s\t%s\t%s\t%d\t%d\n", kind, su, se,
+			ca, c ? case_result_str (c->case_res) : NO_VALUE,
+			attempts, xmlStrlen (record));
+	if (len < 0) {
+		line = NULL;
+		LOG_MSG (LOG_ERR, "OOM");
+		goto out;
+	}
+	iov[0].iov_base = line;
+	iov[0].iov_len = len;
+	iov[1].iov_base = (void *)record;
+	iov[1].iov_len = xmlStrlen (record);
+	iov[2].iov_base = "\n";
+	iov[2].iov_len = 1;
+
+	pthread_mutex_lock (&journal_mutex);
+	/* one write per entry, and the entry is on disk before the
+	   next one is started */
+	if (writev (journal_fd, iov, 3) !=
+	    (ssize_t)(iov[0].iov_len + iov[1].iov_len + 1) ||
+	    fdatasync (journal_fd))
+		LOG_MSG (LOG_WARNING, "Failed to write journal: %s",
+			 strerror (errno));
+	pthread_mutex_unlock (&journal_mutex);
+ out:
+	free (line);
+	free (su);
+	free (se);
+	free (ca);
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Open the run journal next to the result file. When resuming, the
+ *  results of the interrupted run are read from the journal, otherwise
+ *  the journal is started empty.
+ *  @param opts testrunner-lite options, journal, resume_journal,
+ *         input_filename, output_filename and output_type are used
+ *  @return 0 on success or if journal is not used, 1 on error
+ */
+int journal_init (testrunner_lite_options *opts)
+{
+	char *filename = NULL, *header = NULL, *copy;
+	off_t valid = 0;
+	int count, flags = O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC;
+
+	if (!opts->journal && !opts->resume_journal)
+		return 0;
+
+	copy = strdup (opts->input_filename ? opts->input_filename : "");
+	if (asprintf (&filename, "%s" JOURNAL_SUFFIX,
+		      opts->output_filename) < 0)
+		filename = NULL;
+	if (asprintf (&header, JOURNAL_HEADER "\t%s\t%s\n",
+		      copy ? basename (copy) : "",
+		      opts->output_type == OUTPUT_TYPE_TXT ? "text" : "xml")
+	    < 0)
+		header = NULL;
+	free (copy);
+	cases = xmlHashCreate (64);
+	sets = xmlHashCreate (16);
+	if (!filename || !header || !cases || !sets) {
+		LOG_MSG (LOG_ERR, "OOM");
+		goto err_out;
+	}
+
+	if (opts->resume_journal) {
+		count = journal_load (filename, header, &valid);
+		if (count < 0) {
+			LOG_MSG (LOG_ERR, "Journal %s is not for this test "
+				 "plan and result format", filename);
+			goto err_out;
+		}
+		LOG_MSG (LOG_INFO, "Resuming test run with %d results "
+			 "from journal %s", count, filename);
+	} else
+		flags |= O_TRUNC;
+
+	journal_fd = open (filename, flags, 0644);
+	if (journal_fd < 0) {
+		LOG_MSG (LOG_ERR, "Failed to open journal %s: %s",
+			 filename, strerror (errno));
+		goto err_out;
+	}
+	/* drop an entry the interrupted run did not complete */
+	if (ftruncate (journal_fd, valid) ||
+	    (valid == 0 && write (journal_fd, header, strlen (header)) < 0)) {
+		LOG_MSG (LOG_ERR, "Failed to write journal %s: %s",
+			 filename, strerror (errno));
+		goto err_out;
+	}
+
+	free (filename);
+	free (header);
+	return 0;
+ err_out:
+	free (filename);
+	free (header);
+	journal_close ();
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if the run journal is written
+ *  @return 1 if journal is enabled, 0 if not
+ */
+int journal_enabled (void)
+{
+	return journal_fd >= 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Write the result of a completed case to the journal. Safe to call from
+ *  concurrent case workers.
+ *  @param suite suite of the set
+ *  @param s set of the case
+ *  @param c completed case
+ */
+void journal_record_case (const td_suite *suite, const td_set *s,
+			  td_case *c)
+{
+	xmlChar *record;
+
+	if (journal_fd < 0)
+		return;
+
+	record = case_result_record (c);
+	if (record)
+		journal_append ("case", suite, s, c, record);
+	xmlFree (record);
+}
+/* ------------------------------------------------------------------------- */
+/** Write the results of a completed set to the journal
+ *  @param suite suite of the set
+ *  @param s completed set
+ */
+void journal_record_set (const td_suite *suite, td_set *s)
+{
+	xmlChar *record;
+
+	if (journal_fd < 0)
+		return;
+
+	record = set_result_record (s);
+	if (record)
+		journal_append ("set", suite, s, NULL, record);
+	xmlFree (record);
+}
+/* ------------------------------------------------------------------------- */
+/** Take the result of a case from the journal of the interrupted run.
+ *  Safe to call from concurrent case workers.
+ *  @param suite suite of the set
+ *  @param s set of the case
+ *  @param c case data, result and result_record are set
+ *  @param attempts set to the number of attempts of the case, 0 if the
+ *         case had no retries
+ *  @return 1 if the case was completed in the interrupted run, 0 if not
+ */
+int journal_replay_case (const td_suite *suite, const td_set *s,
+			 td_case *c, int *attempts)
+{
+	journal_entry *e;
+
+	if (!cases)
+		return 0;
+
+	e = entry_take (cases, c->gen.name, s->gen.name,
+			suite ? suite->gen.name : NULL);
+	if (!e)
+		return 0;
+
+	c->case_res = e->result;
+	c->result_record = e->record;
+	*attempts = e->attempts;
+	free (e);
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Take the results of a set from the journal of the interrupted run
+ *  @param suite suite of the set
+ *  @param s set data, result_record is set
+ *  @return 1 if the set was completed in the interrupted run, 0 if not
+ */
+int journal_replay_set (const td_suite *suite, td_set *s)
+{
+	journal_entry *e;
+
+	if (!sets)
+		return 0;
+
+	e = entry_take (sets, s->gen.name, suite ? suite->gen.name : NULL,
+			NULL);
+	if (!e)
+		return 0;
+
+	s->result_record = e->record;
+	free (e);
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Close the journal and free the results which were not replayed
+ */
+void journal_close (void)
+{
+	if (journal_fd >= 0)
+		close (journal_fd);
+	journal_fd = -1;
+	if (cases)
+		xmlHashFree (cases, (xmlHashDeallocator) entry_delete);
+	cases = NULL;
+	if (sets)
+		xmlHashFree (sets, (xmlHashDeallocator) entry_delete);
+	sets = NULL;
+}
+/* ================= OTHER EXPORTED FUNCTIONS ============================== */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* End of file */
@@ -0,0 +1,71 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDES */
+#include "testrunnerlite.h"
+#include "testdefinitiondatatypes.h"
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+#define JOURNAL_SUFFIX ".journal"
+
+/* ------------------------------------------------------------------------- */
+/* DATA TYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+int journal_init (testrunner_lite_options *opts);
+/* ------------------------------------------------------------------------- */
+int journal_enabled (void);
+/* ------------------------------------------------------------------------- */
+void journal_record_case (const td_suite *suite, const td_set *s,
+			  td_case *c);
+/* ------------------------------------------------------------------------- */
+void journal_record_set (const td_suite *suite, td_set *s);
+/* ------------------------------------------------------------------------- */
+int journal_replay_case (const td_suite *suite, const td_set *s,
+			 td_case *c, int *attempts);
+/* ------------------------------------------------------------------------- */
+int journal_replay_set (const td_suite *suite, td_set *s);
+/* ------------------------------------------------------------------------- */
+void journal_close (void);
+/* ------------------------------------------------------------------------- */
+#endif                          /* JOURNAL_H */
+/* End of file */
@@ -31,6 +31,7 @@
 #include <sys/time.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <curl/curl.h>
 #include "testrunnerlite.h"
 #include "log.h"
@@ -65,6 +66,8 @@ extern testrunner_lite_options opts;
 /* LOCAL GLOBAL VARIABLES */
 LOCAL CURL *curl;
 LOCAL int  do_syslog = 0;
+/* serializes output and http logging of cases run in parallel */
+LOCAL pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* ------------------------------------------------------------------------- */
 /* LOCAL CONSTANTS AND MACROS */
@@ -153,7 +156,7 @@ void log_msg(int type, const char *file, const char *function,
 	char timestamp[10];
 	char *msg, *post_msg, *url_enc_msg,*module, *p, *new_buff;
 	CURLcode res;
-	struct tm *tm;
+	struct tm tm;
 	time_t current_time;
 	struct timeval now, diff;
 	va_list args;
@@ -198,13 +201,9 @@ void log_msg(int type, const char *file, const char *function,
 
 	/* Current timestamp */	
 	time (&current_time);
-	tm = localtime (&current_time);
-	strftime (timestamp, sizeof (timestamp), "%H:%M:%S", tm);
+	localtime_r (&current_time, &tm);
+	strftime (timestamp, sizeof (timestamp), "%H:%M:%S", &tm);
 	
-	fprintf (stdout, "[%s] %s ", stream_name, timestamp);
-	if (type == LOG_DEBUG)
-		fprintf (stdout, "%s %s() %d ", file, function, lineno);
-
 	/* Print given arguments */
 	if ((msg = malloc(size)) == NULL) {
 		fprintf (stderr, "%s: %s: malloc() failed can not log %s\n",
@@ -245,10 +244,15 @@ void log_msg(int type, const char *file, const char *function,
 	if (do_syslog)
 		syslog (type, "%s", msg);
 	
+	pthread_mutex_lock (&log_mutex);
+	fprintf (stdout, "[%s] %s ", stream_name, timestamp);
+	if (type == LOG_DEBUG)
+		fprintf (stdout, "%s %s() %d ", file, function, lineno);
 	fprintf (stdout, "%s\n", msg);
 	fflush (stdout);
 	
 	if (!curl) {
+		pthread_mutex_unlock (&log_mutex);
 		free (msg);
 		return;
 	}
@@ -303,6 +307,7 @@ void log_msg(int type, const char *file, const char *function,
 			       diff.tv_usec ? diff.tv_usec/1000 : 0,
 			       diff.tv_usec % 1000);
 	if (!post_msg) {
+		pthread_mutex_unlock (&log_mutex);
 		curl_free (url_enc_msg);
 		free (msg);
 		return;
@@ -317,6 +322,7 @@ void log_msg(int type, const char *file, const char *function,
 
 		log_close();
 	}
+	pthread_mutex_unlock (&log_mutex);
 	curl_free (url_enc_msg);
 	free (msg);
 	free (post_msg);
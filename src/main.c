@@ -47,9 +47,13 @@
 #include "testfilters.h"
 #include "executor.h"
 #include "remote_executor.h"
+#include "remote_agent.h"
 #include "manual_executor.h"
 #include "utils.h"
 #include "hwinfo.h"
+#include "history.h"
+#include "journal.h"
+#include "resultcache.h"
 #include "log.h"
 #ifdef ENABLE_EVENTS
 #include "event.h"
@@ -86,8 +90,12 @@ LOCAL hw_info hwinfo;
 /* LOCAL CONSTANTS AND MACROS */
 #define SSH_REMOTE_EXECUTOR "/usr/bin/ssh -o StrictHostKeyChecking=no " \
 		"-o PasswordAuthentication=no -o ServerAliveInterval=5 " \
-		"-o ServerAliveCountMax=1 -o ConnectTimeout=7 %s %s %s"
-#define SCP_REMOTE_GETTER "/usr/bin/scp %s %s %s:'<FILE>' '<DEST>'"
+		"-o ServerAliveCountMax=1 -o ConnectTimeout=7 %s %s %s %s"
+#define SCP_REMOTE_GETTER "/usr/bin/scp %s %s %s %s:'<FILE>' '<DEST>'"
+/* connections use the master started by remote executor, if any */
+#define SSH_CONTROL_ARGS "-o ControlMaster=no -o ControlPath=%s"
+#define SSH_CONTROL_PATH "/tmp/testrunner-lite-ssh.%d.%s.%u"
+#define SSH_CONTROL_PATH_MAX 104 /* sun_path of unix socket */
 /* ------------------------------------------------------------------------- */
 /* MODULE DATA STRUCTURES */
 /* None */
@@ -105,8 +113,15 @@ LOCAL int parse_remote_logger(char *url, testrunner_lite_options *opts);
 /* ------------------------------------------------------------------------- */
 LOCAL int parse_target_address(char *address, testrunner_lite_options *opts);
 /* ------------------------------------------------------------------------- */
+LOCAL int parse_target_list(char *list, testrunner_lite_options *opts);
+/* ------------------------------------------------------------------------- */
+LOCAL int parse_shard_targets(testrunner_lite_options *opts);
+/* ------------------------------------------------------------------------- */
 LOCAL int parse_remote_getter(char *getter, testrunner_lite_options *opts);
 /* ------------------------------------------------------------------------- */
+LOCAL void ssh_control_args(testrunner_lite_options *opts, char *buf,
+			     size_t size);
+/* ------------------------------------------------------------------------- */
 LOCAL int parse_default_ssh_executor(testrunner_lite_options *opts);
 /* ------------------------------------------------------------------------- */
 LOCAL int parse_default_scp_getter(testrunner_lite_options *opts);
@@ -117,6 +132,10 @@ LOCAL int test_chroot(char * folder);
 /* ------------------------------------------------------------------------- */
 LOCAL int set_rich_core_dumps(char *folder, testrunner_lite_options *opts);
 /* ------------------------------------------------------------------------- */
+LOCAL int parse_jobs(char *jobs, testrunner_lite_options *opts);
+/* ------------------------------------------------------------------------- */
+LOCAL int parse_count(char *count, const char *name, int max, int *result);
+/* ------------------------------------------------------------------------- */
 LOCAL int parse_logid(char *logid, testrunner_lite_options *opts);
 /* ------------------------------------------------------------------------- */
 LOCAL int parse_target_address_hwinfo(char* address, 
@@ -209,6 +228,73 @@ LOCAL void usage()
 	        "Maximum allowed length of a UTF-8 byte sequence in output of a test step.\n\t\t"
 		"If the limit is exceeded, the whole output will be written into a separate\n\t\t"
 		"file as in case of any invalid UTF-8 output. Default value is 4.\n");
+	printf ("  --output-limit=BYTES[K|M]\n\t\t"
+		"Maximum amount of stdout and stderr of a test step kept in memory.\n\t\t"
+		"Output exceeding the limit is written into a file in the output\n\t\t"
+		"folder, which is referenced from the results. Default is no limit.\n");
+	printf ("  --output-tail=BYTES[K|M]\n\t\t"
+		"With --output-limit, keep also the last BYTES of stdout and stderr\n\t\t"
+		"of a test step in memory, so that results contain both the\n\t\t"
+		"beginning and the end of long output. Default is 0.\n");
+	printf ("  --shell-worker\n\t\t"
+		"Execute local test steps in a long-lived shell instead of starting\n\t\t"
+		"a new shell for each step. Each step is run in a subshell with a\n\t\t"
+		"process group of its own, so shell variables or working directory\n\t\t"
+		"do not leak between steps, but $$ is the pid of the long-lived\n\t\t"
+		"shell, and exit status above 128 is reported as termination by signal.\n");
+	printf ("  --background-get\n\t\t"
+		"Collect the files in the get element of a test case in background\n\t\t"
+		"while the next cases are executed. Measurement files are evaluated\n\t\t"
+		"when they are collected, and all results of a set are final before\n\t\t"
+		"its post steps. Later cases must not modify the collected files.\n");
+	printf ("  --batch-get\n\t\t"
+		"Collect the files in a get element with one tar stream over the\n\t\t"
+		"remote executor instead of running the getter for each file, and\n\t\t"
+		"delete them with one command. Requires tar on the target and\n\t\t"
+		"an executor passing binary output. Default with -t.\n");
+	printf ("  --cgroup=PATH\n\t\t"
+		"Run each local test step in a cgroup of its own, created under the\n\t\t"
+		"cgroup v2 directory PATH delegated to the user. On timeout and at\n\t\t"
+		"the end of the test case all processes of the step are killed,\n\t\t"
+		"also the ones which have left its process group or session.\n");
+	printf ("  -j N, --jobs=N\n\t\t"
+		"Execute up to N test cases of a set concurrently. Only automatic\n\t\t"
+		"cases marked with parallel=\"true\" (on the case or on its set)\n\t\t"
+		"are run concurrently, longest first by their mean duration in\n\t\t"
+		"--history or by their timeout. Other cases are run alone in\n\t\t"
+		"definition order. Results are written in definition order.\n\t\t"
+		"Default is 1.\n");
+	printf ("  --history=FILE\n\t\t"
+		"Append duration, result, step timeouts and resource usage of each\n\t\t"
+		"executed case to the run history FILE, which is created if it does\n\t\t"
+		"not exist. Runs are keyed by test plan file name, set, case and\n\t\t"
+		"hardware ID, and the earlier runs of the plan are read at startup.\n");
+	printf ("  --journal\n\t\t"
+		"Write the result of each completed case and set to a journal\n\t\t"
+		"next to the result file (result file name with .journal added),\n\t\t"
+		"flushed to disk before the next case is started.\n");
+	printf ("  --resume-journal\n\t\t"
+		"Continue a run interrupted by a crash of testrunner-lite or the\n\t\t"
+		"host. Results in the journal are written to the result file\n\t\t"
+		"without executing the cases again, and the run continues from\n\t\t"
+		"the first case not in the journal. Implies --journal.\n");
+	printf ("  --result-cache=DIR\n\t\t"
+		"Store the results of passed automatic cases in directory DIR,\n\t\t"
+		"and use a stored result instead of executing the case when the\n\t\t"
+		"case, its steps, the pre steps of its set, environment, hardware\n\t\t"
+		"ID and build ID have not changed. Cached results are marked\n\t\t"
+		"with cached=\"true\". Requires --build-id.\n");
+	printf ("  --build-id=ID\n\t\t"
+		"ID of the software build under test, for example the image\n\t\t"
+		"version, used in the keys of --result-cache.\n");
+	printf ("  --retries=N\n\t\t"
+		"Execute a failed automatic case again, up to N times, until it\n\t\t"
+		"passes. The retries attribute of a case or set overrides N.\n\t\t"
+		"The result of the last attempt is the result of the case, and\n\t\t"
+		"each attempt is written to the results. Default is 0.\n");
+	printf ("  --retry-delay=SECONDS\n\t\t"
+		"Wait before executing a failed case again, doubling the wait\n\t\t"
+		"for each further attempt. Default is 1.\n");
 	printf ("\nTest commands are executed locally by default.  Alternatively, one\n"
 		"of the following executors can be used:\n");
 	printf ("\nChroot Execution:\n");
@@ -223,6 +309,13 @@ LOCAL void usage()
 		"of the system under test. Behind the scenes, host-based\n\t\t"
 		"testing uses the external execution described below with SSH\n\t\t"
 		"and SCP.\n");
+	printf ("  -t ADDRESS,ADDRESS[,...], --target=ADDRESS,ADDRESS[,...]\n\t\t"
+		"Shard the test run to several identical systems under test.\n\t\t"
+		"Pre and post steps of each set are executed on every target,\n\t\t"
+		"and each target executes the next case not yet started until\n\t\t"
+		"the cases of the set are done. The target of each case is\n\t\t"
+		"written to the results. Hardware info and set level files\n\t\t"
+		"are taken from the first target.\n");
 	printf ("  -R[ACTION], --resume[=ACTION]\n\t\t"
 		"Resume testrun when ssh connection failure occurs.\n\t\t"
 		"The possible ACTIONs after resume are:\n\t\t"
@@ -237,6 +330,15 @@ LOCAL void usage()
 		"Usage is similar to -t option.\n");
 	printf ("  -k KEY, --ssh-key=KEY\n"
 	        "\t\tpath to SSH private key file\n");
+	printf ("  --no-ssh-multiplex\n\t\t"
+		"Open a new SSH connection for each command. By default the\n\t\t"
+		"commands of a target share one master connection.\n");
+	printf ("  --agent[=PATH]\n\t\t"
+		"Run the steps through an agent process started once on the\n\t\t"
+		"target instead of starting a shell for each step. PATH is the\n\t\t"
+		"agent on the target, default is %s.\n\t\t"
+		"Requires remote execution (-t, -E/-G or -n).\n",
+		DEFAULT_REMOTE_AGENT);
 
 #ifdef ENABLE_LIBSSH2
 	printf ("\nLibssh2 Execution:\n");
@@ -513,6 +615,90 @@ LOCAL int parse_target_address(char *address, testrunner_lite_options *opts)
 
 }
 
+/* ------------------------------------------------------------------------- */
+/** Parse comma separated list of target addresses. The first address is
+ *  used as target address, executors of all targets are created later by
+ *  parse_shard_targets().
+ * @param list SUT addresses separated by commas
+ * @param opts Options struct
+ * @return 0 in success, 1 on failure
+ */
+LOCAL int parse_target_list(char *list, testrunner_lite_options *opts)
+{
+	char *first;
+	int ret;
+
+	if (opts->target_list) free (opts->target_list);
+	opts->target_list = strdup (list);
+	first = strndup (list, strcspn (list, ","));
+	ret = parse_target_address (first, opts);
+	free (first);
+
+	return ret;
+}
+
+/* ------------------------------------------------------------------------- */
+/** Create remote executor and getter for each target of the target list
+ * @param opts Options struct
+ * @return 0 in success, 1 on failure
+ */
+LOCAL int parse_shard_targets(testrunner_lite_options *opts)
+{
+	testrunner_lite_options topts;
+	shard_target *t = NULL;
+	char *list, *address, *saveptr = NULL;
+	int count = 1;
+	int ret = 0;
+	char *p;
+
+	for (p = opts->target_list; *p; p++)
+		if (*p == ',')
+			count++;
+	if (count > MAX_PARALLEL_JOBS) {
+		fprintf (stderr, "Too many targets (max %d)\n",
+			 MAX_PARALLEL_JOBS);
+		return 1;
+	}
+	opts->targets = calloc (count, sizeof (shard_target));
+	list = strdup (opts->target_list);
+	if (opts->targets == NULL || list == NULL) {
+		fprintf (stderr, "Malloc failed\n");
+		free (list);
+		return 1;
+	}
+
+	for (address = strtok_r (list, ",", &saveptr); address;
+	     address = strtok_r (NULL, ",", &saveptr)) {
+		memcpy (&topts, opts, sizeof (topts));
+		topts.target_address = NULL;
+		topts.target_port = 0;
+		topts.remote_executor = NULL;
+		topts.remote_getter = NULL;
+		t = &opts->targets[opts->target_count];
+		ret = parse_target_address (address, &topts);
+		t->address = topts.target_address;
+		if (ret)
+			break;
+		ret = parse_default_ssh_executor (&topts);
+		t->remote_executor = topts.remote_executor;
+		if (ret)
+			break;
+		ret = parse_default_scp_getter (&topts);
+		t->remote_getter = topts.remote_getter;
+		if (ret)
+			break;
+		opts->target_count++;
+	}
+	free (list);
+	if (ret && t) {
+		free (t->address);
+		free (t->remote_executor);
+		free (t->remote_getter);
+	}
+
+	return ret;
+}
+
 /* ------------------------------------------------------------------------- */
 /** Parse remote getter argument.
  * @param getter Remote getter.
@@ -535,6 +721,30 @@ LOCAL int parse_remote_getter(char *getter, testrunner_lite_options *opts)
 	return 0;
 }
 
+/* ------------------------------------------------------------------------- */
+/** Create the ssh options for sharing a master connection to the target
+ * @param opts Options struct
+ * @param buf buffer for the options, empty if connections are not shared
+ * @param size size of buf
+ */
+LOCAL void ssh_control_args(testrunner_lite_options *opts, char *buf,
+			    size_t size)
+{
+	char path [SSH_CONTROL_PATH_MAX];
+	int len;
+
+	buf[0] = '\0';
+	if (opts->no_ssh_multiplex)
+		return;
+	len = snprintf (path, SSH_CONTROL_PATH_MAX, SSH_CONTROL_PATH,
+			getpid(), opts->target_address, opts->target_port);
+	/* too long address, or characters expanded by ssh or wordexp */
+	if (len >= SSH_CONTROL_PATH_MAX || 
+	    strpbrk (opts->target_address, "%'\"\\ $`"))
+		return;
+	snprintf (buf, size, SSH_CONTROL_ARGS, path);
+}
+
 /* ------------------------------------------------------------------------- */
 /** Parse target options to create remote executor string using SSH
  * @param opts Options struct
@@ -543,6 +753,7 @@ LOCAL int parse_remote_getter(char *getter, testrunner_lite_options *opts)
 LOCAL int parse_default_ssh_executor(testrunner_lite_options *opts)
 {
 	char portarg [3 + 5 + 1]; /* "-p " + max port size + '\0' */
+	char muxarg [sizeof (SSH_CONTROL_ARGS) + SSH_CONTROL_PATH_MAX];
 	int keyarg_len;
 	if (opts->ssh_key) {  
 		keyarg_len = strlen(opts->ssh_key) + 3 + 1; /* -i + ssh key 
@@ -567,8 +778,9 @@ LOCAL int parse_default_ssh_executor(testrunner_lite_options *opts)
 	if (opts->ssh_key) {
 		snprintf (keyarg, keyarg_len + 1, "-i %s", opts->ssh_key);
 	}
+	ssh_control_args (opts, muxarg, sizeof (muxarg));
 
-	len = strlen(SSH_REMOTE_EXECUTOR) + strlen(portarg) +
+	len = strlen(SSH_REMOTE_EXECUTOR) + strlen(muxarg) + strlen(portarg) +
 		strlen(opts->target_address) + keyarg_len + 1;
 	opts->remote_executor = malloc(len);
 	if (opts->remote_executor == NULL) {
@@ -576,8 +788,8 @@ LOCAL int parse_default_ssh_executor(testrunner_lite_options *opts)
 		return 1;
 	}
 
-	snprintf(opts->remote_executor, len, SSH_REMOTE_EXECUTOR, portarg,
-	        opts->target_address, keyarg);
+	snprintf(opts->remote_executor, len, SSH_REMOTE_EXECUTOR, muxarg,
+		 portarg, opts->target_address, keyarg);
 
 	return 0;
 }
@@ -590,6 +802,7 @@ LOCAL int parse_default_ssh_executor(testrunner_lite_options *opts)
 LOCAL int parse_default_scp_getter(testrunner_lite_options *opts)
 {
 	char portarg [3 + 5 + 1]; /* "-P " + max port size + '\0' */
+	char muxarg [sizeof (SSH_CONTROL_ARGS) + SSH_CONTROL_PATH_MAX];
 	int keyarg_len;
 	if (opts->ssh_key) {  
 		keyarg_len = strlen(opts->ssh_key) + 3 + 1; /* -i + ssh key len + '\0'*/
@@ -607,8 +820,9 @@ LOCAL int parse_default_scp_getter(testrunner_lite_options *opts)
 	if (opts->ssh_key) {
 		snprintf (keyarg, keyarg_len + 1, "-i %s", opts->ssh_key);
 	}
+	ssh_control_args (opts, muxarg, sizeof (muxarg));
 
-	len = strlen(SCP_REMOTE_GETTER) + strlen(portarg) +
+	len = strlen(SCP_REMOTE_GETTER) + strlen(muxarg) + strlen(portarg) +
 		strlen(opts->target_address) + keyarg_len + 1;
 	opts->remote_getter = malloc(len);
 	if (opts->remote_getter == NULL) {
@@ -616,8 +830,8 @@ LOCAL int parse_default_scp_getter(testrunner_lite_options *opts)
 		return 1;
 	}
 
-	snprintf(opts->remote_getter, len, SCP_REMOTE_GETTER, portarg, keyarg,
-		 opts->target_address);
+	snprintf(opts->remote_getter, len, SCP_REMOTE_GETTER, muxarg, portarg,
+		 keyarg, opts->target_address);
 
 	return 0;
 }
@@ -798,6 +1012,77 @@ LOCAL int parse_utf8_limit(char *limit, testrunner_lite_options *opts) {
 	return 1;
 }
 /* ------------------------------------------------------------------------- */
+/** Parse jobs option
+ * @param jobs Number of concurrent cases as a string
+ * @param opts Options struct
+ * @return 0 in success, 1 on failure
+ */
+LOCAL int parse_jobs(char *jobs, testrunner_lite_options *opts) {
+	long int value = 0;
+	char *endptr = NULL;
+
+	value = strtol(jobs, &endptr, 10);
+	if (value > 0 && value <= MAX_PARALLEL_JOBS && *endptr == '\0') {
+		opts->jobs = value;
+		return 0;
+	}
+
+	fprintf(stderr, "Invalid value for option jobs (1-%d)\n",
+		MAX_PARALLEL_JOBS);
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Parse retries or retry delay option
+ * @param count Non-negative number as a string
+ * @param name Option name for error message
+ * @param max Largest accepted value
+ * @param result Parsed value
+ * @return 0 in success, 1 on failure
+ */
+LOCAL int parse_count(char *count, const char *name, int max, int *result) {
+	long int value = 0;
+	char *endptr = NULL;
+
+	value = strtol(count, &endptr, 10);
+	if (value >= 0 && value <= max && *count != '\0' && *endptr == '\0') {
+		*result = value;
+		return 0;
+	}
+
+	fprintf(stderr, "Invalid value for option %s (0-%d)\n", name, max);
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Parse output limit or output tail option
+ * @param limit Limit as a string, optionally followed by K or M
+ * @param name Option name for error message
+ * @param result Parsed value
+ * @return 0 in success, 1 on failure
+ */
+LOCAL int parse_output_limit(char *limit, const char *name,
+			     unsigned long *result) {
+	unsigned long value = 0;
+	char *endptr = NULL;
+
+	value = strtoul(limit, &endptr, 10);
+	if (*endptr == 'K' || *endptr == 'k') {
+		value *= 1024;
+		endptr++;
+	} else if (*endptr == 'M' || *endptr == 'm') {
+		value *= 1024 * 1024;
+		endptr++;
+	}
+
+	if (value > 0 && value < INT_MAX && endptr != limit && 
+	    *endptr == '\0') {
+		*result = value;
+		return 0;
+	}
+
+	fprintf(stderr, "Invalid value for option %s\n", name);
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
 /* ======================== FUNCTIONS ====================================== */
 /* ------------------------------------------------------------------------- */
 /** main() for testrunnerlite - handle command line switches and call parser
@@ -810,7 +1095,7 @@ int main (int argc, char *argv[], char *envp[])
 {
 	int h_flag = 0, a_flag = 0, m_flag = 0, A_flag = 0, V_flag = 0;
 	int power_flag = 0;
-	int opt_char, option_idx;
+	int opt_char, option_idx, i;
 	char *address = NULL;
 	char *executor = NULL;
 #ifdef ENABLE_LIBSSH2
@@ -856,6 +1141,14 @@ int main (int argc, char *argv[], char *envp[])
 #endif
 			{"print-step-output", no_argument, 
 			 &opts.print_step_output, 1},
+			{"shell-worker", no_argument, 
+			 &opts.shell_worker, 1},
+			{"background-get", no_argument, 
+			 &opts.background_get, 1},
+			{"batch-get", no_argument, 
+			 &opts.batch_get, 1},
+			{"no-ssh-multiplex", no_argument, 
+			 &opts.no_ssh_multiplex, 1},
 			{"disable-measurement-verdict", no_argument, 
 			 &opts.no_measurement_verdicts, 1},
 			{"measure-power", no_argument, &power_flag, 1},
@@ -866,7 +1159,28 @@ int main (int argc, char *argv[], char *envp[])
 			{"rich-core-dumps", required_argument, NULL, 'd'},
 			{"utf8-limit", required_argument, NULL,
 			 TRLITE_LONG_OPTION_UTF8_LIMIT},
+			{"output-limit", required_argument, NULL,
+			 TRLITE_LONG_OPTION_OUTPUT_LIMIT},
+			{"output-tail", required_argument, NULL,
+			 TRLITE_LONG_OPTION_OUTPUT_TAIL},
+			{"cgroup", required_argument, NULL,
+			 TRLITE_LONG_OPTION_CGROUP},
 			{"core-upload-timeout", required_argument, NULL, 'T'},
+			{"jobs", required_argument, NULL, 'j'},
+			{"history", required_argument, NULL,
+			 TRLITE_LONG_OPTION_HISTORY},
+			{"journal", no_argument, &opts.journal, 1},
+			{"resume-journal", no_argument, &opts.resume_journal, 1},
+			{"result-cache", required_argument, NULL,
+			 TRLITE_LONG_OPTION_RESULT_CACHE},
+			{"build-id", required_argument, NULL,
+			 TRLITE_LONG_OPTION_BUILD_ID},
+			{"retries", required_argument, NULL,
+			 TRLITE_LONG_OPTION_RETRIES},
+			{"retry-delay", required_argument, NULL,
+			 TRLITE_LONG_OPTION_RETRY_DELAY},
+			{"agent", optional_argument, NULL,
+			 TRLITE_LONG_OPTION_AGENT},
 			{0, 0, 0, 0}
 		};
 
@@ -878,6 +1192,7 @@ int main (int argc, char *argv[], char *envp[])
 
 	opts.output_type = OUTPUT_TYPE_XML;
 	opts.run_automatic = opts.run_manual = 1;
+	opts.retry_delay = 1;
 	opts.ssh_key = NULL;
 	gettimeofday (&created, NULL);
 	signal (SIGINT, handle_sigint);
@@ -889,7 +1204,7 @@ int main (int argc, char *argv[], char *envp[])
 		option_idx = 0;
      
 		opt_char = getopt_long (argc, argv, 
-					":hVaAHSMsmcPd:C:f:o:e:l:r:u:U:L:t:E:G:v::k:T:"
+					":hVaAHSMsmcPd:C:f:o:e:l:r:u:U:L:t:E:G:v::k:T:j:"
 #ifdef ENABLE_LIBSSH2
 					"n:"
 #endif
@@ -988,7 +1303,12 @@ int main (int argc, char *argv[], char *envp[])
 				filter_string = xmlCharStrdup (optarg);
 			break;
 		case 't':
-			if (parse_target_address(optarg, &opts) != 0) {
+			if (strchr(optarg, ',')) {
+				if (parse_target_list(optarg, &opts) != 0) {
+					retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+					goto OUT;
+				}
+			} else if (parse_target_address(optarg, &opts) != 0) {
 				retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
 				goto OUT;
 			}
@@ -1071,6 +1391,12 @@ int main (int argc, char *argv[], char *envp[])
 		case 'T':
 			opts.core_upload_timeout = atoi (optarg);
 			break;
+		case 'j':
+			if (parse_jobs(optarg, &opts) != 0) {
+				retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+				goto OUT;
+			}
+			break;
 		case TRLITE_LONG_OPTION_LOGID:
 			if (parse_logid(optarg, &opts) != 0) {
 				retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
@@ -1083,6 +1409,55 @@ int main (int argc, char *argv[], char *envp[])
 				goto OUT;
 			}
 			break;
+		case TRLITE_LONG_OPTION_OUTPUT_LIMIT:
+			if (parse_output_limit(optarg, "output-limit",
+					       &opts.output_limit) != 0) {
+				retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+				goto OUT;
+			}
+			break;
+		case TRLITE_LONG_OPTION_OUTPUT_TAIL:
+			if (parse_output_limit(optarg, "output-tail",
+					       &opts.output_tail) != 0) {
+				retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+				goto OUT;
+			}
+			break;
+		case TRLITE_LONG_OPTION_CGROUP:
+			if (opts.cgroup) free (opts.cgroup);
+			opts.cgroup = strdup (optarg);
+			break;
+		case TRLITE_LONG_OPTION_HISTORY:
+			if (opts.history_file) free (opts.history_file);
+			opts.history_file = strdup (optarg);
+			break;
+		case TRLITE_LONG_OPTION_RESULT_CACHE:
+			if (opts.result_cache) free (opts.result_cache);
+			opts.result_cache = strdup (optarg);
+			break;
+		case TRLITE_LONG_OPTION_BUILD_ID:
+			if (opts.build_id) free (opts.build_id);
+			opts.build_id = strdup (optarg);
+			break;
+		case TRLITE_LONG_OPTION_RETRIES:
+			if (parse_count(optarg, "retries", MAX_RETRIES,
+					&opts.retries) != 0) {
+				retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+				goto OUT;
+			}
+			break;
+		case TRLITE_LONG_OPTION_RETRY_DELAY:
+			if (parse_count(optarg, "retry-delay", MAX_RETRY_DELAY,
+					&opts.retry_delay) != 0) {
+				retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+				goto OUT;
+			}
+			break;
+		case TRLITE_LONG_OPTION_AGENT:
+			if (opts.remote_agent) free (opts.remote_agent);
+			opts.remote_agent = strdup (optarg ? optarg :
+						    DEFAULT_REMOTE_AGENT);
+			break;
 		case ':':
 			fprintf (stderr, "%s missing argument - exiting\n",
 				 PROGNAME);
@@ -1116,13 +1491,16 @@ int main (int argc, char *argv[], char *envp[])
 		}
 
 		if ((parse_default_ssh_executor(&opts) != 0) ||
-		    (parse_default_scp_getter(&opts) != 0)) {
+		    (parse_default_scp_getter(&opts) != 0) ||
+		    (opts.target_list && parse_shard_targets(&opts) != 0)) {
 			fprintf (stderr,
 				"%s: Failed to parse SSH/SCP executor/getter\n",
 				PROGNAME);
 			retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
 			goto OUT;
 		}
+		/* ssh passes the tar stream as is */
+		opts.batch_get = 1;
 	}
 #ifdef ENABLE_LIBSSH2
 	}
@@ -1149,9 +1527,29 @@ int main (int argc, char *argv[], char *envp[])
 			retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
 			goto OUT;
 		}
+		/* the libssh2 session is not shared with a get thread */
+		if (opts.background_get) {
+			fprintf (stderr,
+				"%s: -n and --background-get are mutually exclusive\n",
+				PROGNAME);
+			retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+			goto OUT;
+		}
 	}
 #endif
 
+	if (opts.remote_agent && !opts.remote_executor
+#ifdef ENABLE_LIBSSH2
+	    && !opts.libssh2
+#endif
+	    ) {
+		fprintf (stderr,
+			"%s: --agent requires remote execution (-t, -E/-G or -n)\n",
+			PROGNAME);
+		retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+		goto OUT;
+	}
+
 	if (opts.chroot_folder && (opts.remote_executor || opts.remote_getter)) {
 		fprintf (stderr,
 			"%s: -C and remote execution (-t or -E/-G) are mutually exclusive\n",
@@ -1160,6 +1558,55 @@ int main (int argc, char *argv[], char *envp[])
 		goto OUT;
 	}
 
+	if (opts.cgroup && (opts.target_address || opts.remote_executor)) {
+		fprintf (stderr,
+			"%s: --cgroup and remote execution (-t or -E/-G) are mutually exclusive\n",
+			PROGNAME);
+		retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+		goto OUT;
+	}
+
+	if (opts.jobs > 1 && (opts.target_address || opts.remote_executor)) {
+		fprintf (stderr,
+			"%s: -j and remote execution (-t or -E/-G) are mutually exclusive\n",
+			PROGNAME);
+		retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+		goto OUT;
+	}
+
+	if (opts.target_count > 1 &&
+	    (opts.rich_core_dumps || power_flag || opts.resume_testrun)) {
+		fprintf (stderr,
+			"%s: several targets can not be used with -d, -R or --measure-power\n",
+			PROGNAME);
+		retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+		goto OUT;
+	}
+
+	if (opts.jobs > 1 && (opts.rich_core_dumps || power_flag)) {
+		fprintf (stderr,
+			"%s: -j can not be used with -d or --measure-power\n",
+			PROGNAME);
+		retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+		goto OUT;
+	}
+
+	if (opts.result_cache && !opts.build_id) {
+		fprintf (stderr,
+			"%s: --result-cache requires --build-id\n",
+			PROGNAME);
+		retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+		goto OUT;
+	}
+
+	if (opts.output_tail && !opts.output_limit) {
+		fprintf (stderr,
+			"%s: --output-tail requires --output-limit\n",
+			PROGNAME);
+		retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+		goto OUT;
+	}
+
 	if ((opts.remote_executor && !opts.remote_getter) ||
 	    (!opts.remote_executor && opts.remote_getter)) {
 		fprintf (stderr,
@@ -1306,14 +1753,33 @@ int main (int argc, char *argv[], char *envp[])
 #endif
 	}
 	
+	/*
+	** Open run journal, results of an interrupted run are read from it
+	*/
+	if (journal_init (&opts)) {
+		LOG_MSG (LOG_ERR, "Run journal can not be used... exiting");
+		retval = TESTRUNNER_LITE_INVALID_ARGUMENTS;
+		goto OUT;
+	}
 	/*
 	** Initialize result logger
 	*/
 	retval =  init_result_logger(&opts, &hwinfo);
 	if (retval) {
 		retval = TESTRUNNER_LITE_RESULT_LOGGING_FAIL;
+		journal_close();
 		goto OUT;
 	}
+	/*
+	** Read run history, the run is not aborted if it is not available
+	*/
+	if (history_init (&opts, &hwinfo))
+		LOG_MSG (LOG_WARNING, "Run history is not recorded");
+	/*
+	** Open result cache, cases are executed if it is not available
+	*/
+	if (result_cache_init (&opts, &hwinfo))
+		LOG_MSG (LOG_WARNING, "Results are not cached");
 #ifdef ENABLE_EVENTS
 	init_event_system();
 #endif
@@ -1323,6 +1789,9 @@ int main (int argc, char *argv[], char *envp[])
 	td_process();
 
 	executor_close();
+	history_close();
+	journal_close();
+	result_cache_close();
 #ifdef ENABLE_EVENTS
 	cleanup_event_system();
 #endif
@@ -1350,6 +1819,18 @@ int main (int argc, char *argv[], char *envp[])
 #endif
 	if (opts.ssh_key) free (opts.ssh_key);
 	if (opts.rich_core_dumps) free (opts.rich_core_dumps);
+	if (opts.cgroup) free (opts.cgroup);
+	if (opts.history_file) free (opts.history_file);
+	if (opts.result_cache) free (opts.result_cache);
+	if (opts.build_id) free (opts.build_id);
+	if (opts.remote_agent) free (opts.remote_agent);
+	if (opts.target_list) free (opts.target_list);
+	for (i = 0; i < opts.target_count; i++) {
+		free (opts.targets[i].address);
+		free (opts.targets[i].remote_executor);
+		free (opts.targets[i].remote_getter);
+	}
+	if (opts.targets) free (opts.targets);
 	if (filter_string) free (filter_string);
 	if (bail_out == 255+SIGINT) {
 		signal (SIGINT, SIG_DFL);
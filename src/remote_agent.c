@@ -0,0 +1,955 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "testrunnerlite.h"
+#include "executor.h"
+#include "remote_executor.h"
+#include "remote_agent.h"
+#include "agent_protocol.h"
+#include "log.h"
+#ifdef ENABLE_LIBSSH2
+#include "remote_executor_libssh2.h"
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+#define AGENT_START_TIMEOUT_MS 15000 /* longer than ssh ConnectTimeout */
+#define AGENT_FILE_TIMEOUT_MS  (1000 * (COMMON_SOFT_TIMEOUT + \
+					COMMON_HARD_TIMEOUT))
+/* the agent gets the environment of .profile like the step wrapper */
+#define AGENT_COMMAND "if [ -e .profile ]; then . ./.profile > /dev/null; " \
+	"fi; exec %s"
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/** Step, get or put waiting for frames from the agent. The write ends are
+ *  owned by the reader thread, which removes the request when it is done.
+ *  The request is freed when the last reference is released, so the reader
+ *  can write to it without the lock. */
+typedef struct _agent_request {
+	uint32_t id;        /**< request id */
+	int      out_fd;    /**< stdout of step, -1 if not redirected */
+	int      err_fd;    /**< stderr of step, -1 if not redirected */
+	int      status_fd; /**< exit status of step or result of get/put */
+	int      file_fd;   /**< file of get being received */
+	char    *folder;    /**< destination folder of get */
+	int      error;     /**< errno of the first local error of get */
+	int      refs;      /**< list of the agent and the reader writing */
+	int      finished;  /**< status is reported when freed */
+	int32_t  status;    /**< exit status of step or result of get/put */
+	struct _agent_request *next;
+} agent_request;
+
+/** Connection to the agent on a target */
+typedef struct _remote_agent {
+	char     *executor;  /**< remote executor of the target */
+	pid_t     pid;       /**< executor process running the agent, 0 if
+				the agent is not running */
+#ifdef ENABLE_LIBSSH2
+	lssh2_pipe *pipe;    /**< channel of the libssh2 session running
+				the agent, NULL if not running */
+#endif
+	int       to_fd;     /**< frames to the agent */
+	int       from_fd;   /**< frames from the agent */
+	int       started;   /**< agent has been running, restart if lost */
+	int       failed;    /**< agent could not be started */
+	int       reading;   /**< reader thread has been created */
+	pthread_t reader;    /**< thread reading frames from the agent */
+	pthread_mutex_t lock; /**< requests and frames to the agent */
+	pthread_mutex_t control; /**< starting and stopping the agent */
+	agent_request *requests; /**< requests waiting for the agent */
+	struct _remote_agent *next; /**< agent added before this one */
+} remote_agent;
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+LOCAL testrunner_lite_options *options = NULL;
+/* agents are only added until remote_agent_close, so that signal handlers
+   can walk the list without the lock */
+LOCAL remote_agent *agents = NULL;
+LOCAL pthread_mutex_t agents_lock = PTHREAD_MUTEX_INITIALIZER;
+LOCAL uint32_t last_id = 0;
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL void write_fd (int fd, const void *buf, size_t len);
+/* ------------------------------------------------------------------------- */
+LOCAL void request_release (remote_agent *a, agent_request *r);
+/* ------------------------------------------------------------------------- */
+LOCAL void request_done (remote_agent *a, agent_request *r, int32_t status);
+/* ------------------------------------------------------------------------- */
+LOCAL agent_request *take_request (remote_agent *a, uint32_t id, int remove);
+/* ------------------------------------------------------------------------- */
+LOCAL void receive_file (agent_request *r, const agent_frame *frame);
+/* ------------------------------------------------------------------------- */
+LOCAL void *agent_reader (void *arg);
+/* ------------------------------------------------------------------------- */
+LOCAL int agent_connect (remote_agent *a, const char *cmd);
+/* ------------------------------------------------------------------------- */
+LOCAL int agent_start (remote_agent *a);
+/* ------------------------------------------------------------------------- */
+LOCAL void agent_stop (remote_agent *a);
+/* ------------------------------------------------------------------------- */
+LOCAL int agent_running (remote_agent *a);
+/* ------------------------------------------------------------------------- */
+LOCAL remote_agent *agent_find (const char *executor, int start);
+/* ------------------------------------------------------------------------- */
+LOCAL agent_request *agent_request_new (remote_agent *a, int *status_fd);
+/* ------------------------------------------------------------------------- */
+LOCAL int agent_send (remote_agent *a, int type, uint32_t id,
+		      const void *payload, size_t length);
+/* ------------------------------------------------------------------------- */
+LOCAL int agent_submit (remote_agent *a, agent_request *r, int type,
+			const void *payload, size_t length);
+/* ------------------------------------------------------------------------- */
+LOCAL int agent_wait (int status_fd);
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Write the whole buffer, ignoring errors of a reader that has gone
+ * @param fd file descriptor
+ * @param buf data to write
+ * @param len length of data
+ */
+LOCAL void write_fd (int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (fd >= 0 && len > 0) {
+		ret = write (fd, p, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		p += ret;
+		len -= ret;
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Release a reference to a request. The last one closes the write ends,
+ *  reports the status if the request has finished and frees the request.
+ *  A waiting thread sees the end of status without the result.
+ * @param a agent
+ * @param r request
+ */
+LOCAL void request_release (remote_agent *a, agent_request *r)
+{
+	int refs;
+
+	pthread_mutex_lock (&a->lock);
+	refs = --r->refs;
+	pthread_mutex_unlock (&a->lock);
+	if (refs > 0)
+		return;
+
+	if (r->out_fd >= 0)
+		close (r->out_fd);
+	if (r->err_fd >= 0)
+		close (r->err_fd);
+	if (r->file_fd >= 0)
+		close (r->file_fd);
+	if (r->finished)
+		write_fd (r->status_fd, &r->status, sizeof (r->status));
+	close (r->status_fd);
+	free (r->folder);
+	free (r);
+}
+/* ------------------------------------------------------------------------- */
+/** Report result of a request to the waiting thread once the request is
+ *  released
+ * @param a agent
+ * @param r request, already removed from the agent
+ * @param status exit status of step, result of get or put
+ */
+LOCAL void request_done (remote_agent *a, agent_request *r, int32_t status)
+{
+	r->status = status;
+	r->finished = 1;
+	request_release (a, r);
+}
+/* ------------------------------------------------------------------------- */
+/** Find a request of an agent
+ * @param a agent
+ * @param id request id
+ * @param remove remove the request from the agent, else the request is
+ *        referenced until request_release()
+ * @return request or NULL if not found
+ */
+LOCAL agent_request *take_request (remote_agent *a, uint32_t id, int remove)
+{
+	agent_request *r, **prev;
+
+	pthread_mutex_lock (&a->lock);
+	for (prev = &a->requests; (r = *prev); prev = &r->next)
+		if (r->id == id)
+			break;
+	if (r && remove)
+		*prev = r->next;
+	else if (r)
+		r->refs++;
+	pthread_mutex_unlock (&a->lock);
+
+	return r;
+}
+/* ------------------------------------------------------------------------- */
+/** Write a file of get to the destination folder
+ * @param r get request
+ * @param frame AGENT_FILE or AGENT_DATA frame
+ */
+LOCAL void receive_file (agent_request *r, const agent_frame *frame)
+{
+	char path[PATH_MAX];
+	const char *p;
+	size_t done;
+	ssize_t ret;
+
+	if (frame->type == AGENT_FILE) {
+		if (r->file_fd >= 0)
+			close (r->file_fd);
+		p = strrchr (frame->payload, '/');
+		p = p ? p + 1 : frame->payload;
+		r->file_fd = -1;
+		if (snprintf (path, PATH_MAX, "%s/%s", r->folder, p) >= 
+		    PATH_MAX)
+			errno = ENAMETOOLONG;
+		else
+			r->file_fd = open (path, O_WRONLY | O_CREAT | 
+					   O_TRUNC | O_CLOEXEC, 0644);
+		if (r->file_fd < 0 && !r->error) {
+			r->error = errno;
+			LOG_MSG (LOG_ERR, "Failed to create %s: %s", path,
+				 strerror (errno));
+		}
+		return;
+	}
+
+	for (done = 0; r->file_fd >= 0 && done < frame->length; done += ret) {
+		ret = write (r->file_fd, frame->payload + done, 
+			     frame->length - done);
+		if (ret < 0 && errno == EINTR) {
+			ret = 0;
+			continue;
+		}
+		if (ret < 0) {
+			if (!r->error)
+				r->error = errno;
+			close (r->file_fd);
+			r->file_fd = -1;
+		}
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Thread passing frames from the agent to the waiting requests. Output
+ *  is written to the pipes of steps without holding the lock, since it
+ *  blocks until the step output is read.
+ * @param arg agent
+ * @return NULL
+ */
+LOCAL void *agent_reader (void *arg)
+{
+	remote_agent *a = (remote_agent *)arg;
+	agent_frame *frame;
+	agent_request *r, *next;
+	sigset_t set;
+
+	/* signals are handled by the other threads, and a write to a step
+	   that has finished must not raise SIGPIPE */
+	sigfillset (&set);
+	pthread_sigmask (SIG_BLOCK, &set, NULL);
+
+	frame = (agent_frame *)malloc (sizeof (agent_frame));
+	while (frame && agent_read_frame (a->from_fd, frame) == 1) {
+		switch (frame->type) {
+		case AGENT_STDOUT:
+		case AGENT_STDERR:
+			r = take_request (a, frame->id, 0);
+			if (!r)
+				break;
+			if (frame->type == AGENT_STDOUT)
+				write_fd (r->out_fd >= 0 ? r->out_fd :
+					  STDOUT_FILENO, frame->payload,
+					  frame->length);
+			else
+				write_fd (r->err_fd >= 0 ? r->err_fd :
+					  STDERR_FILENO, frame->payload,
+					  frame->length);
+			request_release (a, r);
+			break;
+		case AGENT_FILE:
+		case AGENT_DATA:
+			r = take_request (a, frame->id, 0);
+			if (!r)
+				break;
+			receive_file (r, frame);
+			request_release (a, r);
+			break;
+		case AGENT_EXIT:
+			r = take_request (a, frame->id, 1);
+			if (r)
+				request_done (a, r, agent_frame_int (frame));
+			break;
+		case AGENT_END:
+			r = take_request (a, frame->id, 1);
+			if (r)
+				request_done (a, r, r->error ? r->error :
+					      agent_frame_int (frame));
+			break;
+		default:
+			LOG_MSG (LOG_WARNING, "Unexpected frame %d from remote "
+				 "agent", frame->type);
+			break;
+		}
+	}
+	free (frame);
+
+	/* connection lost, waiting threads see end of status */
+	pthread_mutex_lock (&a->lock);
+	r = a->requests;
+	a->requests = NULL;
+	pthread_mutex_unlock (&a->lock);
+	for (; r; r = next) {
+		next = r->next;
+		request_release (a, r);
+	}
+
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Run the agent command on the target with its stdin and stdout
+ *  connected to the agent
+ * @param a agent
+ * @param cmd command starting the agent
+ * @return 0 on success, -1 on error
+ */
+LOCAL int agent_connect (remote_agent *a, const char *cmd)
+{
+	int to[2] = { -1, -1 };
+	int from[2] = { -1, -1 };
+
+#ifdef ENABLE_LIBSSH2
+	if (options->libssh2) {
+		/* the agent runs on a channel of the session */
+		a->pipe = executor_libssh2_pipe (cmd, &a->to_fd, &a->from_fd);
+		return a->pipe ? 0 : -1;
+	}
+#endif
+	if (pipe2 (to, O_CLOEXEC) < 0 || pipe2 (from, O_CLOEXEC) < 0) {
+		LOG_MSG (LOG_ERR, "pipe: %s", strerror (errno));
+		goto err_out;
+	}
+
+	a->pid = fork ();
+	if (a->pid < 0) {
+		LOG_MSG (LOG_ERR, "Fork failed: %s", strerror (errno));
+		a->pid = 0;
+		goto err_out;
+	}
+	if (a->pid == 0) {
+		dup2 (to[0], STDIN_FILENO);
+		dup2 (from[1], STDOUT_FILENO);
+		remote_exec (a->executor, cmd);
+		_exit (255);
+	}
+	close (to[0]);
+	close (from[1]);
+	a->to_fd = to[1];
+	a->from_fd = from[0];
+
+	return 0;
+ err_out:
+	if (to[0] >= 0) close (to[0]);
+	if (to[1] >= 0) close (to[1]);
+	if (from[0] >= 0) close (from[0]);
+	if (from[1] >= 0) close (from[1]);
+	return -1;
+}
+/* ------------------------------------------------------------------------- */
+/** Start the agent on the target with the remote executor
+ * @param a agent
+ * @return 0 on success, -1 on error
+ */
+LOCAL int agent_start (remote_agent *a)
+{
+	struct pollfd pfd;
+	agent_frame *frame = NULL;
+	char *cmd = NULL;
+	size_t len;
+	int ret;
+
+	len = strlen (AGENT_COMMAND) + strlen (options->remote_agent) + 1;
+	cmd = (char *)malloc (len);
+	frame = (agent_frame *)malloc (sizeof (agent_frame));
+	if (!cmd || !frame) {
+		LOG_MSG (LOG_ERR, "OOM");
+		goto err_out;
+	}
+	snprintf (cmd, len, AGENT_COMMAND, options->remote_agent);
+
+	if (agent_connect (a, cmd) < 0)
+		goto err_out;
+
+	/* agent greets when it is ready */
+	pfd.fd = a->from_fd;
+	pfd.events = POLLIN;
+	do {
+		ret = poll (&pfd, 1, AGENT_START_TIMEOUT_MS);
+	} while (ret < 0 && errno == EINTR);
+	if (ret <= 0 || agent_read_frame (a->from_fd, frame) != 1 ||
+	    frame->type != AGENT_HELLO ||
+	    agent_frame_int (frame) != AGENT_PROTOCOL_VERSION) {
+		LOG_MSG (LOG_WARNING, "Remote agent %s did not start",
+			 options->remote_agent);
+		goto err_stop;
+	}
+
+	if (pthread_create (&a->reader, NULL, agent_reader, a)) {
+		LOG_MSG (LOG_ERR, "Failed to create thread for remote agent");
+		goto err_stop;
+	}
+	a->reading = 1;
+	a->started = 1;
+	LOG_MSG (LOG_DEBUG, "Remote agent started on %s", a->executor);
+
+	free (cmd);
+	free (frame);
+	return 0;
+ err_stop:
+	agent_stop (a);
+ err_out:
+	free (cmd);
+	free (frame);
+	return -1;
+}
+/* ------------------------------------------------------------------------- */
+/** Stop the agent. Closing the connection makes the agent terminate the
+ *  steps still running and exit.
+ * @param a agent
+ */
+LOCAL void agent_stop (remote_agent *a)
+{
+	if (a->to_fd >= 0) {
+		close (a->to_fd);
+		a->to_fd = -1;
+	}
+	if (a->pid > 0) {
+		/* executor may not notice that the agent has exited */
+		kill (a->pid, SIGTERM);
+		waitpid (a->pid, NULL, 0);
+		a->pid = 0;
+	}
+#ifdef ENABLE_LIBSSH2
+	if (a->pipe) {
+		lssh2_pipe *p = a->pipe;
+
+		/* hidden from signal handlers before it is freed */
+		a->pipe = NULL;
+		__sync_synchronize ();
+		lssh2_pipe_close (p);
+	}
+#endif
+	if (a->reading) {
+		pthread_join (a->reader, NULL);
+		a->reading = 0;
+	}
+	if (a->from_fd >= 0) {
+		close (a->from_fd);
+		a->from_fd = -1;
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Check if the agent has been started and not stopped
+ * @param a agent
+ * @return 1 if running, 0 if not
+ */
+LOCAL int agent_running (remote_agent *a)
+{
+#ifdef ENABLE_LIBSSH2
+	if (a->pipe)
+		return 1;
+#endif
+	return a->pid > 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Find the agent of a remote executor
+ * @param executor remote executor
+ * @param start start the agent if it is not running
+ * @return agent or NULL if the agent is not available
+ */
+LOCAL remote_agent *agent_find (const char *executor, int start)
+{
+	remote_agent *a;
+	int running;
+
+	pthread_mutex_lock (&agents_lock);
+	for (a = agents; a; a = a->next)
+		if (!strcmp (a->executor, executor))
+			break;
+	if (!a && start) {
+		a = (remote_agent *)calloc (1, sizeof (remote_agent));
+		if (!a || !(a->executor = strdup (executor))) {
+			LOG_MSG (LOG_ERR, "OOM");
+			free (a);
+			pthread_mutex_unlock (&agents_lock);
+			return NULL;
+		}
+		a->to_fd = a->from_fd = -1;
+		pthread_mutex_init (&a->lock, NULL);
+		pthread_mutex_init (&a->control, NULL);
+		a->next = agents;
+		/* complete before a signal handler can see it */
+		__sync_synchronize ();
+		agents = a;
+	}
+	pthread_mutex_unlock (&agents_lock);
+	if (!a || !start)
+		return a;
+
+	/* the handshake may take long, other agents are not held up */
+	pthread_mutex_lock (&a->control);
+	/* lost for example on reboot, the reader has seen the end */
+	if (a->pid > 0 && !a->requests && 
+	    waitpid (a->pid, NULL, WNOHANG) == a->pid) {
+		a->pid = 0;
+		agent_stop (a);
+	}
+#ifdef ENABLE_LIBSSH2
+	if (a->pipe && !a->requests && lssh2_pipe_closed (a->pipe))
+		agent_stop (a);
+#endif
+	if (!agent_running (a) && !a->failed && agent_start (a) < 0) {
+		/* not installed or not compatible, try again only if it
+		   was lost */
+		a->failed = !a->started;
+		if (a->failed)
+			LOG_MSG (LOG_WARNING, "Executing steps with remote "
+				 "executor");
+	}
+	running = agent_running (a);
+	pthread_mutex_unlock (&a->control);
+
+	return running ? a : NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Create a request of an agent
+ * @param a agent
+ * @param status_fd read end of status, the result of the request
+ * @return request added to the agent, NULL on error
+ */
+LOCAL agent_request *agent_request_new (remote_agent *a, int *status_fd)
+{
+	agent_request *r;
+	int fds[2];
+
+	r = (agent_request *)calloc (1, sizeof (agent_request));
+	if (!r || pipe2 (fds, O_CLOEXEC) < 0) {
+		LOG_MSG (LOG_ERR, "Failed to create request: %s", 
+			 strerror (errno));
+		free (r);
+		return NULL;
+	}
+	r->id = __sync_add_and_fetch (&last_id, 1);
+	r->out_fd = r->err_fd = r->file_fd = -1;
+	r->refs = 1;
+	r->status_fd = fds[1];
+	*status_fd = fds[0];
+
+	return r;
+}
+/* ------------------------------------------------------------------------- */
+/** Send a frame to an agent
+ * @param a agent
+ * @param type agent_frame_type
+ * @param id request id
+ * @param payload payload
+ * @param length payload length
+ * @return 0 on success, -1 on error
+ */
+LOCAL int agent_send (remote_agent *a, int type, uint32_t id,
+		      const void *payload, size_t length)
+{
+	int ret;
+
+	pthread_mutex_lock (&a->lock);
+	ret = agent_write_frame (a->to_fd, type, id, payload, length);
+	pthread_mutex_unlock (&a->lock);
+	if (ret < 0)
+		LOG_MSG (LOG_ERR, "Failed to send to remote agent: %s",
+			 strerror (errno));
+
+	return ret;
+}
+/* ------------------------------------------------------------------------- */
+/** Add a request to an agent and send the frame starting it
+ * @param a agent
+ * @param r request
+ * @param type agent_frame_type
+ * @param payload payload
+ * @param length payload length
+ * @return 0 on success, -1 on error, the request is then done with
+ *         status -1
+ */
+LOCAL int agent_submit (remote_agent *a, agent_request *r, int type,
+			const void *payload, size_t length)
+{
+	uint32_t id = r->id;
+
+	pthread_mutex_lock (&a->lock);
+	r->next = a->requests;
+	a->requests = r;
+	pthread_mutex_unlock (&a->lock);
+
+	if (agent_send (a, type, id, payload, length) == 0)
+		return 0;
+
+	/* agent is gone, reader may have ended the request already */
+	r = take_request (a, id, 1);
+	if (r)
+		request_done (a, r, -1);
+
+	return -1;
+}
+/* ------------------------------------------------------------------------- */
+/** Wait for the result of get or put
+ * @param status_fd read end of status of the request, closed
+ * @return 0 on success, errno on error, -1 if the agent was lost or did
+ *         not respond
+ */
+LOCAL int agent_wait (int status_fd)
+{
+	struct pollfd pfd;
+	int32_t status = -1;
+	int ret;
+
+	pfd.fd = status_fd;
+	pfd.events = POLLIN;
+	do {
+		ret = poll (&pfd, 1, AGENT_FILE_TIMEOUT_MS);
+	} while (ret < 0 && errno == EINTR);
+	if (ret <= 0 || read (status_fd, &status, sizeof (status)) !=
+	    sizeof (status))
+		status = -1;
+	close (status_fd);
+
+	return status;
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Initialize remote agents. Agents are started when first needed.
+ * @param opts testrunner-lite options
+ */
+void remote_agent_init (testrunner_lite_options *opts)
+{
+	options = opts;
+}
+/* ------------------------------------------------------------------------- */
+/** Execute a step command with the agent of a remote executor
+ * @param executor remote executor
+ * @param command Command to execute
+ * @param data Input and output data controlling execution
+ * @param stdout_fd Pointer to a file descriptor used to read stdout of
+ *        executed command, NULL if output is not redirected
+ * @param stderr_fd Pointer to a file descriptor used to read stderr of
+ *        executed command, NULL if output is not redirected
+ * @return request id of the step used as its pid, -1 if the step can not
+ *         be run by agent
+ */
+pid_t remote_agent_execute (const char *executor, const char *command,
+			    exec_data *data, int *stdout_fd, int *stderr_fd)
+{
+	remote_agent *a;
+	agent_request *r;
+	int out[2] = { -1, -1 };
+	int err[2] = { -1, -1 };
+	int status_fd = -1;
+	uint32_t id;
+
+	if (!options || !options->remote_agent || !command)
+		return -1;
+	if (strlen (command) > AGENT_PAYLOAD_MAX) {
+		LOG_MSG (LOG_DEBUG, "Command too long for remote agent");
+		return -1;
+	}
+	a = agent_find (executor, 1);
+	if (!a)
+		return -1;
+
+	r = agent_request_new (a, &status_fd);
+	if (!r)
+		return -1;
+	if (stdout_fd && (pipe2 (out, O_CLOEXEC) < 0 || 
+			  pipe2 (err, O_CLOEXEC) < 0)) {
+		LOG_MSG (LOG_ERR, "pipe: %s", strerror (errno));
+		goto err_out;
+	}
+	r->out_fd = out[1];
+	r->err_fd = err[1];
+	id = r->id;
+
+	if (agent_submit (a, r, AGENT_START, command, strlen (command)) < 0) {
+		close (status_fd);
+		if (out[0] >= 0) close (out[0]);
+		if (err[0] >= 0) close (err[0]);
+		return -1;
+	}
+
+	LOG_MSG (LOG_DEBUG, "Remote agent started step %u", id);
+	fcntl (status_fd, F_SETFL, O_NONBLOCK);
+	data->status_fd = status_fd;
+	if (stdout_fd) {
+		*stdout_fd = out[0];
+		*stderr_fd = err[0];
+	}
+
+	return (pid_t)id;
+ err_out:
+	if (out[0] >= 0) close (out[0]);
+	if (out[1] >= 0) close (out[1]);
+	if (err[0] >= 0) close (err[0]);
+	if (err[1] >= 0) close (err[1]);
+	close (r->status_fd);
+	close (status_fd);
+	free (r);
+
+	return -1;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if a step run by agent has finished. Does not block.
+ * @param data Input and output data controlling execution
+ * @param status wait status of the step
+ * @return 1 if the step has finished, 0 if not, -1 if the agent was lost
+ */
+int remote_agent_status (exec_data *data, int *status)
+{
+	int32_t st;
+	ssize_t ret;
+
+	do {
+		ret = read (data->status_fd, &st, sizeof (st));
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0 && errno == EAGAIN)
+		return 0;
+
+	close (data->status_fd);
+	data->status_fd = -1;
+	if (ret != sizeof (st)) {
+		LOG_MSG (LOG_ERR, "Remote agent lost");
+		return -1;
+	}
+	*status = st;
+
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Send a signal to the process group of a step run by agent
+ * @param executor remote executor
+ * @param id pid of the step returned by remote_agent_execute
+ * @param sig signal
+ * @return 0 on success, -1 on error
+ */
+int remote_agent_kill (const char *executor, pid_t id, int sig)
+{
+	remote_agent *a;
+	uint32_t n = htonl ((uint32_t)sig);
+
+	a = agent_find (executor, 0);
+	if (!a || !agent_running (a))
+		return -1;
+
+	return agent_send (a, AGENT_KILL, id, &n, sizeof (n));
+}
+/* ------------------------------------------------------------------------- */
+/** Get files from target with the agent of a remote executor
+ * @param executor remote executor
+ * @param pattern path of the files on target, may contain wildcards
+ * @param folder destination folder
+ * @return 0 on success, errno on error, -1 if the agent is not available
+ */
+int remote_agent_get (const char *executor, const char *pattern,
+		      const char *folder)
+{
+	remote_agent *a;
+	agent_request *r;
+	int status_fd;
+
+	if (!options || !options->remote_agent)
+		return -1;
+	a = agent_find (executor, 1);
+	if (!a || strlen (pattern) > AGENT_PAYLOAD_MAX)
+		return -1;
+	r = agent_request_new (a, &status_fd);
+	if (!r)
+		return -1;
+	r->folder = strdup (folder);
+
+	agent_submit (a, r, AGENT_GET, pattern, strlen (pattern));
+
+	return agent_wait (status_fd);
+}
+/* ------------------------------------------------------------------------- */
+/** Copy a file to target with the agent of a remote executor
+ * @param executor remote executor
+ * @param file local file
+ * @param path destination path on target
+ * @return 0 on success, errno on error, -1 if the agent is not available
+ */
+int remote_agent_put (const char *executor, const char *file,
+		      const char *path)
+{
+	remote_agent *a;
+	agent_request *r;
+	char *chunk = NULL;
+	int status_fd, fd, error = 0;
+	uint32_t id;
+	ssize_t ret;
+
+	if (!options || !options->remote_agent)
+		return -1;
+	fd = open (file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno;
+	chunk = (char *)malloc (AGENT_PAYLOAD_MAX);
+	a = agent_find (executor, 1);
+	if (!a || !chunk || strlen (path) > AGENT_PAYLOAD_MAX)
+		goto err_out;
+	r = agent_request_new (a, &status_fd);
+	if (!r)
+		goto err_out;
+	id = r->id;
+
+	if (agent_submit (a, r, AGENT_PUT, path, strlen (path)) == 0) {
+		while ((ret = read (fd, chunk, AGENT_PAYLOAD_MAX)) != 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0) {
+				error = errno;
+				break;
+			}
+			if (agent_send (a, AGENT_DATA, id, chunk, ret) < 0)
+				break;
+		}
+		agent_send (a, AGENT_END, id, NULL, 0);
+	}
+	ret = agent_wait (status_fd);
+	close (fd);
+	free (chunk);
+
+	return error ? error : ret;
+ err_out:
+	close (fd);
+	free (chunk);
+	return -1;
+}
+/* ------------------------------------------------------------------------- */
+/** Terminate the agents and so all steps they run. Called from signal 
+ *  handlers.
+ */
+void remote_agent_interrupt (void)
+{
+	remote_agent *a;
+	pid_t pid;
+#ifdef ENABLE_LIBSSH2
+	lssh2_pipe *p;
+#endif
+
+	for (a = agents; a; a = a->next) {
+		pid = a->pid;
+		if (pid > 0)
+			kill (pid, SIGTERM);
+#ifdef ENABLE_LIBSSH2
+		p = a->pipe;
+		if (p)
+			lssh2_pipe_interrupt (p);
+#endif
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Stop all agents
+ */
+void remote_agent_close (void)
+{
+	remote_agent *a, *next;
+
+	pthread_mutex_lock (&agents_lock);
+	a = agents;
+	agents = NULL;
+	__sync_synchronize ();
+	for (; a; a = next) {
+		next = a->next;
+		pthread_mutex_lock (&a->control);
+		agent_stop (a);
+		pthread_mutex_unlock (&a->control);
+		pthread_mutex_destroy (&a->control);
+		pthread_mutex_destroy (&a->lock);
+		free (a->executor);
+		free (a);
+	}
+	pthread_mutex_unlock (&agents_lock);
+}
+/* ------------------------------------------------------------------------- */
+/* End of file */
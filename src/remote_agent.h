@@ -0,0 +1,74 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+#ifndef REMOTE_AGENT_H
+#define REMOTE_AGENT_H
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDES */
+#include "testrunnerlite.h"
+#include "executor.h"
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+#define DEFAULT_REMOTE_AGENT "testrunner-lite-agent"
+
+/* ------------------------------------------------------------------------- */
+/* DATA TYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+void remote_agent_init (testrunner_lite_options *opts);
+/* ------------------------------------------------------------------------- */
+pid_t remote_agent_execute (const char *executor, const char *command,
+			    exec_data *data, int *stdout_fd, int *stderr_fd);
+/* ------------------------------------------------------------------------- */
+int remote_agent_status (exec_data *data, int *status);
+/* ------------------------------------------------------------------------- */
+int remote_agent_kill (const char *executor, pid_t id, int sig);
+/* ------------------------------------------------------------------------- */
+int remote_agent_get (const char *executor, const char *pattern,
+		      const char *folder);
+/* ------------------------------------------------------------------------- */
+int remote_agent_put (const char *executor, const char *file,
+		      const char *path);
+/* ------------------------------------------------------------------------- */
+void remote_agent_interrupt (void);
+/* ------------------------------------------------------------------------- */
+void remote_agent_close (void);
+/* ------------------------------------------------------------------------- */
+#endif                          /* REMOTE_AGENT_H */
+/* End of file */
@@ -30,9 +30,12 @@
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <wordexp.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/prctl.h>
 
 #include "testrunnerlite.h"
 #include "executor.h"
@@ -46,7 +49,7 @@
 
 /* ------------------------------------------------------------------------- */
 /* EXTERNAL GLOBAL VARIABLES */
-/* None */
+extern int bail_out;
 
 /* ------------------------------------------------------------------------- */
 /* EXTERNAL FUNCTION PROTOTYPES */
@@ -67,21 +70,64 @@
 /* ------------------------------------------------------------------------- */
 /* LOCAL GLOBAL VARIABLES */
 LOCAL char *unique_id = NULL;
+LOCAL struct _remote_target *remote_targets = NULL; /* initialized
+						       executors */
+LOCAL int remote_target_count = 0;
 /* ------------------------------------------------------------------------- */
 /* LOCAL CONSTANTS AND MACROS */
 #define UNIQUE_ID_FMT     "%d"
 #define PID_FILE_FMT      "/var/tmp/testrunner-lite-%s.%d.pid"
+#define PID_FILE_SH       "/var/tmp/testrunner-lite-%s.$trl_pid.pid"
+#define WRAPPER_FMT       "/tmp/testrunner-lite-%s"
+/* Deploys the step wrapper, which is sourced by the shell executing a
+ * step. The variables set by .profile are stored once in an env file,
+ * instead of sourcing .profile for each step. Variables .profile sets
+ * without exporting them are exported with allexport to be stored. */
+#define WRAPPER_DEPLOY "w=" WRAPPER_FMT "; export -p > $w.before; "	\
+	"if [ -e .profile ]; then set -a; . ./.profile > /dev/null; "	\
+	"set +a; fi; "							\
+	"export -p | grep -vxF -f $w.before > $w.env; rm -f $w.before; " \
+	"{ echo '. '$w.env; echo 'echo $$ > " PID_FILE_SH "'; "	\
+	"echo 'if [ -n \"$trl_mark\" ]; then "				\
+	"logger -- \"$trl_mark\" > /dev/null 2>&1 & fi'; } > $w.sh"
+#define WRAPPER_EXEC "trl_pid=%d trl_mark='%s' . " WRAPPER_FMT ".sh; %s"
+#define WRAPPER_REMOVE "w=" WRAPPER_FMT "; rm -f $w.sh $w.env"
 #define UNIQUE_ID_MAX_LEN (HOST_NAME_MAX + 10 + 1 + 1)
 #define PID_FILE_MAX_LEN  (30 + UNIQUE_ID_MAX_LEN + 10 + 1 + 1)
+#define MASTER_WAIT_MS    10000 /* longer than ssh ConnectTimeout */
+#define MASTER_POLL_MS    50
 
 /* ------------------------------------------------------------------------- */
 /* MODULE DATA STRUCTURES */
-/* None */
+/** Executor of a target, split to words once in remote_executor_init */
+typedef struct _remote_target {
+	char     *executor;  /**< executor string */
+	wordexp_t words;     /**< executor split to words */
+	int       multiplex; /**< ssh with ControlPath, connections share
+				a master connection */
+	pid_t     master;    /**< ssh master process, 0 if not running */
+} remote_target;
 /* ------------------------------------------------------------------------- */
 /* LOCAL FUNCTION PROTOTYPES */
 /* ------------------------------------------------------------------------- */
 LOCAL int _execute (const char *executor, const char *command);
 /* ------------------------------------------------------------------------- */
+LOCAL remote_target *find_target (const char *executor);
+/* ------------------------------------------------------------------------- */
+LOCAL remote_target *add_target (const char *executor);
+/* ------------------------------------------------------------------------- */
+LOCAL int exec_ssh (remote_target *t, const char **options);
+/* ------------------------------------------------------------------------- */
+LOCAL int ssh_control (remote_target *t, const char *command);
+/* ------------------------------------------------------------------------- */
+LOCAL void start_master (remote_target *t);
+/* ------------------------------------------------------------------------- */
+LOCAL void stop_master (remote_target *t);
+/* ------------------------------------------------------------------------- */
+LOCAL int run_child (const char *executor, const char *command);
+/* ------------------------------------------------------------------------- */
+LOCAL void quote_arg (char *dst, const char *src);
+/* ------------------------------------------------------------------------- */
 /* FORWARD DECLARATIONS */
 /* None */
 
@@ -97,10 +143,18 @@ LOCAL int _execute (const char *executor, const char *command)
 {
 	int ret = 0;
 	wordexp_t we;
+	wordexp_t *words = &we;
+	remote_target *t;
 	char **argv = NULL;
 	size_t argv_size;
 	size_t i;
 
+	/* executors given to remote_executor_init are already split */
+	t = find_target (executor);
+	if (t) {
+		words = &t->words;
+		goto split;
+	}
 	/* expand executor string to array of words */
 	ret = wordexp(executor, &we, 0);
 	if (ret) {
@@ -108,17 +162,18 @@ LOCAL int _execute (const char *executor, const char *command)
 				ret, executor);
 		goto out_no_wordfree;
 	}
+ split:
 
 	/* create argv from executor + command */
-	argv_size = we.we_wordc + 2; /* +2 for command and NULL */
+	argv_size = words->we_wordc + 2; /* +2 for command and NULL */
 	argv = malloc(argv_size * sizeof(char *));
 	if (argv == NULL) {
 		fprintf(stderr, "malloc failed");
 		ret = -1;
 		goto out;
 	}
-	for (i = 0; i < we.we_wordc; i++)
-		argv[i] = we.we_wordv[i];
+	for (i = 0; i < words->we_wordc; i++)
+		argv[i] = words->we_wordv[i];
 	argv[i] = (char *)command;
 	argv[i + 1] = NULL;
 
@@ -128,37 +183,207 @@ LOCAL int _execute (const char *executor, const char *command)
 	fprintf(stderr, "Failed to exec executor: %s", executor);
 
 out:
-	wordfree(&we);
+	if (words == &we)
+		wordfree(&we);
 out_no_wordfree:
 	if (argv)
 		free(argv);
 	return ret;
 }
 /* ------------------------------------------------------------------------- */
-/* ======================== FUNCTIONS ====================================== */
+/** Find an initialized executor
+ * @param executor executor string
+ * @return executor data or NULL if executor is not initialized
+ */
+LOCAL remote_target *find_target (const char *executor)
+{
+	int i;
+
+	for (i = 0; i < remote_target_count; i++)
+		if (!strcmp (remote_targets[i].executor, executor))
+			return &remote_targets[i];
+	return NULL;
+}
 /* ------------------------------------------------------------------------- */
-/** Init the remote executor
- * @param executor prepended to command to execute on DUT
- * @return 0 on success
+/** Split an executor to words and add it to initialized executors. Ssh
+ *  executors with a ControlPath option are multiplexed.
+ * @param executor executor string
+ * @return executor data or NULL on error
  */
-int remote_executor_init (const char *executor)
+LOCAL remote_target *add_target (const char *executor)
 {
-	int ret, status;
-	pid_t pid;
-	char *cmd = "echo '#!/bin/sh' > /tmp/mypid.sh;"
-		"echo 'echo $PPID' >> /tmp/mypid.sh;";
-	unique_id = (char *)malloc (UNIQUE_ID_MAX_LEN);
-	ret = gethostname(unique_id, HOST_NAME_MAX);
+	remote_target *t;
+	char *base;
+	size_t i;
+	int ret;
+
+	t = realloc (remote_targets, (remote_target_count + 1) * 
+		     sizeof (remote_target));
+	if (!t) {
+		LOG_MSG(LOG_ERR, "%s: FATAL : OOM", PROGNAME);
+		return NULL;
+	}
+	remote_targets = t;
+	t = &remote_targets[remote_target_count];
+	memset (t, 0x0, sizeof (remote_target));
+
+	ret = wordexp(executor, &t->words, 0);
 	if (ret) {
-		LOG_MSG(LOG_ERR, "Failed to get host name: %s", 
+		LOG_MSG(LOG_ERR, "Executor word expansion failed (%d): %s",
+				ret, executor);
+		return NULL;
+	}
+	t->executor = strdup (executor);
+	remote_target_count++;
+
+	base = strrchr (t->words.we_wordv[0], '/');
+	base = base ? base + 1 : t->words.we_wordv[0];
+	if (strcmp (base, "ssh"))
+		return t;
+	for (i = 1; i < t->words.we_wordc; i++)
+		if (strstr (t->words.we_wordv[i], "ControlPath="))
+			t->multiplex = 1;
+
+	return t;
+}
+/* ------------------------------------------------------------------------- */
+/** Execute ssh of an executor with options before the executor options.
+ *  The first value of an option is used by ssh, so these take precedence.
+ * @param t executor data
+ * @param options NULL terminated options to add
+ * @return error code from exec, no return on success
+ */
+LOCAL int exec_ssh (remote_target *t, const char **options)
+{
+	char **argv;
+	size_t i, n, count;
+
+	for (count = 0; options[count]; count++)
+		;
+	argv = malloc ((t->words.we_wordc + count + 1) * sizeof (char *));
+	if (argv == NULL)
+		return -1;
+	n = 0;
+	argv[n++] = t->words.we_wordv[0];
+	for (i = 0; i < count; i++)
+		argv[n++] = (char *)options[i];
+	for (i = 1; i < t->words.we_wordc; i++)
+		argv[n++] = t->words.we_wordv[i];
+	argv[n] = NULL;
+
+	execvp (argv[0], argv);
+	free (argv);
+
+	return -1;
+}
+/* ------------------------------------------------------------------------- */
+/** Send a control command to the ssh master of an executor
+ * @param t executor data
+ * @param command control command (check, exit)
+ * @return exit status of ssh, 0 on success
+ */
+LOCAL int ssh_control (remote_target *t, const char *command)
+{
+	const char *options[] = { "-O", command, NULL };
+	int status, fd;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		fd = open ("/dev/null", O_RDWR);
+		dup2 (fd, STDIN_FILENO);
+		dup2 (fd, STDOUT_FILENO);
+		dup2 (fd, STDERR_FILENO);
+		exec_ssh (t, options);
+		_exit (255);
+	}
+	if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status))
+		return -1;
+
+	return WEXITSTATUS (status);
+}
+/* ------------------------------------------------------------------------- */
+/** Start the ssh master connection of a multiplexed executor, unless it is
+ *  running. If the master can not be started, ssh connects directly.
+ * @param t executor data
+ */
+LOCAL void start_master (remote_target *t)
+{
+	const char *options[] = { "-o", "ControlMaster=yes",
+				  "-o", "ControlPersist=no", "-N", NULL };
+	int waited, fd;
+	pid_t pid, parent;
+
+	if (t->master) {
+		if (waitpid (t->master, NULL, WNOHANG) == 0)
+			return;
+		/* lost with the connection, for example on reboot */
+		t->master = 0;
+	}
+
+	parent = getpid();
+	pid = fork();
+	if (pid < 0) {
+		LOG_MSG(LOG_WARNING, "Failed to start ssh master: %s",
 			strerror (errno));
-		strncpy (unique_id, "foo", UNIQUE_ID_MAX_LEN);
+		return;
+	}
+	if (pid == 0) {
+		/* not interrupted with testrunner-lite, which stops it */
+		setpgid (0, 0);
+		signal (SIGINT, SIG_IGN);
+		/* nor left behind if testrunner-lite is killed */
+		if (prctl (PR_SET_PDEATHSIG, SIGTERM) == 0 &&
+		    getppid () != parent)
+			_exit (255);
+		fd = open ("/dev/null", O_RDWR);
+		dup2 (fd, STDIN_FILENO);
+		dup2 (fd, STDOUT_FILENO);
+		exec_ssh (t, options);
+		_exit (255);
 	}
-	snprintf (unique_id + strlen(unique_id),  UNIQUE_ID_MAX_LEN,
-		  UNIQUE_ID_FMT, getpid());
+	t->master = pid;
+
+	for (waited = 0; waited < MASTER_WAIT_MS; waited += MASTER_POLL_MS) {
+		if (ssh_control (t, "check") == 0) {
+			LOG_MSG(LOG_DEBUG, "ssh master %d started", pid);
+			return;
+		}
+		if (waitpid (pid, NULL, WNOHANG) == pid) {
+			t->master = 0;
+			break;
+		}
+		usleep (MASTER_POLL_MS * 1000);
+	}
+	LOG_MSG(LOG_WARNING, "ssh master connection not available, "
+		"connecting separately for each command");
+	stop_master (t);
+}
+/* ------------------------------------------------------------------------- */
+/** Stop the ssh master connection of an executor
+ * @param t executor data
+ */
+LOCAL void stop_master (remote_target *t)
+{
+	if (!t->master)
+		return;
+	kill (t->master, SIGTERM);
+	waitpid (t->master, NULL, 0);
+	t->master = 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Execute a command with executor in a child process and wait for it
+ * @param executor prepended to command to execute on DUT
+ * @param command command to execute
+ * @return exit status of executor, or wait status if it did not exit
+ */
+LOCAL int run_child (const char *executor, const char *command)
+{
+	int status;
+	pid_t pid;
 
-	LOG_MSG(LOG_DEBUG, "unique_id set to %s", unique_id);
-	
 	pid = fork();
 	if (pid > 0) { 
 		waitpid(pid, &status, 0);
@@ -168,8 +393,64 @@ int remote_executor_init (const char *executor)
 	}
 	if (pid < 0)
 		return pid;
-	
-	return _execute (executor, cmd);
+
+	_execute (executor, command);
+	_exit (255);
+}
+/* ------------------------------------------------------------------------- */
+/** Copy a string to be used inside single quotes in a shell command
+ * @param dst destination, 4 times the length of src + 1
+ * @param src string to copy
+ */
+LOCAL void quote_arg (char *dst, const char *src)
+{
+	for (; *src; src++) {
+		if (*src == '\'') {
+			strcpy (dst, "'\\''");
+			dst += 4;
+		} else
+			*dst++ = *src;
+	}
+	*dst = '\0';
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Init the remote executor
+ * @param executor prepended to command to execute on DUT
+ * @return 0 on success
+ */
+int remote_executor_init (const char *executor)
+{
+	int ret;
+	remote_target *t;
+	char cmd [sizeof (WRAPPER_DEPLOY) + 2 * UNIQUE_ID_MAX_LEN];
+	/* initialized once for every target of a sharded run */
+	if (!unique_id) {
+		unique_id = (char *)malloc (UNIQUE_ID_MAX_LEN);
+		ret = gethostname(unique_id, HOST_NAME_MAX);
+		if (ret) {
+			LOG_MSG(LOG_ERR, "Failed to get host name: %s", 
+				strerror (errno));
+			strncpy (unique_id, "foo", UNIQUE_ID_MAX_LEN);
+		}
+		snprintf (unique_id + strlen(unique_id),  UNIQUE_ID_MAX_LEN,
+			  UNIQUE_ID_FMT, getpid());
+
+		LOG_MSG(LOG_DEBUG, "unique_id set to %s", unique_id);
+	}
+
+	/* initialized again after reboot, restarting the master */
+	t = find_target (executor);
+	if (!t)
+		t = add_target (executor);
+	if (t && t->multiplex)
+		start_master (t);
+
+	/* deployed again after reboot, as .profile or /tmp may change */
+	snprintf (cmd, sizeof (cmd), WRAPPER_DEPLOY, unique_id, unique_id);
+
+	return run_child (executor, cmd);
 }
 /* ------------------------------------------------------------------------- */
 /** Executes a command using a remote executor
@@ -181,6 +462,7 @@ int remote_execute (const char *executor, const char *command)
 {
 	int   ret;
         char *cmd; 
+	char *mark;
 	const char *casename;
 	const char *setname;
 	int   stepnum;
@@ -193,44 +475,48 @@ int remote_execute (const char *executor, const char *command)
 	casename = current_case_name();
 	stepnum  = current_step_num();
 	setname  = current_set_name();
-	len = PID_FILE_MAX_LEN + 256 + strlen (command) + strlen (casename) + 
-		strlen (setname);
+	len = 4 * (strlen (casename) + strlen (setname)) + 64;
+	mark = (char *)malloc (len);
+	len += sizeof (WRAPPER_EXEC) + UNIQUE_ID_MAX_LEN + strlen (command);
         cmd = (char *)malloc (len);
-        if (!cmd) {
+        if (!cmd || !mark) {
                 fprintf (stderr, "%s: could not allocate memory for "
                          "command %s\n", __FUNCTION__, command);
+		return -1;
         }
-	if (strlen (casename) && strlen (setname)) 
-		snprintf (cmd, len, "logger set:%s-case:%s-step:%d || true;"
-			 "sh < /tmp/mypid.sh > " 
-			 PID_FILE_FMT 
-			 "; if [ -e .profile ]; then source .profile >"
-			 " /dev/null; fi; %s", setname, casename, stepnum, 
-			 unique_id, getpid(), command);
-	else
-		snprintf (cmd, len, "sh < /tmp/mypid.sh > " 
-			 PID_FILE_FMT 
-			 "; if [ -e .profile ]; then source .profile >"
-			 " /dev/null; fi; %s",
-			 unique_id, getpid(), command);
+	mark[0] = '\0';
+	if (strlen (casename) && strlen (setname)) {
+		strcpy (mark, "set:");
+		quote_arg (mark + strlen (mark), setname);
+		strcat (mark, "-case:");
+		quote_arg (mark + strlen (mark), casename);
+		sprintf (mark + strlen (mark), "-step:%d", stepnum);
+	}
+	/* wrapper writes the pid file and logs the step to target syslog */
+	snprintf (cmd, len, WRAPPER_EXEC, getpid(), mark, unique_id, command);
+	free (mark);
 
 	ret = _execute (executor, cmd);
         return ret;
 }
 /* ------------------------------------------------------------------------- */
+/** Executes a command using a remote executor without the step wrapper
+ * @param executor prepended to command to execute on DUT
+ * @param command Command to execute
+ * @return Does not return in success, error code from exec in case of error
+ */
+int remote_exec (const char *executor, const char *command)
+{
+	return _execute (executor, command);
+}
+/* ------------------------------------------------------------------------- */
 /** Tries to check if remote connections are still working
  * @param executor prepended to command to execute on DUT
  * @return 0 or executor error code
  */
 int remote_check_conn (const char *executor)
 {
-	int ret;
-	char cmd[1024];
-
-	snprintf (cmd, 1024, "%s \"echo echo from remote connection check\"", 
-		 executor);
-	ret = system (cmd);
-	return ret;
+	return run_child (executor, "echo echo from remote connection check");
 }
 /* ------------------------------------------------------------------------- */
 /** Tries to kill program started by remote executor and removes temporary file
@@ -270,26 +556,12 @@ int remote_kill (const char *executor, pid_t id, int signal)
  */
 int remote_clean (const char *executor, pid_t id)
 {
-	int status;
-	pid_t pid;
 	char cmd [PID_FILE_MAX_LEN + 80];
 
 	snprintf (cmd, PID_FILE_MAX_LEN + 80,
 		  "rm -f " PID_FILE_FMT, unique_id, id);
 
-	pid = fork();
-
-	if (pid > 0) {
-		waitpid(pid, &status, 0);
-		if (WIFEXITED(status))
-			return WEXITSTATUS(status);
-		return status;
-	}
-	if (pid < 0)
-		return pid;
-
-	/* child: clean up target */
-	return _execute (executor, cmd);
+	return run_child (executor, cmd);
 }
 /* ------------------------------------------------------------------------- */
 /** Clean up
@@ -297,8 +569,30 @@ int remote_clean (const char *executor, pid_t id)
  */
 int remote_executor_close (void)
 {
+	char cmd [sizeof (WRAPPER_REMOVE) + UNIQUE_ID_MAX_LEN];
+	int i;
+
+	for (i = 0; i < remote_target_count; i++) {
+		/* not waiting for a connection that was lost */
+		if (unique_id && !bail_out) {
+			snprintf (cmd, sizeof (cmd), WRAPPER_REMOVE, unique_id);
+			run_child (remote_targets[i].executor, cmd);
+		}
+		if (remote_targets[i].master &&
+		    ssh_control (&remote_targets[i], "exit") == 0)
+			waitpid (remote_targets[i].master, NULL, 0);
+		else
+			stop_master (&remote_targets[i]);
+		remote_targets[i].master = 0;
+		wordfree (&remote_targets[i].words);
+		free (remote_targets[i].executor);
+	}
+	free (remote_targets);
+	remote_targets = NULL;
+	remote_target_count = 0;
 
 	free (unique_id);
+	unique_id = NULL;
 
 	return 0;
 }
@@ -29,9 +29,15 @@
 #include <limits.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <libssh2.h>
+#include <libssh2_sftp.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "testrunnerlite.h"
 #include "executor.h"
@@ -71,6 +77,14 @@
 #define LIBSSH2_TIMEOUT 3
 /* Size we try to read from ssh session */
 #define CHANNEL_BUFFER_SIZE 1024
+/* Size we try to read from a remote file. libssh2 sends the SFTP read
+   requests of a large read ahead, so a transfer is not limited by the
+   round trip time of each request */
+#define SFTP_BUFFER_SIZE (256 * 1024)
+/* How many select timeouts in a row before a file transfer is given up */
+#define MAX_SFTP_STALLS 10
+/* Size of the buffers of the agent channel pump */
+#define PIPE_BUFFER_SIZE (32 * 1024)
 #define KNOWN_HOSTS_FILE "known_hosts"
 #define DEFAULT_PUBLIC_KEY "~/.ssh/id_eat_dsa.pub"
 #define DEFAULT_PRIVATE_KEY "~/.ssh/id_eat_dsa"
@@ -106,9 +120,8 @@ kill -9 $PPID\n\
 fi\n\
 exit $ret\n' > /var/tmp/testrunner-lite.sh"
 
-/* State machine for timeouts and signals */
-/* TODO in the future: support multiple sessions, now there's
-   need for only one */
+/* State machine for timeouts and signals. Timeouts are timed by the
+   deadline of the step, signals are process wide. */
 typedef enum {
 	OK = 1,
 	SOFT_TIMEOUT,
@@ -134,17 +147,30 @@ const useconds_t conn_sleep = 10000;
 
 /* ------------------------------------------------------------------------- */
 /* MODULE DATA STRUCTURES */
-/* none */
+/* A channel of the session served by a thread, see lssh2_pipe_open() */
+struct lssh2_pipe {
+	libssh2_conn *conn;
+	LIBSSH2_CHANNEL *channel;
+	int to_fd;                 /* read end of the stdin of the command */
+	int from_fd;               /* write end of the stdout of the command */
+	int wake[2];               /* wakes the pump from poll() */
+	volatile int interrupted;  /* set by lssh2_pipe_interrupt() */
+	volatile int lost;         /* the session has been closed under it */
+	volatile int done;         /* the pump has ended */
+	pthread_t thread;
+};
+
+/* The session is used both by the main thread and by the pump of the
+   agent channel, libssh2 calls are serialized with the lock */
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+/* The running pump, or NULL */
+static lssh2_pipe *pump = NULL;
 /* ------------------------------------------------------------------------- */
 /* LOCAL FUNCTION PROTOTYPES */
 /* ------------------------------------------------------------------------- */
-static int lssh2_set_timer(unsigned long timeout); 
-/* ------------------------------------------------------------------------- */
-static void lssh2_stop_timer();
+static void lssh2_check_deadline(libssh2_conn *conn);
 /* ------------------------------------------------------------------------- */
-static void lssh2_timeout(int signal, siginfo_t *siginfo, void *data);
-/* ------------------------------------------------------------------------- */
-static int lssh2_check_status(libssh2_conn *conn, exec_data *data);
+static int lssh2_check_status(libssh2_conn *conn);
 /* ------------------------------------------------------------------------- */
 static int lssh2_setup_socket(libssh2_conn *conn);
 /* ------------------------------------------------------------------------- */
@@ -169,99 +195,68 @@ static int lssh2_create_shell_scripts(libssh2_conn *conn);
 /* ------------------------------------------------------------------------- */
 static int lssh2_kill (libssh2_conn *conn, int signal);
 /* ------------------------------------------------------------------------- */
+static int lssh2_wait(libssh2_conn *conn, int *stalls);
+/* ------------------------------------------------------------------------- */
+static LIBSSH2_SFTP *lssh2_sftp_open(libssh2_conn *conn);
+/* ------------------------------------------------------------------------- */
+static void lssh2_sftp_shutdown(libssh2_conn *conn);
+/* ------------------------------------------------------------------------- */
+static int lssh2_sftp_errno(libssh2_conn *conn);
+/* ------------------------------------------------------------------------- */
+static int lssh2_sftp_fetch(libssh2_conn *conn, const char *path, 
+			    const char *folder);
+/* ------------------------------------------------------------------------- */
 static char *replace(char const *const cmd, char const *const pat, 
 		     char const *const rep);
 /* ------------------------------------------------------------------------- */
 static int lssh2_verify_keypair(libssh2_conn *conn, const char *username, 
                                 const char *ssh_key);
 /* ------------------------------------------------------------------------- */
+static void lssh2_lock(void);
+/* ------------------------------------------------------------------------- */
+static void lssh2_unlock(void);
+/* ------------------------------------------------------------------------- */
+static void lssh2_pipe_lose(libssh2_conn *conn);
+/* ------------------------------------------------------------------------- */
+static int lssh2_write_fd(int fd, const char *buf, size_t len);
+/* ------------------------------------------------------------------------- */
+static void *lssh2_pump(void *arg);
+/* ------------------------------------------------------------------------- */
+static int lssh2_sftp_get(libssh2_conn *conn, const char *pattern, 
+			  const char *folder);
+/* ------------------------------------------------------------------------- */
 /* FORWARD DECLARATIONS */
 /* None */
 
 /* ------------------------------------------------------------------------- */
 /* ==================== LOCAL FUNCTIONS ==================================== */
 /* ------------------------------------------------------------------------- */
-/** Initialize timer and set signal action for SIGALRM
- * @param first_timeout seconds to first timeout
- * @param first_timeout seconds to second timeout
- *
- * @return 0 in success, -1 in error
- */
-static int lssh2_set_timer(unsigned long timeout)
-{
-	struct sigaction act;
-	struct itimerval timer;
-	int ret = 0;
-
-	act.sa_sigaction = &lssh2_timeout;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = 0;
-	timer.it_value.tv_sec = timeout;
-	timer.it_value.tv_usec = 0;
-	timer.it_interval.tv_sec = 0;
-	timer.it_interval.tv_usec = 0;
-
-	/* set signal action. */
-	ret = sigaction(SIGALRM, &act, NULL);
-	if (ret < 0) {
-		LOG_MSG(LOG_DEBUG, "sigaction() failed: %s", strerror(ret));
-		return -1;
-	}
-   
-	ret = setitimer(ITIMER_REAL, &timer, NULL);
-	if (ret < 0) {
-		LOG_MSG(LOG_DEBUG, "setitimer() failed: %s", strerror(ret));
-		return -1;
-	}
-
-	LOG_MSG(LOG_DEBUG, "Timeout set to %u second(s)", 
-	        timeout);
-
-	return 0;
-}
-
-/* ------------------------------------------------------------------------- */
-/** Reset timer and restore signal action of SIGALRM
+/** Moves the state machine on when a timeout of the running step expires.
+ *  The processes are killed later by lssh2_check_status().
  */
-static void lssh2_stop_timer() 
+static void lssh2_check_deadline(libssh2_conn *conn) 
 {
-	struct itimerval timer;
-	timer.it_interval.tv_sec = 0;
-	timer.it_interval.tv_usec = 0;
-	timer.it_value.tv_sec = 0;
-	timer.it_value.tv_usec = 0;
+	if (!conn->deadline)
+		return;
 
-	if (setitimer(ITIMER_REAL, &timer, NULL) < 0) {
-		perror("setitimer");
-	}
-	LOG_MSG(LOG_DEBUG, "Timer stopped");
-}
-/* ------------------------------------------------------------------------- */
-/** Signal handler that tries to resolve a soft timeout in a polite manner. 
-    And a hard timeout with brute force.
- */
-static void lssh2_timeout(int signal, siginfo_t *siginfo, void *data) 
-{
-	if (signal == SIGALRM) {
-		switch(trlite_status) {
-		case OK:
+	switch (deadline_check(conn->deadline)) {
+	case DEADLINE_SOFT:
+		if (trlite_status == OK)
 			trlite_status = SOFT_TIMEOUT;
-			break;
-		case SOFT_TIMEOUT_KILLED:
-		case SIGNALED_SIGINT:
-		case SIGNALED_SIGTERM:			
+		break;
+	case DEADLINE_HARD:
+		if (trlite_status == SOFT_TIMEOUT_KILLED)
 			trlite_status = HARD_TIMEOUT;
-			break;
-		default:
-			break;
-		}
+		break;
+	default:
+		break;
 	}
 }
 /* ------------------------------------------------------------------------- */
-/** Checks during reading if the timeout timer has expired, or if process was
- *   signaled. Kills processes accordingly.
+/** Checks during reading if the timeout of the step has expired, or if
+ *  process was signaled. Kills processes accordingly.
  */
-static int lssh2_check_status(libssh2_conn *conn, exec_data *data) 
+static int lssh2_check_status(libssh2_conn *conn) 
 {
 	if (!conn || conn->status == SESSION_GIVE_UP) {
 		LOG_MSG(LOG_ERR, "No connection");
@@ -274,17 +269,14 @@ static int lssh2_check_status(libssh2_conn *conn, exec_data *data)
 		break;
 	case SOFT_TIMEOUT:
 		LOG_MSG(LOG_DEBUG, "Soft timeout, sending SIGTERM");
-		lssh2_stop_timer();
 		lssh2_kill(conn, SIGTERM);
 		trlite_status = SOFT_TIMEOUT_KILLED;
-		lssh2_set_timer(data->hard_timeout);
 		break;
 	case SOFT_TIMEOUT_KILLED:
 		//LOG_MSG(LOG_DEBUG, "Soft timeout, already killed");
 		break;
 	case HARD_TIMEOUT:
 		LOG_MSG(LOG_DEBUG, "Hard timeout, sending SIGKILL");
-		lssh2_stop_timer();
 		lssh2_kill(conn, SIGKILL);
 		trlite_status = HARD_TIMEOUT_KILLED;
 		break;
@@ -293,17 +285,17 @@ static int lssh2_check_status(libssh2_conn *conn, exec_data *data)
 		break;
 	case SIGNALED_SIGINT:
 		LOG_MSG(LOG_DEBUG, "Sending SIGINT");
-		lssh2_stop_timer();
 		lssh2_kill(conn, SIGINT);
 		trlite_status = SOFT_TIMEOUT_KILLED;
-		lssh2_set_timer(data->hard_timeout);
+		if (conn->deadline)
+			deadline_escalate(conn->deadline);
 		break;
 	case SIGNALED_SIGTERM:
 		LOG_MSG(LOG_DEBUG, "Sending SIGTERM");
-		lssh2_stop_timer();
 		lssh2_kill(conn, SIGTERM);
 		trlite_status = SOFT_TIMEOUT_KILLED;
-		lssh2_set_timer(data->hard_timeout);
+		if (conn->deadline)
+			deadline_escalate(conn->deadline);
 		break;
 	case EXIT:
 		LOG_MSG(LOG_INFO, "exiting... hurry up");
@@ -536,6 +528,7 @@ static int lssh2_session_free(libssh2_conn *conn)
 		LOG_MSG(LOG_DEBUG, "No SSH session");
 		return -1;
 	}
+	lssh2_pipe_lose(conn);
 
 	exec_data data;
 	data.stdout_data.buffer = NULL;
@@ -558,6 +551,7 @@ static int lssh2_session_free(libssh2_conn *conn)
 		LOG_MSG(LOG_ERR, "Cleaning shell scripts failed");
 	}
 	
+	lssh2_sftp_shutdown(conn);
 
 	if (conn->ssh2_session) {
 		if (libssh2_session_disconnect(conn->ssh2_session, NULL) < 0) {
@@ -598,6 +592,8 @@ static int lssh2_session_free(libssh2_conn *conn)
 static int lssh2_session_reconnect(libssh2_conn *conn) 
 {
 
+	lssh2_pipe_lose(conn);
+	lssh2_sftp_shutdown(conn);
 	if (conn->ssh2_session) {
 		if (libssh2_session_disconnect(conn->ssh2_session, NULL) < 0) {
 			/* Ignore */
@@ -716,28 +712,41 @@ static int lssh2_setup_socket(libssh2_conn *conn)
  */
 static int lssh2_select(libssh2_conn *conn) 
 {
+	fd_set readfd;
+	fd_set writefd;
+	int nfds = conn->sock + 1;
 	int n;
 	int dir;
 
-	FD_ZERO(&conn->nfd);
-	FD_SET(conn->sock, &conn->nfd);
+	FD_ZERO(&readfd);
+	FD_ZERO(&writefd);
 
 	/* Get direction */
 	dir = libssh2_session_block_directions(conn->ssh2_session);
 
 	if (dir & LIBSSH2_SESSION_BLOCK_INBOUND) {
-		conn->readfd = &conn->nfd;
+		FD_SET(conn->sock, &readfd);
 	}
 
 	if (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND) {
-		conn->writefd = &conn->nfd;
+		FD_SET(conn->sock, &writefd);
 	}
 
-	n = pselect(conn->sock + 1, conn->readfd, conn->writefd, NULL, 
+	/* Wake up also when a timeout of the step expires */
+	if (conn->deadline && conn->deadline->fd >= 0) {
+		FD_SET(conn->deadline->fd, &readfd);
+		if (conn->deadline->fd >= nfds)
+			nfds = conn->deadline->fd + 1;
+	}
+
+	n = pselect(nfds, &readfd, &writefd, NULL, 
 	           &conn->timeout, &blocked_signals);
 
 	if (n < 0) {
 		LOG_MSG(LOG_DEBUG, "pselect() failed: %s", strerror(errno));
+	} else if (conn->deadline && conn->deadline->fd >= 0 &&
+		   FD_ISSET(conn->deadline->fd, &readfd)) {
+		lssh2_check_deadline(conn);
 	}
 	LOG_MSG(LOG_DEBUG, "select returned %d", n);
 
@@ -823,7 +832,7 @@ static int lssh2_read_output(libssh2_conn *conn,
 		if (n_stdout == LIBSSH2_ERROR_EAGAIN ||
 		    n_stderr == LIBSSH2_ERROR_EAGAIN) {
 			lssh2_select(conn);	
-			lssh2_check_status(conn, data);
+			lssh2_check_status(conn);
 			if (conn->status == SESSION_GIVE_UP) {
 				LOG_MSG(LOG_DEBUG, "Session died, giving up...");
 				conn->signaled = SIGKILL;
@@ -1202,6 +1211,461 @@ static int lssh2_verify_keypair(libssh2_conn *conn, const char *username,
 
 }
 
+/* ------------------------------------------------------------------------- */
+/** Waits for the session after a file transfer operation returned EAGAIN
+ * @param conn SSH session
+ * @param stalls count of select timeouts in a row
+ * @return 0 to retry the operation, -1 to give up
+ */
+static int lssh2_wait(libssh2_conn *conn, int *stalls)
+{
+	int n;
+
+	if (trlite_status != OK)
+		return -1;
+
+	n = lssh2_select(conn);
+	if (n > 0) {
+		*stalls = 0;
+	} else if (n == 0 && ++(*stalls) > MAX_SFTP_STALLS) {
+		LOG_MSG(LOG_ERR, "SFTP transfer stalled");
+		return -1;
+	}
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Opens the SFTP subsystem on the session, once for the session
+ * @param conn SSH session
+ * @return SFTP session, NULL if not available
+ */
+static LIBSSH2_SFTP *lssh2_sftp_open(libssh2_conn *conn)
+{
+	int stalls = 0;
+
+	if (conn->sftp_session || conn->sftp_unavailable)
+		return conn->sftp_session;
+
+	while ((conn->sftp_session = libssh2_sftp_init(conn->ssh2_session)) 
+	       == NULL &&
+	       libssh2_session_last_error(conn->ssh2_session, NULL, NULL, 0)
+	       == LIBSSH2_ERROR_EAGAIN) {
+		if (lssh2_wait(conn, &stalls) < 0)
+			break;
+	}
+	if (!conn->sftp_session) {
+		LOG_MSG(LOG_WARNING, "SFTP not available on target, "
+			"using scp for get files");
+		conn->sftp_unavailable = 1;
+	}
+	return conn->sftp_session;
+}
+/* ------------------------------------------------------------------------- */
+/** Closes the SFTP subsystem of the session
+ * @param conn SSH session
+ */
+static void lssh2_sftp_shutdown(libssh2_conn *conn)
+{
+	int channel_retries = 0;
+
+	if (!conn->sftp_session)
+		return;
+
+	while (libssh2_sftp_shutdown(conn->sftp_session) == 
+	       LIBSSH2_ERROR_EAGAIN && 
+	       channel_retries++ < MAX_SSH_CHANNEL_RETRIES) {
+		lssh2_select(conn);
+	}
+	conn->sftp_session = NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Maps the last error of an SFTP operation to errno
+ * @param conn SSH session
+ * @return errno value
+ */
+static int lssh2_sftp_errno(libssh2_conn *conn)
+{
+	if (libssh2_session_last_error(conn->ssh2_session, NULL, NULL, 0) !=
+	    LIBSSH2_ERROR_SFTP_PROTOCOL)
+		return EIO;
+
+	switch (libssh2_sftp_last_error(conn->sftp_session)) {
+	case LIBSSH2_FX_NO_SUCH_FILE:
+	case LIBSSH2_FX_NO_SUCH_PATH:
+		return ENOENT;
+	case LIBSSH2_FX_PERMISSION_DENIED:
+		return EACCES;
+	default:
+		return EIO;
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Copies a file from remote end to a local folder over SFTP. The file is
+ *  written to a temporary file in the folder and renamed when complete, 
+ *  an earlier copy is kept if the transfer fails.
+ * @param conn SSH session
+ * @param path path of the file at remote end
+ * @param folder local destination folder, ends with /
+ * @return 0 on success, errno if fails
+ */
+static int lssh2_sftp_fetch(libssh2_conn *conn, const char *path, 
+			    const char *folder)
+{
+	LIBSSH2_SFTP_HANDLE *handle;
+	const char *name;
+	char *dest = NULL;
+	char *tmp = NULL;
+	char *buffer = NULL;
+	ssize_t n, written, ret;
+	int fd = -1;
+	int stalls = 0;
+	int error = 0;
+	size_t len;
+
+	while ((handle = libssh2_sftp_open(conn->sftp_session, path, 
+					   LIBSSH2_FXF_READ, 0)) == NULL &&
+	       libssh2_session_last_error(conn->ssh2_session, NULL, NULL, 0)
+	       == LIBSSH2_ERROR_EAGAIN) {
+		if (lssh2_wait(conn, &stalls) < 0)
+			return ETIMEDOUT;
+	}
+	if (!handle)
+		return lssh2_sftp_errno(conn);
+
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	len = strlen(folder) + strlen(name) + strlen("..XXXXXX") + 1;
+	dest = malloc(len);
+	tmp = malloc(len);
+	buffer = malloc(SFTP_BUFFER_SIZE);
+	if (!dest || !tmp || !buffer) {
+		error = ENOMEM;
+		goto out;
+	}
+	snprintf(dest, len, "%s%s", folder, name);
+	snprintf(tmp, len, "%s.%s.XXXXXX", folder, name);
+
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0 || fchmod(fd, 0644) < 0) {
+		error = errno;
+		goto out;
+	}
+
+	while (1) {
+		n = libssh2_sftp_read(handle, buffer, SFTP_BUFFER_SIZE);
+		if (n == LIBSSH2_ERROR_EAGAIN) {
+			if (lssh2_wait(conn, &stalls) < 0) {
+				error = ETIMEDOUT;
+				break;
+			}
+			continue;
+		}
+		if (n < 0) {
+			error = lssh2_sftp_errno(conn);
+			break;
+		}
+		if (n == 0)
+			break;
+		stalls = 0;
+		for (written = 0; written < n; written += ret) {
+			ret = write(fd, buffer + written, n - written);
+			if (ret < 0 && errno == EINTR) {
+				ret = 0;
+			} else if (ret < 0) {
+				error = errno;
+				goto out;
+			}
+		}
+	}
+
+ out:
+	if (fd >= 0 && close(fd) < 0 && !error)
+		error = errno;
+	if (fd >= 0 && !error && rename(tmp, dest) < 0)
+		error = errno;
+	if (fd >= 0 && error)
+		unlink(tmp);
+	while (libssh2_sftp_close(handle) == LIBSSH2_ERROR_EAGAIN &&
+	       lssh2_wait(conn, &stalls) == 0)
+		;
+	free(buffer);
+	free(tmp);
+	free(dest);
+	return error;
+}
+/* ------------------------------------------------------------------------- */
+/** Copies files from remote end over SFTP with the session locked, 
+ *  see lssh2_get()
+ * @param conn SSH session
+ * @param pattern path of the files at remote end
+ * @param folder local destination folder, ends with /
+ * @return as lssh2_get()
+ */
+static int lssh2_sftp_get(libssh2_conn *conn, const char *pattern, 
+			  const char *folder)
+{
+	LIBSSH2_SFTP_HANDLE *dir;
+	LIBSSH2_SFTP_ATTRIBUTES attrs;
+	char name[PATH_MAX];
+	char *dirname;
+	char *path;
+	const char *base;
+	const char *wildcard;
+	int n, ret;
+	int stalls = 0;
+	int error = 0;
+	int matched = 0;
+	size_t len;
+
+	if (!conn || conn->status == SESSION_GIVE_UP || !conn->ssh2_session)
+		return -1;
+
+	/* other expansions of the remote shell are left to scp */
+	if (strpbrk(pattern, "~$`{ "))
+		return -1;
+	base = strrchr(pattern, '/');
+	base = base ? base + 1 : pattern;
+	wildcard = strpbrk(pattern, "*?[");
+	if (wildcard && wildcard < base)
+		return -1;
+
+	if (!lssh2_sftp_open(conn))
+		return -1;
+
+	if (!wildcard) {
+		error = lssh2_sftp_fetch(conn, pattern, folder);
+		goto out;
+	}
+
+	dirname = strndup(pattern, base - pattern);
+	if (!dirname)
+		return ENOMEM;
+	while ((dir = libssh2_sftp_opendir(conn->sftp_session, 
+					   *dirname ? dirname : ".")) == NULL &&
+	       libssh2_session_last_error(conn->ssh2_session, NULL, NULL, 0)
+	       == LIBSSH2_ERROR_EAGAIN) {
+		if (lssh2_wait(conn, &stalls) < 0)
+			break;
+	}
+	if (!dir) {
+		error = lssh2_sftp_errno(conn);
+		free(dirname);
+		goto out;
+	}
+
+	while (1) {
+		n = libssh2_sftp_readdir(dir, name, sizeof(name), &attrs);
+		if (n == LIBSSH2_ERROR_EAGAIN) {
+			if (lssh2_wait(conn, &stalls) < 0) {
+				error = ETIMEDOUT;
+				break;
+			}
+			continue;
+		}
+		if (n < 0)
+			error = lssh2_sftp_errno(conn);
+		if (n <= 0)
+			break;
+		if (fnmatch(base, name, FNM_PERIOD))
+			continue;
+		/* scp without -r does not copy directories either */
+		if ((attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) &&
+		    !LIBSSH2_SFTP_S_ISREG(attrs.permissions))
+			continue;
+
+		len = strlen(dirname) + strlen(name) + 1;
+		path = malloc(len);
+		if (!path) {
+			error = ENOMEM;
+			break;
+		}
+		snprintf(path, len, "%s%s", dirname, name);
+		LOG_MSG(LOG_DEBUG, "Fetching %s over SFTP", path);
+		ret = lssh2_sftp_fetch(conn, path, folder);
+		if (ret && !error)
+			error = ret;
+		matched++;
+		free(path);
+	}
+
+	while (libssh2_sftp_closedir(dir) == LIBSSH2_ERROR_EAGAIN &&
+	       lssh2_wait(conn, &stalls) == 0)
+		;
+	free(dirname);
+
+	if (!matched && !error)
+		error = ENOENT;
+ out:
+	/* a failed transfer is retried with scp */
+	if (error == ETIMEDOUT || error == EIO)
+		return -1;
+	return error;
+}
+/* ------------------------------------------------------------------------- */
+/** Takes the session for the main thread
+ */
+static void lssh2_lock(void)
+{
+	pthread_mutex_lock(&session_lock);
+}
+/* ------------------------------------------------------------------------- */
+/** Releases the session taken with lssh2_lock(). libssh2 may have read
+ *  data of the agent channel meanwhile, so the pump is woken up to check.
+ */
+static void lssh2_unlock(void)
+{
+	pthread_mutex_unlock(&session_lock);
+	if (pump && write(pump->wake[1], "", 1) < 0) {
+		/* the pump has been woken up already */
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Marks the channel of the pump dead when its session is closed or
+ *  reconnected. Called with the session locked.
+ * @param conn SSH session
+ */
+static void lssh2_pipe_lose(libssh2_conn *conn)
+{
+	if (pump && pump->conn == conn)
+		pump->lost = 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Writes all of the data to a file descriptor
+ * @param fd file descriptor
+ * @param buf data
+ * @param len length of data
+ * @return 0 on success, -1 on error
+ */
+static int lssh2_write_fd(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Passes data between the pipes and the channel until either end closes
+ *  or the pipe is interrupted. libssh2 is only called with the session
+ *  locked, the pipes are written without the lock.
+ * @param arg the pipe
+ * @return NULL
+ */
+static void *lssh2_pump(void *arg)
+{
+	lssh2_pipe *p = (lssh2_pipe *)arg;
+	LIBSSH2_CHANNEL *channel = p->channel;
+	struct pollfd fds[3];
+	char *in, *out;
+	char junk[64];
+	ssize_t in_len = 0, in_done = 0;
+	ssize_t n, m, e, w;
+	int dir, eof, exitcode;
+	int in_eof = 0;
+	sigset_t set;
+
+	/* signals are left to the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	in = malloc(PIPE_BUFFER_SIZE);
+	out = malloc(PIPE_BUFFER_SIZE);
+
+	while (in && out && !p->interrupted) {
+		n = m = e = 0;
+		pthread_mutex_lock(&session_lock);
+		if (p->lost) {
+			pthread_mutex_unlock(&session_lock);
+			break;
+		}
+		if (in_done < in_len)
+			n = libssh2_channel_write(channel, in + in_done,
+						  in_len - in_done);
+		else if (in_eof == 1 &&
+			 libssh2_channel_send_eof(channel) != 
+			 LIBSSH2_ERROR_EAGAIN)
+			in_eof = 2;
+		m = libssh2_channel_read(channel, out, PIPE_BUFFER_SIZE);
+		if (m <= 0)
+			e = libssh2_channel_read_stderr(channel, out, 
+							PIPE_BUFFER_SIZE);
+		eof = libssh2_channel_eof(channel);
+		dir = libssh2_session_block_directions(p->conn->ssh2_session);
+		pthread_mutex_unlock(&session_lock);
+
+		if ((n < 0 && n != LIBSSH2_ERROR_EAGAIN) ||
+		    (m < 0 && m != LIBSSH2_ERROR_EAGAIN) ||
+		    (e < 0 && e != LIBSSH2_ERROR_EAGAIN)) {
+			LOG_MSG(LOG_ERR, "Agent channel failed, error %d",
+				(int)(n < 0 && n != LIBSSH2_ERROR_EAGAIN ? n :
+				      m < 0 && m != LIBSSH2_ERROR_EAGAIN ? m :
+				      e));
+			break;
+		}
+		if (n > 0)
+			in_done += n;
+		if (m > 0 && lssh2_write_fd(p->from_fd, out, m) < 0)
+			break;
+		/* diagnostics of the agent go where the ssh client puts them */
+		if (e > 0 && write(STDERR_FILENO, out, e) < 0) {
+			/* nowhere to report */
+		}
+		if (m > 0 || e > 0 || n > 0)
+			continue;
+		if (eof)
+			break;
+
+		fds[0].fd = p->conn->sock;
+		fds[0].events = POLLIN;
+		if (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+			fds[0].events |= POLLOUT;
+		/* the next frame is read when the previous one is sent */
+		fds[1].fd = in_done < in_len || in_eof ? -1 : p->to_fd;
+		fds[1].events = POLLIN;
+		fds[2].fd = p->wake[0];
+		fds[2].events = POLLIN;
+		if (poll(fds, 3, LIBSSH2_TIMEOUT * 1000) < 0 && errno != EINTR)
+			break;
+		if (fds[2].revents & POLLIN)
+			while (read(p->wake[0], junk, sizeof(junk)) > 0)
+				;
+		if (fds[1].revents) {
+			w = read(p->to_fd, in, PIPE_BUFFER_SIZE);
+			/* the command sees the end of its stdin, and its
+			   output is read until it exits */
+			if (w == 0 || (w < 0 && errno != EINTR))
+				in_eof = 1;
+			if (w > 0) {
+				in_len = w;
+				in_done = 0;
+			}
+		}
+	}
+
+	pthread_mutex_lock(&session_lock);
+	if (!p->lost) {
+		while (in_eof != 2 && libssh2_channel_send_eof(channel) == 
+		       LIBSSH2_ERROR_EAGAIN && lssh2_select(p->conn) > 0)
+			;
+		lssh2_channel_close(p->conn, channel, &exitcode);
+	}
+	p->channel = NULL;
+	pthread_mutex_unlock(&session_lock);
+
+	/* the reader of the pipe sees the end */
+	close(p->from_fd);
+	p->from_fd = -1;
+	p->done = 1;
+	free(in);
+	free(out);
+	return NULL;
+}
 /* ------------------------------------------------------------------------- */
 /* ======================== FUNCTIONS ====================================== */
 /* ------------------------------------------------------------------------- */
@@ -1222,11 +1686,12 @@ static int lssh2_verify_keypair(libssh2_conn *conn, const char *username,
 	conn->username = username;
 	conn->port = port;
 	conn->password = "";
-	conn->writefd = NULL;
-	conn->readfd = NULL;
+	conn->deadline = NULL;
 	conn->timeout.tv_sec = LIBSSH2_TIMEOUT;
 	conn->timeout.tv_nsec = 0;
 	conn->signaled = 0;
+	conn->sftp_session = NULL;
+	conn->sftp_unavailable = 0;
 	
 	if (lssh2_verify_keypair(conn, username, ssh_key) < 0) {
 		free(conn);
@@ -1299,6 +1764,7 @@ int lssh2_execute(libssh2_conn *conn, const char *command,
 	if (!log_cmd) {
 		return ret;
 	}
+	lssh2_lock();
 	snprintf (log_cmd, log_cmd_size, "logger set:%s-case:%s-step:%d",
 	          setname, casename, stepnum);
 		
@@ -1314,7 +1780,8 @@ int lssh2_execute(libssh2_conn *conn, const char *command,
 	test_cmd = malloc(test_cmd_size);
 	snprintf(test_cmd, test_cmd_size, TRLITE_RUN_CMD, command);
 	LOG_MSG(LOG_DEBUG, "Executing test command: %s\n", test_cmd);
-	lssh2_set_timer(data->soft_timeout);
+	deadline_start(&data->deadline, data->soft_timeout, data->hard_timeout);
+	conn->deadline = &data->deadline;
 	if (lssh2_execute_command(conn, test_cmd, data) < 0) {
 		LOG_MSG(LOG_ERR, "Executing test command failed");
 		ret = -1;
@@ -1330,9 +1797,11 @@ int lssh2_execute(libssh2_conn *conn, const char *command,
 		conn->signaled = 0;
 	}
 
-	lssh2_stop_timer();
+	conn->deadline = NULL;
+	deadline_stop(&data->deadline);
 	LOG_MSG(LOG_DEBUG, "Test step return value %d", data->result);
 
+	lssh2_unlock();
 	free(log_cmd);
 	free(test_cmd);
 	return ret;
@@ -1344,12 +1813,15 @@ int lssh2_execute(libssh2_conn *conn, const char *command,
  */
 int lssh2_executor_close (libssh2_conn *conn)
 {
+	int ret = 0;
+
 	LOG_MSG(LOG_DEBUG, "");
 	if (conn) {
-		return lssh2_session_free(conn);
-	} else {
-		return 0;
+		lssh2_lock();
+		ret = lssh2_session_free(conn);
+		lssh2_unlock();
 	}
+	return ret;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -1382,6 +1854,153 @@ int lssh2_signal (int signal) {
 	return ret;
 }
 
+/* ------------------------------------------------------------------------- */
+/** Copies files from remote end to a local folder over SFTP on the 
+ *  session. Wildcards are supported in the file name part of the path.
+ * @param conn SSH session
+ * @param pattern path of the files at remote end
+ * @param folder local destination folder, ends with /
+ * @return 0 on success, errno if a file fails, -1 if SFTP can not be used
+ *         or the transfer fails
+ */
+int lssh2_get(libssh2_conn *conn, const char *pattern, const char *folder)
+{
+	int ret;
+
+	lssh2_lock();
+	ret = lssh2_sftp_get(conn, pattern, folder);
+	lssh2_unlock();
+	return ret;
+}
+
+/* ------------------------------------------------------------------------- */
+/** Starts a command at remote end on a channel of the session and passes
+ *  its stdin and stdout through pipes. The channel is served by a thread,
+ *  so the main thread can use the session meanwhile. One pipe can be open
+ *  at a time.
+ * @param conn SSH session
+ * @param command command to execute
+ * @param to_fd set to the write end of the stdin of the command
+ * @param from_fd set to the read end of the stdout of the command
+ * @return the pipe, NULL if fails
+ */
+lssh2_pipe *lssh2_pipe_open(libssh2_conn *conn, const char *command,
+			    int *to_fd, int *from_fd)
+{
+	lssh2_pipe *p;
+	int to[2] = { -1, -1 };
+	int from[2] = { -1, -1 };
+	int retries = 0;
+	int n = 0;
+	int exitcode;
+
+	if (!conn || conn->status == SESSION_GIVE_UP || !conn->ssh2_session ||
+	    pump)
+		return NULL;
+
+	p = calloc(1, sizeof(lssh2_pipe));
+	if (!p)
+		return NULL;
+	p->conn = conn;
+	p->wake[0] = p->wake[1] = -1;
+	if (pipe2(to, O_CLOEXEC) < 0 || pipe2(from, O_CLOEXEC) < 0 ||
+	    pipe2(p->wake, O_CLOEXEC | O_NONBLOCK) < 0) {
+		LOG_MSG(LOG_ERR, "pipe() failed: %s", strerror(errno));
+		goto err_out;
+	}
+
+	lssh2_lock();
+	while ((p->channel = 
+		libssh2_channel_open_session(conn->ssh2_session)) == NULL &&
+	       libssh2_session_last_error(conn->ssh2_session, NULL, NULL, 0)
+	       == LIBSSH2_ERROR_EAGAIN && 
+	       retries++ < MAX_SSH_CHANNEL_RETRIES)
+		lssh2_select(conn);
+	retries = 0;
+	if (p->channel) {
+		while ((n = libssh2_channel_exec(p->channel, command)) ==
+		       LIBSSH2_ERROR_EAGAIN && 
+		       retries++ < MAX_SSH_CHANNEL_RETRIES)
+			lssh2_select(conn);
+		if (n < 0) {
+			lssh2_channel_close(conn, p->channel, &exitcode);
+			p->channel = NULL;
+		}
+	}
+	lssh2_unlock();
+	if (!p->channel) {
+		LOG_MSG(LOG_ERR, "Opening SSH channel for %s failed", command);
+		goto err_out;
+	}
+
+	p->to_fd = to[0];
+	p->from_fd = from[1];
+	if (pthread_create(&p->thread, NULL, lssh2_pump, p)) {
+		LOG_MSG(LOG_ERR, "pthread_create() failed");
+		lssh2_lock();
+		lssh2_channel_close(conn, p->channel, &exitcode);
+		lssh2_unlock();
+		goto err_out;
+	}
+	pump = p;
+
+	*to_fd = to[1];
+	*from_fd = from[0];
+	return p;
+
+ err_out:
+	if (to[0] >= 0) {
+		close(to[0]);
+		close(to[1]);
+	}
+	if (from[0] >= 0) {
+		close(from[0]);
+		close(from[1]);
+	}
+	if (p->wake[0] >= 0) {
+		close(p->wake[0]);
+		close(p->wake[1]);
+	}
+	free(p);
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Asks the pump to close the channel. Safe to call from a signal handler.
+ * @param p pipe
+ */
+void lssh2_pipe_interrupt(lssh2_pipe *p)
+{
+	p->interrupted = 1;
+	if (write(p->wake[1], "", 1) < 0) {
+		/* the pump has been woken up already */
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Tells if the channel of the pipe has been closed
+ * @param p pipe
+ * @return 1 if closed, 0 if open
+ */
+int lssh2_pipe_closed(lssh2_pipe *p)
+{
+	return p->done;
+}
+/* ------------------------------------------------------------------------- */
+/** Closes the channel of the pipe and frees the pipe. The write end of the
+ *  stdin and the read end of the stdout are left to the caller.
+ * @param p pipe
+ */
+void lssh2_pipe_close(lssh2_pipe *p)
+{
+	lssh2_pipe_interrupt(p);
+	pthread_join(p->thread, NULL);
+	if (pump == p)
+		pump = NULL;
+	close(p->to_fd);
+	close(p->wake[0]);
+	close(p->wake[1]);
+	free(p);
+}
+
 /* ================= OTHER EXPORTED FUNCTIONS ============================== */
 /* None */
 
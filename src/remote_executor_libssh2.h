@@ -34,6 +34,7 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <libssh2.h>
+#include <libssh2_sftp.h>
 #include "testrunnerlite.h"
 #include "executor.h"
 
@@ -48,7 +49,7 @@
 /* ------------------------------------------------------------------------- */
 /* DATA TYPES */
 /* ------------------------------------------------------------------------- */
-/* None */
+typedef struct lssh2_pipe lssh2_pipe;
 
 /* ------------------------------------------------------------------------- */
 /* FORWARD DECLARATIONS */
@@ -75,9 +76,10 @@ typedef struct libssh2_conn {
 	in_port_t port;
 	int sock;
 	fd_set nfd;
-	fd_set *writefd;
-	fd_set *readfd;
+	step_deadline *deadline; /* timeouts of the running step, or NULL */
 	LIBSSH2_SESSION *ssh2_session;
+	LIBSSH2_SFTP *sftp_session; /* opened by the first get, or NULL */
+	int sftp_unavailable;        /* target has no SFTP subsystem */
 	connection_status status;
 	int signaled;
 } libssh2_conn;
@@ -94,6 +96,17 @@ int lssh2_executor_close(libssh2_conn *conn);
 /* ------------------------------------------------------------------------- */
 int lssh2_signal (int signal);
 /* ------------------------------------------------------------------------- */
+int lssh2_get(libssh2_conn *conn, const char *pattern, const char *folder);
+/* ------------------------------------------------------------------------- */
+lssh2_pipe *lssh2_pipe_open(libssh2_conn *conn, const char *command,
+			    int *to_fd, int *from_fd);
+/* ------------------------------------------------------------------------- */
+void lssh2_pipe_interrupt(lssh2_pipe *p);
+/* ------------------------------------------------------------------------- */
+int lssh2_pipe_closed(lssh2_pipe *p);
+/* ------------------------------------------------------------------------- */
+void lssh2_pipe_close(lssh2_pipe *p);
+/* ------------------------------------------------------------------------- */
 
 #endif                          /* REMOTE_EXECUTOR_LIBSSH2_H */
 /* End of file */
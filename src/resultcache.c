@@ -0,0 +1,445 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <uuid/uuid.h>
+
+#include "testrunnerlite.h"
+#include "testdefinitiondatatypes.h"
+#include "testresultlogger.h"
+#include "executor.h"
+#include "resultcache.h"
+#include "log.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+#define CACHE_HEADER "# testrunner-lite result cache 1"
+/* name space of the name based UUIDs used as cache keys */
+#define CACHE_NAMESPACE "5b1d0c8e-6a2f-4f57-9c1e-2d4b8f0a7e31"
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+LOCAL char *cache_dir = NULL;          /* directory of cached results */
+LOCAL char *build_id = NULL;           /* ID of the software under test */
+LOCAL char *environment = NULL;        /* execution environment */
+LOCAL char *default_hwid = NULL;       /* hwid if case has none */
+LOCAL const char *suffix = "xml";      /* result format of the records */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL void key_field (FILE *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL int key_step (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL int key_steps (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL int key_file (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL void key_case (FILE *, const td_case *);
+/* ------------------------------------------------------------------------- */
+LOCAL int step_spilled (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL char *cache_path (const td_set *, const td_case *, const char *);
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Add a string to the key of a case, prefixed with its length so that
+ *  different fields can not produce the same key
+ *  @param f key being written
+ *  @param value string or NULL
+ */
+LOCAL void key_field (FILE *f, const void *value)
+{
+	const char *s = value ? (const char *)value : "";
+
+	fprintf (f, "%zu:%s;", strlen (s), s);
+}
+/* ------------------------------------------------------------------------- */
+/** Add a step to the key of a case
+ *  @param data step data
+ *  @param user key being written
+ *  @return 1 always
+ */
+LOCAL int key_step (const void *data, const void *user)
+{
+	td_step *step = (td_step *)data;
+	FILE *f = (FILE *)user;
+
+	key_field (f, step->step);
+	fprintf (f, "%d:%d;", step->has_expected_result,
+		 step->expected_result);
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Add pre steps of a set to the key of a case
+ *  @param data pre steps data
+ *  @param user key being written
+ *  @return 1 always
+ */
+LOCAL int key_steps (const void *data, const void *user)
+{
+	td_steps *steps = (td_steps *)data;
+	FILE *f = (FILE *)user;
+
+	fprintf (f, "%lu;", steps->timeout);
+	xmlListWalk (steps->steps, key_step, f);
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Add a get file of a case to the key of the case
+ *  @param data file data
+ *  @param user key being written
+ *  @return 1 always
+ */
+LOCAL int key_file (const void *data, const void *user)
+{
+	td_file *file = (td_file *)data;
+	FILE *f = (FILE *)user;
+
+	key_field (f, file->filename);
+	fprintf (f, "%d:%d:%d;", file->delete_after, file->measurement,
+		 file->series);
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Add a case to its key. Everything of the definition that is replayed
+ *  in the result record is included, so a cached record never shows
+ *  attributes of an older definition.
+ *  @param f key being written
+ *  @param c case data
+ */
+LOCAL void key_case (FILE *f, const td_case *c)
+{
+	key_field (f, c->gen.name);
+	fprintf (f, "%lu;", c->gen.timeout ? c->gen.timeout :
+		 COMMON_SOFT_TIMEOUT);
+	key_field (f, c->gen.description);
+	key_field (f, c->gen.requirement);
+	key_field (f, c->gen.type);
+	key_field (f, c->gen.level);
+	key_field (f, c->gen.domain);
+	key_field (f, c->gen.feature);
+	key_field (f, c->gen.component);
+	key_field (f, c->gen.hwid);
+	fprintf (f, "%d:%d;", c->gen.manual, c->gen.insignificant);
+	key_field (f, c->subfeature);
+	key_field (f, c->tc_id);
+	key_field (f, c->state);
+	key_field (f, c->bugzilla_id);
+	key_field (f, c->description);
+	key_field (f, c->depends);
+	xmlListWalk (c->steps, key_step, f);
+	fprintf (f, "%d;", xmlListSize (c->gets));
+	xmlListWalk (c->gets, key_file, f);
+}
+/* ------------------------------------------------------------------------- */
+/** Check if step output was written to a file in the output folder
+ *  @param data step data
+ *  @param user set to 1 if output was spilled
+ *  @return 0 if output was spilled (stops the walk), 1 if not
+ */
+LOCAL int step_spilled (const void *data, const void *user)
+{
+	td_step *step = (td_step *)data;
+	int *spilled = (int *)user;
+
+	if (step->stdout_file || step->stderr_file)
+		*spilled = 1;
+	return !*spilled;
+}
+/* ------------------------------------------------------------------------- */
+/** Path of the cached result of a case
+ *  @param s set of the case
+ *  @param c case data
+ *  @param hwid hardware identifier, NULL for the default one
+ *  @return allocated path, NULL on error
+ */
+LOCAL char *cache_path (const td_set *s, const td_case *c, const char *hwid)
+{
+	char *key, *path = NULL;
+
+	key = result_cache_key (s, c, hwid);
+	if (!key)
+		return NULL;
+	if (asprintf (&path, "%s/%s.%s", cache_dir, key, suffix) < 0)
+		path = NULL;
+	free (key);
+
+	return path;
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Initialize the result cache, creating the cache directory if needed
+ *  @param opts testrunner-lite options, result_cache, build_id,
+ *         environment and output_type are used
+ *  @param hwinfo hardware information, product is the default hwid
+ *  @return 0 on success or if result cache is not used, 1 on error
+ */
+int result_cache_init (testrunner_lite_options *opts, hw_info *hwinfo)
+{
+	if (!opts->result_cache)
+		return 0;
+
+	if (mkdir (opts->result_cache, 0755) && errno != EEXIST) {
+		LOG_MSG (LOG_ERR, "Failed to create result cache %s: %s",
+			 opts->result_cache, strerror (errno));
+		return 1;
+	}
+	cache_dir = strdup (opts->result_cache);
+	build_id = strdup (opts->build_id ? opts->build_id : "");
+	environment = strdup (opts->environment ? opts->environment : "");
+	default_hwid = strdup (hwinfo && hwinfo->product ?
+			       (char *)hwinfo->product : "");
+	if (!cache_dir || !build_id || !environment || !default_hwid) {
+		LOG_MSG (LOG_ERR, "OOM");
+		result_cache_close ();
+		return 1;
+	}
+	suffix = opts->output_type == OUTPUT_TYPE_TXT ? "txt" : "xml";
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if results are cached
+ *  @return 1 if result cache is enabled, 0 if not
+ */
+int result_cache_enabled (void)
+{
+	return cache_dir != NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Compute the cache key of a case. The key is a digest of the build ID,
+ *  environment, hardware, set pre steps and the case with its attributes,
+ *  steps and get files, so a change in any of them makes the case to be
+ *  executed again.
+ *  @param s set of the case
+ *  @param c case data
+ *  @param hwid hardware identifier, NULL for the default one
+ *  @return allocated key, NULL on error
+ */
+char *result_cache_key (const td_set *s, const td_case *c, const char *hwid)
+{
+	FILE *f;
+	char *text = NULL, *key;
+	size_t size = 0;
+	uuid_t ns, digest;
+
+	f = open_memstream (&text, &size);
+	if (!f)
+		return NULL;
+	key_field (f, build_id);
+	key_field (f, environment);
+	key_field (f, hwid ? hwid : default_hwid);
+	key_field (f, s->gen.name);
+	xmlListWalk (s->pre_steps, key_steps, f);
+	key_case (f, c);
+	fclose (f);
+
+	key = (char *)malloc (37);
+	if (text && key) {
+		uuid_parse (CACHE_NAMESPACE, ns);
+		uuid_generate_sha1 (digest, ns, text, size);
+		uuid_unparse_lower (digest, key);
+	} else {
+		free (key);
+		key = NULL;
+	}
+	free (text);
+
+	return key;
+}
+/* ------------------------------------------------------------------------- */
+/** Take the result of a case from the cache
+ *  @param s set of the case
+ *  @param c case data, result, result_record and cached are set on hit
+ *  @param hwid hardware identifier, NULL for the default one
+ *  @return 1 if the result was cached, 0 if not
+ */
+int result_cache_replay_case (const td_set *s, td_case *c, const char *hwid)
+{
+	FILE *f = NULL;
+	char *path, *line = NULL, *result;
+	size_t size = 0;
+	ssize_t len;
+	struct stat st;
+	xmlChar *record = NULL;
+	int i, ret = 0;
+
+	if (!cache_dir)
+		return 0;
+	path = cache_path (s, c, hwid);
+	if (path)
+		f = fopen (path, "r");
+	if (!f)
+		goto out;
+
+	len = getline (&line, &size, f);
+	if (len <= 0 || line[len - 1] != '\n' ||
+	    strncmp (line, CACHE_HEADER "\t", strlen (CACHE_HEADER) + 1))
+		goto out;
+	line[len - 1] = '\0';
+	result = line + strlen (CACHE_HEADER) + 1;
+	for (i = CASE_FAIL; i <= CASE_NA; i++)
+		if (!strcmp (result, case_result_str (i)))
+			break;
+	if (i > CASE_NA || fstat (fileno (f), &st) || st.st_size < len)
+		goto out;
+
+	record = (xmlChar *)xmlMalloc (st.st_size - len + 1);
+	if (!record ||
+	    fread (record, 1, st.st_size - len, f) != (size_t)(st.st_size - len))
+		goto out;
+	record[st.st_size - len] = '\0';
+
+	c->case_res = i;
+	c->result_record = record;
+	c->cached = 1;
+	record = NULL;
+	ret = 1;
+ out:
+	if (f)
+		fclose (f);
+	xmlFree (record);
+	free (line);
+	free (path);
+	return ret;
+}
+/* ------------------------------------------------------------------------- */
+/** Store the result of an executed case in the cache. Only passed cases
+ *  are stored, so failed cases are executed again in the next run. Safe
+ *  to call from concurrent case workers.
+ *  @param s set of the case
+ *  @param c executed case
+ *  @param hwid hardware identifier, NULL for the default one
+ */
+void result_cache_store_case (const td_set *s, td_case *c, const char *hwid)
+{
+	char *path = NULL, *tmp = NULL, *header = NULL;
+	xmlChar *record = NULL;
+	int fd, spilled = 0, written, len;
+
+	if (!cache_dir || c->case_res != CASE_PASS)
+		return;
+	/* results do not refer to files of the output folder */
+	xmlListWalk (c->steps, step_spilled, &spilled);
+	if (spilled)
+		return;
+
+	path = cache_path (s, c, hwid);
+	if (!path || asprintf (&tmp, "%s.XXXXXX", path) < 0) {
+		tmp = NULL;
+		goto err_out;
+	}
+	len = asprintf (&header, CACHE_HEADER "\t%s\n",
+			case_result_str (c->case_res));
+	if (len < 0) {
+		header = NULL;
+		goto err_out;
+	}
+	/* the record is written as it is replayed */
+	c->cached = 1;
+	record = case_result_record (c);
+	c->cached = 0;
+	if (!record)
+		goto err_out;
+
+	/* readers see either the old or the complete new result */
+	fd = mkstemp (tmp);
+	if (fd < 0)
+		goto err_out;
+	written = write (fd, header, len) == len &&
+		write (fd, record, xmlStrlen (record)) == xmlStrlen (record);
+	if (close (fd) || !written || rename (tmp, path)) {
+		unlink (tmp);
+		goto err_out;
+	}
+	goto out;
+ err_out:
+	LOG_MSG (LOG_WARNING, "Failed to store result of %s in cache: %s",
+		 c->gen.name, strerror (errno));
+ out:
+	xmlFree (record);
+	free (header);
+	free (tmp);
+	free (path);
+}
+/* ------------------------------------------------------------------------- */
+/** Release the result cache
+ */
+void result_cache_close (void)
+{
+	free (cache_dir);
+	cache_dir = NULL;
+	free (build_id);
+	build_id = NULL;
+	free (environment);
+	environment = NULL;
+	free (default_hwid);
+	default_hwid = NULL;
+}
+/* ================= OTHER EXPORTED FUNCTIONS ============================== */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* End of file */
@@ -0,0 +1,68 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDES */
+#include "testrunnerlite.h"
+#include "testdefinitiondatatypes.h"
+#include "hwinfo.h"
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* DATA TYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+int result_cache_init (testrunner_lite_options *opts, hw_info *hwinfo);
+/* ------------------------------------------------------------------------- */
+int result_cache_enabled (void);
+/* ------------------------------------------------------------------------- */
+char *result_cache_key (const td_set *s, const td_case *c, const char *hwid);
+/* ------------------------------------------------------------------------- */
+int result_cache_replay_case (const td_set *s, td_case *c, const char *hwid);
+/* ------------------------------------------------------------------------- */
+void result_cache_store_case (const td_set *s, td_case *c, const char *hwid);
+/* ------------------------------------------------------------------------- */
+void result_cache_close (void);
+/* ------------------------------------------------------------------------- */
+#endif                          /* RESULTCACHE_H */
+/* End of file */
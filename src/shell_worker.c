@@ -0,0 +1,580 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "testrunnerlite.h"
+#include "executor.h"
+#include "shell_worker.h"
+#include "log.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+#define WORKER_HOST      0
+#define WORKER_CHROOT    1
+#define WORKER_COUNT     2
+#define WORKER_DIR_TEMPLATE "/tmp/testrunner-lite-worker.XXXXXX"
+#define WORKER_START_TIMEOUT_MS 5000
+#define REPORT_LINE_MAX  64
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/** Long-lived shell which executes test steps as background jobs */
+typedef struct {
+	pid_t  pid;           /**< pid of the worker shell, 0 if not running */
+	int    sock;          /**< commands to and reports from the worker */
+	int    pty;           /**< master side of worker's controlling tty */
+	char  *dir;           /**< directory for fifos of steps */
+	size_t root_len;      /**< length of chroot folder prefix in dir */
+	unsigned long seq;    /**< number of steps started */
+	char   out[PATH_MAX]; /**< stdout fifo of current step */
+	char   err[PATH_MAX]; /**< stderr fifo of current step */
+	char   line[REPORT_LINE_MAX]; /**< report line read from worker */
+	size_t line_len;      /**< length of partially read line */
+} shell_worker;
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+LOCAL testrunner_lite_options *options = NULL;
+LOCAL shell_worker workers[WORKER_COUNT];
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL void worker_child (int sock, const char *slave, const char *root);
+/* ------------------------------------------------------------------------- */
+LOCAL int worker_start (shell_worker *w, const char *root);
+/* ------------------------------------------------------------------------- */
+LOCAL void worker_remove_fifos (shell_worker *w);
+/* ------------------------------------------------------------------------- */
+LOCAL void worker_stop (shell_worker *w);
+/* ------------------------------------------------------------------------- */
+LOCAL char *append_quoted (char *dst, const char *src);
+/* ------------------------------------------------------------------------- */
+LOCAL char *worker_job (shell_worker *w, const char *command, int redirect,
+			 const char *cgroup);
+/* ------------------------------------------------------------------------- */
+LOCAL int worker_send (shell_worker *w, const char *job);
+/* ------------------------------------------------------------------------- */
+LOCAL int worker_read_line (shell_worker *w, int timeout_ms);
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Set up and exec the worker shell in the child process
+ * @param sock socket the worker reads commands from and writes reports to
+ * @param slave path of the pseudo terminal used as controlling tty
+ * @param root chroot folder or NULL
+ */
+LOCAL void worker_child (int sock, const char *slave, const char *root)
+{
+	int in, out, err, nul, fd;
+
+	/* move everything out of the way of fds 0-4 */
+	in = fcntl (sock, F_DUPFD_CLOEXEC, 10);
+	out = fcntl (STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+	err = fcntl (STDERR_FILENO, F_DUPFD_CLOEXEC, 10);
+	nul = open ("/dev/null", O_RDWR | O_CLOEXEC);
+	nul = fcntl (nul, F_DUPFD_CLOEXEC, 10);
+
+	/* the first tty opened by a session leader becomes its controlling
+	   tty, which the shell requires for job control */
+	setsid ();
+	fd = open (slave, O_RDWR);
+	if (fd >= 0)
+		close (fd);
+
+	dup2 (in, 0);
+	dup2 (in, 1);
+	dup2 (nul, 2);
+	/* stdout and stderr of testrunner-lite for steps without
+	   redirection */
+	dup2 (out, 3);
+	dup2 (err, 4);
+
+	signal (SIGINT, SIG_DFL);
+	signal (SIGTERM, SIG_DFL);
+
+	if (root && (chdir (root) == -1 || chroot (".") == -1))
+		_exit (1);
+
+	execl (SHELLCMD, SHELLCMD, "-m", (char *)NULL);
+	_exit (1);
+}
+/* ------------------------------------------------------------------------- */
+/** Start a worker shell
+ * @param w worker
+ * @param root chroot folder or NULL
+ * @return 0 on success, -1 on error
+ */
+LOCAL int worker_start (shell_worker *w, const char *root)
+{
+	int sv[2] = { -1, -1 };
+	int master = -1;
+	char *slave;
+	size_t len;
+
+	/* fifos must be visible both to testrunner-lite and the worker */
+	len = (root ? strlen (root) : 0) + strlen (WORKER_DIR_TEMPLATE) + 1;
+	w->dir = (char *)malloc (len);
+	if (!w->dir) {
+		LOG_MSG (LOG_ERR, "OOM");
+		goto err_out;
+	}
+	snprintf (w->dir, len, "%s%s", root ? root : "", WORKER_DIR_TEMPLATE);
+	w->root_len = root ? strlen (root) : 0;
+	if (!mkdtemp (w->dir)) {
+		LOG_MSG (LOG_WARNING, "Failed to create %s: %s", w->dir,
+			 strerror (errno));
+		free (w->dir);
+		w->dir = NULL;
+		goto err_out;
+	}
+
+	master = posix_openpt (O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt (master) || unlockpt (master) ||
+	    (slave = ptsname (master)) == NULL) {
+		LOG_MSG (LOG_ERR, "Failed to open pseudo terminal: %s",
+			 strerror (errno));
+		goto err_out;
+	}
+	fcntl (master, F_SETFD, FD_CLOEXEC);
+
+	if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+		LOG_MSG (LOG_ERR, "socketpair: %s", strerror (errno));
+		goto err_out;
+	}
+
+	w->pid = fork ();
+	if (w->pid == 0)
+		worker_child (sv[1], slave, root);
+	if (w->pid < 0) {
+		LOG_MSG (LOG_ERR, "Fork failed: %s", strerror (errno));
+		w->pid = 0;
+		goto err_out;
+	}
+
+	close (sv[1]);
+	w->sock = sv[0];
+	w->pty = master;
+	w->seq = 0;
+	w->line_len = 0;
+	w->out[0] = w->err[0] = '\0';
+
+	LOG_MSG (LOG_DEBUG, "Started shell worker %d%s%s", w->pid,
+		 root ? " in " : "", root ? root : "");
+
+	return 0;
+ err_out:
+	if (sv[0] >= 0) close (sv[0]);
+	if (sv[1] >= 0) close (sv[1]);
+	if (master >= 0) close (master);
+	if (w->dir) {
+		rmdir (w->dir);
+		free (w->dir);
+		w->dir = NULL;
+	}
+	return -1;
+}
+/* ------------------------------------------------------------------------- */
+/** Remove fifos of the current step
+ * @param w worker
+ */
+LOCAL void worker_remove_fifos (shell_worker *w)
+{
+	if (w->out[0])
+		unlink (w->out);
+	if (w->err[0])
+		unlink (w->err);
+	w->out[0] = w->err[0] = '\0';
+}
+/* ------------------------------------------------------------------------- */
+/** Stop a worker shell and clean up after it
+ * @param w worker
+ */
+LOCAL void worker_stop (shell_worker *w)
+{
+	if (w->pid > 0) {
+		LOG_MSG (LOG_DEBUG, "Stopping shell worker %d", w->pid);
+		kill (w->pid, SIGKILL);
+		waitpid (w->pid, NULL, 0);
+		close (w->sock);
+		close (w->pty);
+		w->pid = 0;
+	}
+
+	worker_remove_fifos (w);
+	if (w->dir) {
+		rmdir (w->dir);
+		free (w->dir);
+		w->dir = NULL;
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Append string as a single quoted shell word
+ * @param dst destination with room for 4 * strlen (src) + 3 bytes
+ * @param src string to quote
+ * @return pointer to the terminating null of dst
+ */
+LOCAL char *append_quoted (char *dst, const char *src)
+{
+	*dst++ = '\'';
+	for (; *src; src++) {
+		if (*src == '\'') {
+			memcpy (dst, "'\\''", 4);
+			dst += 4;
+		} else {
+			*dst++ = *src;
+		}
+	}
+	*dst++ = '\'';
+	*dst = '\0';
+
+	return dst;
+}
+/* ------------------------------------------------------------------------- */
+/** Create the text sent to worker for executing a step. The command is
+ *  passed as a quoted word to eval, so that whatever the command contains
+ *  the worker stays in sync with us. The step runs as a background job,
+ *  which gets a process group of its own. The job is started and waited
+ *  for within a single command line, since the shell forgets finished
+ *  jobs each time it reads a new one. If the step has a cgroup, the job
+ *  moves itself there before running the command. Cgroup file system is
+ *  not visible in chroot, so steps of chroot worker are not moved.
+ * @param w worker
+ * @param command step command
+ * @param redirect redirect output to fifos of the step
+ * @param cgroup cgroup of the step, NULL if none
+ * @return job text to be freed by the caller, NULL on error
+ */
+LOCAL char *worker_job (shell_worker *w, const char *command, int redirect,
+			 const char *cgroup)
+{
+	char *job, *p;
+	size_t len;
+
+	len = 4 * strlen (command) + 8 * PATH_MAX + 256;
+	if (cgroup)
+		len += 4 * strlen (cgroup);
+	job = (char *)malloc (len);
+	if (!job) {
+		LOG_MSG (LOG_ERR, "OOM");
+		return NULL;
+	}
+
+	p = job + sprintf (job, "{ ");
+	if (cgroup && !w->root_len) {
+		p += sprintf (p, "echo 0 2>/dev/null >");
+		p = append_quoted (p, cgroup);
+		p += sprintf (p, "/cgroup.procs; ");
+	}
+	p += sprintf (p, "eval ");
+	p = append_quoted (p, command);
+	p += sprintf (p, "\n} </dev/null ");
+	if (redirect) {
+		*p++ = '>';
+		p = append_quoted (p, w->out + w->root_len);
+		p += sprintf (p, " 2>");
+		p = append_quoted (p, w->err + w->root_len);
+	} else {
+		p += sprintf (p, ">&3 2>&4");
+	}
+	sprintf (p, " 3>&- 4>&- & "
+		 "echo \"pid $!\"; wait $!; echo \"status $?\"\n");
+
+	return job;
+}
+/* ------------------------------------------------------------------------- */
+/** Send text to worker
+ * @param w worker
+ * @param job text to send
+ * @return 0 on success, -1 on error
+ */
+LOCAL int worker_send (shell_worker *w, const char *job)
+{
+	size_t len = strlen (job);
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = send (w->sock, job, len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			LOG_MSG (LOG_ERR, "Failed to send to shell worker %d: "
+				 "%s", w->pid, strerror (errno));
+			return -1;
+		}
+		job += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Read a report line from worker. Only complete lines are consumed from
+ *  the socket, rest is left for later.
+ * @param w worker
+ * @param timeout_ms how long to wait for the line, 0 to not wait at all
+ * @return 1 if line was read to w->line, 0 if line is not complete yet,
+ *         -1 if worker has died or does not respond
+ */
+LOCAL int worker_read_line (shell_worker *w, int timeout_ms)
+{
+	struct pollfd pfd;
+	ssize_t ret;
+	size_t n;
+	char *nl;
+
+	while (1) {
+		ret = recv (w->sock, &w->line[w->line_len],
+			    sizeof (w->line) - 1 - w->line_len,
+			    MSG_PEEK | MSG_DONTWAIT);
+		if (ret == 0)
+			return -1;
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+			if (timeout_ms == 0)
+				return 0;
+
+			pfd.fd = w->sock;
+			pfd.events = POLLIN;
+			ret = poll (&pfd, 1, timeout_ms);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				return -1;
+			continue;
+		}
+
+		nl = memchr (&w->line[w->line_len], '\n', ret);
+		n = nl ? (size_t)(nl - &w->line[w->line_len]) + 1 : (size_t)ret;
+		if (recv (w->sock, &w->line[w->line_len], n, 0) != (ssize_t)n)
+			return -1;
+		w->line_len += n;
+
+		if (nl) {
+			w->line[w->line_len - 1] = '\0';
+			w->line_len = 0;
+			return 1;
+		}
+		if (w->line_len >= sizeof (w->line) - 1) {
+			LOG_MSG (LOG_ERR, "Garbage from shell worker %d",
+				 w->pid);
+			return -1;
+		}
+	}
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Initialize shell workers. Workers are started when first needed.
+ * @param opts testrunner-lite options
+ */
+void shell_worker_init (testrunner_lite_options *opts)
+{
+	int i;
+
+	options = opts;
+	for (i = 0; i < WORKER_COUNT; i++) {
+		memset (&workers[i], 0x0, sizeof (shell_worker));
+		workers[i].sock = -1;
+		workers[i].pty = -1;
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Execute a step command as a job of a shell worker. There is a worker for
+ *  host and for the chroot folder.
+ * @param command Command to execute
+ * @param data Input and output data controlling execution
+ * @param stdout_fd Pointer to a file descriptor used to read stdout of
+ *        executed command, NULL if output is not redirected
+ * @param stderr_fd Pointer to a file descriptor used to read stderr of
+ *        executed command, NULL if output is not redirected
+ * @return PID of the step job, -1 if the step can not be run by a worker
+ */
+pid_t shell_worker_execute (const char *command, exec_data *data,
+			    int *stdout_fd, int *stderr_fd)
+{
+	shell_worker *w;
+	const char *root = NULL;
+	char *job = NULL;
+	int out_fd = -1;
+	int err_fd = -1;
+	pid_t pid = -1;
+
+	if (!options || !command)
+		return -1;
+
+	if (options->chroot_folder && !data->disobey_chroot) {
+		w = &workers[WORKER_CHROOT];
+		root = options->chroot_folder;
+	} else {
+		w = &workers[WORKER_HOST];
+	}
+
+	if (w->pid == 0 && worker_start (w, root))
+		return -1;
+
+	w->seq++;
+	if (stdout_fd) {
+		snprintf (w->out, PATH_MAX, "%s/out.%lu", w->dir, w->seq);
+		snprintf (w->err, PATH_MAX, "%s/err.%lu", w->dir, w->seq);
+		if (mkfifo (w->out, 0600) < 0 || mkfifo (w->err, 0600) < 0) {
+			LOG_MSG (LOG_ERR, "mkfifo: %s", strerror (errno));
+			goto err_out;
+		}
+		/* open read ends first, the step opens the write ends */
+		out_fd = open (w->out, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		err_fd = open (w->err, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (out_fd < 0 || err_fd < 0) {
+			LOG_MSG (LOG_ERR, "Failed to open fifo: %s",
+				 strerror (errno));
+			goto err_out;
+		}
+	}
+
+	job = worker_job (w, command, stdout_fd != NULL, data->cgroup);
+	if (!job)
+		goto err_out;
+
+	if (worker_send (w, job) < 0)
+		goto err_stop;
+
+	if (worker_read_line (w, WORKER_START_TIMEOUT_MS) != 1 ||
+	    sscanf (w->line, "pid %d", &pid) != 1) {
+		LOG_MSG (LOG_ERR, "Shell worker %d did not start step",
+			 w->pid);
+		pid = -1;
+		goto err_stop;
+	}
+
+	LOG_MSG (LOG_DEBUG, "Shell worker %d started process %d", w->pid,
+		 pid);
+
+	/* job control gives the job a process group of its own */
+	data->pgid = pid;
+	data->status_fd = w->sock;
+	if (stdout_fd) {
+		*stdout_fd = out_fd;
+		*stderr_fd = err_fd;
+	}
+	free (job);
+
+	return pid;
+ err_stop:
+	worker_stop (w);
+ err_out:
+	free (job);
+	if (out_fd >= 0) close (out_fd);
+	if (err_fd >= 0) close (err_fd);
+	worker_remove_fifos (w);
+
+	return -1;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if a step run by a shell worker has finished. Does not block.
+ * @param data Input and output data controlling execution
+ * @param status exit status of the step as reported by shell
+ * @return 1 if the step has finished, 0 if not, -1 if the worker died
+ */
+int shell_worker_status (exec_data *data, int *status)
+{
+	shell_worker *w = NULL;
+	int i, ret;
+
+	for (i = 0; i < WORKER_COUNT; i++)
+		if (workers[i].pid > 0 && workers[i].sock == data->status_fd)
+			w = &workers[i];
+	if (!w)
+		return -1;
+
+	ret = worker_read_line (w, 0);
+	if (ret == 0)
+		return 0;
+
+	worker_remove_fifos (w);
+	if (ret < 0 || sscanf (w->line, "status %d", status) != 1) {
+		LOG_MSG (LOG_ERR, "Shell worker %d died", w->pid);
+		worker_stop (w);
+		return -1;
+	}
+
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Stop all shell workers
+ */
+void shell_worker_close (void)
+{
+	int i;
+
+	if (!options)
+		return;
+
+	for (i = 0; i < WORKER_COUNT; i++)
+		worker_stop (&workers[i]);
+}
+/* ------------------------------------------------------------------------- */
+/* End of file */
@@ -0,0 +1,64 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef SHELL_WORKER_H
+#define SHELL_WORKER_H
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDES */
+#include "testrunnerlite.h"
+#include "executor.h"
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* DATA TYPES */
+/* ------------------------------------------------------------------------- */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+void shell_worker_init (testrunner_lite_options *opts);
+/* ------------------------------------------------------------------------- */
+pid_t shell_worker_execute (const char *command, exec_data *data,
+			    int *stdout_fd, int *stderr_fd);
+/* ------------------------------------------------------------------------- */
+int shell_worker_status (exec_data *data, int *status);
+/* ------------------------------------------------------------------------- */
+void shell_worker_close (void);
+/* ------------------------------------------------------------------------- */
+#endif                          /* SHELL_WORKER_H */
+/* End of file */
@@ -143,6 +143,16 @@ LOCAL void td_measurement_delete (xmlLinkPtr lk)
 	free (meas);
 }
 /* ------------------------------------------------------------------------- */
+/** Deallocator for list with td_attempt items
+ *  @param lk list item
+ */
+LOCAL void td_attempt_delete (xmlLinkPtr lk)
+{
+	td_attempt *attempt = (td_attempt *)xmlLinkGetData (lk);
+	free (attempt->failure_info);
+	free (attempt);
+}
+/* ------------------------------------------------------------------------- */
 /** Deallocator for general attributes 
  *  @param gen general attributes 
  */
@@ -226,6 +236,7 @@ td_suite *td_suite_create()
 
 	memset (s, 0x0, sizeof (td_suite));
 	s->gen.timeout = DEFAULT_TIMEOUT;
+	s->gen.retries = -1;
 	return s;
 }
 /* ------------------------------------------------------------------------- */
@@ -251,6 +262,7 @@ td_set *td_set_create ()
 		return NULL;
 	}
 	memset (set, 0x0, sizeof (td_set));
+	set->gen.retries = -1;
 	set->pre_steps = xmlListCreate (td_steps_delete, list_dummy_compare);
 	set->post_steps = xmlListCreate (td_steps_delete, list_dummy_compare);
 	set->post_reboot_steps = xmlListCreate (td_steps_delete, list_dummy_compare);
@@ -286,6 +298,7 @@ void td_set_delete(td_set *s)
 	xmlListDelete (s->gets);
 	xmlFree (s->description);
 	xmlFree (s->environment);
+	xmlFree (s->result_record);
 	free (s);
 }
 /* ------------------------------------------------------------------------- */
@@ -318,6 +331,7 @@ td_case *td_case_create()
 		return NULL;
 	}
 	memset (td_c, 0x0, sizeof (td_case));
+	td_c->gen.retries = -1;
 	td_c->steps = xmlListCreate (td_step_delete, list_dummy_compare);
 	td_c->gets = xmlListCreate (td_file_delete_link, NULL);
 	td_c->measurements = xmlListCreate (td_measurement_delete, 
@@ -326,6 +340,7 @@ td_case *td_case_create()
 				      list_dummy_compare);
 	td_c->crashes = xmlHashCreate (10);
 	td_c->post_reboot_steps = xmlListCreate (td_steps_delete, list_dummy_compare);
+	td_c->attempts = xmlListCreate (td_attempt_delete, list_dummy_compare);
 
 	return td_c;
 }
@@ -364,7 +379,10 @@ void td_step_delete(xmlLinkPtr lk)
 
 	free (step->stdout_);
 	free (step->stderr_);
+	free (step->stdout_file);
+	free (step->stderr_file);
 	free (step->failure_info);
+	free (step->cgroup);
 	
 	free (step);
 }
@@ -379,6 +397,7 @@ void td_case_delete(xmlLinkPtr lk)
 	xmlListDelete (td_c->measurements);
 	xmlListDelete (td_c->series);
 	xmlListDelete (td_c->post_reboot_steps);
+	xmlListDelete (td_c->attempts);
 
 	xmlHashFree (td_c->crashes, (xmlHashDeallocator) xmlFree);
 
@@ -390,6 +409,10 @@ void td_case_delete(xmlLinkPtr lk)
 	xmlFree (td_c->bugzilla_id);
 	xmlFree (td_c->description);
 	xmlFree (td_c->rich_core_uuid);
+	xmlFree (td_c->target);
+	xmlFree (td_c->depends);
+	free (td_c->prerequisites);
+	xmlFree (td_c->result_record);
 
 	gen_attribs_delete(&td_c->gen);
 	free (td_c);
@@ -28,6 +28,7 @@
 /* INCLUDES */
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <libxml/hash.h>
 #include <libxml/xmlstring.h>
 #include <libxml/list.h>
@@ -58,6 +59,10 @@ typedef struct {
 
 	int      manual;        /**< Manual flag (default false) */
 	int      insignificant; /**< Insignificant flag (default false) */
+	int      parallel;      /**< Case may be run concurrently with other
+				   parallel cases of the set (default false) */
+	int      retries;       /**< Times a failed case is executed again,
+				   -1 to use the --retries option */
 	xmlChar *hwid;          /**< Comma separated list of HW identifiers */
 } td_gen_attribs;
 /* ------------------------------------------------------------------------- */
@@ -84,6 +89,9 @@ typedef struct {
 	int        measurement;   /**< Measurement attribute */
 	int        series;        /**< Is measurement series */
         xmlChar    *filename;     /**< File name */
+	/* executor fills */
+	int        collected;     /**< 1 when collected, -1 when collecting
+				     failed, 0 when not processed */
 } td_file;
 /* ------------------------------------------------------------------------- */
 /** Test set. */
@@ -99,6 +107,8 @@ typedef struct {
 	xmlChar   *description;  /**< Set description */
 	/* Executor fills */
 	xmlChar    *environment; /**< Current environment */
+	xmlChar    *result_record; /**< Results of the set replayed from
+				      run journal, NULL if set is executed */
 } td_set;
 /* ------------------------------------------------------------------------- */
 #ifdef ENABLE_EVENTS
@@ -146,8 +156,15 @@ typedef struct {
 	time_t   end;             /**< step execution end time */
 	xmlChar *stdout_;         /**< step stdout printouts */
 	xmlChar *stderr_;         /**< step stderr printouts */
+	xmlChar *stdout_file;     /**< file with stdout exceeding the limit */
+	xmlChar *stderr_file;     /**< file with stderr exceeding the limit */
+	unsigned long long stdout_bytes; /**< total size of stdout */
+	unsigned long long stderr_bytes; /**< total size of stderr */
 	pid_t    pgid;            /**< step process group id */
 	pid_t    pid;             /**< step process id */
+	struct rusage usage;      /**< resources used by step process tree */
+	int      has_usage;       /**< usage is valid */
+	char    *cgroup;          /**< cgroup of step processes, or NULL */
 	int      fail;            /**< step is failed, regardless of result */
 } td_step;
 /* ------------------------------------------------------------------------- */
@@ -158,8 +175,17 @@ typedef enum {
 	CASE_NA
 } case_result_t;
 /* ------------------------------------------------------------------------- */
-/** Test case */
+/** Execution attempt of a case with retries */
 typedef struct {
+	int           number;   /**< Attempt number, the first is 1 */
+	case_result_t result;   /**< Result of the attempt */
+	time_t        start;    /**< Start time of the attempt */
+	double        duration; /**< Wall clock duration in seconds */
+	xmlChar      *failure_info; /**< Failure info of the attempt */
+} td_attempt;
+/* ------------------------------------------------------------------------- */
+/** Test case */
+typedef struct _td_case {
 	/* Parser fills */
 	td_gen_attribs gen;     /**< General attributes */
 	xmlChar   *subfeature;  /**< Sub feature attribute */
@@ -170,6 +196,8 @@ typedef struct {
 				    feature number in bugs.meego.com */
         xmlChar   *description;  /**< Description element */
 	xmlListPtr gets;         /**< Get commands */
+	xmlChar   *depends;     /**< Comma separated names of the cases of
+				   the set this case depends on */
 
 	/* Executor fills */
 	xmlListPtr measurements;         /**< measurements */
@@ -178,10 +206,25 @@ typedef struct {
 	case_result_t  case_res; /**< Case result */
 	xmlChar   *failure_info;   /**< Optional failure info */
 	xmlChar   *rich_core_uuid; /**< Optional UUID for rich core dumps */
+	xmlChar   *target;      /**< Target the case was executed on, NULL
+				   if the run is not sharded */
 	xmlHashTablePtr crashes; /**< Maps a crash log file to telemetry URL */
 	xmlListPtr post_reboot_steps; /**< Steps executed after reboot */
 	int        dummy;       /**< Case is dummy - used with pre post steps */
 	int        filtered;    /**< Case is filtered */
+	struct _td_case **prerequisites; /**< Cases this case depends on */
+	int        prerequisite_count; /**< Number of prerequisites */
+	int        executed;    /**< Steps of the case were executed */
+	int        blocked;     /**< Case was not executed because a
+				   prerequisite failed */
+	int        done;        /**< Processing of the case is finished */
+	xmlChar   *result_record; /**< Result of the case replayed from run
+				     journal, NULL if case is executed */
+	int        cached;      /**< Result is taken from the result cache */
+	xmlListPtr attempts;    /**< Attempts of the case, empty if the case
+				   has no retries */
+	int        collecting;  /**< Files of the case are being collected
+				   in background, result is not final */
 } td_case;
 /* ------------------------------------------------------------------------- */
 /** Pre/post steps */
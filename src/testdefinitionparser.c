@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include <libxml/xmlreader.h>
 #include <libxml/xmlschemas.h>
@@ -61,6 +62,41 @@
 /* MACROS */
 /* None */
 
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+#define PREFETCH_QUEUE_SIZE 16 /* parsed nodes waiting to be processed */
+#define PREFETCH_SETS       1  /* sets parsed ahead of the processed one */
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/** Type of a prefetched node, tells which callback processes it */
+typedef enum {
+	TD_NODE_TD = 0,
+	TD_NODE_TD_END,
+	TD_NODE_HWIDDETECT,
+	TD_NODE_SUITE,
+	TD_NODE_SUITE_END,
+	TD_NODE_SET,
+	TD_NODE_END           /* parser thread is done */
+} td_node_type;
+
+/** Node parsed by the prefetch thread */
+typedef struct {
+	td_node_type type;
+	void *data;           /* td_td, td_suite or td_set, NULL for others */
+} td_node;
+
+/** Bounded queue from the prefetch thread to the processing thread */
+typedef struct {
+	td_node nodes[PREFETCH_QUEUE_SIZE];
+	int head;             /* next node to process */
+	int count;            /* nodes in queue */
+	int sets;             /* sets in queue */
+	int stop;             /* reader is closed, discard parsed nodes */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} td_node_queue;
+
 /* ------------------------------------------------------------------------- */
 /* LOCAL GLOBAL VARIABLES */
 LOCAL td_parser_callbacks *cbs;
@@ -71,13 +107,15 @@ LOCAL td_td *current_td;
 LOCAL td_suite *current_suite;
 LOCAL td_set *current_set;
 LOCAL int parsing_level = 0;
-/* ------------------------------------------------------------------------- */
-/* LOCAL CONSTANTS AND MACROS */
-/* None */
-
-/* ------------------------------------------------------------------------- */
-/* MODULE DATA STRUCTURES */
-/* None */
+LOCAL int prefetching = 0;
+LOCAL pthread_t prefetch_thread;
+LOCAL td_node_queue prefetch_queue = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER
+};
+LOCAL td_parser_callbacks *process_cbs; /* callbacks of the caller while
+					   prefetching */
+LOCAL td_parser_callbacks queue_cbs;    /* callbacks of the prefetch thread */
 
 /* ------------------------------------------------------------------------- */
 /* LOCAL FUNCTION PROTOTYPES */
@@ -108,6 +146,28 @@ LOCAL void log_xml_warning(void * ctx, const char * fmt, ...);
 /* ------------------------------------------------------------------------- */
 LOCAL int add_post_reboot_step(const void *, const void *);
 /* ------------------------------------------------------------------------- */
+LOCAL int td_read_node (void);
+/* ------------------------------------------------------------------------- */
+LOCAL void node_delete (td_node *);
+/* ------------------------------------------------------------------------- */
+LOCAL void queue_put (td_node_type, void *);
+/* ------------------------------------------------------------------------- */
+LOCAL void queue_td (td_td *);
+/* ------------------------------------------------------------------------- */
+LOCAL void queue_td_end ();
+/* ------------------------------------------------------------------------- */
+LOCAL void queue_hwiddetect ();
+/* ------------------------------------------------------------------------- */
+LOCAL void queue_suite (td_suite *);
+/* ------------------------------------------------------------------------- */
+LOCAL void queue_suite_end ();
+/* ------------------------------------------------------------------------- */
+LOCAL void queue_set (td_set *);
+/* ------------------------------------------------------------------------- */
+LOCAL void *prefetch_worker (void *);
+/* ------------------------------------------------------------------------- */
+LOCAL int prefetch_next_node (void);
+/* ------------------------------------------------------------------------- */
 #ifdef ENABLE_EVENTS
 LOCAL td_step *td_parse_event();
 /* ------------------------------------------------------------------------- */
@@ -129,6 +189,8 @@ LOCAL int td_parse_gen_attribs (td_gen_attribs *attr,
 		attr->timeout = defaults->timeout;
 		attr->manual  = defaults->manual;
 		attr->insignificant = defaults->insignificant;
+		attr->parallel = defaults->parallel;
+		attr->retries = defaults->retries;
 		if (defaults->requirement)
 			attr->requirement = xmlStrdup(defaults->requirement);
 		if (defaults->level)
@@ -202,6 +264,18 @@ LOCAL int td_parse_gen_attribs (td_gen_attribs *attr,
 					    BAD_CAST "true");
 			continue;
 		}
+		if (!xmlStrcmp (name, BAD_CAST "parallel")) {
+			attr->parallel = 
+				!xmlStrcmp (xmlTextReaderConstValue (reader), 
+					    BAD_CAST "true");
+			continue;
+		}
+		if (!xmlStrcmp (name, BAD_CAST "retries")) {
+			attr->retries = strtoul((char *)
+						xmlTextReaderConstValue(reader),
+						NULL, 10);
+			continue;
+		}
 		if (!xmlStrcmp (name, BAD_CAST "hwid")) {
 			if (attr->hwid)
 				free (attr->hwid);
@@ -566,6 +640,10 @@ LOCAL int td_parse_case(td_set *s)
 					  BAD_CAST "state") == 1) {
 		c->state = xmlTextReaderValue(reader);
 	}
+	if (xmlTextReaderMoveToAttribute (reader, 
+					  BAD_CAST "depends") == 1) {
+		c->depends = xmlTextReaderValue(reader);
+	}
 
 	xmlTextReaderMoveToElement (reader);
 	if (xmlTextReaderIsEmptyElement (reader))
@@ -762,6 +840,7 @@ LOCAL int td_parse_gets(xmlListPtr list)
 			file->delete_after = delete_after;
 			file->measurement = measurement;
 			file->series = series;
+			file->collected = 0;
 			delete_after = 0;
 			if (xmlListAppend (list, file)) {
 				LOG_MSG (LOG_ERR, 
@@ -987,6 +1066,238 @@ LOCAL void log_xml_warning(void * ctx, const char * fmt, ...)
 		free(msg);
 	}
 }
+/* ------------------------------------------------------------------------- */
+/** Read next node from XML reader instance and pass it to callbacks.
+ *  @return 0 on success
+ */
+LOCAL int td_read_node (void)
+{
+	int ret;
+	const xmlChar *name = NULL;
+	xmlReaderTypes type;
+	
+        ret = xmlTextReaderRead(reader);
+	
+	if (!ret)
+		return !ret;
+
+	name = xmlTextReaderConstName(reader);
+	type = xmlTextReaderNodeType(reader);
+
+	if (!name)
+		return 1;
+
+	if (!xmlStrcmp (name, BAD_CAST "testdefinition")) {
+		if (type == XML_READER_TYPE_ELEMENT) {
+			return td_parse_td();
+		}
+		else if (type == XML_READER_TYPE_END_ELEMENT) {
+			parsing_level--;
+			if (cbs->test_td_end)
+				cbs->test_td_end();
+			return 0;
+		}
+	}
+
+	if (!xmlStrcmp (name, BAD_CAST "hwiddetect")) {
+		if (type == XML_READER_TYPE_ELEMENT) {
+			return td_parse_hwiddetect();
+		}
+	}
+
+	if (!xmlStrcmp (name, BAD_CAST "description") &&
+	    type == XML_READER_TYPE_ELEMENT) {
+		switch (parsing_level) {
+		case 1:
+			current_td->description = 
+				xmlTextReaderReadString (reader);
+			break;
+		case 2:
+			current_suite->description = 
+				xmlTextReaderReadString (reader); 
+			break;
+		default:
+			LOG_MSG (LOG_ERR, "run time error, "
+				 "invalid parsing level %d", parsing_level);
+			return 1;
+		}
+		return 0;
+	}
+
+	if (!xmlStrcmp (name, BAD_CAST "suite")) {
+		if (type == XML_READER_TYPE_ELEMENT) {
+			parsing_level ++;
+			return td_parse_suite();
+		}
+		else if (type == XML_READER_TYPE_END_ELEMENT) {
+			parsing_level --;
+			if (cbs->test_suite_end) cbs->test_suite_end();
+			return 0;
+		}
+	}
+
+	if (!xmlStrcmp (name, BAD_CAST "set") && 
+	    type == XML_READER_TYPE_ELEMENT)
+		return td_parse_set();
+
+	return !ret;
+} 
+/* ------------------------------------------------------------------------- */
+/** Free data of a parsed node which is not going to be processed
+ *  @param node parsed node
+ */
+LOCAL void node_delete (td_node *node)
+{
+	switch (node->type) {
+	case TD_NODE_TD:
+		td_td_delete (node->data);
+		break;
+	case TD_NODE_SUITE:
+		td_suite_delete (node->data);
+		break;
+	case TD_NODE_SET:
+		td_set_delete (node->data);
+		break;
+	default:
+		break;
+	}
+}
+/* ------------------------------------------------------------------------- */
+/** Add parsed node to prefetch queue. Blocks while the queue is full, or
+ *  while enough sets are already waiting.
+ *  @param type type of the node
+ *  @param data data of the node
+ */
+LOCAL void queue_put (td_node_type type, void *data)
+{
+	td_node_queue *q = &prefetch_queue;
+	td_node node;
+
+	node.type = type;
+	node.data = data;
+
+	pthread_mutex_lock (&q->mutex);
+	while (!q->stop && (q->count == PREFETCH_QUEUE_SIZE ||
+			    (type == TD_NODE_SET && q->sets >= PREFETCH_SETS)))
+		pthread_cond_wait (&q->cond, &q->mutex);
+	if (q->stop) {
+		pthread_mutex_unlock (&q->mutex);
+		node_delete (&node);
+		return;
+	}
+	q->nodes[(q->head + q->count) % PREFETCH_QUEUE_SIZE] = node;
+	q->count++;
+	if (type == TD_NODE_SET)
+		q->sets++;
+	pthread_cond_broadcast (&q->cond);
+	pthread_mutex_unlock (&q->mutex);
+}
+/* ------------------------------------------------------------------------- */
+/** Prefetch callback for testdefinition
+ *  @param td test definition data
+ */
+LOCAL void queue_td (td_td *td)
+{
+	queue_put (TD_NODE_TD, td);
+}
+/* ------------------------------------------------------------------------- */
+/** Prefetch callback for testdefinition end
+ */
+LOCAL void queue_td_end ()
+{
+	queue_put (TD_NODE_TD_END, NULL);
+}
+/* ------------------------------------------------------------------------- */
+/** Prefetch callback for hw id detection
+ */
+LOCAL void queue_hwiddetect ()
+{
+	queue_put (TD_NODE_HWIDDETECT, NULL);
+}
+/* ------------------------------------------------------------------------- */
+/** Prefetch callback for suite
+ *  @param s suite data
+ */
+LOCAL void queue_suite (td_suite *s)
+{
+	queue_put (TD_NODE_SUITE, s);
+}
+/* ------------------------------------------------------------------------- */
+/** Prefetch callback for suite end
+ */
+LOCAL void queue_suite_end ()
+{
+	queue_put (TD_NODE_SUITE_END, NULL);
+}
+/* ------------------------------------------------------------------------- */
+/** Prefetch callback for set
+ *  @param s set data
+ */
+LOCAL void queue_set (td_set *s)
+{
+	queue_put (TD_NODE_SET, s);
+}
+/* ------------------------------------------------------------------------- */
+/** Prefetch thread, parses and validates the test definition until it
+ *  ends or an error occurs
+ *  @param arg not used
+ *  @return NULL always
+ */
+LOCAL void *prefetch_worker (void *arg)
+{
+	while (!prefetch_queue.stop && td_read_node() == 0);
+	queue_put (TD_NODE_END, NULL);
+
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Pass next node parsed by the prefetch thread to the callbacks
+ *  @return 0 on success, 1 when there are no more nodes
+ */
+LOCAL int prefetch_next_node (void)
+{
+	td_node_queue *q = &prefetch_queue;
+	td_node node;
+
+	pthread_mutex_lock (&q->mutex);
+	while (q->count == 0)
+		pthread_cond_wait (&q->cond, &q->mutex);
+	node = q->nodes[q->head];
+	q->head = (q->head + 1) % PREFETCH_QUEUE_SIZE;
+	q->count--;
+	if (node.type == TD_NODE_SET)
+		q->sets--;
+	pthread_cond_broadcast (&q->cond);
+	pthread_mutex_unlock (&q->mutex);
+
+	switch (node.type) {
+	case TD_NODE_TD:
+		process_cbs->test_td (node.data);
+		break;
+	case TD_NODE_TD_END:
+		process_cbs->test_td_end ();
+		break;
+	case TD_NODE_HWIDDETECT:
+		process_cbs->test_hwiddetect ();
+		break;
+	case TD_NODE_SUITE:
+		process_cbs->test_suite (node.data);
+		break;
+	case TD_NODE_SUITE_END:
+		process_cbs->test_suite_end ();
+		break;
+	case TD_NODE_SET:
+		process_cbs->test_set (node.data);
+		break;
+	case TD_NODE_END:
+		pthread_join (prefetch_thread, NULL);
+		prefetching = 0;
+		cbs = process_cbs;
+		return 1;
+	}
+
+	return 0;
+}
 
 
 /* ------------------------------------------------------------------------- */
@@ -1151,85 +1462,80 @@ int td_reader_init (testrunner_lite_options *opts)
  */
 void td_reader_close ()
 {
+	td_node_queue *q = &prefetch_queue;
+
+	if (prefetching) {
+		pthread_mutex_lock (&q->mutex);
+		q->stop = 1;
+		pthread_cond_broadcast (&q->cond);
+		pthread_mutex_unlock (&q->mutex);
+		pthread_join (prefetch_thread, NULL);
+		for (; q->count > 0; q->count--) {
+			node_delete (&q->nodes[q->head]);
+			q->head = (q->head + 1) % PREFETCH_QUEUE_SIZE;
+		}
+		prefetching = 0;
+		cbs = process_cbs;
+	}
 	if (reader) xmlFreeTextReader (reader); 
 	if (schema) xmlSchemaFree(schema);
 	if (schema_context) xmlSchemaFreeParserCtxt(schema_context);
 }
 /* ------------------------------------------------------------------------- */
-/** Process next node from XML reader instance.
+/** Process next node from XML reader instance, or next node parsed by the
+ *  prefetch thread if td_reader_prefetch() has been called.
  *  @return 0 on success
  */
 int td_next_node (void) {
-	int ret;
-	const xmlChar *name = NULL;
-	xmlReaderTypes type;
-	
-        ret = xmlTextReaderRead(reader);
-	
-	if (!ret)
-		return !ret;
+	if (prefetching)
+		return prefetch_next_node ();
 
-	name = xmlTextReaderConstName(reader);
-	type = xmlTextReaderNodeType(reader);
+	return td_read_node ();
+}
+/* ------------------------------------------------------------------------- */
+/** Parse and validate the test definition in a separate thread from now on,
+ *  so that next set is parsed while the current one is processed. The
+ *  callbacks are still called from the thread calling td_next_node().
+ *  Callbacks must be registered before calling this.
+ *  @return 0 on success, 1 if the thread could not be started
+ */
+int td_reader_prefetch (void)
+{
+	td_node_queue *q = &prefetch_queue;
+	int err;
 
-	if (!name)
+	if (prefetching || !reader || !cbs)
 		return 1;
 
-	if (!xmlStrcmp (name, BAD_CAST "testdefinition")) {
-		if (type == XML_READER_TYPE_ELEMENT) {
-			return td_parse_td();
-		}
-		else if (type == XML_READER_TYPE_END_ELEMENT) {
-			parsing_level--;
-			if (cbs->test_td_end)
-				cbs->test_td_end();
-			return 0;
-		}
-	}
-
-	if (!xmlStrcmp (name, BAD_CAST "hwiddetect")) {
-		if (type == XML_READER_TYPE_ELEMENT) {
-			return td_parse_hwiddetect();
-		}
-	}
-
-	if (!xmlStrcmp (name, BAD_CAST "description") &&
-	    type == XML_READER_TYPE_ELEMENT) {
-		switch (parsing_level) {
-		case 1:
-			current_td->description = 
-				xmlTextReaderReadString (reader);
-			break;
-		case 2:
-			current_suite->description = 
-				xmlTextReaderReadString (reader); 
-			break;
-		default:
-			LOG_MSG (LOG_ERR, "run time error, "
-				 "invalid parsing level %d", parsing_level);
-			return 1;
-		}
-		return 0;
-	}
-
-	if (!xmlStrcmp (name, BAD_CAST "suite")) {
-		if (type == XML_READER_TYPE_ELEMENT) {
-			parsing_level ++;
-			return td_parse_suite();
-		}
-		else if (type == XML_READER_TYPE_END_ELEMENT) {
-			parsing_level --;
-			if (cbs->test_suite_end) cbs->test_suite_end();
-			return 0;
-		}
+	process_cbs = cbs;
+	memset (&queue_cbs, 0x0, sizeof (td_parser_callbacks));
+	/* parser checks presence of some of the callbacks */
+	if (process_cbs->test_td)
+		queue_cbs.test_td = queue_td;
+	if (process_cbs->test_td_end)
+		queue_cbs.test_td_end = queue_td_end;
+	if (process_cbs->test_hwiddetect)
+		queue_cbs.test_hwiddetect = queue_hwiddetect;
+	if (process_cbs->test_suite)
+		queue_cbs.test_suite = queue_suite;
+	if (process_cbs->test_suite_end)
+		queue_cbs.test_suite_end = queue_suite_end;
+	if (process_cbs->test_set)
+		queue_cbs.test_set = queue_set;
+
+	q->head = q->count = q->sets = q->stop = 0;
+	cbs = &queue_cbs;
+	err = pthread_create (&prefetch_thread, NULL, prefetch_worker, NULL);
+	if (err) {
+		LOG_MSG (LOG_WARNING, "Failed to create parser thread: %s",
+			 strerror (err));
+		cbs = process_cbs;
+		return 1;
 	}
+	prefetching = 1;
 
-	if (!xmlStrcmp (name, BAD_CAST "set") && 
-	    type == XML_READER_TYPE_ELEMENT)
-		return td_parse_set();
-
-	return !ret;
-} 
+	return 0;
+}
 /* ------------------------------------------------------------------------- */
 /** Set the callbacks for parser
  *  @return 0 (always so far)
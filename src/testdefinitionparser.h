@@ -73,6 +73,8 @@ int td_register_callbacks(td_parser_callbacks *);
 /* ------------------------------------------------------------------------- */
 int td_next_node(void);
 /* ------------------------------------------------------------------------- */
+int td_reader_prefetch(void);
+/* ------------------------------------------------------------------------- */
 
 #endif                          /* TESTDEFINITIONPARSER_H */
 /* End of file */
@@ -31,8 +31,12 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <glob.h>
+#include <ftw.h>
 #include <libxml/tree.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/inotify.h>
 #include <uuid/uuid.h>
 
@@ -42,7 +46,12 @@
 #include "testfilters.h"
 #include "testmeasurement.h"
 #include "executor.h"
+#include "cgroup.h"
+#include "history.h"
+#include "journal.h"
+#include "resultcache.h"
 #include "remote_executor.h"
+#include "remote_agent.h"
 #include "manual_executor.h"
 #include "utils.h"
 #include "log.h"
@@ -81,18 +90,79 @@ int bail_out = 0;
 LOCAL td_td    *current_td = NULL;    /* Test definition currently executed */
 LOCAL td_suite *current_suite = NULL; /* Suite currently executed */
 LOCAL td_set   *current_set = NULL;   /* Set currently executed */
-LOCAL xmlChar  *cur_case_name = BAD_CAST"";   /* Name of the current case */ 
-LOCAL int       cur_step_num;         /* Number of current step within case */
+/* cases of a set may run in parallel threads, each with a case of its own */
+LOCAL __thread xmlChar *cur_case_name = BAD_CAST""; /* Name of the current
+							case */
+LOCAL __thread int cur_step_num;      /* Number of current step within case */
+LOCAL __thread int parallel_worker;   /* Thread runs parallel cases */
+LOCAL __thread shard_target *cur_target; /* Target of the thread in sharded
+					    runs, NULL otherwise */
+/* targets of a sharded run where pre steps of current set have passed */
+LOCAL shard_target *ready_targets[MAX_PARALLEL_JOBS];
+LOCAL int ready_count = 0;
 
 LOCAL int passcount = 0;
 LOCAL int failcount = 0;
 LOCAL int casecount = 0;
+LOCAL int cachedcount = 0;
+LOCAL int flakycount = 0;
+/* cases waiting for their files to be collected in background */
+LOCAL struct _get_job *get_jobs = NULL;
+LOCAL struct _get_job *get_jobs_tail = NULL;
+LOCAL int get_pending = 0;           /* cases queued or being collected */
+LOCAL int get_worker_running = 0;
+LOCAL int get_worker_stop = 0;
+LOCAL pthread_t get_thread;
+LOCAL pthread_mutex_t get_mutex = PTHREAD_MUTEX_INITIALIZER;
+LOCAL pthread_cond_t get_cond = PTHREAD_COND_INITIALIZER;
 /* ------------------------------------------------------------------------- */
 /* LOCAL CONSTANTS AND MACROS */
 const char *TESTCASE_UUID_FILENAME = "testrunner-lite-testcase";
 /* ------------------------------------------------------------------------- */
 /* MODULE DATA STRUCTURES */
-/* None */
+/** Parallel cases shared by the worker threads of a set */
+typedef struct {
+	td_case **cases;        /**< cases to execute */
+	int       count;        /**< number of cases */
+	int       next;         /**< index of the next case to execute */
+	int       running;      /**< cases being executed */
+	td_set   *set;          /**< set of the cases */
+	pthread_mutex_t mutex;  /**< protects the queue and done flags */
+	pthread_cond_t  cond;   /**< signaled when a case is done */
+} case_queue;
+
+/** Parallel case with its expected duration, for scheduling */
+typedef struct {
+	td_case *c;             /**< case data */
+	double   expected;      /**< expected duration in seconds */
+	int      index;         /**< position in definition order */
+} scheduled_case;
+
+/** Worker thread data */
+typedef struct {
+	case_queue   *queue;    /**< cases shared by the workers */
+	shard_target *target;   /**< target of the worker, NULL if default */
+} case_worker_arg;
+
+/** Case whose files are collected in background */
+typedef struct _get_job {
+	td_case      *c;        /**< case data */
+	td_set       *set;      /**< set of the case */
+	shard_target *target;   /**< target the case was executed on */
+	time_t        start;    /**< start time of the case */
+	double        duration; /**< duration of the case before collection */
+	struct _get_job *next;  /**< next queued case */
+} get_job;
+
+/** Get files of a set or case */
+typedef struct {
+	td_file **files;        /**< get file data */
+	char    **fnames;       /**< paths of the files */
+	char    **deletes;      /**< paths of the collected files with
+				   delete_after */
+	int       count;        /**< number of files */
+	int       ndeletes;     /**< number of files to delete */
+} get_batch;
 
 /* ------------------------------------------------------------------------- */
 /* LOCAL FUNCTION PROTOTYPES */
@@ -113,10 +183,88 @@ LOCAL int process_case (const void *, const void *);
 /* ------------------------------------------------------------------------- */
 LOCAL int case_result_fail (const void *, const void *);
 /* ------------------------------------------------------------------------- */
+LOCAL int collect_case (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL int step_parallel_safe (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL int case_parallel_safe (td_case *);
+/* ------------------------------------------------------------------------- */
+LOCAL int case_cacheable (td_case *);
+/* ------------------------------------------------------------------------- */
+LOCAL int case_retries (td_case *);
+/* ------------------------------------------------------------------------- */
+LOCAL int step_reset (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL int case_attempt_done (td_case *, int, time_t, struct timespec *);
+/* ------------------------------------------------------------------------- */
+LOCAL void case_retry_prepare (td_case *);
+/* ------------------------------------------------------------------------- */
+LOCAL void case_history_record (td_set *, td_case *, time_t, double);
+/* ------------------------------------------------------------------------- */
+LOCAL void case_finish (td_set *, td_case *, time_t, double);
+/* ------------------------------------------------------------------------- */
+LOCAL void case_count (case_result_t, int);
+/* ------------------------------------------------------------------------- */
+LOCAL int case_replay_count (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL double elapsed (struct timespec *);
+/* ------------------------------------------------------------------------- */
+LOCAL void get_queue_add (td_set *, td_case *, time_t, double);
+/* ------------------------------------------------------------------------- */
+LOCAL void *get_worker (void *);
+/* ------------------------------------------------------------------------- */
+LOCAL void get_queue_wait (td_case *);
+/* ------------------------------------------------------------------------- */
+LOCAL void get_queue_close (void);
+/* ------------------------------------------------------------------------- */
+LOCAL int resolve_dependencies (td_case **, int);
+/* ------------------------------------------------------------------------- */
+LOCAL void order_by_dependencies (td_case **, int);
+/* ------------------------------------------------------------------------- */
+LOCAL td_case *failed_prerequisite (td_case *);
+/* ------------------------------------------------------------------------- */
+LOCAL int prerequisites_done (td_case *);
+/* ------------------------------------------------------------------------- */
+LOCAL td_case *next_ready_case (case_queue *);
+/* ------------------------------------------------------------------------- */
+LOCAL double case_expected_duration (td_set *, td_case *);
+/* ------------------------------------------------------------------------- */
+LOCAL int scheduled_case_cmp (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL td_case **schedule_cases (td_case **, int, td_set *);
+/* ------------------------------------------------------------------------- */
+LOCAL void *case_worker (void *);
+/* ------------------------------------------------------------------------- */
+LOCAL void process_parallel_cases (td_case **, int, td_set *);
+/* ------------------------------------------------------------------------- */
+LOCAL void process_cases (td_set *);
+/* ------------------------------------------------------------------------- */
+LOCAL void use_target (shard_target *);
+/* ------------------------------------------------------------------------- */
+LOCAL int set_steps_execute (td_set *, xmlListPtr, int);
+/* ------------------------------------------------------------------------- */
+LOCAL char *get_file_name (td_file *);
+/* ------------------------------------------------------------------------- */
+LOCAL void get_file (td_file *, const char *);
+/* ------------------------------------------------------------------------- */
+LOCAL int remove_path (const char *, const struct stat *, int, struct FTW *);
+/* ------------------------------------------------------------------------- */
+LOCAL int get_file_batchable (const char *);
+/* ------------------------------------------------------------------------- */
+LOCAL int get_files_batched (td_file **, char **, int);
+/* ------------------------------------------------------------------------- */
+LOCAL void delete_files (char **, int);
+/* ------------------------------------------------------------------------- */
+LOCAL int get_batch_add (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL void process_gets (xmlListPtr);
+/* ------------------------------------------------------------------------- */
 LOCAL int process_get (const void *, const void *);
 /* ------------------------------------------------------------------------- */
 LOCAL int process_get_case (const void *, const void *);
 /* ------------------------------------------------------------------------- */
+LOCAL void process_case_gets (td_case *);
+/* ------------------------------------------------------------------------- */
 LOCAL int step_execute (const void *, const void *);
 /* ------------------------------------------------------------------------- */
 LOCAL int prepost_steps_execute (const void *, const void *);
@@ -270,6 +418,7 @@ LOCAL void fetch_leftover_report (xmlChar *url, void *unused, char *filename)
 	file = (td_file *)malloc (sizeof (td_file));
 	file->filename = (xmlChar*)path_in_core_dumps(filename);
 	file->delete_after = 1;
+	file->collected = 0;
 	file->measurement = 0;
 	file->series = 0;
 	process_get (file, 0);
@@ -625,6 +774,7 @@ LOCAL int step_execute (const void *data, const void *user)
 	edata.redirect_output = REDIRECT_OUTPUT;
 	edata.soft_timeout = c->gen.timeout;
 	edata.hard_timeout = COMMON_HARD_TIMEOUT;
+	edata.parallel = parallel_worker;
 	
 	if (step->step) {
 		execute((char*)step->step, &edata);
@@ -639,6 +789,19 @@ LOCAL int step_execute (const void *data, const void *user)
 		if (edata.stderr_data.buffer) {
 			step->stderr_ = edata.stderr_data.buffer;
 		}
+		if (step->stdout_file) free (step->stdout_file);
+		if (step->stderr_file) free (step->stderr_file);
+		step->stdout_file = BAD_CAST edata.stdout_data.spill_file;
+		step->stderr_file = BAD_CAST edata.stderr_data.spill_file;
+		step->stdout_bytes = edata.stdout_data.total;
+		step->stderr_bytes = edata.stderr_data.total;
+		/* processes left by the step are killed in post processing */
+		if (step->cgroup) {
+			cgroup_remove (step->cgroup);
+			free (step->cgroup);
+		}
+		step->cgroup = edata.cgroup;
+		edata.cgroup = NULL;
 
 		/* If case is expected to reboot the device */
 		if (step->control == CONTROL_REBOOT_EXPECTED) {
@@ -714,6 +877,8 @@ LOCAL int step_execute (const void *data, const void *user)
 
 		step->pgid = edata.pgid; 
 		step->pid = edata.pid;
+		step->usage = edata.usage;
+		step->has_usage = edata.has_usage;
 		step->has_result = 1;
 		step->return_code = edata.result;
 		step->start = edata.start_time;
@@ -809,6 +974,13 @@ LOCAL int step_post_process (const void *data, const void *user)
 	if (!step->start)
 		goto out;
 
+	/* ... kill everything left in the cgroup of the step ... */
+	if (step->cgroup) {
+		cgroup_remove (step->cgroup);
+		free (step->cgroup);
+		step->cgroup = NULL;
+	}
+
 	/* ... or ones that do not have process group ... */
 	if (!step->pgid)
 		goto out;
@@ -839,6 +1011,11 @@ LOCAL int process_case (const void *data, const void *user)
 	char uuid_buf[36];
 	uuid_t uuid_gen;
 	char *pos = NULL;
+	struct timespec started;
+	time_t start_time;
+	td_case *dep;
+	char info[FAILURE_INFO_MAX];
+	int retries, attempts, i;
 
 	if (c->gen.manual && !opts.run_manual) {
 		LOG_MSG(LOG_DEBUG, "Skipping manual case %s",
@@ -862,10 +1039,55 @@ LOCAL int process_case (const void *data, const void *user)
 		c->case_res = CASE_NA;
 		return 1;
 	}
+	/* measurement files collected in background may fail a
+	   prerequisite */
+	for (i = 0; i < c->prerequisite_count; i++)
+		get_queue_wait (c->prerequisites[i]);
+	if ((dep = failed_prerequisite (c))) {
+		LOG_MSG (LOG_INFO, "Skipping case %s, it depends on failed "
+			 "case %s", c->gen.name, dep->gen.name);
+		snprintf (info, sizeof (info), "depends on failed case %s",
+			  (char *)dep->gen.name);
+		c->case_res = CASE_NA;
+		c->failure_info = xmlCharStrdup (info);
+		c->blocked = 1;
+		return 1;
+	}
+	if (journal_replay_case (current_suite, (td_set *)user, c,
+				 &attempts)) {
+		LOG_MSG (LOG_INFO, "Test case %s was completed before the run "
+			 "was interrupted. Result: %s", c->gen.name,
+			 case_result_str (c->case_res));
+		c->executed = 1;
+		__sync_add_and_fetch (&casecount, 1);
+		case_count (c->case_res, attempts);
+		return 1;
+	}
+	if (case_cacheable (c) &&
+	    result_cache_replay_case ((td_set *)user, c, current_td ?
+				      (char *)current_td->detected_hw :
+				      NULL)) {
+		LOG_MSG (LOG_INFO, "Test case %s result is taken from result "
+			 "cache. Result: %s", c->gen.name,
+			 case_result_str (c->case_res));
+		__sync_add_and_fetch (&cachedcount, 1);
+		c->executed = 1;
+		journal_record_case (current_suite, (td_set *)user, c);
+		return 1;
+	}
 
 	cur_case_name = c->gen.name;
-	LOG_MSG (LOG_INFO, "Starting test case %s", c->gen.name);
-	casecount++;
+	if (cur_target) {
+		LOG_MSG (LOG_INFO, "Starting test case %s on %s", c->gen.name,
+			 cur_target->address);
+		if (c->target) xmlFree (c->target);
+		c->target = xmlCharStrdup (cur_target->address);
+	} else
+		LOG_MSG (LOG_INFO, "Starting test case %s", c->gen.name);
+	__sync_add_and_fetch (&casecount, 1);
+	c->executed = 1;
+	start_time = time (NULL);
+	clock_gettime (CLOCK_MONOTONIC, &started);
 
 	if (opts.rich_core_dumps != NULL) {
 		/* Create UUID to map test case and rich-core dump. */
@@ -903,10 +1125,20 @@ LOCAL int process_case (const void *data, const void *user)
 			 c->gen.name);
 		c->case_res = CASE_NA;
 	}
-	cur_step_num = 0;
-	
-	xmlListWalk (c->steps, step_execute, data);
-	xmlListWalk (c->steps, step_post_process, data);
+	retries = case_retries (c);
+	for (;;) {
+		cur_step_num = 0;
+		xmlListWalk (c->steps, step_execute, data);
+		xmlListWalk (c->steps, step_post_process, data);
+		if (!case_attempt_done (c, retries, start_time, &started))
+			break;
+		/* each failed attempt is a run of its own in the history */
+		case_history_record ((td_set *)user, c, start_time,
+				     elapsed (&started));
+		case_retry_prepare (c);
+		start_time = time (NULL);
+		clock_gettime (CLOCK_MONOTONIC, &started);
+	}
 	
 	if (c->gen.manual && opts.run_manual)
 		post_manual (c);
@@ -924,15 +1156,208 @@ LOCAL int process_case (const void *data, const void *user)
 			c->rich_core_uuid = xmlCharStrdup (uuid_buf);
 		}
 	}
-	xmlListWalk (c->gets, process_get_case, c);
+
+	/* the next case is started while the files are collected */
+	if (opts.background_get && xmlListSize (c->gets) > 0 && !bail_out) {
+		get_queue_add ((td_set *)user, c, start_time,
+			       elapsed (&started));
+		return 1;
+	}
+	process_case_gets (c);
 	
+	case_finish ((td_set *)user, c, start_time, elapsed (&started));
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Finish an executed case: its result is final when this is called
+ *  @param s set data
+ *  @param c case data
+ *  @param start start time of the case
+ *  @param duration duration of the case in seconds
+ */
+LOCAL void case_finish (td_set *s, td_case *c, time_t start, double duration)
+{
 	LOG_MSG (LOG_INFO, "Finished test case %s Result: %s",
 		 c->gen.name, case_result_str(c->case_res));
-	passcount += (c->case_res == CASE_PASS);
-	failcount += (c->case_res == CASE_FAIL);
+	case_history_record (s, c, start, duration);
+	/* a case cut short by bail out is executed again on resume */
+	if (!bail_out)
+		journal_record_case (current_suite, s, c);
+	/* a flaky pass is not reused */
+	if (!bail_out && case_cacheable (c) && xmlListSize (c->attempts) < 2)
+		result_cache_store_case (s, c, current_td ?
+					 (char *)current_td->detected_hw :
+					 NULL);
+	case_count (c->case_res, xmlListSize (c->attempts));
+}
+/* ------------------------------------------------------------------------- */
+/** Add a completed case to the totals of the run
+ *  @param result result of the case
+ *  @param attempts attempts of the case, 0 if the case has no retries
+ */
+LOCAL void case_count (case_result_t result, int attempts)
+{
+	if (result == CASE_PASS)
+		__sync_add_and_fetch (&passcount, 1);
+	if (result == CASE_PASS && attempts > 1)
+		__sync_add_and_fetch (&flakycount, 1);
+	if (result == CASE_FAIL)
+		__sync_add_and_fetch (&failcount, 1);
+}
+/* ------------------------------------------------------------------------- */
+/** Count a case of a set replayed from the journal in the totals
+ *  @param data case data
+ *  @param user set data
+ *  @return 1 always
+ */
+LOCAL int case_replay_count (const void *data, const void *user)
+{
+	td_case *c = (td_case *)data;
+	int attempts;
+
+	if (journal_replay_case (current_suite, (td_set *)user, c,
+				 &attempts)) {
+		__sync_add_and_fetch (&casecount, 1);
+		case_count (c->case_res, attempts);
+	}
 	return 1;
 }
 /* ------------------------------------------------------------------------- */
+/** Get seconds elapsed since a monotonic time
+ *  @param started monotonic start time
+ *  @return elapsed time in seconds
+ */
+LOCAL double elapsed (struct timespec *started)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - started->tv_sec) +
+		(now.tv_nsec - started->tv_nsec) / 1e9;
+}
+/* ------------------------------------------------------------------------- */
+/** Queue the files of a case to be collected by the background worker,
+ *  which finishes the case when they are collected
+ *  @param s set data
+ *  @param c case data
+ *  @param start start time of the case
+ *  @param duration duration of the case so far in seconds
+ */
+LOCAL void get_queue_add (td_set *s, td_case *c, time_t start,
+			  double duration)
+{
+	get_job *job;
+
+	job = (get_job *)malloc (sizeof (get_job));
+	if (job == NULL) {
+		LOG_MSG (LOG_ERR, "%s: FATAL : OOM", PROGNAME);
+		process_case_gets (c);
+		case_finish (s, c, start, duration);
+		return;
+	}
+	memset (job, 0x0, sizeof (get_job));
+	job->c = c;
+	job->set = s;
+	job->target = cur_target;
+	job->start = start;
+	job->duration = duration;
+
+	pthread_mutex_lock (&get_mutex);
+	if (!get_worker_running) {
+		if (pthread_create (&get_thread, NULL, get_worker, NULL)) {
+			pthread_mutex_unlock (&get_mutex);
+			LOG_MSG (LOG_WARNING, "Failed to start file collection "
+				 "thread");
+			free (job);
+			process_case_gets (c);
+			case_finish (s, c, start, duration);
+			return;
+		}
+		get_worker_running = 1;
+	}
+	c->collecting = 1;
+	if (get_jobs_tail)
+		get_jobs_tail->next = job;
+	else
+		get_jobs = job;
+	get_jobs_tail = job;
+	get_pending++;
+	pthread_cond_broadcast (&get_cond);
+	pthread_mutex_unlock (&get_mutex);
+	LOG_MSG (LOG_DEBUG, "Collecting files of test case %s in background",
+		 c->gen.name);
+}
+/* ------------------------------------------------------------------------- */
+/** Background worker collecting the files of queued cases in queue order
+ *  @param arg not used
+ *  @return NULL
+ */
+LOCAL void *get_worker (void *arg)
+{
+	get_job *job;
+	struct timespec started;
+
+	/* shell worker is left to the steps of the main thread */
+	parallel_worker = 1;
+	pthread_mutex_lock (&get_mutex);
+	while (1) {
+		while (!get_jobs && !get_worker_stop)
+			pthread_cond_wait (&get_cond, &get_mutex);
+		job = get_jobs;
+		if (!job)
+			break;
+		get_jobs = job->next;
+		if (!get_jobs)
+			get_jobs_tail = NULL;
+		pthread_mutex_unlock (&get_mutex);
+
+		use_target (job->target);
+		cur_case_name = job->c->gen.name;
+		clock_gettime (CLOCK_MONOTONIC, &started);
+		process_case_gets (job->c);
+		case_finish (job->set, job->c, job->start,
+			     job->duration + elapsed (&started));
+
+		pthread_mutex_lock (&get_mutex);
+		job->c->collecting = 0;
+		get_pending--;
+		pthread_cond_broadcast (&get_cond);
+		free (job);
+	}
+	pthread_mutex_unlock (&get_mutex);
+	use_target (NULL);
+
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Wait until the files of a case, or of all cases, are collected
+ *  @param c case data, NULL to wait for all queued cases
+ */
+LOCAL void get_queue_wait (td_case *c)
+{
+	pthread_mutex_lock (&get_mutex);
+	while (c ? c->collecting : get_pending > 0)
+		pthread_cond_wait (&get_cond, &get_mutex);
+	pthread_mutex_unlock (&get_mutex);
+}
+/* ------------------------------------------------------------------------- */
+/** Stop the background file collection worker after the queued cases
+ */
+LOCAL void get_queue_close (void)
+{
+	pthread_mutex_lock (&get_mutex);
+	if (!get_worker_running) {
+		pthread_mutex_unlock (&get_mutex);
+		return;
+	}
+	get_worker_stop = 1;
+	pthread_cond_broadcast (&get_cond);
+	pthread_mutex_unlock (&get_mutex);
+	pthread_join (get_thread, NULL);
+	get_worker_running = 0;
+	get_worker_stop = 0;
+}
+/* ------------------------------------------------------------------------- */
 /** Set case result to fail
  *  @param data case data
  *  @param user failure info
@@ -954,56 +1379,751 @@ LOCAL int case_result_fail (const void *data, const void *user)
 	return 1;
 }
 /* ------------------------------------------------------------------------- */
-/** Process set get data. 
- *  @param data get file data
+/** Append case to an array of cases
+ *  @param data case data
+ *  @param user pointer to the next free slot in array of cases
+ *  @return 1 always
+ */
+LOCAL int collect_case (const void *data, const void *user)
+{
+	td_case ***next = (td_case ***)user;
+
+	**next = (td_case *)data;
+	(*next)++;
+
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if step can be executed concurrently with steps of other cases
+ *  @param data step data
+ *  @param user set to 0 if step is not parallel safe
+ *  @return 1 if step is parallel safe, 0 if not (stops the walk)
+ */
+LOCAL int step_parallel_safe (const void *data, const void *user)
+{
+	td_step *step = (td_step *)data;
+	int *safe = (int *)user;
+
+	/* manual steps need the console, control steps reboot the device */
+	if (step->manual || step->control != CONTROL_NONE)
+		*safe = 0;
+#ifdef ENABLE_EVENTS
+	if (step->event)
+		*safe = 0;
+#endif
+	return *safe;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if case can be executed concurrently with other cases, or on
+ *  any target of a sharded run
+ *  @param c case data
+ *  @return 1 if case is parallel safe, 0 if not
+ */
+LOCAL int case_parallel_safe (td_case *c)
+{
+	int safe = 1;
+
+	/* on several targets, each case runs alone on its target */
+	if (!c->gen.parallel && opts.target_count < 2)
+		return 0;
+	if (c->gen.manual)
+		return 0;
+	xmlListWalk (c->steps, step_parallel_safe, &safe);
+
+	return safe;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if the result of a case may be taken from the result cache
+ *  @param c case data
+ *  @return 1 if case is cacheable, 0 if not
+ */
+LOCAL int case_cacheable (td_case *c)
+{
+	int safe = 1;
+
+	if (!result_cache_enabled () || c->gen.manual)
+		return 0;
+	/* files got by the case, rich-core dumps or power measurements
+	   would be missing from the output folder */
+	if (xmlListSize (c->gets) > 0 || opts.rich_core_dumps ||
+	    opts.measure_power)
+		return 0;
+	/* steps rebooting the device or waiting for events are not
+	   repeatable */
+	xmlListWalk (c->steps, step_parallel_safe, &safe);
+
+	return safe;
+}
+/* ------------------------------------------------------------------------- */
+/** Get the number of times a failed case may be executed again
+ *  @param c case data
+ *  @return retries of the case, 0 if the case is not retried
+ */
+LOCAL int case_retries (td_case *c)
+{
+	int safe = 1;
+
+	if (c->gen.manual)
+		return 0;
+	/* steps rebooting the device or waiting for events are not
+	   repeatable */
+	xmlListWalk (c->steps, step_parallel_safe, &safe);
+	if (!safe)
+		return 0;
+
+	return c->gen.retries >= 0 ? c->gen.retries : opts.retries;
+}
+/* ------------------------------------------------------------------------- */
+/** Record an executed attempt of a case with retries
+ *  @param c case data
+ *  @param retries retries of the case
+ *  @param start start time of the attempt
+ *  @param started monotonic start time of the attempt
+ *  @return 1 if the case is executed again, 0 if not
+ */
+LOCAL int case_attempt_done (td_case *c, int retries, time_t start,
+			     struct timespec *started)
+{
+	td_attempt *attempt;
+	struct timespec finished;
+
+	if (retries == 0)
+		return 0;
+
+	clock_gettime (CLOCK_MONOTONIC, &finished);
+	attempt = (td_attempt *)malloc (sizeof (td_attempt));
+	if (attempt == NULL) {
+		LOG_MSG (LOG_ERR, "%s: FATAL : OOM", PROGNAME);
+		return 0;
+	}
+	memset (attempt, 0x0, sizeof (td_attempt));
+	attempt->number = xmlListSize (c->attempts) + 1;
+	attempt->result = c->case_res;
+	attempt->start = start;
+	attempt->duration = (finished.tv_sec - started->tv_sec) +
+		(finished.tv_nsec - started->tv_nsec) / 1e9;
+	if (c->failure_info)
+		attempt->failure_info = xmlStrdup (c->failure_info);
+	xmlListAppend (c->attempts, attempt);
+
+	/* a case cut short by bail out fails again */
+	if (c->case_res != CASE_FAIL || bail_out || attempt->number > retries)
+		return 0;
+
+	LOG_MSG (LOG_INFO, "Test case %s failed on attempt %d of %d",
+		 c->gen.name, attempt->number, retries + 1);
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Clear the results of the steps of a case before it is executed again
+ *  @param data step data
  *  @param user not used
  *  @return 1 always
  */
-LOCAL int process_get (const void *data, const void *user)
+LOCAL int step_reset (const void *data, const void *user)
 {
+	td_step *step = (td_step *)data;
 
-	td_file *file = (td_file *)data;
-	char *command;
+	free (step->stdout_);
+	free (step->stderr_);
+	free (step->stdout_file);
+	free (step->stderr_file);
+	free (step->failure_info);
+	step->stdout_ = step->stderr_ = NULL;
+	step->stdout_file = step->stderr_file = NULL;
+	step->failure_info = NULL;
+	step->stdout_bytes = step->stderr_bytes = 0;
+	step->has_result = 0;
+	step->return_code = 0;
+	step->fail = 0;
+	step->start = step->end = 0;
+	step->pgid = step->pid = 0;
+	step->has_usage = 0;
+	memset (&step->usage, 0x0, sizeof (struct rusage));
+
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Wait before a failed case is executed again, and clear its results.
+ *  The wait is doubled for each attempt.
+ *  @param c case data
+ */
+LOCAL void case_retry_prepare (td_case *c)
+{
+	unsigned delay;
+	int n;
+
+	delay = opts.retry_delay;
+	for (n = 1; n < xmlListSize (c->attempts) && delay < MAX_RETRY_DELAY;
+	     n++)
+		delay *= 2;
+	if (delay > MAX_RETRY_DELAY)
+		delay = MAX_RETRY_DELAY;
+	if (delay)
+		LOG_MSG (LOG_INFO, "Executing test case %s again in %u s",
+			 c->gen.name, delay);
+	/* interrupted by a signal setting bail out */
+	while (delay && !bail_out)
+		delay = sleep (delay);
+
+	xmlListWalk (c->steps, step_reset, NULL);
+	if (c->failure_info) {
+		xmlFree (c->failure_info);
+		c->failure_info = NULL;
+	}
+	c->case_res = CASE_PASS;
+}
+/* ------------------------------------------------------------------------- */
+/** Record a run of a case to the run history
+ *  @param s set data
+ *  @param c case data
+ *  @param start start time of the run
+ *  @param duration duration of the run in seconds
+ */
+LOCAL void case_history_record (td_set *s, td_case *c, time_t start,
+				double duration)
+{
+	if (!history_enabled () || c->gen.manual)
+		return;
+
+	history_record_case (s, c, current_td ?
+			     (char *)current_td->detected_hw : NULL, start,
+			     duration);
+}
+/* ------------------------------------------------------------------------- */
+/** Resolve the depends attributes of the cases of a set to prerequisite
+ *  cases. Unknown case names are ignored with a warning.
+ *  @param cases cases of the set in definition order
+ *  @param count number of cases
+ *  @return number of dependencies found
+ */
+LOCAL int resolve_dependencies (td_case **cases, int count)
+{
+	xmlHashTablePtr names;
+	td_case *dep, **prereqs;
+	char *list, *p, *name, *end;
+	int i, links = 0;
+
+	names = xmlHashCreate (count);
+	if (!names)
+		return 0;
+	/* with duplicate names, the first case is the prerequisite */
+	for (i = 0; i < count; i++)
+		if (cases[i]->gen.name)
+			xmlHashAddEntry (names, cases[i]->gen.name, cases[i]);
+
+	for (i = 0; i < count; i++) {
+		if (!cases[i]->depends)
+			continue;
+		list = p = strdup ((char *)cases[i]->depends);
+		while (p) {
+			name = strsep (&p, ",");
+			name += strspn (name, " \t\n");
+			for (end = name + strlen (name); end > name &&
+				     strchr (" \t\n", end[-1]); end--)
+				;
+			*end = '\0';
+			if (!*name)
+				continue;
+			dep = xmlHashLookup (names, BAD_CAST name);
+			if (!dep) {
+				LOG_MSG (LOG_WARNING, "Case %s depends on "
+					 "unknown case %s", cases[i]->gen.name,
+					 name);
+				continue;
+			}
+			if (dep == cases[i])
+				continue;
+			prereqs = realloc (cases[i]->prerequisites,
+					   (cases[i]->prerequisite_count + 1) *
+					   sizeof (td_case *));
+			if (!prereqs) {
+				LOG_MSG (LOG_ERR, "OOM");
+				break;
+			}
+			prereqs[cases[i]->prerequisite_count++] = dep;
+			cases[i]->prerequisites = prereqs;
+			links++;
+		}
+		free (list);
+	}
+
+	xmlHashFree (names, NULL);
+	return links;
+}
+/* ------------------------------------------------------------------------- */
+/** Order cases so that each case comes after the cases it depends on,
+ *  otherwise keeping definition order. Dependencies of cases in a cycle
+ *  are ignored.
+ *  @param cases cases of the set in definition order, reordered
+ *  @param count number of cases
+ */
+LOCAL void order_by_dependencies (td_case **cases, int count)
+{
+	td_case **order;
+	int *indegree;
+	int i, j, k, n;
+
+	order = (td_case **)malloc (count * sizeof (td_case *));
+	indegree = (int *)malloc (count * sizeof (int));
+	if (!order || !indegree) {
+		LOG_MSG (LOG_ERR, "OOM");
+		goto out;
+	}
+
+	for (i = 0; i < count; i++)
+		indegree[i] = cases[i]->prerequisite_count;
+	for (n = 0; n < count; n++) {
+		/* first case in definition order without pending
+		   prerequisites, placed cases are marked with -1 */
+		for (i = 0; i < count && indegree[i] != 0; i++)
+			;
+		if (i == count)
+			break;
+		indegree[i] = -1;
+		order[n] = cases[i];
+		for (j = 0; j < count; j++)
+			for (k = 0; k < cases[j]->prerequisite_count; k++)
+				if (cases[j]->prerequisites[k] == cases[i])
+					indegree[j]--;
+	}
+	for (i = 0; i < count && n < count; i++) {
+		if (indegree[i] < 0)
+			continue;
+		LOG_MSG (LOG_WARNING, "Circular dependency, ignoring "
+			 "dependencies of case %s", cases[i]->gen.name);
+		free (cases[i]->prerequisites);
+		cases[i]->prerequisites = NULL;
+		cases[i]->prerequisite_count = 0;
+		order[n++] = cases[i];
+	}
+	memcpy (cases, order, count * sizeof (td_case *));
+ out:
+	free (order);
+	free (indegree);
+}
+/* ------------------------------------------------------------------------- */
+/** Find a prerequisite of a case which failed or was not executed
+ *  because of its own failed prerequisites
+ *  @param c case data
+ *  @return failed prerequisite, NULL if none
+ */
+LOCAL td_case *failed_prerequisite (td_case *c)
+{
+	td_case *dep;
+	int i;
+
+	for (i = 0; i < c->prerequisite_count; i++) {
+		dep = c->prerequisites[i];
+		if (dep->blocked || (dep->executed &&
+				     dep->case_res == CASE_FAIL))
+			return dep;
+	}
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if the prerequisites of a case have been processed
+ *  @param c case data
+ *  @return 1 if case can be started, 0 if not
+ */
+LOCAL int prerequisites_done (td_case *c)
+{
+	int i;
+
+	for (i = 0; i < c->prerequisite_count; i++)
+		if (!c->prerequisites[i]->done)
+			return 0;
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Take the first case from the queue whose prerequisites are done. Waits
+ *  for running cases if no case is ready. Caller holds queue->mutex.
+ *  @param queue case queue
+ *  @return case to execute, NULL if the queue is empty
+ */
+LOCAL td_case *next_ready_case (case_queue *queue)
+{
+	td_case *c;
+	int i;
+
+	while (queue->next < queue->count) {
+		for (i = queue->next; i < queue->count; i++)
+			if (prerequisites_done (queue->cases[i]))
+				break;
+		/* nothing else to wait for, should not happen as cases
+		   are ordered by dependencies */
+		if (i == queue->count && queue->running == 0)
+			i = queue->next;
+		if (i < queue->count) {
+			c = queue->cases[i];
+			memmove (&queue->cases[queue->next + 1],
+				 &queue->cases[queue->next],
+				 (i - queue->next) * sizeof (td_case *));
+			queue->cases[queue->next++] = c;
+			queue->running++;
+			return c;
+		}
+		pthread_cond_wait (&queue->cond, &queue->mutex);
+	}
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Expected duration of a case: mean of the recorded runs, or the case
+ *  timeout if there is no history
+ *  @param s set data
+ *  @param c case data
+ *  @return expected duration in seconds
+ */
+LOCAL double case_expected_duration (td_set *s, td_case *c)
+{
+	history_stats stats;
+
+	if (history_case_stats ((char *)s->gen.name, (char *)c->gen.name,
+				current_td ? (char *)current_td->detected_hw :
+				NULL, &stats))
+		return stats.mean_duration;
+
+	return c->gen.timeout ? c->gen.timeout : COMMON_SOFT_TIMEOUT;
+}
+/* ------------------------------------------------------------------------- */
+/** Compare scheduled cases, longest first and then in definition order
+ *  @param a scheduled case
+ *  @param b scheduled case
+ *  @return qsort comparison result
+ */
+LOCAL int scheduled_case_cmp (const void *a, const void *b)
+{
+	const scheduled_case *sa = (const scheduled_case *)a;
+	const scheduled_case *sb = (const scheduled_case *)b;
+
+	if (sa->expected != sb->expected)
+		return sa->expected < sb->expected ? 1 : -1;
+	return sa->index - sb->index;
+}
+/* ------------------------------------------------------------------------- */
+/** Order parallel cases for execution longest processing time first, so
+ *  that a long case started last does not keep the other workers idle.
+ *  @param cases array of parallel safe cases in definition order
+ *  @param count number of cases
+ *  @param s set data
+ *  @return new array of the cases in execution order, NULL on OOM
+ */
+LOCAL td_case **schedule_cases (td_case **cases, int count, td_set *s)
+{
+	scheduled_case *sched;
+	td_case **order;
+	int i;
+
+	sched = (scheduled_case *)malloc (count * sizeof (scheduled_case));
+	order = (td_case **)malloc (count * sizeof (td_case *));
+	if (!sched || !order) {
+		free (sched);
+		free (order);
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		sched[i].c = cases[i];
+		sched[i].expected = case_expected_duration (s, cases[i]);
+		sched[i].index = i;
+	}
+	qsort (sched, count, sizeof (scheduled_case), scheduled_case_cmp);
+	for (i = 0; i < count; i++) {
+		order[i] = sched[i].c;
+		LOG_MSG (LOG_DEBUG, "Scheduling case %s, expected duration "
+			 "%.1f s", sched[i].c->gen.name, sched[i].expected);
+	}
+
+	free (sched);
+	return order;
+}
+/* ------------------------------------------------------------------------- */
+/** Worker thread executing cases from a queue until it is empty. Idle
+ *  workers take the next case, so a slow target does not hold up the
+ *  others.
+ *  @param arg worker data
+ *  @return NULL always
+ */
+LOCAL void *case_worker (void *arg)
+{
+	case_queue *queue = ((case_worker_arg *)arg)->queue;
+	td_case *c;
+
+	use_target (((case_worker_arg *)arg)->target);
+	parallel_worker = 1;
+	while (1) {
+		pthread_mutex_lock (&queue->mutex);
+		c = next_ready_case (queue);
+		pthread_mutex_unlock (&queue->mutex);
+		if (!c)
+			break;
+		process_case (c, queue->set);
+		pthread_mutex_lock (&queue->mutex);
+		c->done = 1;
+		queue->running--;
+		pthread_cond_broadcast (&queue->cond);
+		pthread_mutex_unlock (&queue->mutex);
+	}
+	parallel_worker = 0;
+	use_target (NULL);
+
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Execute cases concurrently in up to opts.jobs worker threads, or in
+ *  a worker thread for each ready target of a sharded run
+ *  @param cases array of parallel safe cases
+ *  @param count number of cases
+ *  @param s set data
+ */
+LOCAL void process_parallel_cases (td_case **cases, int count, td_set *s)
+{
+	case_queue queue;
+	pthread_t threads[MAX_PARALLEL_JOBS];
+	case_worker_arg args[MAX_PARALLEL_JOBS];
+	td_case **order;
+	int i, nthreads, err;
+
+	/* results are still written in definition order */
+	order = schedule_cases (cases, count, s);
+	queue.cases = order ? order : cases;
+	queue.count = count;
+	queue.next = 0;
+	queue.running = 0;
+	queue.set = s;
+	pthread_mutex_init (&queue.mutex, NULL);
+	pthread_cond_init (&queue.cond, NULL);
+
+	nthreads = ready_count > 1 ? ready_count : opts.jobs;
+	if (count < nthreads)
+		nthreads = count;
+	LOG_MSG (LOG_DEBUG, "Executing %d parallel cases in %d threads",
+		 count, nthreads);
+	for (i = 0; i < nthreads; i++) {
+		args[i].queue = &queue;
+		args[i].target = ready_count > 1 ? ready_targets[i] : NULL;
+		err = pthread_create (&threads[i], NULL, case_worker,
+				      &args[i]);
+		if (err) {
+			LOG_MSG (LOG_WARNING, "Failed to create thread: %s",
+				 strerror (err));
+			break;
+		}
+	}
+	nthreads = i;
+	/* without threads, the cases are executed here one by one */
+	if (nthreads == 0) {
+		args[0].queue = &queue;
+		args[0].target = ready_count ? ready_targets[0] : NULL;
+		case_worker (&args[0]);
+		use_target (args[0].target);
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join (threads[i], NULL);
+	pthread_mutex_destroy (&queue.mutex);
+	pthread_cond_destroy (&queue.cond);
+	free (order);
+}
+/* ------------------------------------------------------------------------- */
+/** Execute the cases of a set. Cases are first ordered after the cases
+ *  they depend on. With opts.jobs > 1 or several targets, consecutive
+ *  parallel safe cases are executed concurrently, longest first, and
+ *  other cases one at a time between them. Results are kept
+ *  in the cases, so they are written in definition order regardless of
+ *  the order of execution.
+ *  @param s set data
+ */
+LOCAL void process_cases (td_set *s)
+{
+	td_case **cases, **next;
+	int count, i, j;
+
+	count = xmlListSize (s->cases);
+	if (count == 0)
+		return;
+	cases = (td_case **)malloc (count * sizeof (td_case *));
+	if (!cases) {
+		LOG_MSG (LOG_ERR, "OOM");
+		xmlListWalk (s->cases, process_case, s);
+		return;
+	}
+	next = cases;
+	xmlListWalk (s->cases, collect_case, &next);
+
+	if (resolve_dependencies (cases, count))
+		order_by_dependencies (cases, count);
+
+	for (i = 0; i < count; i = j) {
+		j = i;
+		if (opts.jobs > 1 || ready_count > 1)
+			while (j < count && case_parallel_safe (cases[j]))
+				j++;
+		if (j - i > 1) {
+			process_parallel_cases (&cases[i], j - i, s);
+		} else {
+			process_case (cases[i], s);
+			cases[i]->done = 1;
+			j = i + 1;
+		}
+	}
+
+	free (cases);
+}
+/* ------------------------------------------------------------------------- */
+/** Set the target steps executed by the calling thread are run on
+ *  @param target target of a sharded run, NULL for the default target
+ */
+LOCAL void use_target (shard_target *target)
+{
+	cur_target = target;
+	executor_set_target (target ? target->remote_executor : NULL);
+}
+/* ------------------------------------------------------------------------- */
+/** Execute pre or post steps of a set, on each ready target of a sharded
+ *  run. Targets where pre steps fail are not used for the cases of the set.
+ *  @param s set data
+ *  @param steps pre or post steps
+ *  @param pre 1 for pre steps, 0 for post steps
+ *  @return 1 if steps passed on at least one target, 0 if not
+ */
+LOCAL int set_steps_execute (td_set *s, xmlListPtr steps, int pre)
+{
+	shard_target *targets[MAX_PARALLEL_JOBS];
+	td_case dummy;
+	int count, i, passed = 0;
+
+	count = ready_count;
+	memcpy (targets, ready_targets, count * sizeof (shard_target *));
+	if (count == 0) {
+		/* not sharded, executed once on the default target */
+		targets[0] = NULL;
+		count = 1;
+	}
+	if (pre)
+		ready_count = 0;
+
+	for (i = 0; i < count; i++) {
+		use_target (targets[i]);
+		cur_case_name = (xmlChar *)(pre ? "pre_steps" : "post_steps");
+		cur_step_num = 0;
+		memset (&dummy, 0x0, sizeof (td_case));
+		dummy.case_res = CASE_PASS;
+		dummy.dummy = 1;
+		if (targets[i])
+			LOG_MSG (LOG_INFO, "Executing %s steps on %s",
+				 pre ? "pre" : "post", targets[i]->address);
+		else
+			LOG_MSG (LOG_INFO, "Executing %s steps",
+				 pre ? "pre" : "post");
+		xmlListWalk (steps, prepost_steps_execute, &dummy);
+
+		if (dummy.case_res == CASE_PASS) {
+			passed++;
+			if (pre && targets[i])
+				ready_targets[ready_count++] = targets[i];
+		} else if (!pre && dummy.case_res == CASE_FAIL) {
+			LOG_MSG (LOG_INFO, 
+				 "Post steps failed for %s.", s->gen.name);
+		} else if (pre && targets[i]) {
+			LOG_MSG (LOG_WARNING, "Pre steps failed on %s, "
+				 "target not used for set %s",
+				 targets[i]->address, s->gen.name);
+		}
+	}
+	use_target (ready_count ? ready_targets[0] : NULL);
+
+	return passed > 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Compose the path of a get file on the system under test
+ *  @param file get file data
+ *  @return path of the file, prefixed with the chroot folder
+ */
+LOCAL char *get_file_name (td_file *file)
+{
 	char *fname;
 	char *tmpname;
+
+	if (opts.chroot_folder) {
+		/* source file must be prefixed with chroot dir */
+		fname = (char *)malloc(strlen(opts.chroot_folder) +
+				       strlen((char *)file->filename) + 2);
+		strcpy(fname, opts.chroot_folder);
+		strcat(fname, "/");
+
+		tmpname = malloc (strlen((char *)file->filename) + 1);
+		trim_string ((char *)file->filename, tmpname);
+
+		strcat(fname, tmpname);
+		free(tmpname);
+	} else {
+		fname = malloc (strlen((char *)file->filename) + 1);
+		trim_string ((char *)file->filename, fname);
+	}
+
+	return fname;
+}
+/* ------------------------------------------------------------------------- */
+/** Collect one get file to the output folder
+ *  @param file get file data
+ *  @param fname path of the file
+ */
+LOCAL void get_file (td_file *file, const char *fname)
+{
+	char *command;
 	exec_data edata;
 	char *p;
-	char *executor = opts.remote_executor;
+	char *executor = cur_target ? cur_target->remote_executor :
+		opts.remote_executor;
+	char *getter = cur_target ? cur_target->remote_getter :
+		opts.remote_getter;
 	int command_len;
+	int ret;
 #ifdef ENABLE_LIBSSH2
 	int key_param_len = 0;
 	char *remote = opts.target_address;
+
+	/* the agent of the libssh2 session is known by the target address */
+	if (opts.libssh2)
+		executor = remote;
 #endif
-	if (bail_out) {
-		return 1;
+	if (executor && opts.remote_agent) {
+		ret = remote_agent_get (executor, fname, opts.output_folder);
+		if (ret > 0)
+			LOG_MSG (LOG_INFO, "%s: get %s failed: %s\n", PROGNAME,
+				 fname, strerror (ret));
+		if (ret >= 0) {
+			file->collected = ret ? -1 : 1;
+			return;
+		}
+		/* agent not available, use getter */
 	}
+#ifdef ENABLE_LIBSSH2
+	if (opts.libssh2) {
+		ret = executor_libssh2_get (fname, opts.output_folder);
+		if (ret > 0)
+			LOG_MSG (LOG_INFO, "%s: get %s failed: %s\n", PROGNAME,
+				 fname, strerror (ret));
+		if (ret >= 0) {
+			file->collected = ret ? -1 : 1;
+			return;
+		}
+		/* no SFTP on target or transfer failed, use scp */
+	}
+#endif
 
 	memset (&edata, 0x0, sizeof (exec_data));
 	init_exec_data(&edata);
 	edata.soft_timeout = COMMON_SOFT_TIMEOUT;
 	edata.hard_timeout = COMMON_HARD_TIMEOUT;
+	edata.parallel = parallel_worker;
 
 	if (opts.chroot_folder) {
 		/* Tell executor not to execute cp command in chroot
 		   but in "normal" environment */
 		edata.disobey_chroot = 1;
-
-		/* source file must be prefixed with chroot dir */
-		fname = (char *)malloc(strlen(opts.chroot_folder) +
-				       strlen((char *)file->filename) + 2);
-		strcpy(fname, opts.chroot_folder);
-		strcat(fname, "/");
-
-		tmpname = malloc (strlen((char *)file->filename) + 1);
-		trim_string ((char *)file->filename, tmpname);
-
-		strcat(fname, tmpname);
-		free(tmpname);
-	} else {
-		fname = malloc (strlen((char *)file->filename) + 1);
-		trim_string ((char *)file->filename, fname);
 	}
-	command_len = strlen ("rm -f ") + strlen (fname) + 1;
 	/*
 	** Compose command 
 	*/
@@ -1024,7 +2144,7 @@ LOCAL int process_get (const void *data, const void *user)
 			key_param[0] = '\0';
 		}
 		
-		opts.target_address = NULL; /* execute locally */
+		edata.local = 1; /* execute locally */
 		command_len = strlen ("scp ") +
 			strlen (opts.username) + 1 +
 			strlen (fname) +
@@ -1044,8 +2164,8 @@ LOCAL int process_get (const void *data, const void *user)
 	} else
 #endif
 	if (executor) {
-		opts.remote_executor = NULL; /* execute locally */
-		command = replace_string (opts.remote_getter, "<FILE>", fname);
+		edata.local = 1; /* execute locally */
+		command = replace_string (getter, "<FILE>", fname);
 		p = command;
 		command = replace_string (command, "<DEST>", opts.output_folder);
 		free(p);
@@ -1069,22 +2189,184 @@ LOCAL int process_get (const void *data, const void *user)
 				  edata.stderr_data.buffer : 
 				  BAD_CAST "no info available"));
 	}
-#ifdef ENABLE_LIBSSH2
-	opts.target_address = remote;
-#endif
-	opts.remote_executor = executor;
+	file->collected = edata.result ? -1 : 1;
 	if (edata.stdout_data.buffer) free (edata.stdout_data.buffer);
 	if (edata.stderr_data.buffer) free (edata.stderr_data.buffer);
 	if (edata.failure_info.buffer) free (edata.failure_info.buffer);
+	free (command);
+}
+/* ------------------------------------------------------------------------- */
+/** Remove a file or directory tree, callback for nftw
+ *  @param path path of the file
+ *  @param sb not used
+ *  @param flag not used
+ *  @param ftw not used
+ *  @return 0 always
+ */
+LOCAL int remove_path (const char *path, const struct stat *sb, int flag,
+		       struct FTW *ftw)
+{
+	if (remove (path) < 0)
+		LOG_MSG (LOG_DEBUG, "Failed to remove %s: %s", path,
+			 strerror (errno));
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Check if a get file can be collected with the tar stream. The files are
+ *  found in the stream with the path as given, so paths the remote shell
+ *  would expand to another name, like ~ or $HOME, are left to the getter.
+ *  Wildcards are expanded to the same names on both ends.
+ *  @param fname path of the file
+ *  @return 1 if the file can be streamed, 0 if not
+ */
+LOCAL int get_file_batchable (const char *fname)
+{
+	return strpbrk (fname, "~$`{ \t\\'\";&|<>()") == NULL;
+}
+/* ------------------------------------------------------------------------- */
+/** Collect get files from the system under test as one tar stream over 
+ *  the remote executor. The stream is unpacked to a temporary folder and
+ *  the files are moved from there to the output folder. Files that can 
+ *  not be streamed are skipped and left uncollected.
+ *  @param files get file data
+ *  @param fnames paths of the files
+ *  @param count number of files
+ *  @return number of files collected, -1 if the stream failed
+ */
+LOCAL int get_files_batched (td_file **files, char **fnames, int count)
+{
+	char *executor = cur_target ? cur_target->remote_executor :
+		opts.remote_executor;
+	char *tar, *quoted, *command, *pattern, *dest, *p;
+	char dir[PATH_MAX];
+	exec_data edata;
+	glob_t gl;
+	size_t len;
+	int collected = 0, streamed = 0, i, ret = -1;
+	unsigned int j;
 
-	if (!file->delete_after)
-		goto out;
+	for (i = 0; i < count; i++)
+		streamed += get_file_batchable (fnames[i]);
+	if (!streamed)
+		return 0;
+
+	if (snprintf (dir, PATH_MAX, "%s.get.XXXXXX", opts.output_folder)
+	    >= PATH_MAX || !mkdtemp (dir)) {
+		LOG_MSG (LOG_WARNING, "Failed to create folder for get "
+			 "files: %s", strerror (errno));
+		return -1;
+	}
+
+	len = strlen ("tar cf -") + 1;
+	for (i = 0; i < count; i++)
+		len += strlen (fnames[i]) + 1;
+	tar = (char *)malloc (len);
+	strcpy (tar, "tar cf -");
+	for (i = 0; i < count; i++) {
+		if (!get_file_batchable (fnames[i]))
+			continue;
+		strcat (tar, " ");
+		strcat (tar, fnames[i]);
+	}
+	/* remote command is one argument of the executor */
+	quoted = replace_string (tar, "'", "'\\''");
+	len = strlen (executor) + strlen (quoted) + strlen (dir) + 
+		strlen (" '' | tar xf - -C ''") + 1;
+	command = (char *)malloc (len);
+	snprintf (command, len, "%s '%s' | tar xf - -C '%s'", executor,
+		  quoted, dir);
+	free (tar);
+	free (quoted);
+
+	memset (&edata, 0x0, sizeof (exec_data));
+	init_exec_data(&edata);
+	edata.soft_timeout = COMMON_SOFT_TIMEOUT;
+	edata.hard_timeout = COMMON_HARD_TIMEOUT;
+	edata.parallel = parallel_worker;
+	edata.local = 1; /* execute locally */
+
+	LOG_MSG (LOG_DEBUG, "%s:  Executing command: %s", PROGNAME, command);
+	execute(command, &edata);
+
+	/* tar stores the paths without leading slash */
+	for (i = 0; i < count; i++) {
+		if (!get_file_batchable (fnames[i]))
+			continue;
+		p = fnames[i];
+		while (*p == '/')
+			p++;
+		len = strlen (dir) + strlen (p) + 2;
+		pattern = (char *)malloc (len);
+		snprintf (pattern, len, "%s/%s", dir, p);
+		if (glob (pattern, 0, NULL, &gl) == 0) {
+			for (j = 0; j < gl.gl_pathc; j++) {
+				len = strlen (opts.output_folder) +
+					strlen (gl.gl_pathv[j]) + 1;
+				dest = (char *)malloc (len);
+				snprintf (dest, len, "%s%s", opts.output_folder,
+					  strrchr (gl.gl_pathv[j], '/') + 1);
+				if (rename (gl.gl_pathv[j], dest) < 0)
+					LOG_MSG (LOG_WARNING, "Failed to move "
+						 "%s to %s: %s", gl.gl_pathv[j],
+						 dest, strerror (errno));
+				free (dest);
+			}
+			files[i]->collected = 1;
+			collected++;
+		} else {
+			files[i]->collected = -1;
+		}
+		globfree (&gl);
+		free (pattern);
+	}
+
+	if (edata.result)
+		LOG_MSG (collected ? LOG_INFO : LOG_DEBUG, 
+			 "%s: %s failed: %s\n", PROGNAME, command,
+			 (char *)(edata.stderr_data.buffer ?
+				  edata.stderr_data.buffer : 
+				  BAD_CAST "no info available"));
+	if (collected || !edata.result)
+		ret = collected;
+	nftw (dir, remove_path, 16, FTW_DEPTH | FTW_PHYS);
+
+	if (edata.stdout_data.buffer) free (edata.stdout_data.buffer);
+	if (edata.stderr_data.buffer) free (edata.stderr_data.buffer);
+	if (edata.failure_info.buffer) free (edata.failure_info.buffer);
+	free (command);
+
+	return ret;
+}
+/* ------------------------------------------------------------------------- */
+/** Delete get files from the system under test with one command
+ *  @param fnames paths of the files
+ *  @param count number of files
+ */
+LOCAL void delete_files (char **fnames, int count)
+{
+	char *command;
+	exec_data edata;
+	size_t len;
+	int i;
+
+	if (count == 0)
+		return;
+
+	len = strlen ("rm -f") + 1;
+	for (i = 0; i < count; i++)
+		len += strlen (fnames[i]) + 1;
+	command = (char *)malloc (len);
+	strcpy (command, "rm -f");
+	for (i = 0; i < count; i++) {
+		strcat (command, " ");
+		strcat (command, fnames[i]);
+	}
 
 	memset (&edata, 0x0, sizeof (exec_data));
 	init_exec_data(&edata);
 	edata.soft_timeout = COMMON_SOFT_TIMEOUT;
 	edata.hard_timeout = COMMON_HARD_TIMEOUT;
-	snprintf (command, command_len, "rm -f %s", fname);
+	edata.parallel = parallel_worker;
 	LOG_MSG (LOG_DEBUG, "%s:  Executing command: %s", PROGNAME, command);
 	execute(command, &edata);
 	if (edata.result) {
@@ -1096,14 +2378,100 @@ LOCAL int process_get (const void *data, const void *user)
 	if (edata.stdout_data.buffer) free (edata.stdout_data.buffer);
 	if (edata.stderr_data.buffer) free (edata.stderr_data.buffer);
 	if (edata.failure_info.buffer) free (edata.failure_info.buffer);
+	free (command);
+}
+/* ------------------------------------------------------------------------- */
+/** Add a get file to a batch, callback for xmlListWalk
+ *  @param data get file data
+ *  @param user batch
+ *  @return 1 always
+ */
+LOCAL int get_batch_add (const void *data, const void *user)
+{
+	td_file *file = (td_file *)data;
+	get_batch *batch = (get_batch *)user;
+	char *fname = get_file_name (file);
+
+	batch->files[batch->count] = file;
+	batch->fnames[batch->count++] = fname;
+
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Collect the get files of a set or case, then delete the ones with
+ *  delete_after from the system under test. With --batch-get the files
+ *  of a remote target are collected with one stream.
+ *  @param gets list of get files
+ */
+LOCAL void process_gets (xmlListPtr gets)
+{
+	get_batch batch;
+	char *executor = cur_target ? cur_target->remote_executor :
+		opts.remote_executor;
+	int size = xmlListSize (gets), batched = -1, i;
+
+	if (bail_out || size == 0)
+		return;
 
+	memset (&batch, 0x0, sizeof (get_batch));
+	batch.files = (td_file **)malloc (size * sizeof (td_file *));
+	batch.fnames = (char **)malloc (size * sizeof (char *));
+	batch.deletes = (char **)malloc (size * sizeof (char *));
+	if (!batch.files || !batch.fnames || !batch.deletes) {
+		LOG_MSG (LOG_ERR, "%s: FATAL : OOM", PROGNAME);
+		goto out;
+	}
+	xmlListWalk (gets, get_batch_add, &batch);
+
+	if (opts.batch_get && executor && !opts.remote_agent)
+		batched = get_files_batched (batch.files, batch.fnames,
+					     batch.count);
+	/* stream failed, for example no tar on target, or the path is
+	   expanded by the remote shell */
+	for (i = 0; i < batch.count && !bail_out; i++)
+		if (batched < 0 || !get_file_batchable (batch.fnames[i]))
+			get_file (batch.files[i], batch.fnames[i]);
+
+	/* a file is deleted only when there is a copy */
+	for (i = 0; i < batch.count; i++)
+		if (batch.files[i]->delete_after && 
+		    batch.files[i]->collected > 0)
+			batch.deletes[batch.ndeletes++] = batch.fnames[i];
+	if (!bail_out)
+		delete_files (batch.deletes, batch.ndeletes);
+
+	for (i = 0; i < batch.count; i++)
+		free (batch.fnames[i]);
  out:
-	free (command);
+	free (batch.files);
+	free (batch.fnames);
+	free (batch.deletes);
+}
+/* ------------------------------------------------------------------------- */
+/** Process get data of a single file
+ *  @param data get file data
+ *  @param user not used
+ *  @return 1 always
+ */
+LOCAL int process_get (const void *data, const void *user)
+{
+	td_file *file = (td_file *)data;
+	char *fname;
+
+	if (bail_out) {
+		return 1;
+	}
+
+	fname = get_file_name (file);
+	get_file (file, fname);
+	if (file->delete_after)
+		delete_files (&fname, 1);
 	free (fname);
+
 	return 1;
 }
 /* ------------------------------------------------------------------------- */
-/** Process case get data. 
+/** Process measurements of a collected case get file
  *  @param data get file data
  *  @param user case data
  *  @return 1 always
@@ -1117,10 +2485,6 @@ LOCAL int process_get_case (const void *data, const void *user)
 	int measurement_verdict = CASE_PASS;
 	size_t len;
 
-	ret = process_get (data, NULL);
-	if (!ret)
-		LOG_MSG (LOG_WARNING, "get file processing failed");
-
 	if (bail_out)
 		return 1;
 
@@ -1174,6 +2538,15 @@ LOCAL int process_get_case (const void *data, const void *user)
 	return 1;
 }
 
+/* ------------------------------------------------------------------------- */
+/** Collect the get files of a case and process their measurements
+ *  @param c case data
+ */
+LOCAL void process_case_gets (td_case *c)
+{
+	process_gets (c->gets);
+	xmlListWalk (c->gets, process_get_case, c);
+}
 /* ------------------------------------------------------------------------- */
 /** Process test definition
  *  @param *td Test definition data
@@ -1258,6 +2631,7 @@ LOCAL void process_set (td_set *s)
 {
 	td_case dummy;
 	td_steps *steps;
+	int i;
 	/*
 	** Check that the set is not filtered
 	*/
@@ -1290,51 +2664,57 @@ LOCAL void process_set (td_set *s)
 	current_set = s;
 	LOG_MSG (LOG_INFO, "Test set: %s", s->gen.name);
 	write_pre_set (s);
+	memset (&dummy, 0x0, sizeof (td_case));
+
+	if (journal_replay_set (current_suite, s)) {
+		LOG_MSG (LOG_INFO, "Test set %s was completed before the run "
+			 "was interrupted", s->gen.name);
+		/* the cases of the set are in the journal before it */
+		xmlListWalk (s->cases, case_replay_count, s);
+		write_post_set (s);
+		xml_end_element();
+		goto skip_all;
+	}
 
-	if (xmlListSize (s->pre_steps) > 0) {
-		cur_case_name = (xmlChar *)"pre_steps";
-		cur_step_num = 0;
-		memset (&dummy, 0x0, sizeof (td_case));
-		dummy.case_res = CASE_PASS;
-		dummy.dummy = 1;
-		LOG_MSG (LOG_INFO, "Executing pre steps");
-		xmlListWalk (s->pre_steps, prepost_steps_execute, &dummy);
-		if (dummy.case_res != CASE_PASS) {
-			LOG_MSG (LOG_INFO, "Pre steps failed. "
-				 "Test set %s aborted.", s->gen.name); 
-			xmlListWalk (s->cases, case_result_fail, 
-				     global_failure ? global_failure :
-				     "pre_steps failed");
-			goto short_circuit;
-		}
+	/* in sharded runs, cases which are not sharded and files of the
+	   set are executed on the first ready target */
+	ready_count = 0;
+	for (i = 0; i < opts.target_count; i++)
+		ready_targets[ready_count++] = &opts.targets[i];
+	use_target (ready_count ? ready_targets[0] : NULL);
+
+	if (xmlListSize (s->pre_steps) > 0 &&
+	    !set_steps_execute (s, s->pre_steps, 1)) {
+		LOG_MSG (LOG_INFO, "Pre steps failed. "
+			 "Test set %s aborted.", s->gen.name); 
+		xmlListWalk (s->cases, case_result_fail, 
+			     global_failure ? global_failure :
+			     "pre_steps failed");
+		goto short_circuit;
 	}
 	
-	xmlListWalk (s->cases, process_case, s);
+	process_cases (s);
+	/* results of the cases are final before post steps may remove
+	   their files */
+	get_queue_wait (NULL);
 
 	if (opts.resume_testrun != RESUME_TESTRUN_ACTION_NONE) {
 		wait_for_resume_execution();
 	}
 
-	if (xmlListSize (s->post_steps) > 0) {
-		LOG_MSG (LOG_INFO, "Executing post steps");
-		cur_case_name = (xmlChar *)"post_steps";
-		cur_step_num = 0;
-		memset (&dummy, 0x0, sizeof (td_case));
-		dummy.case_res = CASE_PASS;
-		dummy.dummy = 1;
-		xmlListWalk (s->post_steps, prepost_steps_execute, &dummy);
-		if (dummy.case_res == CASE_FAIL)
-			LOG_MSG (LOG_INFO, 
-				 "Post steps failed for %s.", s->gen.name);
-	}
-	xmlListWalk (s->gets, process_get, NULL);
+	if (xmlListSize (s->post_steps) > 0)
+		set_steps_execute (s, s->post_steps, 0);
+	process_gets (s->gets);
 
 	if (opts.resume_testrun == RESUME_TESTRUN_ACTION_EXIT) {
 		restore_bail_out_after_resume_execution();
 	}
 
  short_circuit:
+	use_target (NULL);
 	write_post_set (s);
+	if (!bail_out)
+		journal_record_set (current_suite, s);
 	if (xmlListSize (s->pre_steps) > 0) {
 		steps = xmlLinkGetData(xmlListFront(s->pre_steps));
 		xmlListWalk (steps->steps, step_post_process, &dummy);
@@ -1370,6 +2750,12 @@ void td_process () {
 	cbs.test_set = process_set;
 
 	retval = td_register_callbacks (&cbs);
+
+	/*
+	** Parse next set while the current one is executed
+	*/
+	if (td_reader_prefetch ())
+		LOG_MSG (LOG_DEBUG, "Parsing test definition in main thread");
 	
 	/*
 	** Call td_next_node untill error occurs or the end of data is reached
@@ -1378,9 +2764,16 @@ void td_process () {
 
 	while (td_next_node() == 0);
 
+	get_queue_close ();
 	LOG_MSG (LOG_INFO, "Finished running tests.");
 	LOG_MSG (LOG_INFO, "Executed %d cases. Passed %d Failed %d",
 		 casecount, passcount, failcount);
+	if (cachedcount)
+		LOG_MSG (LOG_INFO, "Results of %d cases were taken from "
+			 "result cache", cachedcount);
+	if (flakycount)
+		LOG_MSG (LOG_INFO, "%d cases passed after a failed attempt",
+			 flakycount);
 	return; 
 }	
 /* ------------------------------------------------------------------------- */
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
 #include <libxml/xmlwriter.h>
 #include "testresultlogger.h"
 #include "log.h"
@@ -66,6 +67,7 @@ const char* control_actions [] = {
 /* LOCAL GLOBAL VARIABLES */
 LOCAL xmlTextWriterPtr writer;
 LOCAL FILE *ofile;
+LOCAL pthread_mutex_t record_mutex = PTHREAD_MUTEX_INITIALIZER;
 /* ------------------------------------------------------------------------- */
 /* LOCAL CONSTANTS AND MACROS */
 /* None */
@@ -96,6 +98,11 @@ LOCAL int xml_write_pre_set (td_set *);
 /* ------------------------------------------------------------------------- */
 LOCAL int xml_write_general_attributes (td_gen_attribs *);
 /* ------------------------------------------------------------------------- */
+LOCAL int xml_write_output (const char *, xmlChar *, xmlChar *,
+			     unsigned long long);
+/* ------------------------------------------------------------------------- */
+LOCAL int xml_write_usage (td_step *);
+/* ------------------------------------------------------------------------- */
 LOCAL int xml_write_step (const void *, const void *);
 /* ------------------------------------------------------------------------- */
 #ifdef ENABLE_EVENTS
@@ -108,6 +115,8 @@ LOCAL int xml_write_pre_post_step (const void *, const void *);
 /* ------------------------------------------------------------------------- */
 LOCAL int xml_write_case (const void *, const void *);
 /* ------------------------------------------------------------------------- */
+LOCAL int xml_write_attempt (const void *, const void *);
+/* ------------------------------------------------------------------------- */
 LOCAL int xml_write_file_data (const void *, const void *);
 /* ------------------------------------------------------------------------- */
 LOCAL int xml_write_post_set (td_set *);
@@ -134,6 +143,10 @@ LOCAL int txt_write_post_set (td_set *);
 /* ------------------------------------------------------------------------- */
 LOCAL int txt_write_case (const void *, const void *);
 /* ------------------------------------------------------------------------- */
+LOCAL int txt_write_attempt (const void *, const void *);
+/* ------------------------------------------------------------------------- */
+LOCAL xmlChar *result_record (td_set *, td_case *);
+/* ------------------------------------------------------------------------- */
 /* FORWARD DECLARATIONS */
 /* None */
 
@@ -338,6 +351,88 @@ LOCAL int xml_write_general_attributes (td_gen_attribs *gen)
 	return 1;
 }
 
+/* ------------------------------------------------------------------------- */
+/** Write stdout or stderr element of a step
+ * @param name element name
+ * @param output captured output
+ * @param file file containing the whole output if it exceeded the limit
+ * @param bytes total size of the output
+ * @return 0 on success, -1 on error
+ */
+LOCAL int xml_write_output (const char *name, xmlChar *output, xmlChar *file,
+			    unsigned long long bytes)
+{
+	if (xmlTextWriterStartElement (writer, BAD_CAST name) < 0)
+		return -1;
+
+	if (file) {
+		/* output in results is truncated */
+		if (xmlTextWriterWriteAttribute (writer, BAD_CAST "file",
+						 file) < 0)
+			return -1;
+		if (xmlTextWriterWriteAttribute (writer, BAD_CAST "truncated",
+						 BAD_CAST "true") < 0)
+			return -1;
+		if (xmlTextWriterWriteFormatAttribute (writer, 
+						       BAD_CAST "bytes",
+						       "%llu", bytes) < 0)
+			return -1;
+	}
+
+	if (xmlTextWriterWriteString (writer, output ? output :
+				      BAD_CAST "") < 0)
+		return -1;
+
+	return xmlTextWriterEndElement (writer) < 0 ? -1 : 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Write resource usage of a step as attributes of step element
+ * @param step step data
+ * @return 0 on success, -1 on error
+ */
+LOCAL int xml_write_usage (td_step *step)
+{
+	struct rusage *ru = &step->usage;
+
+	if (!step->has_usage)
+		return 0;
+
+	if (xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "cpu_user",
+					       "%ld.%03ld", 
+					       (long)ru->ru_utime.tv_sec,
+					       (long)ru->ru_utime.tv_usec / 1000)
+	    < 0)
+		return -1;
+	if (xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "cpu_system",
+					       "%ld.%03ld", 
+					       (long)ru->ru_stime.tv_sec,
+					       (long)ru->ru_stime.tv_usec / 1000)
+	    < 0)
+		return -1;
+	/* kilobytes */
+	if (xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "max_rss",
+					       "%ld", ru->ru_maxrss) < 0)
+		return -1;
+	/* block counts are in 512 byte units */
+	if (xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "io_read",
+					       "%llu", (unsigned long long)
+					       ru->ru_inblock * 512) < 0)
+		return -1;
+	if (xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "io_write",
+					       "%llu", (unsigned long long)
+					       ru->ru_oublock * 512) < 0)
+		return -1;
+	if (xmlTextWriterWriteFormatAttribute (writer, 
+					       BAD_CAST "ctx_voluntary",
+					       "%ld", ru->ru_nvcsw) < 0)
+		return -1;
+	if (xmlTextWriterWriteFormatAttribute (writer, 
+					       BAD_CAST "ctx_involuntary",
+					       "%ld", ru->ru_nivcsw) < 0)
+		return -1;
+
+	return 0;
+}
 /* ------------------------------------------------------------------------- */
 /** Write step result xml
  * @param data step data 
@@ -415,6 +510,9 @@ LOCAL int xml_write_step (const void *data, const void *user)
 			goto err_out;
 	}
 
+	if (xml_write_usage (step) < 0)
+		goto err_out;
+
 	if (xmlTextWriterWriteFormatElement (writer,
 					     BAD_CAST "expected_result",
 					     "%d", step->expected_result) < 0)
@@ -449,18 +547,12 @@ LOCAL int xml_write_step (const void *data, const void *user)
 					     tm->tm_sec) < 0)
 		goto err_out;
 
-	if (xmlTextWriterWriteFormatElement (writer,
-					     BAD_CAST "stdout",
-					     "%s", 
-					     step->stdout_ ? step->stdout_ :
-					     BAD_CAST "") < 0)
+	if (xml_write_output ("stdout", step->stdout_, step->stdout_file,
+			      step->stdout_bytes) < 0)
 		goto err_out;
 
-	if (xmlTextWriterWriteFormatElement (writer,
-					     BAD_CAST "stderr",
-					     "%s", 
-					     step->stderr_ ? step->stderr_ :
-					     BAD_CAST "") < 0)
+	if (xml_write_output ("stderr", step->stderr_, step->stderr_file,
+			      step->stderr_bytes) < 0)
 		goto err_out;
 
 	if(step->control == CONTROL_REBOOT
@@ -629,6 +721,9 @@ LOCAL int xml_write_pre_post_step (const void *data, const void *user)
 			goto err_out;
 	}
 
+	if (xml_write_usage (step) < 0)
+		goto err_out;
+
 	if (xmlTextWriterWriteFormatElement (writer,
 					     BAD_CAST "expected_result",
 					     "%d", step->expected_result) < 0)
@@ -663,18 +758,12 @@ LOCAL int xml_write_pre_post_step (const void *data, const void *user)
 					     tm->tm_sec) < 0)
 		goto err_out;
 
-	if (xmlTextWriterWriteFormatElement (writer,
-					     BAD_CAST "stdout",
-					     "%s", 
-					     step->stdout_ ?
-					     step->stdout_ : BAD_CAST "") < 0)
+	if (xml_write_output ("stdout", step->stdout_, step->stdout_file,
+			      step->stdout_bytes) < 0)
 		goto err_out;
 
-	if (xmlTextWriterWriteFormatElement (writer,
-					     BAD_CAST "stderr",
-					     "%s", 
-					     step->stderr_ ?
-					     step->stderr_ : BAD_CAST "") < 0)
+	if (xml_write_output ("stderr", step->stderr_, step->stderr_file,
+			      step->stderr_bytes) < 0)
 		goto err_out;
 
 
@@ -697,6 +786,9 @@ LOCAL int xml_write_case (const void *data, const void *user)
 	if (c->filtered)
 		return 1;
 
+	if (c->result_record)
+		return xmlTextWriterWriteRaw (writer, c->result_record) >= 0;
+
 	if (xmlTextWriterStartElement (writer, BAD_CAST "case") < 0)
 		goto err_out;
 
@@ -734,6 +826,21 @@ LOCAL int xml_write_case (const void *data, const void *user)
 						 BAD_CAST "state", 
 						 c->state) < 0)
 			goto err_out;
+	if (c->target)
+		if (xmlTextWriterWriteAttribute (writer, 
+						 BAD_CAST "target", 
+						 c->target) < 0)
+			goto err_out;
+	if (c->depends)
+		if (xmlTextWriterWriteAttribute (writer, 
+						 BAD_CAST "depends", 
+						 c->depends) < 0)
+			goto err_out;
+	if (c->cached)
+		if (xmlTextWriterWriteAttribute (writer, 
+						 BAD_CAST "cached", 
+						 BAD_CAST "true") < 0)
+			goto err_out;
 	
 
 	if (c->gen.manual && c->comment)
@@ -755,10 +862,73 @@ LOCAL int xml_write_case (const void *data, const void *user)
                         goto err_out;
 
 	xmlListWalk (c->steps, xml_write_step, c);
+	xmlListWalk (c->attempts, xml_write_attempt, NULL);
 	xmlListWalk (c->measurements, xml_write_measurement, NULL);
 	xmlListWalk (c->series, xml_write_series, NULL);
 	xmlHashScan (c->crashes, (xmlHashScanner)xml_write_crash, NULL);
 
+	if (xmlListSize (c->gets) > 0) {
+		if (xmlTextWriterStartElement (writer, BAD_CAST "get") < 0)
+			goto err_out;
+		xmlListWalk (c->gets, xml_write_file_data, NULL);
+		xml_end_element ();
+	}
+
+
+	return !xml_end_element ();
+
+err_out:
+	LOG_MSG (LOG_ERR, "%s:%s: error\n", PROGNAME, __FUNCTION__);
+	
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+/** Write an attempt of a case with retries
+ * @param data attempt data
+ * @param user not used
+ * @return 1 on success, 0 on error
+ */
+LOCAL int xml_write_attempt (const void *data, const void *user)
+{
+	td_attempt *attempt = (td_attempt *)data;
+	struct tm *tm;
+
+	if (xmlTextWriterStartElement (writer, BAD_CAST "attempt") < 0)
+		goto err_out;
+
+	if (xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "number",
+					       "%d", attempt->number) < 0)
+		goto err_out;
+
+	if (xmlTextWriterWriteAttribute (writer, 
+					 BAD_CAST "result", 
+					 BAD_CAST (case_result_str
+						   (attempt->result))) < 0)
+		goto err_out;
+
+	tm = localtime (&attempt->start);
+	if (xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "start",
+					       "%02d-%02d-%02d %02d:%02d:%02d", 
+					       tm->tm_year+1900,
+					       tm->tm_mon+1,
+					       tm->tm_mday,
+					       tm->tm_hour,
+					       tm->tm_min,
+					       tm->tm_sec) < 0)
+		goto err_out;
+
+	if (xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "duration",
+					       "%.3f", attempt->duration) < 0)
+		goto err_out;
+
+	if (attempt->failure_info) {
+		if (strlen ((char *)attempt->failure_info) >= FAILURE_INFO_MAX)
+			attempt->failure_info[FAILURE_INFO_MAX - 1] = '\0';
+		if (xmlTextWriterWriteAttribute (writer, 
+						 BAD_CAST "failure_info", 
+						 attempt->failure_info) < 0)
+			goto err_out;
+	}
 
 	return !xml_end_element ();
 
@@ -784,6 +954,11 @@ LOCAL int xml_write_file_data (const void *data, const void *user)
 					 f->delete_after ? BAD_CAST "true"
 					 : BAD_CAST "false") < 0)
 		goto err_out;
+	if (f->collected &&
+	    xmlTextWriterWriteAttribute (writer, BAD_CAST "result",
+					 f->collected > 0 ? BAD_CAST "PASS"
+					 : BAD_CAST "FAIL") < 0)
+		goto err_out;
 	if (xmlTextWriterWriteString (writer, f->filename) < 0)
 		goto err_out;
 	return !xml_end_element();
@@ -800,6 +975,12 @@ LOCAL int xml_write_post_set (td_set *set)
 {
 	td_steps *steps;
 
+	if (set->result_record) {
+		if (xmlTextWriterWriteRaw (writer, set->result_record) < 0)
+			goto err_out;
+		return 0;
+	}
+
 	if (set->description)
 		if (xmlTextWriterWriteElement	(writer, 
 						 BAD_CAST "description", 
@@ -1074,8 +1255,22 @@ LOCAL int txt_write_step (const void *data, const void *user)
 		 (step->failure_info ? (char *)step->failure_info : " "));
 	fprintf (ofile, "        stdout        : %s\n",
 		 step->stdout_ ? (char *)step->stdout_ : " ");
+	if (step->stdout_file)
+		fprintf (ofile, "        stdout file   : %s (%llu bytes)\n",
+			 (char *)step->stdout_file, step->stdout_bytes);
 	fprintf (ofile, "        stderr        : %s\n",
 		 step->stderr_ ? (char *)step->stderr_ : " ");
+	if (step->stderr_file)
+		fprintf (ofile, "        stderr file   : %s (%llu bytes)\n",
+			 (char *)step->stderr_file, step->stderr_bytes);
+	if (step->has_usage)
+		fprintf (ofile, "        cpu time      : %ld.%03ld s user, "
+			 "%ld.%03ld s system, max rss %ld kB\n",
+			 (long)step->usage.ru_utime.tv_sec,
+			 (long)step->usage.ru_utime.tv_usec / 1000,
+			 (long)step->usage.ru_stime.tv_sec,
+			 (long)step->usage.ru_stime.tv_usec / 1000,
+			 step->usage.ru_maxrss);
 	fflush (ofile);
 
 	return 1;
@@ -1093,6 +1288,12 @@ LOCAL int txt_write_case (const void *data, const void *user)
 	if (c->filtered)
 		return 1;
 
+	if (c->result_record) {
+		fputs ((char *)c->result_record, ofile);
+		fflush (ofile);
+		return 1;
+	}
+
 	fprintf (ofile, "----------------------------------"
 		 "----------------------------------\n");
         fprintf (ofile, "    Test case name  : %s\n", c->gen.name);
@@ -1117,18 +1318,53 @@ LOCAL int txt_write_case (const void *data, const void *user)
 	    fprintf (ofile, "      type          : %s\n", c->gen.type);
 	if (c->gen.level)
 	    fprintf (ofile, "      level         : %s\n", c->gen.level);
+	if (c->target)
+	    fprintf (ofile, "      target        : %s\n", c->target);
+	if (c->cached)
+	    fprintf (ofile, "      cached        : true\n");
 	
         fprintf (ofile, "      insignificant : %s\n", c->gen.insignificant ?
 		 "true" : "false");
 
 	if (c->gen.manual && c->comment)
 		fprintf (ofile, "      comment       : %s\n", c->comment);
+	xmlListWalk (c->attempts, txt_write_attempt, NULL);
 		
 	fflush (ofile);
 	
 	xmlListWalk (c->steps, txt_write_step, NULL);
 
 
+	return 1;
+}
+/* ------------------------------------------------------------------------- */
+/** Write an attempt of a case with retries to text file
+ * @param data attempt data
+ * @param user not used
+ * @return 1 always
+ */
+LOCAL int txt_write_attempt (const void *data, const void *user)
+{
+	td_attempt *attempt = (td_attempt *)data;
+	struct tm *tm;
+
+	tm =  localtime (&attempt->start);
+	fprintf (ofile, "      attempt %-6d: %s %02d-%02d-%02d"
+		 " %02d:%02d:%02d %.3f s",
+		 attempt->number,
+		 case_result_str (attempt->result),
+		 tm->tm_year+1900,
+		 tm->tm_mon+1,
+		 tm->tm_mday,
+		 tm->tm_hour,
+		 tm->tm_min,
+		 tm->tm_sec,
+		 attempt->duration);
+	if (attempt->failure_info)
+		fprintf (ofile, " (%s)", attempt->failure_info);
+	fprintf (ofile, "\n");
+	fflush (ofile);
+
 	return 1;
 }
 /* ------------------------------------------------------------------------- */
@@ -1213,6 +1449,11 @@ LOCAL int txt_write_pre_set (td_set *set)
  */
 LOCAL int txt_write_post_set (td_set *set)
 {
+	if (set->result_record) {
+		fputs ((char *)set->result_record, ofile);
+		fflush (ofile);
+		return 0;
+	}
 	
 	xmlListWalk (set->cases, txt_write_case, NULL);
 	fflush (ofile);
@@ -1220,6 +1461,65 @@ LOCAL int txt_write_post_set (td_set *set)
 	return 0;
 }
 /* ------------------------------------------------------------------------- */
+/** Write results of a case or a set to memory in the format of the result
+ *  file, instead of writing them to the result file
+ *  @param set set data, used if c is NULL
+ *  @param c case data
+ *  @return results, NULL on error
+ */
+LOCAL xmlChar *result_record (td_set *set, td_case *c)
+{
+	xmlTextWriterPtr file_writer;
+	FILE *file;
+	xmlBufferPtr buf = NULL;
+	char *text = NULL;
+	size_t size = 0;
+	xmlChar *record = NULL;
+
+	/* no results are written to the result file while cases are
+	   executed, only other records */
+	pthread_mutex_lock (&record_mutex);
+	file_writer = writer;
+	file = ofile;
+	if (file_writer) {
+		buf = xmlBufferCreate ();
+		if (!buf)
+			goto out;
+		writer = xmlNewTextWriterMemory (buf, 0);
+		if (!writer)
+			goto out;
+		xmlTextWriterSetIndent (writer, 1);
+		if (c)
+			xml_write_case (c, NULL);
+		else
+			xml_write_post_set (set);
+		xmlTextWriterFlush (writer);
+		xmlFreeTextWriter (writer);
+		record = xmlStrdup (xmlBufferContent (buf));
+	} else if (file) {
+		ofile = open_memstream (&text, &size);
+		if (!ofile)
+			goto out;
+		if (c)
+			txt_write_case (c, NULL);
+		else
+			txt_write_post_set (set);
+		fclose (ofile);
+		record = xmlCharStrdup (text);
+	}
+ out:
+	writer = file_writer;
+	ofile = file;
+	pthread_mutex_unlock (&record_mutex);
+	if (buf)
+		xmlBufferFree (buf);
+	free (text);
+	if (!record)
+		LOG_MSG (LOG_ERR, "%s:%s: error\n", PROGNAME, __FUNCTION__);
+
+	return record;
+}
+/* ------------------------------------------------------------------------- */
 /* ======================== FUNCTIONS ====================================== */
 /* ------------------------------------------------------------------------- */
 /** Initialize result logger according to user options.
@@ -1417,6 +1717,26 @@ int write_post_set (td_set *set)
 	return out_cbs.write_post_set (set);
 }
 /* ------------------------------------------------------------------------- */
+/** Get the result of a case in the result file format, without writing it
+ *  to the result file. Safe to call from concurrent case workers.
+ *  @param c case data
+ *  @return allocated result record, NULL on error
+ */
+xmlChar *case_result_record (td_case *c)
+{
+	return result_record (NULL, c);
+}
+/* ------------------------------------------------------------------------- */
+/** Get the results of a set, as written by write_post_set, without writing
+ *  them to the result file
+ *  @param set set data
+ *  @return allocated result record, NULL on error
+ */
+xmlChar *set_result_record (td_set *set)
+{
+	return result_record (set, NULL);
+}
+/* ------------------------------------------------------------------------- */
 /** Write end element tag
  * @return 0 on success, 1 no element to close
  */
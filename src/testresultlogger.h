@@ -69,6 +69,10 @@ int write_pre_set (td_set *);
 /* ------------------------------------------------------------------------- */
 int write_post_set (td_set *);
 /* ------------------------------------------------------------------------- */
+xmlChar *case_result_record (td_case *);
+/* ------------------------------------------------------------------------- */
+xmlChar *set_result_record (td_set *);
+/* ------------------------------------------------------------------------- */
 int xml_end_element (void);
 /* ------------------------------------------------------------------------- */
 #endif                          /* TESTRESULTLOGGER_H */
@@ -38,6 +38,9 @@
 #define LOCAL static
 #define PROGNAME "testrunner-lite"
 #define SIGUSR3 (SIGRTMIN)
+#define MAX_PARALLEL_JOBS 256
+#define MAX_RETRIES 100
+#define MAX_RETRY_DELAY 3600
 /* ------------------------------------------------------------------------- */
 /* DATA TYPES */
 /* ------------------------------------------------------------------------- */
@@ -73,9 +76,25 @@ typedef enum {
 
 enum {
 	TRLITE_LONG_OPTION_LOGID = 256,
-	TRLITE_LONG_OPTION_UTF8_LIMIT
+	TRLITE_LONG_OPTION_UTF8_LIMIT,
+	TRLITE_LONG_OPTION_OUTPUT_LIMIT,
+	TRLITE_LONG_OPTION_OUTPUT_TAIL,
+	TRLITE_LONG_OPTION_CGROUP,
+	TRLITE_LONG_OPTION_HISTORY,
+	TRLITE_LONG_OPTION_RESULT_CACHE,
+	TRLITE_LONG_OPTION_BUILD_ID,
+	TRLITE_LONG_OPTION_RETRIES,
+	TRLITE_LONG_OPTION_RETRY_DELAY,
+	TRLITE_LONG_OPTION_AGENT
 };
 
+/** Target of a test run sharded to several SUTs */
+typedef struct {
+	char *address;          /**< SUT address */
+	char *remote_executor;  /**< command prefix for remote execution */
+	char *remote_getter;    /**< command to get a remote file */
+} shard_target;
+
 /** Used for storing and passing user (command line) options.*/
 typedef struct {
 	char *input_filename;  /**< the input xml file */
@@ -114,6 +133,41 @@ typedef struct {
 	char *rich_core_dumps;  /**< save rich-core dumps from DUT */
 	int   max_utf8_bytes;	/**< Maximum length of a UTF-8 byte sequence */
 	int   core_upload_timeout; /**< Maximum seconds to wait for core files to upload */
+	unsigned long output_limit; /**< Bytes of step output kept in memory,
+				       rest is written to file (0 = no limit) */
+	unsigned long output_tail; /**< Bytes at the end of step output kept
+				      in memory when output_limit is hit */
+	int   shell_worker;    /**< flag for running local steps in a
+				  long-lived shell */
+	char *cgroup;          /**< delegated cgroup v2 directory for
+				  step cgroups, NULL if not used */
+	int   jobs;            /**< maximum number of parallel cases
+				  executed concurrently (0 or 1 = serial) */
+	char *target_list;     /**< comma separated SUT addresses given
+				  with -t, NULL if only one */
+	shard_target *targets; /**< SUTs cases are sharded to, the first
+				  one is target_address */
+	int   target_count;    /**< number of targets, 0 if not sharded */
+	char *history_file;    /**< run history database, NULL if not used */
+	int   journal;         /**< flag for writing the run journal */
+	int   resume_journal;  /**< flag for resuming an interrupted run
+				  from the run journal */
+	char *result_cache;    /**< directory of cached case results, NULL
+				  if not used */
+	char *build_id;        /**< ID of the software build under test,
+				  part of the result cache key */
+	int   retries;         /**< times a failed automatic case is
+				  executed again, unless given by the case */
+	int   retry_delay;     /**< seconds to wait before the first retry,
+				  doubled for each further retry */
+	int   background_get;  /**< flag for collecting the files of a case
+				  while the next case is executed */
+	int   no_ssh_multiplex; /**< flag for opening a new ssh connection
+				   for each command of -t */
+	char *remote_agent;    /**< agent executing remote steps on target,
+				  NULL if steps are run by remote executor */
+	int   batch_get;       /**< flag for collecting the get files of a
+				  set or case with one tar stream */
 } testrunner_lite_options;    
 /* ------------------------------------------------------------------------- */
 /* FORWARD DECLARATIONS */
@@ -29,6 +29,10 @@
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SANITIZE_SIMD
+#include <immintrin.h>
+#endif
 
 /* ------------------------------------------------------------------------- */
 /* EXTERNAL DATA STRUCTURES */
@@ -71,7 +75,12 @@ const unsigned long unicode_rangemax[] = {
 
 /* ------------------------------------------------------------------------- */
 /* LOCAL GLOBAL VARIABLES */
-/* None */
+
+/* Kernel used by sanitize_output(), selected on first use according to
+   the cpu */
+static void (*sanitize_kernel)(unsigned char *, const unsigned char *,
+			       int, int *) = NULL;
+static const char *sanitize_kernel_name = NULL;
 
 /* ------------------------------------------------------------------------- */
 /* LOCAL CONSTANTS AND MACROS */
@@ -155,6 +164,197 @@ static inline int utf8_decode(const unsigned char **data, int maxlen)
 }
 
 
+/* Printable ASCII, line feed and carriage return need no attention from
+   the sanitizer */
+static inline int is_clean(unsigned char data)
+{
+	return (data >= 0x20 && data < 0x7F) || data == '\n' || data == '\r';
+}
+
+/** Sanitize a character that is not clean. Control characters are replaced
+ * with space and UTF-8 sequences are checked as long as data is valid.
+ * @param p first byte of the character
+ * @param end end of data
+ * @param maxlen Maximum allowed bytes in a UTF-8 sequence (1-4)
+ * @param valid set to 0 if invalid UTF-8 is found
+ * @return pointer to the byte following the character
+ */
+static inline unsigned char *sanitize_char(unsigned char *p,
+					   const unsigned char *end,
+					   int maxlen, int *valid)
+{
+	unsigned long codepoint;
+	int n, l;
+
+	if (*p < 0x80) {
+		*p = ' ';
+		return p + 1;
+	}
+
+	if (!*valid)
+		return p + 1;
+
+	/* same as decode_utf8_length() for sequences of up to 4 bytes */
+	if (*p < 0xC0)
+		l = 0;
+	else if (*p < 0xE0)
+		l = 2;
+	else if (*p < 0xF0)
+		l = 3;
+	else if (*p < 0xF8)
+		l = 4;
+	else
+		l = 0;
+
+	if (l < 2 || l > maxlen || end - p < l) {
+		*valid = 0;
+		return p + 1;
+	}
+
+	codepoint = p[0] & 0x1F >> (l-2);
+	for (n = 1; n < l; ++n) {
+		if (!is_cont_byte(p[n])) {
+			*valid = 0;
+			return p + 1;
+		}
+		codepoint <<= 6;
+		codepoint += p[n] & 0x3F;
+	}
+
+	if (codepoint < unicode_rangemin[l] ||
+	    codepoint > unicode_rangemax[l]) {
+		*valid = 0;
+		return p + 1;
+	}
+
+	return p + l;
+}
+
+/** Sanitize characters up to the next clean byte
+ * @param p start of data
+ * @param end end of data
+ * @param maxlen Maximum allowed bytes in a UTF-8 sequence (1-4)
+ * @param valid set to 0 if invalid UTF-8 is found
+ * @return pointer to the next clean byte, or end
+ */
+static inline unsigned char *sanitize_run(unsigned char *p,
+					  const unsigned char *end,
+					  int maxlen, int *valid)
+{
+	while (p < end && !is_clean(*p))
+		p = sanitize_char(p, end, maxlen, valid);
+
+	return p;
+}
+
+/** Sanitizer kernel skipping clean bytes one at a time
+ * @param p start of data
+ * @param end end of data
+ * @param maxlen Maximum allowed bytes in a UTF-8 sequence (1-4)
+ * @param valid set to 0 if invalid UTF-8 is found
+ */
+static void sanitize_scalar(unsigned char *p, const unsigned char *end,
+			    int maxlen, int *valid)
+{
+	while (p < end) {
+		while (p < end && is_clean(*p))
+			++p;
+		p = sanitize_run(p, end, maxlen, valid);
+	}
+}
+
+#ifdef SANITIZE_SIMD
+/** Sanitizer kernel skipping clean bytes 16 at a time
+ * @param p start of data
+ * @param end end of data
+ * @param maxlen Maximum allowed bytes in a UTF-8 sequence (1-4)
+ * @param valid set to 0 if invalid UTF-8 is found
+ */
+__attribute__((target("sse2")))
+static void sanitize_sse2(unsigned char *p, const unsigned char *end,
+			  int maxlen, int *valid)
+{
+	const __m128i lo = _mm_set1_epi8(0x1F);
+	const __m128i hi = _mm_set1_epi8(0x7F);
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	__m128i v, ok;
+	unsigned int mask;
+
+	while (end - p >= 16) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		/* signed compare, so bytes >= 0x80 fall outside the range */
+		ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo),
+				   _mm_cmplt_epi8(v, hi));
+		ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, lf));
+		ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, cr));
+		mask = (unsigned int)_mm_movemask_epi8(ok);
+		if (mask == 0xFFFF) {
+			p += 16;
+			continue;
+		}
+		p = sanitize_run(p + __builtin_ctz(~mask), end, maxlen, valid);
+	}
+
+	sanitize_scalar(p, end, maxlen, valid);
+}
+
+/** Sanitizer kernel skipping clean bytes 32 at a time
+ * @param p start of data
+ * @param end end of data
+ * @param maxlen Maximum allowed bytes in a UTF-8 sequence (1-4)
+ * @param valid set to 0 if invalid UTF-8 is found
+ */
+__attribute__((target("avx2")))
+static void sanitize_avx2(unsigned char *p, const unsigned char *end,
+			  int maxlen, int *valid)
+{
+	const __m256i lo = _mm256_set1_epi8(0x1F);
+	const __m256i hi = _mm256_set1_epi8(0x7F);
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	__m256i v, ok;
+	unsigned int mask;
+
+	while (end - p >= 32) {
+		v = _mm256_loadu_si256((const __m256i *)p);
+		ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo),
+				      _mm256_cmpgt_epi8(hi, v));
+		ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, lf));
+		ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, cr));
+		mask = (unsigned int)_mm256_movemask_epi8(ok);
+		if (mask == 0xFFFFFFFF) {
+			p += 32;
+			continue;
+		}
+		p = sanitize_run(p + __builtin_ctz(~mask), end, maxlen, valid);
+	}
+
+	sanitize_sse2(p, end, maxlen, valid);
+}
+#endif
+
+/** Select the fastest sanitizer kernel the cpu supports
+ */
+static void select_sanitize_kernel(void)
+{
+#ifdef SANITIZE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		sanitize_kernel = sanitize_avx2;
+		sanitize_kernel_name = "avx2";
+		return;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		sanitize_kernel = sanitize_sse2;
+		sanitize_kernel_name = "sse2";
+		return;
+	}
+#endif
+	sanitize_kernel = sanitize_scalar;
+	sanitize_kernel_name = "scalar";
+}
+
 /* ------------------------------------------------------------------------- */
 /* ======================== FUNCTIONS ====================================== */
 /* ------------------------------------------------------------------------- */ 
@@ -328,6 +528,43 @@ int utf8_validity_check(const unsigned char *data, int maxlen)
 	return 1;
 }
 
+/**
+ * Replace control characters (other than line feed and carriage return),
+ * including null characters, with space and check that data is valid
+ * UTF-8. Both are done in a single pass over the data; runs of printable
+ * ASCII are skipped with SSE2 or AVX2 when the cpu supports them.
+ *
+ * @param data Data to be sanitized in place
+ * @param length Length of data
+ * @param maxlen Maximum allowed bytes in a UTF-8 sequence (1-4)
+ *
+ * @return 1 when data is valid UTF-8 and 0 if not
+ */
+int sanitize_output(unsigned char *data, size_t length, int maxlen)
+{
+	int valid = maxlen >= 1 && maxlen <= 4;
+
+	if (!sanitize_kernel)
+		select_sanitize_kernel();
+
+	sanitize_kernel(data, data + length, maxlen, &valid);
+
+	return valid;
+}
+
+/**
+ * Name the kernel sanitize_output() uses on this cpu
+ *
+ * @return "avx2", "sse2" or "scalar"
+ */
+const char *sanitize_output_kernel(void)
+{
+	if (!sanitize_kernel)
+		select_sanitize_kernel();
+
+	return sanitize_kernel_name;
+}
+
 
 /* ================= OTHER EXPORTED FUNCTIONS ============================== */
 /* None */
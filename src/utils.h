@@ -28,7 +28,7 @@
 /* ------------------------------------------------------------------------- */
 /* INCLUDES */
 /* ------------------------------------------------------------------------- */
-/* None */
+#include <stddef.h>
 
 /* CONSTANTS */
 /* None */
@@ -57,6 +57,8 @@ char *replace_string (const char *orig, const char *from, const char *to);
 unsigned int trim_string (char *ins, char *outs);
 int list_contains(const char *list, const char *value, const char* delim);
 int utf8_validity_check(const unsigned char *data, int maxlen);
+int sanitize_output(unsigned char *data, size_t length, int maxlen);
+const char *sanitize_output_kernel(void);
 /* ------------------------------------------------------------------------- */
 
 #endif                          /* UTILS_H */
@@ -0,0 +1,235 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "testrunnerlite.h"
+#include "utils.h"
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+#define MB (1024 * 1024)
+#define SYNTHETIC_SIZE (8 * MB)
+#define MIN_ROUNDS 5
+#define DEFAULT_DEMO_FILE TESTDATADIR "/UTF-8-demo.txt"
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Microseconds elapsed since given time
+ * @param start Start time
+ * @return elapsed time in microseconds
+ */
+LOCAL double elapsed_us (const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e6 +
+		(now.tv_nsec - start->tv_nsec) / 1e3;
+}
+/* ------------------------------------------------------------------------- */
+/** Sanitize data the way executor did before sanitize_output(): strcspn()
+ *  for control characters, rawmemchr() for nulls and utf8_validity_check()
+ * @param buffer null terminated data
+ * @param length length of data
+ * @return 1 if data is valid UTF-8, 0 if not
+ */
+LOCAL int legacy_sanitize (unsigned char *buffer, size_t length)
+{
+	size_t clean_len = 0, tmp;
+	char *p = (char *)buffer, *endp;
+	const char rej[] = {0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,
+			    0x0B,
+			    0x0C,
+			    0x0E,0x0F,0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,
+			    0x18,0x19,0x1A,0x1B,0x1C,0x1D,0x1E,0x1F,
+			    0x7F, '\0'};
+
+	do {
+		tmp = strcspn(p, rej);
+		clean_len += tmp;
+		p += tmp;
+		if (clean_len < length)
+			*p = ' ';
+	} while (clean_len < length);
+
+	endp = (char *)&buffer [length];
+	do {
+		p = rawmemchr(buffer, '\0');
+		if (p && p != endp)
+			*p = ' ';
+	} while (p != endp);
+
+	return utf8_validity_check (buffer, 4);
+}
+/* ------------------------------------------------------------------------- */
+/** Measure throughput of a sanitizer. Each round works on a fresh copy of
+ *  the data, copying is not included in the result.
+ * @param data input data
+ * @param length length of data
+ * @param legacy use legacy_sanitize() instead of sanitize_output()
+ * @return throughput in MB/s
+ */
+LOCAL double run_sanitizer (const unsigned char *data, size_t length,
+			    int legacy)
+{
+	struct timespec start;
+	unsigned char *work;
+	double us = 0;
+	int i, rounds;
+
+	work = malloc (length + 1);
+	if (!work) {
+		fprintf (stderr, "OOM\n");
+		exit (1);
+	}
+
+	rounds = MIN_ROUNDS + SYNTHETIC_SIZE / (length + 1);
+	for (i = 0; i < rounds; i++) {
+		memcpy (work, data, length);
+		work[length] = '\0';
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		if (legacy)
+			legacy_sanitize (work, length);
+		else
+			sanitize_output (work, length, 4);
+		us += elapsed_us (&start);
+	}
+
+	free (work);
+	return (double)length * rounds / MB / (us / 1e6);
+}
+/* ------------------------------------------------------------------------- */
+/** Print results for one input
+ * @param name name of input
+ * @param data input data
+ * @param length length of data
+ */
+LOCAL void report (const char *name, const unsigned char *data,
+		   size_t length)
+{
+	printf ("%-28s %10zu %16.1f %16.1f\n", name, length,
+		run_sanitizer (data, length, 1),
+		run_sanitizer (data, length, 0));
+}
+/* ------------------------------------------------------------------------- */
+/** Read a file to memory
+ * @param path file name
+ * @param length set to length of the file
+ * @return file contents, NULL on error
+ */
+LOCAL unsigned char *read_file (const char *path, size_t *length)
+{
+	unsigned char *data;
+	FILE *f;
+	long len;
+
+	f = fopen (path, "r");
+	if (!f) {
+		perror (path);
+		return NULL;
+	}
+	fseek (f, 0, SEEK_END);
+	len = ftell (f);
+	rewind (f);
+
+	data = malloc (len + 1);
+	if (data && fread (data, 1, len, f) != (size_t)len) {
+		free (data);
+		data = NULL;
+	}
+	fclose (f);
+	*length = len;
+
+	return data;
+}
+/* ------------------------------------------------------------------------- */
+/** Fill buffer with copies of a sample
+ * @param buffer buffer to fill
+ * @param length length of buffer
+ * @param sample sample data
+ * @param sample_len length of sample
+ */
+LOCAL void fill (unsigned char *buffer, size_t length,
+		 const unsigned char *sample, size_t sample_len)
+{
+	size_t i, n;
+
+	for (i = 0; i < length; i += n) {
+		n = length - i < sample_len ? length - i : sample_len;
+		memcpy (buffer + i, sample, n);
+	}
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Compare step output sanitizing before and after sanitize_output() on
+ *  UTF-8-demo.txt and on synthetic multi megabyte outputs.
+ *  Usage: sanitize-benchmark [UTF-8-demo.txt]
+ */
+int main (int argc, char *argv[])
+{
+	const char log_line[] = "[INFO] 12:00:00 step 42 finished, "
+		"result=0 elapsed=0.013s\n";
+	unsigned char *demo, *synth;
+	size_t demo_len, i;
+
+	demo = read_file (argc > 1 ? argv[1] : DEFAULT_DEMO_FILE, &demo_len);
+	synth = malloc (SYNTHETIC_SIZE);
+	if (!demo || !synth) {
+		fprintf (stderr, "usage: %s [UTF-8-demo.txt]\n", argv[0]);
+		return 1;
+	}
+
+	printf ("sanitize_output() kernel: %s\n", sanitize_output_kernel ());
+	printf ("%-28s %10s %16s %16s\n", "input", "bytes", "legacy (MB/s)",
+		"fused (MB/s)");
+
+	report ("UTF-8-demo.txt", demo, demo_len);
+
+	fill (synth, SYNTHETIC_SIZE, demo, demo_len);
+	report ("UTF-8-demo.txt x 8 MB", synth, SYNTHETIC_SIZE);
+
+	fill (synth, SYNTHETIC_SIZE, (const unsigned char *)log_line,
+	      strlen (log_line));
+	report ("ASCII log 8 MB", synth, SYNTHETIC_SIZE);
+
+	/* escape sequence of colored output every 4 kB */
+	for (i = 0; i < SYNTHETIC_SIZE; i += 4096)
+		synth[i] = 0x1B;
+	report ("ASCII log, ctrl chars 8 MB", synth, SYNTHETIC_SIZE);
+
+	/* tabs, as in tabulated output */
+	for (i = 0; i < SYNTHETIC_SIZE; i += 16)
+		synth[i] = '\t';
+	report ("ASCII log, tabs 8 MB", synth, SYNTHETIC_SIZE);
+
+	free (synth);
+	free (demo);
+
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "testrunnerlite.h"
+#include "executor.h"
+#include "log.h"
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+#define DEFAULT_SIZE_MB 64
+#define ROUNDS 3
+#define MB (1024 * 1024)
+#define REMOTE_FILE "/tmp/testrunner-lite-sftp-benchmark"
+#define LOCAL_FOLDER "/tmp/testrunner-lite-sftp-benchmark.d/"
+#define COMMAND_LEN 1024
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Seconds elapsed since given time
+ * @param start Start time
+ * @return elapsed time in seconds
+ */
+LOCAL double elapsed_s (const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + 
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+/* ------------------------------------------------------------------------- */
+/** Execute a command on target through the libssh2 executor
+ * @param command Command to execute
+ * @return exit status of the command
+ */
+LOCAL int run_remote (const char *command)
+{
+	exec_data edata;
+	int ret;
+
+	init_exec_data (&edata);
+	edata.soft_timeout = 300;
+	edata.hard_timeout = 5;
+	execute (command, &edata);
+	ret = edata.result;
+	clean_exec_data (&edata);
+
+	return ret;
+}
+/* ------------------------------------------------------------------------- */
+/** Fetch the test file over SFTP on the session of the executor
+ * @return duration in seconds, negative on error
+ */
+LOCAL double run_sftp (void)
+{
+	struct timespec start;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	if (executor_libssh2_get (REMOTE_FILE, LOCAL_FOLDER) != 0)
+		return -1;
+	return elapsed_s (&start);
+}
+/* ------------------------------------------------------------------------- */
+/** Fetch the test file with the scp binary and a connection of its own, 
+ *  as done before SFTP
+ * @param opts options with target
+ * @return duration in seconds, negative on error
+ */
+LOCAL double run_scp (testrunner_lite_options *opts)
+{
+	char command[COMMAND_LEN];
+	struct timespec start;
+	int len;
+
+	len = snprintf (command, COMMAND_LEN, "scp -q -P %u %s%s %s@%s:%s %s",
+			opts->target_port ? opts->target_port : 22,
+			opts->ssh_key ? "-i " : "", 
+			opts->ssh_key ? opts->ssh_key : "",
+			opts->username, opts->target_address, REMOTE_FILE,
+			LOCAL_FOLDER);
+	if (len >= COMMAND_LEN)
+		return -1;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	if (system (command) != 0)
+		return -1;
+	return elapsed_s (&start);
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Measure get throughput over SFTP on the libssh2 session against the scp
+ *  binary. Needs an sshd on the target, for example on localhost.
+ *  Usage: sftp-benchmark [USER@]HOST[:PORT] [SIZE_MB] [KEY]
+ */
+int main (int argc, char *argv[])
+{
+	testrunner_lite_options opts;
+	char command[COMMAND_LEN];
+	char *p;
+	double sftp, scp, best_sftp = 0, best_scp = 0;
+	int size_mb = DEFAULT_SIZE_MB;
+	int i, ret = 1;
+
+	if (argc > 2)
+		size_mb = atoi (argv[2]);
+	if (argc < 2 || size_mb <= 0) {
+		fprintf (stderr, "usage: %s [USER@]HOST[:PORT] [SIZE_MB] "
+			 "[KEY]\n", argv[0]);
+		return 1;
+	}
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.log_level = LOG_LEVEL_SILENT;
+	log_init (&opts);
+
+	opts.libssh2 = 1;
+	opts.target_address = strdup (argv[1]);
+	p = strchr (opts.target_address, '@');
+	if (p) {
+		*p = '\0';
+		opts.username = opts.target_address;
+		opts.target_address = p + 1;
+	} else {
+		opts.username = getenv ("LOGNAME");
+	}
+	p = strchr (opts.target_address, ':');
+	if (p) {
+		*p = '\0';
+		opts.target_port = atoi (p + 1);
+	}
+	if (argc > 3)
+		opts.ssh_key = argv[3];
+	if (!opts.username) {
+		fprintf (stderr, "no user name\n");
+		return 1;
+	}
+
+	if (executor_init (&opts) != 0) {
+		fprintf (stderr, "failed to open libssh2 session\n");
+		return 1;
+	}
+	mkdir (LOCAL_FOLDER, 0755);
+	snprintf (command, COMMAND_LEN, "dd if=/dev/urandom of=%s bs=1M "
+		  "count=%d 2>/dev/null", REMOTE_FILE, size_mb);
+	if (run_remote (command) != 0) {
+		fprintf (stderr, "failed to create %s on target\n", 
+			 REMOTE_FILE);
+		goto out;
+	}
+
+	/* best of a few rounds, the first one warms the page cache */
+	for (i = 0; i < ROUNDS; i++) {
+		sftp = run_sftp ();
+		scp = run_scp (&opts);
+		if (sftp < 0 || scp < 0) {
+			fprintf (stderr, "get failed\n");
+			goto out;
+		}
+		if (!best_sftp || sftp < best_sftp)
+			best_sftp = sftp;
+		if (!best_scp || scp < best_scp)
+			best_scp = scp;
+	}
+
+	printf ("%10s %16s %16s\n", "size (MB)", "sftp (MB/s)", "scp (MB/s)");
+	printf ("%10d %16.1f %16.1f\n", size_mb, size_mb / best_sftp,
+		size_mb / best_scp);
+	ret = 0;
+ out:
+	snprintf (command, COMMAND_LEN, "rm -f %s", REMOTE_FILE);
+	run_remote (command);
+	unlink (LOCAL_FOLDER "testrunner-lite-sftp-benchmark");
+	rmdir (LOCAL_FOLDER);
+	executor_close ();
+	log_close ();
+
+	return ret;
+}
@@ -0,0 +1,173 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "testrunnerlite.h"
+#include "executor.h"
+#include "log.h"
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+#define DEFAULT_STEPS 200
+#define MB (1024 * 1024)
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+LOCAL const size_t heap_sizes_mb[] = { 0, 64, 256, 1024 };
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+/** Microseconds elapsed since given time
+ * @param start Start time
+ * @return elapsed time in microseconds
+ */
+LOCAL double elapsed_us (const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e6 + 
+		(now.tv_nsec - start->tv_nsec) / 1e3;
+}
+/* ------------------------------------------------------------------------- */
+/** Run trivial steps through the executor
+ * @param steps Number of steps
+ * @param shell_worker use shell worker
+ * @return average cost of a step in microseconds
+ */
+LOCAL double run_executor (int steps, int shell_worker)
+{
+	testrunner_lite_options opts;
+	struct timespec start;
+	exec_data edata;
+	double ret;
+	int i;
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.shell_worker = shell_worker;
+	executor_init (&opts);
+
+	/* worker is started by the first step */
+	if (shell_worker) {
+		init_exec_data (&edata);
+		execute ("true", &edata);
+		clean_exec_data (&edata);
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (i = 0; i < steps; i++) {
+		init_exec_data (&edata);
+		execute ("true", &edata);
+		clean_exec_data (&edata);
+	}
+	ret = elapsed_us (&start) / steps;
+
+	executor_close ();
+
+	return ret;
+}
+/* ------------------------------------------------------------------------- */
+/** Run trivial steps with fork() and exec, as done before posix_spawn()
+ * @param steps Number of steps
+ * @return average cost of a step in microseconds
+ */
+LOCAL double run_fork (int steps)
+{
+	struct timespec start;
+	pid_t pid;
+	int i, status;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (i = 0; i < steps; i++) {
+		pid = fork ();
+		if (pid == 0) {
+			setsid ();
+			execl (SHELLCMD, SHELLCMD, SHELLCMD_ARGS, "true", 
+			       (char *)NULL);
+			_exit (1);
+		} else if (pid < 0) {
+			perror ("fork");
+			exit (1);
+		}
+		waitpid (pid, &status, 0);
+	}
+
+	return elapsed_us (&start) / steps;
+}
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+/** Measure per step process creation cost as the heap of the parent grows.
+ *  Usage: spawn-benchmark [STEPS]
+ */
+int main (int argc, char *argv[])
+{
+	testrunner_lite_options log_opts;
+	char *heap = NULL;
+	size_t i;
+	int steps = DEFAULT_STEPS;
+
+	if (argc > 1)
+		steps = atoi (argv[1]);
+	if (steps <= 0) {
+		fprintf (stderr, "usage: %s [STEPS]\n", argv[0]);
+		return 1;
+	}
+
+	memset (&log_opts, 0x0, sizeof (log_opts));
+	log_opts.log_level = LOG_LEVEL_SILENT;
+	log_init (&log_opts);
+
+	printf ("%10s %16s %16s %16s\n", "heap (MB)", "executor (us)", 
+		"shell worker (us)", "fork (us)");
+	for (i = 0; i < sizeof (heap_sizes_mb) / sizeof (heap_sizes_mb[0]); 
+	     i++) {
+		/* touch the memory so that it is really mapped */
+		free (heap);
+		heap = NULL;
+		if (heap_sizes_mb[i]) {
+			heap = malloc (heap_sizes_mb[i] * MB);
+			if (!heap) {
+				fprintf (stderr, "OOM\n");
+				break;
+			}
+			memset (heap, 0xa5, heap_sizes_mb[i] * MB);
+		}
+		printf ("%10zu %16.1f %16.1f %16.1f\n", heap_sizes_mb[i],
+			run_executor (steps, 0), run_executor (steps, 1),
+			run_fork (steps));
+	}
+
+	free (heap);
+	log_close ();
+
+	return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Stand-in for ssh in tests of connection multiplexing. Commands are
+# executed locally, master connection state is kept in files next to
+# the script (which is linked as ssh).
+#
+# masters - a line for each master connection started
+# muxed   - a line for each command executed over the master
+# ctl     - pid of the running master
+
+dir=$(dirname $0)
+
+case " $* " in
+*" -O check "*)
+	test -f $dir/ctl
+	exit $?
+	;;
+*" -O exit "*)
+	test -f $dir/ctl || exit 255
+	kill $(cat $dir/ctl)
+	exit 0
+	;;
+*" -N "*)
+	echo $$ >> $dir/masters
+	trap 'rm -f $dir/ctl; exit 0' TERM
+	echo $$ > $dir/ctl
+	while true; do sleep 1 & wait; done
+	;;
+esac
+
+test -f $dir/ctl && echo $$ >> $dir/muxed
+
+# the command is the last argument
+for cmd; do true; done
+exec sh -c "$cmd"
@@ -71,7 +71,10 @@ suite_functions_t suite_functions[] = {
 	{ "argumentparser", make_argumentparser_suite },
 	{ "features", make_features_suite },
 	{ "filters", make_testfilter_suite },
+	{ "history", make_history_suite },
+	{ "journal", make_journal_suite },
 	{ "manual_executor", make_manualtestexecutor_suite },
+	{ "result_cache", make_result_cache_suite },
 	{ "testdefinitionparser", make_testdefinitionparser_suite },
 	{ "testexecutor", make_testexecutor_suite },
 	{ "testresultlogger", make_testresultlogger_suite }
@@ -43,6 +43,14 @@
 #define TESTDATA_ENTITY_SUBSTITUTION DATADIR "/testrunner-lite-tests/testdata/entity_substitution.xml"
 #define TESTDATA_NON_UTF8_XML_1 DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-non-utf8.xml"
 #define TESTDATA_BG_XML DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-bg.xml"
+#define TESTDATA_PARALLEL_XML DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-parallel.xml"
+#define TESTDATA_LPT_XML DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-lpt.xml"
+#define TESTDATA_DEPENDS_XML DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-depends.xml"
+#define TESTDATA_RETRIES_XML DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-retries.xml"
+#define TESTDATA_BACKGROUND_GET_XML DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-background-get.xml"
+#define TESTDATA_BATCH_GET_XML DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-batch-get.xml"
+#define TESTDATA_BATCH_GET_EXPAND_XML DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-batch-get-expand.xml"
+#define TESTDATA_JOURNAL_XML DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-journal.xml"
 #define TESTDATA_PRE_STEP_FAIL_XML DATADIR "/testrunner-lite-tests/testdata/testrunner-tests-pre_step-fail.xml"
 #define TESTDATA_FILTER_TESTS_XML DATADIR "/testrunner-lite-tests/testdata/filter_tests.xml"
 #define TESTDATA_ENVIRONMENT_TESTS_XML DATADIR"/testrunner-lite-tests/testdata/testrunner-tests-environment.xml"
@@ -75,6 +83,9 @@ Suite *make_testexecutor_suite(void);
 Suite *make_features_suite(void);
 Suite *make_manualtestexecutor_suite(void);
 Suite *make_testfilter_suite(void);
+Suite *make_history_suite(void);
+Suite *make_journal_suite(void);
+Suite *make_result_cache_suite(void);
 /* ------------------------------------------------------------------------- */
 #endif                          /* TESTRUNNERLITE_SUITES */
 /* End of file */
@@ -206,6 +206,15 @@ START_TEST (test_parse_cmd_line_invalid_arguments)
     ret = system (cmd);
     fail_unless (ret != 0, cmd);
 
+#ifdef ENABLE_LIBSSH2
+    /* Test -n with mutually exclusive --background-get. */
+    snprintf (cmd, TEST_CMD_LEN, "%s -f %s -o %s -n localhost "
+	      "--background-get", TESTRUNNERLITE_BIN, TESTDATA_VALID_XML_1,
+	      out_file);
+    ret = system (cmd);
+    fail_unless (ret != 0, cmd);
+#endif
+
 END_TEST
 
 START_TEST (test_semantic_and_validate_only_flags)
@@ -331,6 +340,33 @@ START_TEST (test_remote_logger_flag)
 
 END_TEST
 
+/* ------------------------------------------------------------------------- */
+START_TEST (test_target_list_flag)
+    int ret;
+    char cmd[TEST_CMD_LEN];
+    char *out_file = "/tmp/out.xml";
+
+    /* Test several targets with power measurement */
+    snprintf (cmd, TEST_CMD_LEN, "%s -f %s -o %s -t dut1,dut2 "
+	      "--measure-power", TESTRUNNERLITE_BIN, TESTDATA_SIMPLE_XML_1,
+	      out_file);
+    ret = system (cmd);
+    fail_unless (ret != 0, cmd);
+
+    /* Test several targets with resume */
+    snprintf (cmd, TEST_CMD_LEN, "%s -f %s -o %s -t dut1,dut2 -R",
+	      TESTRUNNERLITE_BIN, TESTDATA_SIMPLE_XML_1, out_file);
+    ret = system (cmd);
+    fail_unless (ret != 0, cmd);
+
+    /* Test several targets with -j */
+    snprintf (cmd, TEST_CMD_LEN, "%s -f %s -o %s -t dut1,dut2 -j 2",
+	      TESTRUNNERLITE_BIN, TESTDATA_SIMPLE_XML_1, out_file);
+    ret = system (cmd);
+    fail_unless (ret != 0, cmd);
+
+END_TEST
+
 /* ------------------------------------------------------------------------- */
 /* ======================== FUNCTIONS ====================================== */
 /* ------------------------------------------------------------------------- */
@@ -364,6 +400,10 @@ Suite *make_argumentparser_suite (void)
     tcase_add_test (tc, test_remote_logger_flag);
     suite_add_tcase (s, tc);
     
+    tc = tcase_create ("Test target list flag.");
+    tcase_add_test (tc, test_target_list_flag);
+    suite_add_tcase (s, tc);
+    
     return s;
 }
 
@@ -196,6 +196,63 @@ START_TEST (test_utf8_checker)
     fail_if(utf8_validity_check("\xF0\x90\x80\x80", 6));
 END_TEST
 
+START_TEST (test_output_sanitizer)
+    unsigned char buf[128];
+    const char *sample;
+    size_t len, off;
+    int i;
+
+    /* place samples at every offset so that they hit both vectorized
+       and scalar parts of the sanitizer */
+    for (i = 0; i < sizeof(valid_utf8_samples)/sizeof(char*); ++i) {
+	sample = valid_utf8_samples[i];
+	len = strlen(sample);
+	for (off = 0; off < 70; ++off) {
+	    memset(buf, 'x', sizeof(buf));
+	    memcpy(buf + off, sample, len);
+	    buf[off + len] = '\t';
+	    buf[off + len + 1] = '\0';
+	    buf[100] = '\n';
+	    fail_unless(sanitize_output(buf, 101, 4),
+			"valid sample %d at %d", i, off);
+	    /* DEL is valid UTF-8 but a control character */
+	    if (strcmp(sample, "\x7F"))
+		fail_if(memcmp(buf + off, sample, len));
+	    else
+		fail_unless(buf[off] == ' ');
+	    fail_unless(buf[off + len] == ' ' && buf[off + len + 1] == ' ');
+	    fail_unless(buf[100] == '\n');
+	}
+    }
+
+    for (i = 0; i < sizeof(invalid_utf8_samples)/sizeof(char*); ++i) {
+	sample = invalid_utf8_samples[i];
+	len = strlen(sample);
+	for (off = 0; off < 70; ++off) {
+	    memset(buf, 'x', sizeof(buf));
+	    memcpy(buf + off, sample, len);
+	    buf[99] = 0x1B;
+	    fail_if(sanitize_output(buf, 100, 4),
+		    "invalid sample %d at %d", i, off);
+	    /* control characters are replaced after invalid data too */
+	    fail_unless(buf[99] == ' ');
+	}
+    }
+
+    /* sequence cut by the end of data */
+    memset(buf, 'x', sizeof(buf));
+    memcpy(buf + 62, "\xE2\x82\xAC", 3);
+    fail_if(sanitize_output(buf, 64, 4));
+    fail_unless(sanitize_output(buf, 65, 4));
+
+    /* maxlen argument works as in utf8_validity_check() */
+    memcpy(buf, "\xF0\x90\x80\x80", 4);
+    fail_if(sanitize_output(buf, 4, 0));
+    fail_if(sanitize_output(buf, 4, 3));
+    fail_unless(sanitize_output(buf, 4, 4));
+    fail_if(sanitize_output(buf, 4, 5));
+END_TEST
+
 START_TEST (test_logging)
 
     char *stdout_tmp = "/tmp/testrunner-lite-stdout.log";
@@ -639,6 +696,10 @@ Suite *make_features_suite (void)
     tcase_add_test (tc, test_utf8_checker);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("Test output sanitizer");
+    tcase_add_test (tc, test_output_sanitizer);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create ("Test logging.");
     tcase_add_test (tc, test_logging);
     suite_add_tcase (s, tc);
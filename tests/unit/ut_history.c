@@ -0,0 +1,200 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testrunnerlitetestscommon.h"
+#include "testdefinitiondatatypes.h"
+#include "executor.h"
+#include "history.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+#define HISTORY_FILE "/tmp/testrunner-lite-history.txt"
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL void record (td_set *, td_case *, case_result_t, const char *, double);
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+LOCAL void record (td_set *s, td_case *c, case_result_t res,
+		   const char *failure_info, double duration)
+{
+    td_step *step;
+
+    step = xmlLinkGetData (xmlListFront (c->steps));
+    if (step->failure_info)
+	free (step->failure_info);
+    step->failure_info = failure_info ? xmlCharStrdup (failure_info) : NULL;
+    c->case_res = res;
+    history_record_case (s, c, NULL, time (NULL), duration);
+}
+/* ------------------------------------------------------------------------- */
+START_TEST (test_history_disabled)
+
+    testrunner_lite_options opts;
+    history_stats stats;
+
+    memset (&opts, 0x0, sizeof (testrunner_lite_options));
+    fail_if (history_init (&opts, NULL));
+    fail_if (history_enabled ());
+    fail_if (history_case_stats ("set", "case", NULL, &stats));
+    history_close ();
+
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_history_record)
+
+    testrunner_lite_options opts;
+    hw_info hwinfo;
+    history_stats stats;
+    td_set *s;
+    td_case *c;
+    td_step *step;
+
+    unlink (HISTORY_FILE);
+    memset (&opts, 0x0, sizeof (testrunner_lite_options));
+    memset (&hwinfo, 0x0, sizeof (hw_info));
+    opts.history_file = HISTORY_FILE;
+    opts.input_filename = "/some/where/plan.xml";
+    hwinfo.product = (unsigned char *)"board";
+
+    s = td_set_create ();
+    s->gen.name = xmlCharStrdup ("set\t1");
+    c = td_case_create ();
+    c->gen.name = xmlCharStrdup ("case1");
+    step = td_step_create ();
+    step->has_usage = 1;
+    step->usage.ru_utime.tv_sec = 1;
+    step->usage.ru_maxrss = 1000;
+    xmlListAppend (c->steps, step);
+    xmlListAppend (s->cases, c);
+
+    fail_if (history_init (&opts, &hwinfo));
+    fail_unless (history_enabled ());
+    record (s, c, CASE_PASS, NULL, 1.0);
+    record (s, c, CASE_FAIL, FAILURE_INFO_TIMEOUT "90 s", 3.0);
+    history_close ();
+
+    /* earlier runs of the plan are read from the file */
+    fail_if (history_init (&opts, &hwinfo));
+    record (s, c, CASE_PASS, NULL, 2.0);
+
+    fail_unless (history_case_stats ("set\t1", "case1", NULL, &stats));
+    fail_unless (stats.runs == 3);
+    fail_unless (stats.passed == 2);
+    fail_unless (stats.failed == 1);
+    fail_unless (stats.flips == 2);
+    fail_unless (stats.timeouts == 1);
+    fail_unless (stats.mean_duration > 1.99 && stats.mean_duration < 2.01);
+    fail_unless (stats.max_duration > 2.99);
+    fail_unless (stats.last_duration > 1.99 && stats.last_duration < 2.01);
+    fail_unless (stats.last_result == CASE_PASS);
+    fail_unless (stats.mean_cpu > 0.99 && stats.mean_cpu < 1.01);
+    fail_unless (stats.max_rss == 1000);
+
+    /* runs are separate for each hardware */
+    fail_if (history_case_stats ("set\t1", "case1", "other", &stats));
+    fail_if (history_case_stats ("set\t1", "case2", NULL, &stats));
+    history_close ();
+
+    /* and for each test plan */
+    opts.input_filename = "other.xml";
+    fail_if (history_init (&opts, &hwinfo));
+    fail_if (history_case_stats ("set\t1", "case1", NULL, &stats));
+    history_close ();
+
+    td_set_delete (s);
+    unlink (HISTORY_FILE);
+
+END_TEST
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+Suite *make_history_suite (void)
+{
+    /* Create suite. */
+    Suite *s = suite_create ("history");
+
+    /* Create test cases and add to suite. */
+    TCase *tc;
+
+    tc = tcase_create ("Test history disabled.");
+    tcase_add_test (tc, test_history_disabled);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test history record and query.");
+    tcase_add_test (tc, test_history_record);
+    suite_add_tcase (s, tc);
+
+    return s;
+}
+
+/* ================= OTHER EXPORTED FUNCTIONS ============================== */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* End of file */
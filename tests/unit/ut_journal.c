@@ -0,0 +1,256 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "testrunnerlitetestscommon.h"
+#include "testdefinitiondatatypes.h"
+#include "testresultlogger.h"
+#include "journal.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+#define RESULT_FILE "/tmp/testrunner-lite-journal.xml"
+#define JOURNAL_FILE RESULT_FILE JOURNAL_SUFFIX
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL td_case *add_case (td_set *, const char *, case_result_t);
+/* ------------------------------------------------------------------------- */
+LOCAL off_t file_size (const char *);
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+LOCAL td_case *add_case (td_set *s, const char *name, case_result_t res)
+{
+    td_case *c;
+    td_step *step;
+
+    c = td_case_create ();
+    c->gen.name = xmlCharStrdup (name);
+    c->case_res = res;
+    step = td_step_create ();
+    step->step = xmlCharStrdup ("echo <out>");
+    step->stdout_ = xmlCharStrdup ("<out>\n");
+    xmlListAppend (c->steps, step);
+    xmlListAppend (s->cases, c);
+
+    return c;
+}
+/* ------------------------------------------------------------------------- */
+LOCAL off_t file_size (const char *filename)
+{
+    struct stat st;
+
+    if (stat (filename, &st))
+	return -1;
+    return st.st_size;
+}
+/* ------------------------------------------------------------------------- */
+START_TEST (test_journal_disabled)
+
+    testrunner_lite_options opts;
+    td_set *s;
+    td_case *c;
+    int attempts;
+
+    memset (&opts, 0x0, sizeof (testrunner_lite_options));
+    fail_if (journal_init (&opts));
+    fail_if (journal_enabled ());
+
+    s = td_set_create ();
+    s->gen.name = xmlCharStrdup ("set");
+    c = add_case (s, "case", CASE_PASS);
+    journal_record_case (NULL, s, c);
+    fail_if (journal_replay_case (NULL, s, c, &attempts));
+    fail_if (journal_replay_set (NULL, s));
+    journal_close ();
+    td_set_delete (s);
+
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_journal_resume)
+
+    testrunner_lite_options opts;
+    hw_info hwinfo;
+    td_suite *suite;
+    td_set *s, *s2;
+    td_case *c1, *c2, *c3;
+    td_attempt *attempt;
+    FILE *f;
+    off_t size;
+    int attempts, i;
+
+    memset (&opts, 0x0, sizeof (testrunner_lite_options));
+    memset (&hwinfo, 0x0, sizeof (hw_info));
+    opts.input_filename = "/some/where/plan.xml";
+    opts.output_filename = RESULT_FILE;
+    opts.output_type = OUTPUT_TYPE_XML;
+    opts.journal = 1;
+
+    suite = td_suite_create ();
+    suite->gen.name = xmlCharStrdup ("suite");
+    s = td_set_create ();
+    s->gen.name = xmlCharStrdup ("set\t1");
+    c1 = add_case (s, "case1", CASE_FAIL);
+    c2 = add_case (s, "case2", CASE_PASS);
+    /* a case with the same name as another one */
+    c3 = add_case (s, "case1", CASE_PASS);
+    /* passed on the second attempt */
+    for (i = 1; i <= 2; i++) {
+	    attempt = (td_attempt *)calloc (1, sizeof (td_attempt));
+	    attempt->number = i;
+	    attempt->result = i == 2 ? CASE_PASS : CASE_FAIL;
+	    xmlListAppend (c3->attempts, attempt);
+    }
+
+    unlink (JOURNAL_FILE);
+    fail_if (init_result_logger (&opts, &hwinfo));
+    fail_if (journal_init (&opts));
+    fail_unless (journal_enabled ());
+    journal_record_case (suite, s, c1);
+    journal_record_case (suite, s, c3);
+    journal_record_set (suite, s);
+    journal_close ();
+    size = file_size (JOURNAL_FILE);
+    fail_unless (size > 0);
+
+    /* an entry left incomplete by a crash */
+    f = fopen (JOURNAL_FILE, "a");
+    fail_unless (f != NULL);
+    fprintf (f, "case\tsuite\tset 1\tcase2\tPASS\t0\t1000\n<case name=");
+    fclose (f);
+
+    /* journal of another result format is not used */
+    opts.resume_journal = 1;
+    opts.output_type = OUTPUT_TYPE_TXT;
+    fail_unless (journal_init (&opts));
+    opts.output_type = OUTPUT_TYPE_XML;
+
+    fail_if (journal_init (&opts));
+    fail_unless (file_size (JOURNAL_FILE) == size);
+
+    s2 = td_set_create ();
+    s2->gen.name = xmlCharStrdup ("set\t1");
+    c1 = add_case (s2, "case1", CASE_NA);
+    c2 = add_case (s2, "case2", CASE_NA);
+    c3 = add_case (s2, "case1", CASE_NA);
+
+    fail_unless (journal_replay_case (suite, s2, c1, &attempts));
+    fail_unless (c1->case_res == CASE_FAIL);
+    fail_unless (attempts == 0);
+    fail_unless (c1->result_record != NULL);
+    fail_unless (strstr ((char *)c1->result_record, "<case name=\"case1\"")
+		 != NULL);
+    fail_unless (strstr ((char *)c1->result_record, "&lt;out&gt;")
+		 != NULL);
+    fail_unless (journal_replay_case (suite, s2, c3, &attempts));
+    fail_unless (c3->case_res == CASE_PASS);
+    fail_unless (attempts == 2);
+    fail_if (journal_replay_case (suite, s2, c2, &attempts));
+    fail_if (c2->result_record);
+    fail_if (journal_replay_case (suite, s2, c1, &attempts));
+
+    fail_unless (journal_replay_set (suite, s2));
+    fail_unless (strstr ((char *)s2->result_record, "case2") != NULL);
+    fail_if (journal_replay_set (suite, s2));
+    journal_close ();
+    close_result_logger ();
+
+    td_set_delete (s);
+    td_set_delete (s2);
+    td_suite_delete (suite);
+    unlink (JOURNAL_FILE);
+    unlink (RESULT_FILE);
+
+END_TEST
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+Suite *make_journal_suite (void)
+{
+    /* Create suite. */
+    Suite *s = suite_create ("journal");
+
+    /* Create test cases and add to suite. */
+    TCase *tc;
+
+    tc = tcase_create ("Test journal disabled.");
+    tcase_add_test (tc, test_journal_disabled);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test journal record and resume.");
+    tcase_add_test (tc, test_journal_resume);
+    suite_add_tcase (s, tc);
+
+    return s;
+}
+
+/* ================= OTHER EXPORTED FUNCTIONS ============================== */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* End of file */
@@ -0,0 +1,286 @@
+/*
+ * This file is part of testrunner-lite
+ *
+ * Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* ------------------------------------------------------------------------- */
+/* INCLUDE FILES */
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testrunnerlitetestscommon.h"
+#include "testdefinitiondatatypes.h"
+#include "testresultlogger.h"
+#include "resultcache.h"
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* EXTERNAL FUNCTION PROTOTYPES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* CONSTANTS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MACROS */
+#define CACHE_DIR "/tmp/testrunner-lite-result-cache"
+#define RESULT_FILE "/tmp/testrunner-lite-result-cache.xml"
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL GLOBAL VARIABLES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL CONSTANTS AND MACROS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* MODULE DATA STRUCTURES */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* LOCAL FUNCTION PROTOTYPES */
+/* ------------------------------------------------------------------------- */
+LOCAL td_set *create_set (const char *, const char *, const char *);
+/* ------------------------------------------------------------------------- */
+LOCAL int key_changes (td_set *, const char *);
+
+/* ------------------------------------------------------------------------- */
+/* FORWARD DECLARATIONS */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* ==================== LOCAL FUNCTIONS ==================================== */
+/* ------------------------------------------------------------------------- */
+LOCAL td_set *create_set (const char *pre_step, const char *name,
+			  const char *command)
+{
+    td_set *s;
+    td_steps *steps;
+    td_case *c;
+    td_step *step;
+
+    s = td_set_create ();
+    s->gen.name = xmlCharStrdup ("set");
+    steps = td_steps_create ();
+    step = td_step_create ();
+    step->step = xmlCharStrdup (pre_step);
+    xmlListAppend (steps->steps, step);
+    xmlListAppend (s->pre_steps, steps);
+
+    c = td_case_create ();
+    c->gen.name = xmlCharStrdup (name);
+    step = td_step_create ();
+    step->step = xmlCharStrdup (command);
+    step->stdout_ = xmlCharStrdup ("output");
+    xmlListAppend (c->steps, step);
+    xmlListAppend (s->cases, c);
+
+    return s;
+}
+/* ------------------------------------------------------------------------- */
+LOCAL int key_changes (td_set *s, const char *key)
+{
+    td_case *c;
+    char *k;
+    int ret;
+
+    c = xmlLinkGetData (xmlListFront (s->cases));
+    k = result_cache_key (s, c, NULL);
+    ret = strcmp (k, key) != 0;
+    free (k);
+    td_set_delete (s);
+
+    return ret;
+}
+/* ------------------------------------------------------------------------- */
+START_TEST (test_result_cache_disabled)
+
+    testrunner_lite_options opts;
+    td_set *s;
+    td_case *c;
+
+    memset (&opts, 0x0, sizeof (testrunner_lite_options));
+    fail_if (result_cache_init (&opts, NULL));
+    fail_if (result_cache_enabled ());
+
+    s = create_set ("pre", "case", "true");
+    c = xmlLinkGetData (xmlListFront (s->cases));
+    c->case_res = CASE_PASS;
+    result_cache_store_case (s, c, NULL);
+    fail_if (result_cache_replay_case (s, c, NULL));
+    result_cache_close ();
+    td_set_delete (s);
+
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_result_cache_key)
+
+    testrunner_lite_options opts;
+    td_set *s;
+    td_case *c;
+    td_file *file;
+    char *key, *k;
+
+    memset (&opts, 0x0, sizeof (testrunner_lite_options));
+    opts.result_cache = CACHE_DIR;
+    opts.build_id = "build-1";
+    opts.environment = "hardware";
+    fail_if (result_cache_init (&opts, NULL));
+
+    s = create_set ("pre", "case", "true");
+    c = xmlLinkGetData (xmlListFront (s->cases));
+    key = result_cache_key (s, c, NULL);
+    fail_unless (key != NULL);
+    k = result_cache_key (s, c, NULL);
+    fail_if (strcmp (k, key));
+    free (k);
+    k = result_cache_key (s, c, "other-hw");
+    fail_unless (strcmp (k, key));
+    free (k);
+    td_set_delete (s);
+
+    fail_unless (key_changes (create_set ("pre2", "case", "true"), key));
+    fail_unless (key_changes (create_set ("pre", "case2", "true"), key));
+    fail_unless (key_changes (create_set ("pre", "case", "false"), key));
+    /* fields can not be shifted to produce the same key */
+    fail_unless (key_changes (create_set ("pr", "ecase", "true"), key));
+
+    /* attributes and get files are replayed in the record */
+    s = create_set ("pre", "case", "true");
+    c = xmlLinkGetData (xmlListFront (s->cases));
+    c->gen.insignificant = 1;
+    fail_unless (key_changes (s, key));
+    s = create_set ("pre", "case", "true");
+    c = xmlLinkGetData (xmlListFront (s->cases));
+    c->gen.level = xmlCharStrdup ("Feature");
+    fail_unless (key_changes (s, key));
+    s = create_set ("pre", "case", "true");
+    c = xmlLinkGetData (xmlListFront (s->cases));
+    c->description = xmlCharStrdup ("described");
+    fail_unless (key_changes (s, key));
+    s = create_set ("pre", "case", "true");
+    c = xmlLinkGetData (xmlListFront (s->cases));
+    file = (td_file *)calloc (1, sizeof (td_file));
+    file->filename = xmlCharStrdup ("/tmp/log.txt");
+    xmlListAppend (c->gets, file);
+    fail_unless (key_changes (s, key));
+    result_cache_close ();
+
+    opts.build_id = "build-2";
+    fail_if (result_cache_init (&opts, NULL));
+    fail_unless (key_changes (create_set ("pre", "case", "true"), key));
+    result_cache_close ();
+    free (key);
+
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_result_cache_replay)
+
+    testrunner_lite_options opts;
+    hw_info hwinfo;
+    td_set *s, *s2;
+    td_case *c, *c2;
+
+    memset (&opts, 0x0, sizeof (testrunner_lite_options));
+    memset (&hwinfo, 0x0, sizeof (hw_info));
+    opts.output_filename = RESULT_FILE;
+    opts.output_type = OUTPUT_TYPE_XML;
+    opts.result_cache = CACHE_DIR;
+    opts.build_id = "build-1";
+    fail_if (system ("rm -rf " CACHE_DIR));
+    fail_if (init_result_logger (&opts, &hwinfo));
+    fail_if (result_cache_init (&opts, &hwinfo));
+
+    s = create_set ("pre", "case", "true");
+    c = xmlLinkGetData (xmlListFront (s->cases));
+    s2 = create_set ("pre", "case", "true");
+    c2 = xmlLinkGetData (xmlListFront (s2->cases));
+
+    /* failed cases are not cached */
+    c->case_res = CASE_FAIL;
+    result_cache_store_case (s, c, NULL);
+    fail_if (result_cache_replay_case (s2, c2, NULL));
+
+    c->case_res = CASE_PASS;
+    result_cache_store_case (s, c, NULL);
+    fail_if (c->cached);
+    fail_unless (result_cache_replay_case (s2, c2, NULL));
+    fail_unless (c2->case_res == CASE_PASS);
+    fail_unless (c2->cached);
+    fail_unless (strstr ((char *)c2->result_record, "<case name=\"case\"")
+		 != NULL);
+    fail_unless (strstr ((char *)c2->result_record, "cached=\"true\"")
+		 != NULL);
+    fail_unless (strstr ((char *)c2->result_record, "output") != NULL);
+
+    result_cache_close ();
+    close_result_logger ();
+    td_set_delete (s);
+    td_set_delete (s2);
+    unlink (RESULT_FILE);
+    fail_if (system ("rm -rf " CACHE_DIR));
+
+END_TEST
+/* ------------------------------------------------------------------------- */
+/* ======================== FUNCTIONS ====================================== */
+/* ------------------------------------------------------------------------- */
+Suite *make_result_cache_suite (void)
+{
+    /* Create suite. */
+    Suite *s = suite_create ("result_cache");
+
+    /* Create test cases and add to suite. */
+    TCase *tc;
+
+    tc = tcase_create ("Test result cache disabled.");
+    tcase_add_test (tc, test_result_cache_disabled);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test result cache key.");
+    tcase_add_test (tc, test_result_cache_key);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test result cache store and replay.");
+    tcase_add_test (tc, test_result_cache_replay);
+    suite_add_tcase (s, tc);
+
+    return s;
+}
+
+/* ================= OTHER EXPORTED FUNCTIONS ============================== */
+/* None */
+
+/* ------------------------------------------------------------------------- */
+/* End of file */
@@ -244,6 +244,48 @@ START_TEST (test_reader_set)
     fail_unless (xmlListSize(set->cases) == 3);
     fail_unless (xmlListSize(set->gets) == 0);
 
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_reader_prefetch)
+
+    td_parser_callbacks cbs;
+    testrunner_lite_options test_opts;
+    
+    suite = NULL;
+    set = NULL;
+    
+    td_reader_close();
+    
+    memset (&cbs, 0x0, sizeof (cbs));
+    memset (&test_opts, 0x0, sizeof (testrunner_lite_options));
+    test_opts.input_filename = strdup (TESTDATA_VALID_XML_1);
+    cbs.test_suite = ut_test_suite;
+    cbs.test_set = ut_test_set;
+
+    fail_if (td_register_callbacks (&cbs));
+    fail_if (td_reader_init(&test_opts));
+    fail_if (td_reader_prefetch());
+    
+    while (td_next_node() == 0);
+    
+    fail_unless (suite != NULL);
+    fail_if (strcmp ((const char *)suite->gen.name, "examplebinary-tests2"));
+    td_suite_delete (suite);
+    suite = NULL;
+
+    fail_unless (set != NULL);
+    fail_if (strcmp ((const char *)set->gen.name, "testset3"));
+    fail_unless (xmlListSize(set->pre_steps) == 1);
+    fail_unless (xmlListSize(set->cases) == 3);
+    td_set_delete (set);
+    set = NULL;
+
+    /* closing the reader stops unfinished prefetching */
+    fail_if (td_reader_init(&test_opts));
+    fail_if (td_reader_prefetch());
+    fail_if (td_next_node());
+    td_reader_close();
+
 END_TEST
 /* ------------------------------------------------------------------------- */
 START_TEST (test_entity_substitution)
@@ -302,6 +344,10 @@ Suite *make_testdefinitionparser_suite (void)
     tcase_add_test (tc, test_reader_set);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("Validate reading with prefetch thread.");
+    tcase_add_test (tc, test_reader_prefetch);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create ("Test parsing test definition with entities.");
     tcase_add_test (tc, test_entity_substitution);
     suite_add_tcase (s, tc);
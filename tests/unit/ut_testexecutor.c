@@ -28,16 +28,22 @@
 #include <stdio.h>
 #include <check.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <poll.h>
 
 #include "testdefinitionparser.h"
 #include "testdefinitiondatatypes.h"
 #include "testrunnerlite.h"
 #include "testrunnerlitetestscommon.h"
 #include "remote_executor.h"
+#include "remote_agent.h"
 #include "executor.h"
 #include "log.h"
 
@@ -65,6 +71,9 @@
 #define DEFAULT_REMOTE_EXECUTOR_PORT "/usr/bin/ssh -o StrictHostKeyChecking=no " \
 		"-o PasswordAuthentication=no -p 22 localhost"
 #define DEFAULT_REMOTE_GETTER "/usr/bin/scp localhost:'<FILE>' '<DEST>'"
+#define SSH_MUX_DIR "/tmp/testrunner-lite-tests/ssh-multiplex"
+#define WRAPPER_DIR "/tmp/testrunner-lite-tests/remote-wrapper"
+#define AGENT_DIR "/tmp/testrunner-lite-tests/remote-agent"
 #define LOCAL_SSH_RULE " -p tcp -d 127.0.0.1 --dport 22 -j DROP"
 #define SSH_KEY = "~/.ssh/myrsakey"
 
@@ -197,6 +206,33 @@ START_TEST (test_executor_stderr)
 	executor_close();
 END_TEST
 /* ------------------------------------------------------------------------- */
+START_TEST (test_executor_chroot_failure)
+	exec_data edata;
+	testrunner_lite_options opts;
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.chroot_folder = "/nonexistent-chroot";
+	executor_init (&opts);
+
+	/* reported by the child before exec */
+	init_exec_data(&edata);
+	fail_if (execute("echo out", &edata));
+	fail_unless (edata.result == 1);
+	fail_unless (strlen ((char *)edata.stdout_data.buffer) == 0);
+	fail_unless (strcmp ((char *)edata.stderr_data.buffer, PROGNAME
+			     ": failed to chdir into chroot "
+			     "'/nonexistent-chroot'\n") == 0);
+	clean_exec_data(&edata);
+
+	init_exec_data(&edata);
+	edata.disobey_chroot = 1;
+	fail_if (execute("echo out", &edata));
+	fail_unless (edata.result == 0);
+	fail_unless (strcmp ((char *)edata.stdout_data.buffer, "out\n") == 0);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
 START_TEST (test_executor_long_input_streams)
 	exec_data edata;
 	testrunner_lite_options opts;
@@ -218,6 +254,247 @@ START_TEST (test_executor_long_input_streams)
 	fail_unless (strlen ((char *)edata.stderr_data.buffer) == 2190);
 END_TEST
 /* ------------------------------------------------------------------------- */
+START_TEST (test_executor_output_limit)
+	exec_data edata;
+	testrunner_lite_options opts;
+	char fname[TEST_CMD_LEN];
+	struct stat st;
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.output_folder = "/tmp";
+	opts.output_limit = 1000;
+	executor_init (&opts);
+	
+	init_exec_data(&edata);
+	fail_if (execute("head -c 300000 /dev/zero | tr '\\0' x", &edata));
+	fail_unless (edata.result == 0);
+	fail_unless (edata.stdout_data.length == 1000);
+	fail_unless (strlen ((char *)edata.stdout_data.buffer) == 1000);
+	fail_if (edata.stdout_data.spill_file == NULL);
+	fail_unless (edata.stderr_data.spill_file == NULL);
+
+	snprintf (fname, TEST_CMD_LEN, "/tmp/%s", edata.stdout_data.spill_file);
+	fail_if (stat (fname, &st));
+	fail_unless (st.st_size == 300000);
+	unlink (fname);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_output_tail)
+	exec_data edata;
+	testrunner_lite_options opts;
+	char fname[TEST_CMD_LEN];
+	const char *end;
+	struct stat st;
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.output_folder = "/tmp";
+	opts.output_limit = 1000;
+	opts.output_tail = 2000;
+	executor_init (&opts);
+	
+	init_exec_data(&edata);
+	fail_if (execute("head -c 300000 /dev/zero | tr '\\0' x; "
+			 "printf END", &edata));
+	fail_unless (edata.result == 0);
+	fail_unless (edata.stdout_data.total == 300003);
+	fail_if (edata.stdout_data.spill_file == NULL);
+	fail_unless (strspn ((char *)edata.stdout_data.buffer, "x") == 1000);
+	fail_if (strstr ((char *)edata.stdout_data.buffer,
+			 "297003 bytes omitted") == NULL,
+		 "%s", edata.stdout_data.buffer);
+
+	/* tail of the output follows the note */
+	end = strrchr ((char *)edata.stdout_data.buffer, '\n') + 1;
+	fail_unless (strlen (end) == 2000);
+	fail_unless (strspn (end, "x") == 1997);
+	fail_if (strcmp (end + 1997, "END"));
+
+	snprintf (fname, TEST_CMD_LEN, "/tmp/%s", edata.stdout_data.spill_file);
+	fail_if (stat (fname, &st));
+	fail_unless (st.st_size == 300003);
+	unlink (fname);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_output_spill_failure)
+	exec_data edata;
+	testrunner_lite_options opts;
+	const char *end;
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.output_folder = "/nonexistent/testrunner-lite-tests";
+	opts.output_limit = 1000;
+	opts.output_tail = 100;
+	executor_init (&opts);
+	
+	/* output is truncated in memory when it can not be spilled */
+	init_exec_data(&edata);
+	fail_if (execute("head -c 300000 /dev/zero | tr '\\0' x; "
+			 "printf END", &edata));
+	fail_unless (edata.result == 0);
+	fail_unless (edata.stdout_data.total == 300003);
+	fail_unless (edata.stdout_data.spill_file == NULL);
+	fail_unless (strspn ((char *)edata.stdout_data.buffer, "x") == 1000);
+	fail_if (strstr ((char *)edata.stdout_data.buffer,
+			 "[... 298903 bytes omitted ...]") == NULL,
+		 "%s", edata.stdout_data.buffer);
+	end = strrchr ((char *)edata.stdout_data.buffer, '\n') + 1;
+	fail_unless (strlen (end) == 100);
+	fail_if (strcmp (end + 97, "END"));
+	fail_unless (edata.stdout_data.size < 4096);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_output_splice)
+	exec_data edata;
+	testrunner_lite_options opts;
+	char cmd[TEST_CMD_LEN];
+	const char *end;
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.output_folder = "/tmp";
+	opts.output_limit = 1000;
+	opts.output_tail = 100;
+	executor_init (&opts);
+	
+	init_exec_data(&edata);
+	fail_if (execute("seq 1 300000", &edata));
+	fail_unless (edata.result == 0);
+	fail_if (edata.stdout_data.spill_file == NULL);
+	fail_unless (edata.stdout_data.spliced);
+	fail_unless (strncmp ((char *)edata.stdout_data.buffer, "1\n2\n", 4) 
+		     == 0);
+	end = (char *)edata.stdout_data.buffer + edata.stdout_data.length;
+	fail_unless (strcmp (end - 14, "299999\n300000\n") == 0);
+
+	/* file has the whole output */
+	snprintf (cmd, TEST_CMD_LEN, "seq 1 300000 | cmp -s - /tmp/%s", 
+		  edata.stdout_data.spill_file);
+	fail_if (system (cmd));
+	snprintf (cmd, TEST_CMD_LEN, "/tmp/%s", edata.stdout_data.spill_file);
+	unlink (cmd);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_resource_usage)
+	exec_data edata;
+	testrunner_lite_options opts;
+	struct rusage *ru = &edata.usage;
+
+	memset (&opts, 0x0, sizeof (opts));
+	executor_init (&opts);
+	
+	/* memory and cpu are used by a grandchild of the step shell */
+	init_exec_data(&edata);
+	fail_if (execute("sh -c 'x=$(head -c 20000000 /dev/zero | tr "
+			 "\"\\0\" a); i=0; while [ $i -lt 20000 ]; "
+			 "do i=$((i+1)); done'", &edata));
+	fail_unless (edata.result == 0);
+	fail_unless (edata.has_usage);
+	fail_unless (ru->ru_maxrss >= 20000, "max rss %ld", ru->ru_maxrss);
+	fail_unless (ru->ru_utime.tv_sec || ru->ru_utime.tv_usec ||
+		     ru->ru_stime.tv_sec || ru->ru_stime.tv_usec);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_cgroup)
+	exec_data edata;
+	testrunner_lite_options opts;
+	char *roots[] = { "/sys/fs/cgroup", "/sys/fs/cgroup/unified", NULL };
+	char path[256];
+	char *cgroup;
+	int i;
+
+	memset (&opts, 0x0, sizeof (opts));
+	for (i = 0; roots[i] && !opts.cgroup; i++) {
+		sprintf (path, "%s/cgroup.kill", roots[i]);
+		if (access (path, F_OK) == 0)
+			opts.cgroup = roots[i];
+	}
+	/* cgroup v2 is not available */
+	if (!opts.cgroup)
+		return;
+	executor_init (&opts);
+
+	/* step leaves a process outside of its session behind */
+	init_exec_data(&edata);
+	fail_if (execute("setsid sleep 100 >/dev/null 2>&1 &", &edata));
+	fail_unless (edata.result == 0);
+	fail_if (edata.cgroup == NULL);
+	fail_unless (edata.has_usage);
+	cgroup = strdup (edata.cgroup);
+	sprintf (path, "%s/cgroup.procs", cgroup);
+	fail_unless (access (path, F_OK) == 0);
+
+	/* cgroup can only be removed when the process is gone */
+	clean_exec_data(&edata);
+	fail_unless (edata.cgroup == NULL);
+	fail_unless (access (cgroup, F_OK) == -1);
+	free (cgroup);
+
+	/* timeout kills the escaped process too */
+	init_exec_data(&edata);
+	edata.soft_timeout = 1;
+	edata.hard_timeout = 1;
+	fail_if (execute("setsid sleep 100 >/dev/null 2>&1 & wait", &edata));
+	fail_unless (edata.result == SIGTERM);
+	fail_unless (edata.cgroup == NULL);
+	clean_exec_data(&edata);
+
+	/* steps without leftovers do not keep their cgroups */
+	init_exec_data(&edata);
+	fail_if (execute("echo testing", &edata));
+	fail_unless (edata.result == 0);
+	fail_unless (edata.cgroup == NULL);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_deadline)
+	step_deadline d1, d2;
+	struct pollfd pfd;
+
+	/* two steps are timed independently of each other */
+	deadline_init (&d1);
+	deadline_init (&d2);
+	fail_if (deadline_start (&d1, 1, 1));
+	fail_if (deadline_start (&d2, 2, 0));
+	fail_if (d1.fd == d2.fd);
+	fail_unless (deadline_check (&d1) == DEADLINE_NONE);
+
+	pfd.fd = d1.fd;
+	pfd.events = POLLIN;
+	fail_unless (poll (&pfd, 1, 1500) == 1);
+	fail_unless (deadline_check (&d1) == DEADLINE_SOFT);
+	fail_unless (deadline_check (&d2) == DEADLINE_NONE);
+
+	/* hard timeout is armed when soft one expires */
+	fail_unless (poll (&pfd, 1, 1500) == 1);
+	fail_unless (deadline_check (&d1) == DEADLINE_HARD);
+	pfd.fd = d2.fd;
+	fail_unless (poll (&pfd, 1, 500) == 1);
+	fail_unless (deadline_check (&d2) == DEADLINE_SOFT);
+
+	/* hard timeout 0 means no timeout */
+	fail_unless (poll (&pfd, 1, 100) == 0);
+	fail_unless (deadline_check (&d2) == DEADLINE_NONE);
+	deadline_stop (&d1);
+
+	/* escalation skips the rest of soft timeout */
+	fail_if (deadline_start (&d2, 100, 1));
+	fail_if (deadline_escalate (&d2));
+	fail_unless (poll (&pfd, 1, 1500) == 1);
+	fail_unless (deadline_check (&d2) == DEADLINE_HARD);
+	deadline_stop (&d2);
+	fail_unless (d2.fd == -1);
+END_TEST
+/* ------------------------------------------------------------------------- */
 START_TEST (test_executor_terminating_process)
 	exec_data edata;
 	testrunner_lite_options opts;
@@ -306,6 +583,588 @@ START_TEST (test_executor_without_output_redirection)
 	executor_close();
 END_TEST
 /* ------------------------------------------------------------------------- */
+START_TEST (test_executor_fast_termination)
+	exec_data edata;
+	testrunner_lite_options opts;
+	struct timeval start, end;
+	long elapsed_ms;
+	int i;
+
+	memset (&opts, 0x0, sizeof (opts));
+	executor_init (&opts);
+
+	/* step should be over as soon as the process exits, not after
+	   a poll interval */
+	gettimeofday (&start, NULL);
+	for (i = 0; i < 20; i++) {
+		init_exec_data(&edata);
+		edata.redirect_output = (i % 2) ? REDIRECT_OUTPUT : 
+			DONT_REDIRECT_OUTPUT;
+		fail_if (execute("true", &edata));
+		fail_unless (edata.result == 0);
+		clean_exec_data(&edata);
+	}
+	gettimeofday (&end, NULL);
+
+	elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + 
+		(end.tv_usec - start.tv_usec) / 1000;
+	fail_if (elapsed_ms > 20 * POLL_TIMEOUT_MS / 2,
+		 "20 steps took %ld ms", elapsed_ms);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_new_session)
+	exec_data edata;
+	testrunner_lite_options opts;
+
+	memset (&opts, 0x0, sizeof (opts));
+	executor_init (&opts);
+
+	/* 6th field of stat is the session id */
+	init_exec_data(&edata);
+	fail_if (execute("cut -d' ' -f6 /proc/$$/stat", &edata));
+	fail_unless (edata.result == 0);
+	fail_unless (atoi ((char *)edata.stdout_data.buffer) == edata.pid);
+	fail_unless (edata.stderr_data.length == 0);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_shell_worker)
+	exec_data edata;
+	testrunner_lite_options opts;
+	pid_t pid;
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.shell_worker = 1;
+	executor_init (&opts);
+
+	init_exec_data(&edata);
+	fail_if (execute("echo 'hello world'; echo testing >&2; exit 3", 
+			 &edata));
+	fail_unless (edata.result == 3);
+	fail_unless (edata.status_fd >= 0);
+	fail_unless (strcmp((char*)edata.stdout_data.buffer, 
+			    "hello world\n") == 0);
+	fail_unless (strcmp((char*)edata.stderr_data.buffer, 
+			    "testing\n") == 0);
+	/* step has a process group of its own */
+	fail_unless (edata.pgid == edata.pid);
+	pid = edata.pid;
+	clean_exec_data(&edata);
+
+	/* shell state does not leak to the next step */
+	init_exec_data(&edata);
+	fail_if (execute("foo=bar; cd /proc", &edata));
+	fail_unless (edata.result == 0);
+	clean_exec_data(&edata);
+
+	init_exec_data(&edata);
+	fail_if (execute("test -z \"$foo\" && test \"$(pwd)\" != /proc", 
+			 &edata));
+	fail_unless (edata.result == 0);
+	fail_if (edata.pid == pid);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_shell_worker_timeout)
+	exec_data edata;
+	testrunner_lite_options opts;
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.shell_worker = 1;
+	executor_init (&opts);
+	
+	init_exec_data(&edata);
+	edata.soft_timeout = 1;
+	edata.hard_timeout = 1;
+	fail_if (execute(LIBDIR "/testrunner-lite-tests/unterminating " 
+			 "stdouttest stderrtest", &edata));
+	fail_unless (edata.result == SIGTERM || edata.result == SIGKILL);
+	fail_unless (strncmp((char*)edata.stdout_data.buffer, 
+			     "stdouttest", strlen("stdouttest")) == 0);
+	fail_if (strstr((char*)edata.failure_info.buffer, 
+			    FAILURE_INFO_TIMEOUT) == NULL);
+	clean_exec_data(&edata);
+
+	/* worker survives killing of the step */
+	init_exec_data(&edata);
+	fail_if (execute("echo testing", &edata));
+	fail_unless (edata.result == 0);
+	fail_unless (strcmp((char*)edata.stdout_data.buffer, 
+			    "testing\n") == 0);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_parallel_cases)
+     int ret;
+     char cmd[TEST_CMD_LEN];
+     char *out_file = "/tmp/testrunner-lite-tests/testrunner-lite.out.xml";
+     struct timeval start, end;
+
+     /* four cases sleeping 2 seconds each, serial case in between */
+     snprintf (cmd, TEST_CMD_LEN, "%s -c -a -v -j 4 -f %s -o %s", 
+	       TESTRUNNERLITE_BIN, TESTDATA_PARALLEL_XML, out_file);
+     gettimeofday (&start, NULL);
+     ret = system (cmd);
+     gettimeofday (&end, NULL);
+     fail_if (ret != 0, cmd);
+     fail_unless (end.tv_sec - start.tv_sec < 6);
+
+     /* results are in definition order */
+     snprintf (cmd, TEST_CMD_LEN, "grep -o 'case name=\"[a-z0-9-]*\"' %s "
+	       "| tr -d '\\n' | grep -q '\"parallel-1\".*\"parallel-2\""
+	       ".*\"serial-3\".*\"parallel-4\".*\"parallel-5\"'", out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     snprintf (cmd, TEST_CMD_LEN, "grep -c '<case .*result=\"PASS\"' %s "
+	       "| grep -qx 5", out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_longest_first)
+     int ret;
+     char cmd[TEST_CMD_LEN];
+     char *out_file = "/tmp/testrunner-lite-tests/testrunner-lite.out.xml";
+     struct timeval start, end;
+
+     /* two 2 second cases before a 4 second one with larger timeout:
+	definition order would take 6 seconds, longest first 4 */
+     snprintf (cmd, TEST_CMD_LEN, "%s -c -a -v -j 2 -f %s -o %s", 
+	       TESTRUNNERLITE_BIN, TESTDATA_LPT_XML, out_file);
+     gettimeofday (&start, NULL);
+     ret = system (cmd);
+     gettimeofday (&end, NULL);
+     fail_if (ret != 0, cmd);
+     fail_unless ((end.tv_sec - start.tv_sec) * 1000 +
+		  (end.tv_usec - start.tv_usec) / 1000 < 5500);
+
+     /* results are in definition order */
+     snprintf (cmd, TEST_CMD_LEN, "grep -o 'case name=\"[a-z0-9-]*\"' %s "
+	       "| tr -d '\\n' | grep -q '\"short-1\".*\"short-2\""
+	       ".*\"long-3\"'", out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_case_dependencies)
+     int ret, i;
+     char cmd[TEST_CMD_LEN];
+     char *out_file = "/tmp/testrunner-lite-tests/testrunner-lite.out.xml";
+     const char *jobs[] = {"1", "3"};
+     const char *expected[] = {
+	     "name=\"build\".*result=\"FAIL\"",
+	     "name=\"uses-build\".*result=\"N/A\" "
+	     "failure_info=\"depends on failed case build\"",
+	     "name=\"uses-uses-build\".*result=\"N/A\" "
+	     "failure_info=\"depends on failed case uses-build\"",
+	     "name=\"independent\".*result=\"PASS\"",
+	     /* early is executed after late it depends on */
+	     "name=\"early\".*result=\"PASS\"",
+	     "name=\"late\".*result=\"PASS\"",
+	     NULL
+     };
+     const char **e;
+
+     for (i = 0; i < 2; i++) {
+	     snprintf (cmd, TEST_CMD_LEN, "%s -c -a -v -j %s -f %s -o %s", 
+		       TESTRUNNERLITE_BIN, jobs[i], TESTDATA_DEPENDS_XML,
+		       out_file);
+	     ret = system (cmd);
+	     fail_if (ret != 0, cmd);
+	     for (e = expected; *e; e++) {
+		     snprintf (cmd, TEST_CMD_LEN, "grep -q '<case .*%s' %s",
+			       *e, out_file);
+		     ret = system (cmd);
+		     fail_if (ret != 0, cmd);
+	     }
+	     /* results are in definition order */
+	     snprintf (cmd, TEST_CMD_LEN, "grep -o 'case name=\"[a-z-]*\"' "
+		       "%s | tr -d '\\n' | grep -q '\"uses-uses-build\""
+		       ".*\"independent\".*\"early\".*\"late\"'",
+		       out_file);
+	     ret = system (cmd);
+	     fail_if (ret != 0, cmd);
+     }
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_resume_journal)
+     int ret;
+     char cmd[TEST_CMD_LEN];
+     char *out_file = "/tmp/testrunner-lite-tests/testrunner-lite.out.xml";
+     char *runs = "/tmp/testrunner-lite-journal-runs";
+     const char *expected[] = {
+	     "pre-1 1", "first 1", "pre-2 2", "before 1", "interrupted 2",
+	     "after 1", NULL
+     };
+     const char **e;
+
+     unlink (runs);
+     /* kill testrunner-lite while case interrupted is executed */
+     snprintf (cmd, TEST_CMD_LEN, "%s -c -a --journal -f %s -o %s & "
+	       "pid=$!; for i in $(seq 100); do grep -q '^case.*before' "
+	       "%s.journal 2>/dev/null && break; sleep 0.1; done; "
+	       "sleep 1; kill -9 $pid", TESTRUNNERLITE_BIN,
+	       TESTDATA_JOURNAL_XML, out_file, out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+
+     snprintf (cmd, TEST_CMD_LEN, "%s -c -a -v --resume-journal -f %s -o %s"
+	       " > %s.log 2>&1", TESTRUNNERLITE_BIN, TESTDATA_JOURNAL_XML,
+	       out_file, runs);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     /* replayed cases are in the totals */
+     snprintf (cmd, TEST_CMD_LEN, "grep -q 'Executed 4 cases. Passed 4 "
+	       "Failed 0' %s.log", runs);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+
+     /* cases completed before the crash are not executed again */
+     for (e = expected; *e; e++) {
+	     snprintf (cmd, TEST_CMD_LEN, "test \"$(grep -c '^%.*s$' %s)\" "
+		       "= %s", (int)(strchr (*e, ' ') - *e), *e, runs,
+		       strchr (*e, ' ') + 1);
+	     ret = system (cmd);
+	     fail_if (ret != 0, cmd);
+     }
+     snprintf (cmd, TEST_CMD_LEN, "test $(grep -c '<case .*result=\"PASS\"'"
+	       " %s) = 4", out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     unlink (runs);
+     snprintf (cmd, TEST_CMD_LEN, "%s.log", runs);
+     unlink (cmd);
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_case_retries)
+     int ret;
+     char cmd[TEST_CMD_LEN];
+     char *out_file = "/tmp/testrunner-lite-tests/testrunner-lite.out.xml";
+     const char *expected[] = {
+	     /* passes on the third attempt */
+	     "<case name=\"flaky\".*result=\"PASS\"",
+	     "<attempt number=\"3\" result=\"PASS\"",
+	     /* case attribute overrides --retries */
+	     "<case name=\"broken\".*result=\"FAIL\"",
+	     NULL
+     };
+     const char **e;
+
+     snprintf (cmd, TEST_CMD_LEN, "%s -c -a --retries=3 --retry-delay=0 "
+	       "-f %s -o %s", TESTRUNNERLITE_BIN, TESTDATA_RETRIES_XML,
+	       out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     for (e = expected; *e; e++) {
+	     snprintf (cmd, TEST_CMD_LEN, "grep -q '%s' %s", *e, out_file);
+	     ret = system (cmd);
+	     fail_if (ret != 0, cmd);
+     }
+     /* flaky fails twice, broken twice and no-retries has no attempts */
+     snprintf (cmd, TEST_CMD_LEN, "test $(grep -c '<attempt .*FAIL' %s) = 4"
+	       " && test $(grep -c '<attempt ' %s) = 5", out_file, out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     ret = system ("test $(wc -l < /tmp/testrunner-lite-retries) = 3");
+     fail_if (ret != 0, "flaky case executed wrong number of times");
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_background_get)
+     int ret;
+     char cmd[TEST_CMD_LEN];
+     char *out_file = "/tmp/testrunner-lite-tests/background-get/res.xml";
+     const char *expected[] = {
+	     /* measurement evaluated after the file is collected */
+	     "<case name=\"collect\".*result=\"FAIL\"",
+	     /* executed while the files of collect were collected */
+	     "<case name=\"overlap\".*result=\"PASS\"",
+	     "<case name=\"uses-collect\".*result=\"N/A\"",
+	     NULL
+     };
+     const char **e;
+
+     /* slow getter, the step commands are executed locally by sh -c */
+     snprintf (cmd, TEST_CMD_LEN, "rm -rf /tmp/testrunner-lite-tests/"
+	       "background-get; %s -c -a --background-get -E 'sh -c' "
+	       "-G 'sleep 2; cp <FILE> <DEST>' -f %s -o %s",
+	       TESTRUNNERLITE_BIN, TESTDATA_BACKGROUND_GET_XML, out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     for (e = expected; *e; e++) {
+	     snprintf (cmd, TEST_CMD_LEN, "grep -q '%s' %s", *e, out_file);
+	     ret = system (cmd);
+	     fail_if (ret != 0, cmd);
+     }
+     ret = system ("test -f /tmp/testrunner-lite-tests/background-get/"
+		   "trace.txt && test ! -f /tmp/testrunner-lite-background-get/"
+		   "trace.txt");
+     fail_if (ret != 0, "file not collected or not deleted");
+     /* files with delete_after are removed once all files of the case
+	are collected, other files are kept */
+     ret = system ("cd /tmp/testrunner-lite-tests/background-get && "
+		   "test -f a.log && test -f b.log && test -f kept.txt && "
+		   "cd /tmp/testrunner-lite-background-get && "
+		   "test ! -f a.log && test ! -f b.log && test -f kept.txt");
+     fail_if (ret != 0, "files not collected or not deleted");
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_background_get_chroot)
+     int ret;
+     char cmd[TEST_CMD_LEN];
+     char *out_file = "/tmp/testrunner-lite-tests/background-get-chroot/"
+	     "res.xml";
+
+     /* the get thread forks the getters, which disobey the chroot, while
+	the steps are forked into the chroot */
+     snprintf (cmd, TEST_CMD_LEN, "rm -rf /tmp/testrunner-lite-tests/"
+	       "background-get-chroot; %s -c -C / -a --background-get -f %s "
+	       "-o %s", TESTRUNNERLITE_BIN, TESTDATA_BACKGROUND_GET_XML,
+	       out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     snprintf (cmd, TEST_CMD_LEN, "grep -q '<case name=\"collect-more\""
+	       ".*result=\"PASS\"' %s", out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     ret = system ("cd /tmp/testrunner-lite-tests/background-get-chroot && "
+		   "test -f trace.txt && test -f a.log && test -f b.log && "
+		   "test -f kept.txt && "
+		   "cd /tmp/testrunner-lite-background-get && "
+		   "test ! -f a.log && test ! -f b.log && test -f kept.txt");
+     fail_if (ret != 0, "files not collected or not deleted");
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_batch_get)
+     int ret;
+     char cmd[TEST_CMD_LEN];
+     char *out_file = "/tmp/testrunner-lite-tests/batch-get/res.xml";
+     const char *expected[] = {
+	     /* measurement evaluated from the streamed file */
+	     "<case name=\"collect\".*result=\"FAIL\"",
+	     "<file delete_after=\"true\" result=\"PASS\">"
+	     "/tmp/testrunner-lite-batch-get/logs/\\*.log</file>",
+	     "<file delete_after=\"false\" result=\"FAIL\">"
+	     "/tmp/testrunner-lite-batch-get/missing.txt</file>",
+	     "<file delete_after=\"false\" result=\"PASS\">"
+	     "/tmp/testrunner-lite-batch-get/load.txt</file>",
+	     NULL
+     };
+     const char **e;
+
+     /* getter is not used for the files of a stream */
+     snprintf (cmd, TEST_CMD_LEN, "rm -rf /tmp/testrunner-lite-tests/"
+	       "batch-get; %s -c -a --batch-get -E 'sh -c' "
+	       "-G 'echo <FILE> >> /tmp/testrunner-lite-tests/batch-get/"
+	       "getter' -f %s -o %s", TESTRUNNERLITE_BIN, 
+	       TESTDATA_BATCH_GET_XML, out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     for (e = expected; *e; e++) {
+	     snprintf (cmd, TEST_CMD_LEN, "grep -q '%s' %s", *e, out_file);
+	     ret = system (cmd);
+	     fail_if (ret != 0, cmd);
+     }
+     ret = system ("cd /tmp/testrunner-lite-tests/batch-get && "
+		   "test ! -e getter && grep -q trace trace.txt && "
+		   "grep -q a a.log && grep -q b b.log && test -f load.txt "
+		   "&& test ! -e logs");
+     fail_if (ret != 0, "files not collected to output folder");
+     ret = system ("cd /tmp/testrunner-lite-batch-get && "
+		   "test ! -e trace.txt && test ! -e logs/a.log && "
+		   "test -f load.txt");
+     fail_if (ret != 0, "delete_after files not deleted");
+
+     /* getter is used for each file when there is no tar on target */
+     snprintf (cmd, TEST_CMD_LEN, "rm -rf /tmp/testrunner-lite-tests/"
+	       "batch-get; %s -c -a --batch-get -E 'sh -c \"tar() "
+	       "{ return 127; }; eval \\\"\\$1\\\"\" sh' "
+	       "-G 'echo <FILE> >> /tmp/testrunner-lite-tests/batch-get/"
+	       "getter' -f %s -o %s", TESTRUNNERLITE_BIN, 
+	       TESTDATA_BATCH_GET_XML, out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     ret = system ("test $(wc -l < /tmp/testrunner-lite-tests/batch-get/"
+		   "getter) = 5");
+     fail_if (ret != 0, "getter not used after failed stream");
+
+     /* paths expanded by the remote shell are collected with the getter,
+	and deleted only after they are collected */
+     snprintf (cmd, TEST_CMD_LEN, "rm -rf /tmp/testrunner-lite-tests/"
+	       "batch-get; %s -c -a --batch-get -E 'sh -c' "
+	       "-G 'cp <FILE> <DEST> && echo >> /tmp/testrunner-lite-tests/"
+	       "batch-get/getter' -f %s -o %s", TESTRUNNERLITE_BIN,
+	       TESTDATA_BATCH_GET_EXPAND_XML, out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+     ret = system ("cd /tmp/testrunner-lite-tests/batch-get && "
+		   "grep -q home testrunner-lite-batch-get-home.txt && "
+		   "grep -q var testrunner-lite-batch-get-var.txt && "
+		   "grep -q plain testrunner-lite-batch-get-plain.txt && "
+		   "test $(wc -l < getter) = 2 && "
+		   "test ! -e ~/testrunner-lite-batch-get-home.txt && "
+		   "test ! -e ~/testrunner-lite-batch-get-var.txt && "
+		   "test ! -e /tmp/testrunner-lite-batch-get-plain.txt");
+     fail_if (ret != 0, "expanded paths not collected or not deleted");
+     snprintf (cmd, TEST_CMD_LEN, "grep -q 'result=\"PASS\"' %s && "
+	       "! grep -q 'result=\"FAIL\"' %s", out_file, out_file);
+     ret = system (cmd);
+     fail_if (ret != 0, cmd);
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_ssh_multiplex)
+	exec_data edata;
+	testrunner_lite_options opts;
+	pid_t pid;
+	int i;
+
+	/* ssh stand-in executing the commands locally */
+	fail_if (system ("rm -rf " SSH_MUX_DIR "; mkdir -p " SSH_MUX_DIR 
+			 " && ln -s " DATADIR "/testrunner-lite-tests/"
+			 "fake_ssh.sh " SSH_MUX_DIR "/ssh"));
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.remote_executor = SSH_MUX_DIR "/ssh -o ControlMaster=no "
+			"-o ControlPath=" SSH_MUX_DIR "/ctl localhost";
+	executor_init (&opts);
+
+	for (i = 0; i < 3; i++) {
+		init_exec_data (&edata);
+		fail_if (execute("echo testing", &edata));
+		fail_unless (edata.result == 0);
+		fail_unless (strcmp((char*)edata.stdout_data.buffer, 
+				    "testing\n") == 0);
+		clean_exec_data(&edata);
+	}
+	/* one master shared by all commands */
+	fail_if (system ("test $(wc -l < " SSH_MUX_DIR "/masters) -eq 1"));
+	fail_if (system ("test $(wc -l < " SSH_MUX_DIR "/muxed) -ge 3"));
+
+	/* master is stopped on close */
+	executor_close();
+	fail_if (system ("test ! -f " SSH_MUX_DIR "/ctl"));
+
+	/* and when testrunner-lite is killed */
+	pid = fork();
+	fail_if (pid < 0);
+	if (pid == 0) {
+		executor_init (&opts);
+		kill (getpid(), SIGKILL);
+	}
+	fail_unless (waitpid (pid, NULL, 0) == pid);
+	fail_if (system ("test $(wc -l < " SSH_MUX_DIR "/masters) -eq 2"));
+	for (i = 0; i < 50 && !system ("test -f " SSH_MUX_DIR "/ctl"); i++)
+		usleep (100000);
+	fail_if (system ("test ! -f " SSH_MUX_DIR "/ctl"));
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_remote_wrapper)
+	exec_data edata;
+	testrunner_lite_options opts;
+	char cwd[PATH_MAX];
+	char host[HOST_NAME_MAX + 1];
+	char cmd[TEST_CMD_LEN];
+	int i;
+
+	/* .profile of the "remote" home counts the times it is sourced */
+	fail_if (system ("rm -rf " WRAPPER_DIR "; mkdir -p " WRAPPER_DIR 
+			 " && echo 'echo x >> sourced; "
+			 "export TRL_PROFILE_VAR=profile; "
+			 "TRL_PROFILE_PLAIN=plain' > " WRAPPER_DIR 
+			 "/.profile"));
+	fail_unless (getcwd (cwd, PATH_MAX) != NULL);
+	fail_if (chdir (WRAPPER_DIR));
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.remote_executor = "/bin/sh -c";
+	fail_if (executor_init (&opts));
+
+	for (i = 0; i < 3; i++) {
+		init_exec_data (&edata);
+		fail_if (execute("echo $TRL_PROFILE_VAR $TRL_PROFILE_PLAIN",
+				 &edata));
+		fail_unless (edata.result == 0);
+		fail_unless (strcmp((char*)edata.stdout_data.buffer, 
+				    "profile plain\n") == 0);
+		clean_exec_data(&edata);
+	}
+
+	/* wrapper files are removed from the target on close */
+	fail_if (gethostname (host, sizeof (host)));
+	snprintf (cmd, TEST_CMD_LEN, "test -f /tmp/testrunner-lite-%s%d.sh "
+		  "&& test -f /tmp/testrunner-lite-%s%d.env", host, getpid(),
+		  host, getpid());
+	fail_if (system (cmd), cmd);
+	executor_close();
+	snprintf (cmd, TEST_CMD_LEN, "test ! -e /tmp/testrunner-lite-%s%d.sh "
+		  "&& test ! -e /tmp/testrunner-lite-%s%d.env", host, getpid(),
+		  host, getpid());
+	fail_if (system (cmd), cmd);
+
+	/* sourced once when the wrapper was deployed */
+	fail_if (system ("test $(wc -l < sourced) -eq 1"));
+	fail_if (chdir (cwd));
+END_TEST
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_remote_agent)
+	exec_data edata;
+	testrunner_lite_options opts;
+	int i;
+
+	fail_if (system ("rm -rf " AGENT_DIR "; mkdir -p " AGENT_DIR "/in "
+			 AGENT_DIR "/out && cd " AGENT_DIR "/in && "
+			 "echo a > a.txt && echo b > b.txt && echo c > c.log"));
+
+	/* agent running locally, started once by the "remote" shell */
+	memset (&opts, 0x0, sizeof (opts));
+	opts.remote_executor = "/bin/sh -c";
+	opts.remote_agent = BINDIR "/testrunner-lite-agent";
+	fail_if (executor_init (&opts));
+
+	for (i = 0; i < 3; i++) {
+		init_exec_data (&edata);
+		fail_if (execute("echo out; echo err >&2; exit 3", &edata));
+		fail_unless (edata.agent);
+		fail_unless (edata.result == 3);
+		fail_unless (strcmp((char*)edata.stdout_data.buffer, 
+				    "out\n") == 0);
+		fail_unless (strcmp((char*)edata.stderr_data.buffer, 
+				    "err\n") == 0);
+		clean_exec_data(&edata);
+	}
+
+	/* timeout kills the process group of the step */
+	init_exec_data (&edata);
+	edata.soft_timeout = 1;
+	edata.hard_timeout = 1;
+	fail_if (execute("sleep 30 & echo $! > " AGENT_DIR "/bg; wait", 
+			 &edata));
+	fail_unless (edata.result == SIGTERM);
+	fail_unless (edata.signaled == SIGTERM);
+	clean_exec_data(&edata);
+	/* the orphaned child is dead, possibly not yet reaped */
+	fail_unless (system ("ps -o stat= -p $(cat " AGENT_DIR "/bg) | "
+			     "grep -q '^[^Z]'"));
+
+	/* files are pulled and pushed over the agent connection */
+	fail_if (remote_agent_get (opts.remote_executor, 
+				   AGENT_DIR "/in/*.txt", AGENT_DIR "/out"));
+	fail_if (system ("cmp " AGENT_DIR "/in/a.txt " AGENT_DIR "/out/a.txt"
+			 " && cmp " AGENT_DIR "/in/b.txt " AGENT_DIR 
+			 "/out/b.txt && test ! -e " AGENT_DIR "/out/c.log"));
+	fail_unless (remote_agent_get (opts.remote_executor, 
+				       AGENT_DIR "/in/none", AGENT_DIR "/out")
+		     > 0);
+	fail_if (remote_agent_put (opts.remote_executor, 
+				   AGENT_DIR "/in/c.log", AGENT_DIR "/put"));
+	fail_if (system ("cmp " AGENT_DIR "/in/c.log " AGENT_DIR "/put"));
+
+	executor_close();
+END_TEST
+/* ------------------------------------------------------------------------- */
 START_TEST (test_executor_exec_data_handling)
 	exec_data edata;
 	testrunner_lite_options opts;
@@ -1354,6 +2213,113 @@ START_TEST (test_remote_libssh2_get)
      fail_if (ret, cmd);
 END_TEST
 
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_remote_libssh2_sftp_get)
+	testrunner_lite_options opts;
+	char *dir = "/tmp/testrunner-lite-sftp";
+	char cmd[TEST_CMD_LEN];
+	int ret;
+
+	snprintf (cmd, TEST_CMD_LEN, "rm -rf %s; mkdir -p %s/remote/d %s/local"
+		  " && echo data > %s/remote/f.txt && echo more > "
+		  "%s/remote/g.txt && echo good > %s/local/d", dir, dir, dir,
+		  dir, dir, dir);
+	ret = system (cmd);
+	fail_if (ret, cmd);
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.libssh2 = 1;
+	opts.log_level = LOG_LEVEL;
+	opts.username = getenv("LOGNAME");
+	opts.ssh_key = "~/.ssh/myrsakey";
+	opts.target_address = "localhost";
+	opts.target_port = 0;
+	executor_init (&opts);
+	log_init(&opts);
+
+	snprintf (cmd, TEST_CMD_LEN, "%s/remote/f.txt", dir);
+	fail_unless (executor_libssh2_get (cmd, 
+					   "/tmp/testrunner-lite-sftp/local/")
+		     == 0, cmd);
+	snprintf (cmd, TEST_CMD_LEN, "%s/remote/*.txt", dir);
+	fail_unless (executor_libssh2_get (cmd, 
+					   "/tmp/testrunner-lite-sftp/local/")
+		     == 0, cmd);
+	snprintf (cmd, TEST_CMD_LEN, "%s/remote/missing.txt", dir);
+	fail_unless (executor_libssh2_get (cmd, 
+					   "/tmp/testrunner-lite-sftp/local/")
+		     == ENOENT, cmd);
+	/* reading a directory fails after it is opened, the earlier copy
+	   is kept and scp is used instead */
+	snprintf (cmd, TEST_CMD_LEN, "%s/remote/d", dir);
+	fail_unless (executor_libssh2_get (cmd, 
+					   "/tmp/testrunner-lite-sftp/local/")
+		     == -1, cmd);
+	executor_close();
+
+	snprintf (cmd, TEST_CMD_LEN, "cd %s/local && test \"$(cat f.txt)\" = "
+		  "data && test \"$(cat g.txt)\" = more && test \"$(cat d)\" "
+		  "= good && test $(ls -A | wc -l) = 3", dir);
+	ret = system (cmd);
+	fail_if (ret, cmd);
+END_TEST
+
+/* ------------------------------------------------------------------------- */
+START_TEST (test_executor_remote_libssh2_agent)
+	exec_data edata;
+	testrunner_lite_options opts;
+	int i;
+
+	fail_if (system ("rm -rf " AGENT_DIR "; mkdir -p " AGENT_DIR "/in "
+			 AGENT_DIR "/out && echo a > " AGENT_DIR "/in/a.txt"));
+
+	memset (&opts, 0x0, sizeof (opts));
+	opts.libssh2 = 1;
+	opts.log_level = LOG_LEVEL;
+	opts.username = getenv("LOGNAME");
+	opts.ssh_key = "~/.ssh/myrsakey";
+	opts.target_address = "localhost";
+	opts.target_port = 0;
+	opts.remote_agent = BINDIR "/testrunner-lite-agent";
+	executor_init (&opts);
+	log_init(&opts);
+
+	/* the agent runs on a channel of the session, which is still 
+	   used for the get below */
+	for (i = 0; i < 3; i++) {
+		init_exec_data (&edata);
+		fail_if (execute("echo out; echo err >&2; exit 3", &edata));
+		fail_unless (edata.agent);
+		fail_unless (edata.result == 3);
+		fail_unless (strcmp((char*)edata.stdout_data.buffer, 
+				    "out\n") == 0);
+		fail_unless (strcmp((char*)edata.stderr_data.buffer, 
+				    "err\n") == 0);
+		clean_exec_data(&edata);
+	}
+
+	init_exec_data (&edata);
+	edata.soft_timeout = 1;
+	edata.hard_timeout = 1;
+	fail_if (execute("sleep 30", &edata));
+	fail_unless (edata.agent);
+	fail_unless (edata.result == SIGTERM);
+	clean_exec_data(&edata);
+
+	fail_if (executor_libssh2_get (AGENT_DIR "/in/a.txt", 
+				       AGENT_DIR "/out/"));
+	fail_if (remote_agent_get (opts.target_address, AGENT_DIR "/in/*.txt",
+				   AGENT_DIR "/out"));
+	fail_if (system ("cmp " AGENT_DIR "/in/a.txt " AGENT_DIR "/out/a.txt"));
+
+	init_exec_data (&edata);
+	fail_if (execute("echo again", &edata));
+	fail_unless (edata.agent);
+	fail_unless (strcmp((char*)edata.stdout_data.buffer, "again\n") == 0);
+	clean_exec_data(&edata);
+	executor_close();
+END_TEST
+
 /* ------------------------------------------------------------------------- */
 START_TEST (test_remote_libssh2_get_username)
 
@@ -1583,11 +2549,50 @@ Suite *make_testexecutor_suite (void)
     tcase_add_test (tc, test_executor_stderr);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("Test executor chroot failure.");
+    tcase_add_test (tc, test_executor_chroot_failure);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create ("Test executor long input streams.");
     tcase_set_timeout (tc, 5);
     tcase_add_test (tc, test_executor_long_input_streams);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("Test executor output limit.");
+    tcase_set_timeout (tc, 5);
+    tcase_add_test (tc, test_executor_output_limit);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor output tail.");
+    tcase_set_timeout (tc, 5);
+    tcase_add_test (tc, test_executor_output_tail);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor output spill failure.");
+    tcase_set_timeout (tc, 5);
+    tcase_add_test (tc, test_executor_output_spill_failure);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor output splice.");
+    tcase_set_timeout (tc, 5);
+    tcase_add_test (tc, test_executor_output_splice);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor resource usage.");
+    tcase_set_timeout (tc, 5);
+    tcase_add_test (tc, test_executor_resource_usage);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor cgroup.");
+    tcase_set_timeout (tc, 5);
+    tcase_add_test (tc, test_executor_cgroup);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor deadline.");
+    tcase_set_timeout (tc, 5);
+    tcase_add_test (tc, test_executor_deadline);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create ("Test executor terminating process.");
     tcase_set_timeout (tc, 5);
     tcase_add_test (tc, test_executor_terminating_process);
@@ -1606,6 +2611,78 @@ Suite *make_testexecutor_suite (void)
     tcase_add_test (tc, test_executor_without_output_redirection);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("Test executor fast termination.");
+    tcase_set_timeout (tc, 5);
+    tcase_add_test (tc, test_executor_fast_termination);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor new session.");
+    tcase_add_test (tc, test_executor_new_session);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor shell worker.");
+    tcase_set_timeout (tc, 5);
+    tcase_add_test (tc, test_executor_shell_worker);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor shell worker timeout.");
+    tcase_set_timeout (tc, 5);
+    tcase_add_test (tc, test_executor_shell_worker_timeout);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor parallel cases.");
+    tcase_set_timeout (tc, 10);
+    tcase_add_test (tc, test_executor_parallel_cases);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor longest first.");
+    tcase_set_timeout (tc, 10);
+    tcase_add_test (tc, test_executor_longest_first);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor case dependencies.");
+    tcase_set_timeout (tc, 15);
+    tcase_add_test (tc, test_executor_case_dependencies);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor resume from journal.");
+    tcase_set_timeout (tc, 20);
+    tcase_add_test (tc, test_executor_resume_journal);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor case retries.");
+    tcase_add_test (tc, test_executor_case_retries);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor background file collection.");
+    tcase_set_timeout (tc, 15);
+    tcase_add_test (tc, test_executor_background_get);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor background get with chroot.");
+    tcase_set_timeout (tc, 30);
+    tcase_add_test (tc, test_executor_background_get_chroot);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor batched file collection.");
+    tcase_set_timeout (tc, 15);
+    tcase_add_test (tc, test_executor_batch_get);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor ssh connection multiplexing.");
+    tcase_set_timeout (tc, 15);
+    tcase_add_test (tc, test_executor_ssh_multiplex);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor remote step wrapper.");
+    tcase_add_test (tc, test_executor_remote_wrapper);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Test executor remote agent.");
+    tcase_set_timeout (tc, 15);
+    tcase_add_test (tc, test_executor_remote_agent);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create ("Test executor execution data handling.");
     tcase_add_test (tc, test_executor_exec_data_handling);
     suite_add_tcase (s, tc);
@@ -1749,6 +2826,16 @@ Suite *make_testexecutor_suite (void)
 	tc = tcase_create ("Test remote libssh2 get.");
     tcase_set_timeout (tc, 20);
     tcase_add_test (tc, test_remote_libssh2_get);
+    suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Test executor remote libssh2 SFTP get.");
+    tcase_set_timeout (tc, 20);
+    tcase_add_test (tc, test_executor_remote_libssh2_sftp_get);
+    suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Test executor remote libssh2 agent.");
+    tcase_set_timeout (tc, 30);
+    tcase_add_test (tc, test_executor_remote_libssh2_agent);
     suite_add_tcase (s, tc);
 
 	tc = tcase_create ("Test remote libssh2 get username.");